@@ -16,6 +16,7 @@
 
 #include <gs-app-list-private.h>
 #include <gs-app-private.h>
+#include <gs-cache-manager.h>
 #include <gs-category-private.h>
 #include <gs-fedora-third-party.h>
 #include <gs-os-release.h>
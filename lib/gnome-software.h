@@ -37,5 +37,6 @@
 #include <gs-plugin-job-refresh-metadata.h>
 #include <gs-plugin-vfuncs.h>
 #include <gs-remote-icon.h>
+#include <gs-trace.h>
 #include <gs-utils.h>
 #include <gs-worker-thread.h>
@@ -35,6 +35,7 @@ typedef enum {
 guint		 gs_app_list_get_size_peak	(GsAppList	*list);
 void		 gs_app_list_set_size_peak	(GsAppList	*list,
 						 guint		 size_peak);
+guint64		 gs_app_list_get_n_comparisons	(GsAppList	*list);
 void		 gs_app_list_filter_duplicates	(GsAppList	*list,
 						 GsAppListFilterFlags flags);
 void		 gs_app_list_randomize		(GsAppList	*list);
@@ -20,6 +20,7 @@
 #include "config.h"
 
 #include <glib.h>
+#include <string.h>
 
 #include "gs-app-private.h"
 #include "gs-app-list-private.h"
@@ -30,8 +31,12 @@ struct _GsAppList
 {
 	GObject			 parent_instance;
 	GPtrArray		*array;
+	GHashTable		*index_by_app;  /* (owned) (element-type GsApp IndexedApp) */
+	GHashTable		*index_by_id;  /* (owned) (element-type utf8 GPtrArray<GsApp>), in array order */
+	GPtrArray		*index_no_id;  /* (owned) (element-type GsApp), in array order */
 	GMutex			 mutex;
 	guint			 size_peak;
+	guint64			 n_comparisons;  /* of unique IDs by lookups, for the self tests */
 	GsAppListFlags		 flags;
 	GsAppState		 state;
 	guint			 progress;  /* 0–100 inclusive, or %GS_APP_PROGRESS_UNKNOWN */
@@ -40,6 +45,116 @@ struct _GsAppList
 
 G_DEFINE_TYPE (GsAppList, gs_app_list, G_TYPE_OBJECT)
 
+/* Each app in the list is indexed by the ID part of its unique ID, as that is
+ * the only part which as_utils_data_id_equal() never treats as a wildcard in
+ * practice. Each bucket is then searched using the usual wildcard rules, so
+ * changes to the other parts of an app’s unique ID after it was added are
+ * still handled. Apps which had no unique ID when they were added are kept
+ * separately and always searched. */
+typedef struct {
+	guint		 n_refs;  /* number of times the app is in the array */
+	gchar		*id;  /* (nullable) (owned) key in index_by_id */
+} IndexedApp;
+
+static void
+indexed_app_free (IndexedApp *indexed)
+{
+	g_free (indexed->id);
+	g_free (indexed);
+}
+
+/* Returns: (transfer full) (nullable): the ID part of @unique_id, or %NULL if
+ * it is not a valid data ID */
+static gchar *
+gs_app_list_unique_id_get_id_part (const gchar *unique_id)
+{
+	const gchar *start = unique_id;
+	const gchar *end;
+
+	if (unique_id == NULL)
+		return NULL;
+
+	for (guint i = 0; i < 3; i++) {
+		start = strchr (start, '/');
+		if (start == NULL)
+			return NULL;
+		start++;
+	}
+	end = strchr (start, '/');
+	if (end == NULL || strchr (end + 1, '/') != NULL)
+		return NULL;
+
+	return g_strndup (start, end - start);
+}
+
+/* mutex must be held */
+static GPtrArray *
+gs_app_list_index_get_bucket (GsAppList *list, const gchar *id)
+{
+	if (id == NULL)
+		return list->index_no_id;
+	return g_hash_table_lookup (list->index_by_id, id);
+}
+
+/* mutex must be held */
+static void
+gs_app_list_index_add (GsAppList *list, GsApp *app)
+{
+	IndexedApp *indexed = g_hash_table_lookup (list->index_by_app, app);
+	GPtrArray *bucket;
+
+	if (indexed == NULL) {
+		indexed = g_new0 (IndexedApp, 1);
+		indexed->id = gs_app_list_unique_id_get_id_part (gs_app_get_unique_id (app));
+		g_hash_table_insert (list->index_by_app, app, indexed);
+	}
+	indexed->n_refs++;
+
+	bucket = gs_app_list_index_get_bucket (list, indexed->id);
+	if (bucket == NULL) {
+		bucket = g_ptr_array_new ();
+		g_hash_table_insert (list->index_by_id, g_strdup (indexed->id), bucket);
+	}
+	g_ptr_array_add (bucket, app);
+}
+
+/* mutex must be held */
+static void
+gs_app_list_index_remove (GsAppList *list, GsApp *app)
+{
+	IndexedApp *indexed = g_hash_table_lookup (list->index_by_app, app);
+	GPtrArray *bucket;
+
+	g_return_if_fail (indexed != NULL);
+
+	bucket = gs_app_list_index_get_bucket (list, indexed->id);
+	g_ptr_array_remove (bucket, app);
+	if (bucket->len == 0 && indexed->id != NULL)
+		g_hash_table_remove (list->index_by_id, indexed->id);
+
+	if (--indexed->n_refs == 0)
+		g_hash_table_remove (list->index_by_app, app);
+}
+
+/* mutex must be held */
+static void
+gs_app_list_index_remove_all (GsAppList *list)
+{
+	g_hash_table_remove_all (list->index_by_app);
+	g_hash_table_remove_all (list->index_by_id);
+	g_ptr_array_set_size (list->index_no_id, 0);
+}
+
+/* mutex must be held; needed when the order of the array changes, as
+ * gs_app_list_lookup() returns the first match in array order */
+static void
+gs_app_list_index_rebuild (GsAppList *list)
+{
+	gs_app_list_index_remove_all (list);
+	for (guint i = 0; i < list->array->len; i++)
+		gs_app_list_index_add (list, g_ptr_array_index (list->array, i));
+}
+
 enum {
 	PROP_STATE = 1,
 	PROP_PROGRESS,
@@ -165,6 +280,13 @@ static GPtrArray *
 gs_app_list_get_watched (GsAppList *list)
 {
 	GPtrArray *apps = g_ptr_array_new ();
+
+	/* avoid walking the whole list on every add if nothing is watched */
+	if ((list->flags & (GS_APP_LIST_FLAG_WATCH_APPS |
+			    GS_APP_LIST_FLAG_WATCH_APPS_ADDONS |
+			    GS_APP_LIST_FLAG_WATCH_APPS_RELATED)) == 0)
+		return apps;
+
 	for (guint i = 0; i < list->array->len; i++) {
 		GsApp *app_tmp = g_ptr_array_index (list->array, i);
 		gs_app_list_add_watched_for_app (list, apps, app_tmp);
@@ -282,6 +404,26 @@ gs_app_list_get_size_peak (GsAppList *list)
 	return list->size_peak;
 }
 
+/**
+ * gs_app_list_get_n_comparisons:
+ * @list: A #GsAppList
+ *
+ * Returns how many times lookups in the list have compared two unique IDs,
+ * including the lookups done to find duplicates as apps are added. This is
+ * only meant for the self tests, to check that lookups don’t scale with the
+ * length of the list.
+ *
+ * Returns: integer
+ *
+ * Since: 43
+ **/
+guint64
+gs_app_list_get_n_comparisons (GsAppList *list)
+{
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&list->mutex);
+	return list->n_comparisons;
+}
+
 /**
  * gs_app_list_set_size_peak:
  * @list: A #GsAppList
@@ -299,17 +441,43 @@ gs_app_list_set_size_peak (GsAppList *list,
 	list->size_peak = size_peak;
 }
 
+/* mutex must be held */
 static GsApp *
-gs_app_list_lookup_safe (GsAppList *list, const gchar *unique_id)
+gs_app_list_lookup_in_bucket (GsAppList *list, GPtrArray *bucket, const gchar *unique_id)
 {
-	for (guint i = 0; i < list->array->len; i++) {
-		GsApp *app = g_ptr_array_index (list->array, i);
+	if (bucket == NULL)
+		return NULL;
+
+	for (guint i = 0; i < bucket->len; i++) {
+		GsApp *app = g_ptr_array_index (bucket, i);
+		list->n_comparisons++;
 		if (as_utils_data_id_equal (gs_app_get_unique_id (app), unique_id))
 			return app;
 	}
 	return NULL;
 }
 
+static GsApp *
+gs_app_list_lookup_safe (GsAppList *list, const gchar *unique_id)
+{
+	g_autofree gchar *id = gs_app_list_unique_id_get_id_part (unique_id);
+	GsApp *app;
+
+	/* a wildcard or malformed ID could match anything */
+	if (id == NULL || g_strcmp0 (id, "*") == 0)
+		return gs_app_list_lookup_in_bucket (list, list->array, unique_id);
+
+	app = gs_app_list_lookup_in_bucket (list, g_hash_table_lookup (list->index_by_id, id), unique_id);
+	if (app != NULL)
+		return app;
+	app = gs_app_list_lookup_in_bucket (list, g_hash_table_lookup (list->index_by_id, "*"), unique_id);
+	if (app != NULL)
+		return app;
+
+	/* apps which gained a unique ID since being added */
+	return gs_app_list_lookup_in_bucket (list, list->index_no_id, unique_id);
+}
+
 /**
  * gs_app_list_lookup:
  * @list: A #GsAppList
@@ -379,23 +547,28 @@ gs_app_list_check_for_duplicate (GsAppList *list, GsApp *app)
 
 	/* adding a wildcard */
 	if (gs_app_has_quirk (app, GS_APP_QUIRK_IS_WILDCARD)) {
-		for (guint i = 0; i < list->array->len; i++) {
-			GsApp *app_tmp = g_ptr_array_index (list->array, i);
-			if (!gs_app_has_quirk (app_tmp, GS_APP_QUIRK_IS_WILDCARD))
-				continue;
-			/* not adding exactly the same wildcard */
-			if (g_strcmp0 (gs_app_get_unique_id (app_tmp),
-				       gs_app_get_unique_id (app)) == 0)
-				return FALSE;
+		const gchar *unique_id = gs_app_get_unique_id (app);
+		g_autofree gchar *id_part = gs_app_list_unique_id_get_id_part (unique_id);
+		GPtrArray *buckets[] = { gs_app_list_index_get_bucket (list, id_part),
+					 (id_part != NULL) ? list->index_no_id : NULL };
+
+		/* an identical unique ID can only be in the same bucket, or
+		 * in the one for apps which gained a unique ID later */
+		for (gsize b = 0; b < G_N_ELEMENTS (buckets); b++) {
+			for (guint i = 0; buckets[b] != NULL && i < buckets[b]->len; i++) {
+				GsApp *app_tmp = g_ptr_array_index (buckets[b], i);
+				if (!gs_app_has_quirk (app_tmp, GS_APP_QUIRK_IS_WILDCARD))
+					continue;
+				/* not adding exactly the same wildcard */
+				if (g_strcmp0 (gs_app_get_unique_id (app_tmp), unique_id) == 0)
+					return FALSE;
+			}
 		}
 		return TRUE;
 	}
 
-	for (guint i = 0; i < list->array->len; i++) {
-		GsApp *app_tmp = g_ptr_array_index (list->array, i);
-		if (app_tmp == app)
-			return FALSE;
-	}
+	if (g_hash_table_contains (list->index_by_app, app))
+		return FALSE;
 
 	/* does not exist */
 	id = gs_app_get_unique_id (app);
@@ -432,6 +605,7 @@ gs_app_list_add_safe (GsAppList *list, GsApp *app, GsAppListAddFlag flag)
 	/* just use the ref */
 	gs_app_list_maybe_watch_app (list, app);
 	g_ptr_array_add (list->array, g_object_ref (app));
+	gs_app_list_index_add (list, app);
 
 	/* update the historical max */
 	if (list->array->len > list->size_peak)
@@ -488,6 +662,10 @@ gs_app_list_remove (GsAppList *list, GsApp *app)
 	g_return_val_if_fail (GS_IS_APP (app), FALSE);
 
 	locker = g_mutex_locker_new (&list->mutex);
+	if (!g_hash_table_contains (list->index_by_app, app))
+		return FALSE;
+
+	gs_app_list_index_remove (list, app);
 	removed = g_ptr_array_remove (list->array, app);
 	if (removed) {
 		gs_app_list_maybe_unwatch_app (list, app);
@@ -574,6 +752,7 @@ gs_app_list_remove_all_safe (GsAppList *list)
 		gs_app_list_maybe_unwatch_app (list, app);
 	}
 	g_ptr_array_set_size (list->array, 0);
+	gs_app_list_index_remove_all (list);
 	gs_app_list_invalidate_state (list);
 	gs_app_list_invalidate_progress (list);
 }
@@ -664,6 +843,7 @@ gs_app_list_sort (GsAppList *list, GsAppListSortFunc func, gpointer user_data)
 	helper.func = func;
 	helper.user_data = user_data;
 	g_ptr_array_sort_with_data (list->array, gs_app_list_sort_cb, &helper);
+	gs_app_list_index_rebuild (list);
 }
 
 /**
@@ -695,6 +875,8 @@ gs_app_list_truncate (GsAppList *list, guint length)
 
 	/* remove the apps in the positions larger than the length */
 	locker = g_mutex_locker_new (&list->mutex);
+	for (guint i = length; i < list->array->len; i++)
+		gs_app_list_index_remove (list, g_ptr_array_index (list->array, i));
 	g_ptr_array_set_size (list->array, length);
 }
 
@@ -737,6 +919,7 @@ gs_app_list_randomize (GsAppList *list)
 	}
 
 	g_rand_free (rand);
+	gs_app_list_index_rebuild (list);
 }
 
 static gboolean
@@ -949,6 +1132,9 @@ gs_app_list_finalize (GObject *object)
 {
 	GsAppList *list = GS_APP_LIST (object);
 	g_ptr_array_unref (list->array);
+	g_hash_table_unref (list->index_by_app);
+	g_hash_table_unref (list->index_by_id);
+	g_ptr_array_unref (list->index_no_id);
 	g_mutex_clear (&list->mutex);
 	G_OBJECT_CLASS (gs_app_list_parent_class)->finalize (object);
 }
@@ -1004,6 +1190,11 @@ gs_app_list_init (GsAppList *list)
 {
 	g_mutex_init (&list->mutex);
 	list->array = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	list->index_by_app = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+						    NULL, (GDestroyNotify) indexed_app_free);
+	list->index_by_id = g_hash_table_new_full (g_str_hash, g_str_equal,
+						   g_free, (GDestroyNotify) g_ptr_array_unref);
+	list->index_no_id = g_ptr_array_new ();
 	list->custom_progress = GS_APP_PROGRESS_UNKNOWN;
 }
 
@@ -27,4 +27,23 @@ void		 gs_app_set_pending_action	(GsApp		*app,
 gint		 gs_app_compare_priority	(GsApp		*app1,
 						 GsApp		*app2);
 
+/**
+ * GsAppIndexFunc:
+ * @app: the #GsApp which changed
+ * @user_data: data passed to gs_app_add_index_watch()
+ *
+ * Called when the state, kind or sources of @app change.
+ *
+ * Since: 43
+ */
+typedef void	(*GsAppIndexFunc)		(GsApp		*app,
+						 gpointer	 user_data);
+
+void		 gs_app_add_index_watch		(GsApp		*app,
+						 GsAppIndexFunc	 func,
+						 gpointer	 user_data);
+void		 gs_app_remove_index_watch	(GsApp		*app,
+						 GsAppIndexFunc	 func,
+						 gpointer	 user_data);
+
 G_END_DECLS
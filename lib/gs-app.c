@@ -52,9 +52,15 @@
 #include "gs-remote-icon.h"
 #include "gs-utils.h"
 
+typedef struct {
+	GsAppIndexFunc		 func;
+	gpointer		 user_data;
+} GsAppIndexWatch;
+
 typedef struct
 {
 	GMutex			 mutex;
+	GArray			*index_watches;  /* (nullable) (owned) (element-type GsAppIndexWatch), protected by mutex */
 	gchar			*id;
 	gchar			*unique_id;
 	gboolean		 unique_id_valid;
@@ -140,6 +146,7 @@ typedef struct
 	GPtrArray		*version_history; /* (element-type AsRelease) (nullable) (owned) */
 	GPtrArray		*relations;  /* (nullable) (element-type AsRelation) (owned) */
 	gboolean		 has_translations;
+	guint64			 notify_props;  /* (mutex notify_mutex), bitmask of GsAppProperty to notify */
 } GsAppPrivate;
 
 typedef enum {
@@ -799,34 +806,149 @@ gs_app_to_string_append (GsApp *app, GString *str)
 	g_string_append_printf (str, "\n");
 }
 
-typedef struct {
-	GsApp *app;
-	GParamSpec *pspec;
-} AppNotifyData;
+/* Property change notifications are emitted from an idle callback in the
+ * default main context, as properties may be changed from any thread.
+ *
+ * They are batched: each app has a bitmask of its properties which have
+ * changed since they were last notified, and a single idle callback notifies
+ * them for all the apps which have any. Changing the same property several
+ * times before then results in a single notification. */
+G_STATIC_ASSERT (G_N_ELEMENTS (obj_props) <= 64);
+
+static GMutex notify_mutex;
+static GPtrArray *notify_apps = NULL;  /* (element-type GsApp) (owned) (nullable) (mutex notify_mutex) */
 
 static gboolean
 notify_idle_cb (gpointer data)
 {
-	AppNotifyData *notify_data = data;
+	g_autoptr(GPtrArray) apps = NULL;
 
-	g_object_notify_by_pspec (G_OBJECT (notify_data->app), notify_data->pspec);
+	/* take the whole batch, so anything changed by the notify handlers
+	 * is queued in a new one */
+	g_mutex_lock (&notify_mutex);
+	apps = g_steal_pointer (&notify_apps);
+	g_mutex_unlock (&notify_mutex);
 
-	g_object_unref (notify_data->app);
-	g_free (notify_data);
+	for (guint i = 0; i < apps->len; i++) {
+		GsApp *app = g_ptr_array_index (apps, i);
+		GsAppPrivate *priv = gs_app_get_instance_private (app);
+		guint64 props;
+
+		g_mutex_lock (&notify_mutex);
+		props = priv->notify_props;
+		priv->notify_props = 0;
+		g_mutex_unlock (&notify_mutex);
+
+		for (guint j = PROP_ID; j < G_N_ELEMENTS (obj_props); j++) {
+			if (props & (G_GUINT64_CONSTANT (1) << j))
+				g_object_notify_by_pspec (G_OBJECT (app), obj_props[j]);
+		}
+	}
 
 	return G_SOURCE_REMOVE;
 }
 
 static void
-gs_app_queue_notify (GsApp *app, GParamSpec *pspec)
+gs_app_queue_notify (GsApp *app, GsAppProperty prop_id)
+{
+	GsAppPrivate *priv = gs_app_get_instance_private (app);
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&notify_mutex);
+	gboolean queued = (priv->notify_props != 0);
+
+	priv->notify_props |= G_GUINT64_CONSTANT (1) << prop_id;
+	if (queued)
+		return;
+
+	if (notify_apps == NULL) {
+		notify_apps = g_ptr_array_new_with_free_func (g_object_unref);
+		g_idle_add (notify_idle_cb, NULL);
+	}
+	g_ptr_array_add (notify_apps, g_object_ref (app));
+}
+
+/* mutex must be held */
+static void
+gs_app_notify_index_watches_unlocked (GsApp *app)
+{
+	GsAppPrivate *priv = gs_app_get_instance_private (app);
+
+	if (priv->index_watches == NULL)
+		return;
+
+	for (guint i = 0; i < priv->index_watches->len; i++) {
+		GsAppIndexWatch *watch = &g_array_index (priv->index_watches, GsAppIndexWatch, i);
+		watch->func (app, watch->user_data);
+	}
+}
+
+/**
+ * gs_app_add_index_watch:
+ * @app: a #GsApp
+ * @func: function to call when an indexed property changes
+ * @user_data: data to pass to @func
+ *
+ * Call @func synchronously, in whichever thread made the change, whenever the
+ * state, kind or sources of @app change. This is unlike the #GObject::notify
+ * signal, which is emitted later in the main thread.
+ *
+ * @func is called with the #GsApp lock held, so it must not call any
+ * #GsApp setters, and must not take any lock which is held while calling into
+ * @app. It is intended for keeping indexes of apps up to date.
+ *
+ * Since: 43
+ **/
+void
+gs_app_add_index_watch (GsApp          *app,
+                        GsAppIndexFunc  func,
+                        gpointer        user_data)
 {
-	AppNotifyData *notify_data;
+	GsAppPrivate *priv = gs_app_get_instance_private (app);
+	g_autoptr(GMutexLocker) locker = NULL;
+	GsAppIndexWatch watch = { func, user_data };
+
+	g_return_if_fail (GS_IS_APP (app));
+	g_return_if_fail (func != NULL);
 
-	notify_data = g_new (AppNotifyData, 1);
-	notify_data->app = g_object_ref (app);
-	notify_data->pspec = pspec;
+	locker = g_mutex_locker_new (&priv->mutex);
 
-	g_idle_add (notify_idle_cb, notify_data);
+	if (priv->index_watches == NULL)
+		priv->index_watches = g_array_new (FALSE, FALSE, sizeof (GsAppIndexWatch));
+	g_array_append_val (priv->index_watches, watch);
+}
+
+/**
+ * gs_app_remove_index_watch:
+ * @app: a #GsApp
+ * @func: function passed to gs_app_add_index_watch()
+ * @user_data: data passed to gs_app_add_index_watch()
+ *
+ * Remove a watch added with gs_app_add_index_watch(). Once this returns,
+ * @func will not be called again for @app with @user_data.
+ *
+ * Since: 43
+ **/
+void
+gs_app_remove_index_watch (GsApp          *app,
+                           GsAppIndexFunc  func,
+                           gpointer        user_data)
+{
+	GsAppPrivate *priv = gs_app_get_instance_private (app);
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	g_return_if_fail (GS_IS_APP (app));
+
+	locker = g_mutex_locker_new (&priv->mutex);
+
+	if (priv->index_watches == NULL)
+		return;
+
+	for (guint i = 0; i < priv->index_watches->len; i++) {
+		GsAppIndexWatch *watch = &g_array_index (priv->index_watches, GsAppIndexWatch, i);
+		if (watch->func == func && watch->user_data == user_data) {
+			g_array_remove_index_fast (priv->index_watches, i);
+			return;
+		}
+	}
 }
 
 /**
@@ -992,7 +1114,7 @@ gs_app_set_special_kind	(GsApp *app, GsAppSpecialKind kind)
 		return;
 	gs_app_set_kind (app, AS_COMPONENT_KIND_GENERIC);
 	priv->special_kind = kind;
-	gs_app_queue_notify (app, obj_props[PROP_SPECIAL_KIND]);
+	gs_app_queue_notify (app, PROP_SPECIAL_KIND);
 }
 
 /**
@@ -1062,6 +1184,7 @@ void
 gs_app_set_state_recover (GsApp *app)
 {
 	GsAppPrivate *priv = gs_app_get_instance_private (app);
+	g_autoptr(GMutexLocker) locker = NULL;
 
 	g_return_if_fail (GS_IS_APP (app));
 
@@ -1080,7 +1203,10 @@ gs_app_set_state_recover (GsApp *app)
 	gs_app_set_progress (app, GS_APP_PROGRESS_UNKNOWN);
 
 	priv->state = priv->state_recover;
-	gs_app_queue_notify (app, obj_props[PROP_STATE]);
+	gs_app_queue_notify (app, PROP_STATE);
+
+	locker = g_mutex_locker_new (&priv->mutex);
+	gs_app_notify_index_watches_unlocked (app);
 }
 
 /* mutex must be held */
@@ -1248,7 +1374,7 @@ gs_app_set_progress (GsApp *app, guint percentage)
 		percentage = 100;
 	}
 	priv->progress = percentage;
-	gs_app_queue_notify (app, obj_props[PROP_PROGRESS]);
+	gs_app_queue_notify (app, PROP_PROGRESS);
 }
 
 /**
@@ -1272,7 +1398,7 @@ gs_app_set_allow_cancel (GsApp *app, gboolean allow_cancel)
 	if (priv->allow_cancel == allow_cancel)
 		return;
 	priv->allow_cancel = allow_cancel;
-	gs_app_queue_notify (app, obj_props[PROP_CAN_CANCEL_INSTALLATION]);
+	gs_app_queue_notify (app, PROP_CAN_CANCEL_INSTALLATION);
 }
 
 static void
@@ -1284,7 +1410,7 @@ gs_app_set_pending_action_internal (GsApp *app,
 		return;
 
 	priv->pending_action = action;
-	gs_app_queue_notify (app, obj_props[PROP_PENDING_ACTION]);
+	gs_app_queue_notify (app, PROP_PENDING_ACTION);
 }
 
 /**
@@ -1333,7 +1459,8 @@ gs_app_set_state (GsApp *app, GsAppState state)
 		}
 		gs_app_set_pending_action_internal (app, action);
 
-		gs_app_queue_notify (app, obj_props[PROP_STATE]);
+		gs_app_queue_notify (app, PROP_STATE);
+		gs_app_notify_index_watches_unlocked (app);
 	}
 }
 
@@ -1425,7 +1552,8 @@ gs_app_set_kind (GsApp *app, AsComponentKind kind)
 	}
 
 	priv->kind = kind;
-	gs_app_queue_notify (app, obj_props[PROP_KIND]);
+	gs_app_queue_notify (app, PROP_KIND);
+	gs_app_notify_index_watches_unlocked (app);
 
 	/* no longer valid */
 	priv->unique_id_valid = FALSE;
@@ -1526,7 +1654,7 @@ gs_app_set_name (GsApp *app, GsAppQuality quality, const gchar *name)
 		return;
 	priv->name_quality = quality;
 	if (_g_set_str (&priv->name, name))
-		gs_app_queue_notify (app, obj_props[PROP_NAME]);
+		gs_app_queue_notify (app, PROP_NAME);
 }
 
 /**
@@ -1654,6 +1782,7 @@ gs_app_add_source (GsApp *app, const gchar *source)
 			return;
 	}
 	g_ptr_array_add (priv->sources, g_strdup (source));
+	gs_app_notify_index_watches_unlocked (app);
 }
 
 /**
@@ -1693,6 +1822,7 @@ gs_app_set_sources (GsApp *app, GPtrArray *sources)
 	g_return_if_fail (GS_IS_APP (app));
 	locker = g_mutex_locker_new (&priv->mutex);
 	_g_set_ptr_array (&priv->sources, sources);
+	gs_app_notify_index_watches_unlocked (app);
 }
 
 /**
@@ -2019,6 +2149,33 @@ gs_app_get_icons (GsApp *app)
 	return priv->icons;
 }
 
+/**
+ * gs_app_dup_icons:
+ * @app: a #GsApp
+ *
+ * Gets a copy of the icons for the application, which is safe to iterate
+ * while other threads add or remove icons.
+ *
+ * Returns: (transfer container) (element-type GIcon) (nullable): an array of
+ *     icons, or %NULL if there are no icons
+ *
+ * Since: 43
+ **/
+GPtrArray *
+gs_app_dup_icons (GsApp *app)
+{
+	GsAppPrivate *priv = gs_app_get_instance_private (app);
+	g_autoptr(GMutexLocker) locker = NULL;
+	g_return_val_if_fail (GS_IS_APP (app), NULL);
+
+	locker = g_mutex_locker_new (&priv->mutex);
+
+	if (priv->icons == NULL || priv->icons->len == 0)
+		return NULL;
+
+	return g_ptr_array_copy (priv->icons, (GCopyFunc) g_object_ref, NULL);
+}
+
 static gint
 icon_sort_width_cb (gconstpointer a,
                     gconstpointer b)
@@ -2202,7 +2359,7 @@ gs_app_set_content_rating (GsApp *app, AsContentRating *content_rating)
 	g_return_if_fail (GS_IS_APP (app));
 	locker = g_mutex_locker_new (&priv->mutex);
 	if (g_set_object (&priv->content_rating, content_rating))
-		gs_app_queue_notify (app, obj_props[PROP_CONTENT_RATING]);
+		gs_app_queue_notify (app, PROP_CONTENT_RATING);
 }
 
 /**
@@ -2244,8 +2401,8 @@ gs_app_set_runtime (GsApp *app, GsApp *runtime)
 	g_set_object (&priv->runtime, runtime);
 
 	/* The runtime adds to the main app’s sizes. */
-	gs_app_queue_notify (app, obj_props[PROP_SIZE_DOWNLOAD_DEPENDENCIES_TYPE]);
-	gs_app_queue_notify (app, obj_props[PROP_SIZE_DOWNLOAD_DEPENDENCIES]);
+	gs_app_queue_notify (app, PROP_SIZE_DOWNLOAD_DEPENDENCIES_TYPE);
+	gs_app_queue_notify (app, PROP_SIZE_DOWNLOAD_DEPENDENCIES);
 }
 
 /**
@@ -2359,7 +2516,7 @@ gs_app_ui_versions_populate (GsApp *app)
 		priv->version_ui = gs_app_get_ui_version (priv->version, flags[i]);
 		priv->update_version_ui = gs_app_get_ui_version (priv->update_version, flags[i]);
 		if (g_strcmp0 (priv->version_ui, priv->update_version_ui) != 0) {
-			gs_app_queue_notify (app, obj_props[PROP_VERSION]);
+			gs_app_queue_notify (app, PROP_VERSION);
 			return;
 		}
 		gs_app_ui_versions_invalidate (app);
@@ -2434,7 +2591,7 @@ gs_app_set_version (GsApp *app, const gchar *version)
 
 	if (_g_set_str (&priv->version, version)) {
 		gs_app_ui_versions_invalidate (app);
-		gs_app_queue_notify (app, obj_props[PROP_VERSION]);
+		gs_app_queue_notify (app, PROP_VERSION);
 	}
 }
 
@@ -2480,7 +2637,7 @@ gs_app_set_summary (GsApp *app, GsAppQuality quality, const gchar *summary)
 		return;
 	priv->summary_quality = quality;
 	if (_g_set_str (&priv->summary, summary))
-		gs_app_queue_notify (app, obj_props[PROP_SUMMARY]);
+		gs_app_queue_notify (app, PROP_SUMMARY);
 }
 
 /**
@@ -2577,7 +2734,7 @@ gs_app_set_url (GsApp *app, AsUrlKind kind, const gchar *url)
 			     GINT_TO_POINTER (kind),
 			     g_strdup (url));
 
-	gs_app_queue_notify (app, obj_props[PROP_URLS]);
+	gs_app_queue_notify (app, PROP_URLS);
 }
 
 /**
@@ -2623,7 +2780,7 @@ gs_app_set_url_missing (GsApp *app, const gchar *url)
 		return;
 	g_free (priv->url_missing);
 	priv->url_missing = g_strdup (url);
-	gs_app_queue_notify (app, obj_props[PROP_URL_MISSING]);
+	gs_app_queue_notify (app, PROP_URL_MISSING);
 }
 
 /**
@@ -2745,7 +2902,7 @@ gs_app_set_license (GsApp *app, GsAppQuality quality, const gchar *license)
 	priv->license_is_free = as_license_is_free_license (license);
 
 	if (_g_set_str (&priv->license, license))
-		gs_app_queue_notify (app, obj_props[PROP_LICENSE]);
+		gs_app_queue_notify (app, PROP_LICENSE);
 }
 
 /**
@@ -3152,7 +3309,7 @@ gs_app_set_update_version (GsApp *app, const gchar *update_version)
 	g_return_if_fail (GS_IS_APP (app));
 	locker = g_mutex_locker_new (&priv->mutex);
 	gs_app_set_update_version_internal (app, update_version);
-	gs_app_queue_notify (app, obj_props[PROP_VERSION]);
+	gs_app_queue_notify (app, PROP_VERSION);
 }
 
 /**
@@ -3394,7 +3551,7 @@ gs_app_set_rating (GsApp *app, gint rating)
 	if (rating == priv->rating)
 		return;
 	priv->rating = rating;
-	gs_app_queue_notify (app, obj_props[PROP_RATING]);
+	gs_app_queue_notify (app, PROP_RATING);
 }
 
 /**
@@ -3621,12 +3778,12 @@ gs_app_set_size_download (GsApp      *app,
 
 	if (priv->size_download_type != size_type) {
 		priv->size_download_type = size_type;
-		gs_app_queue_notify (app, obj_props[PROP_SIZE_DOWNLOAD_TYPE]);
+		gs_app_queue_notify (app, PROP_SIZE_DOWNLOAD_TYPE);
 	}
 
 	if (priv->size_download != size_bytes) {
 		priv->size_download = size_bytes;
-		gs_app_queue_notify (app, obj_props[PROP_SIZE_DOWNLOAD]);
+		gs_app_queue_notify (app, PROP_SIZE_DOWNLOAD);
 	}
 }
 
@@ -3823,12 +3980,12 @@ gs_app_set_size_installed (GsApp      *app,
 
 	if (priv->size_installed_type != size_type) {
 		priv->size_installed_type = size_type;
-		gs_app_queue_notify (app, obj_props[PROP_SIZE_INSTALLED_TYPE]);
+		gs_app_queue_notify (app, PROP_SIZE_INSTALLED_TYPE);
 	}
 
 	if (priv->size_installed != size_bytes) {
 		priv->size_installed = size_bytes;
-		gs_app_queue_notify (app, obj_props[PROP_SIZE_INSTALLED]);
+		gs_app_queue_notify (app, PROP_SIZE_INSTALLED);
 	}
 }
 
@@ -3957,12 +4114,12 @@ gs_app_set_size_user_data (GsApp      *app,
 
 	if (priv->size_user_data_type != size_type) {
 		priv->size_user_data_type = size_type;
-		gs_app_queue_notify (app, obj_props[PROP_SIZE_USER_DATA_TYPE]);
+		gs_app_queue_notify (app, PROP_SIZE_USER_DATA_TYPE);
 	}
 
 	if (priv->size_user_data != size_bytes) {
 		priv->size_user_data = size_bytes;
-		gs_app_queue_notify (app, obj_props[PROP_SIZE_USER_DATA]);
+		gs_app_queue_notify (app, PROP_SIZE_USER_DATA);
 	}
 }
 
@@ -4020,12 +4177,12 @@ gs_app_set_size_cache_data (GsApp      *app,
 
 	if (priv->size_cache_data_type != size_type) {
 		priv->size_cache_data_type = size_type;
-		gs_app_queue_notify (app, obj_props[PROP_SIZE_CACHE_DATA_TYPE]);
+		gs_app_queue_notify (app, PROP_SIZE_CACHE_DATA_TYPE);
 	}
 
 	if (priv->size_cache_data != size_bytes) {
 		priv->size_cache_data = size_bytes;
-		gs_app_queue_notify (app, obj_props[PROP_SIZE_CACHE_DATA]);
+		gs_app_queue_notify (app, PROP_SIZE_CACHE_DATA);
 	}
 }
 
@@ -4266,16 +4423,18 @@ gs_app_add_related (GsApp *app, GsApp *app2)
 	/* if the app is updatable-live and any related app is not then
 	 * degrade to the offline state */
 	if (priv->state == GS_APP_STATE_UPDATABLE_LIVE &&
-	    priv2->state == GS_APP_STATE_UPDATABLE)
+	    priv2->state == GS_APP_STATE_UPDATABLE) {
 		priv->state = priv2->state;
+		gs_app_notify_index_watches_unlocked (app);
+	}
 
 	gs_app_list_add (priv->related, app2);
 
 	/* The related apps add to the main app’s sizes. */
-	gs_app_queue_notify (app, obj_props[PROP_SIZE_DOWNLOAD_DEPENDENCIES_TYPE]);
-	gs_app_queue_notify (app, obj_props[PROP_SIZE_DOWNLOAD_DEPENDENCIES]);
-	gs_app_queue_notify (app, obj_props[PROP_SIZE_INSTALLED_DEPENDENCIES_TYPE]);
-	gs_app_queue_notify (app, obj_props[PROP_SIZE_INSTALLED_DEPENDENCIES]);
+	gs_app_queue_notify (app, PROP_SIZE_DOWNLOAD_DEPENDENCIES_TYPE);
+	gs_app_queue_notify (app, PROP_SIZE_DOWNLOAD_DEPENDENCIES);
+	gs_app_queue_notify (app, PROP_SIZE_INSTALLED_DEPENDENCIES_TYPE);
+	gs_app_queue_notify (app, PROP_SIZE_INSTALLED_DEPENDENCIES);
 }
 
 /**
@@ -4389,7 +4548,7 @@ gs_app_set_release_date (GsApp *app, guint64 release_date)
 		return;
 	priv->release_date = release_date;
 
-	gs_app_queue_notify (app, obj_props[PROP_RELEASE_DATE]);
+	gs_app_queue_notify (app, PROP_RELEASE_DATE);
 }
 
 /**
@@ -4598,6 +4757,8 @@ calculate_key_colors (GsApp *app)
 	GsAppPrivate *priv = gs_app_get_instance_private (app);
 	g_autoptr(GIcon) icon_small = NULL;
 	g_autoptr(GdkPixbuf) pb_small = NULL;
+	g_autofree gchar *cache_key = NULL;
+	g_autofree gchar *cache_fn = NULL;
 	const gchar *overrides_str;
 
 	/* Lazily create the array */
@@ -4735,9 +4896,34 @@ calculate_key_colors (GsApp *app)
 		return;
 	}
 
-	/* get a list of key colors */
+	/* get a list of key colors, from the cache if this icon has been
+	 * seen before, as calculating them is slow */
 	g_clear_pointer (&priv->key_colors, g_array_unref);
+	cache_key = gs_key_colors_get_cache_key (pb_small);
+	cache_fn = gs_utils_get_cache_filename ("key-colors", cache_key,
+						GS_UTILS_CACHE_FLAG_WRITEABLE |
+						GS_UTILS_CACHE_FLAG_CREATE_DIRECTORY,
+						NULL);
+	if (cache_fn != NULL) {
+		g_autoptr(GError) error_local = NULL;
+
+		priv->key_colors = gs_key_colors_load (cache_fn, &error_local);
+		if (priv->key_colors != NULL)
+			return;
+		if (!g_error_matches (error_local, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+			g_debug ("failed to load cached key colors from %s: %s",
+				 cache_fn, error_local->message);
+	}
+
 	priv->key_colors = gs_calculate_key_colors (pb_small);
+
+	if (cache_fn != NULL) {
+		g_autoptr(GError) error_local = NULL;
+
+		if (!gs_key_colors_save (cache_fn, priv->key_colors, &error_local))
+			g_debug ("failed to save key colors to %s: %s",
+				 cache_fn, error_local->message);
+	}
 }
 
 /**
@@ -4781,7 +4967,7 @@ gs_app_set_key_colors (GsApp *app, GArray *key_colors)
 	locker = g_mutex_locker_new (&priv->mutex);
 	priv->user_key_colors = FALSE;
 	if (_g_set_array (&priv->key_colors, key_colors))
-		gs_app_queue_notify (app, obj_props[PROP_KEY_COLORS]);
+		gs_app_queue_notify (app, PROP_KEY_COLORS);
 }
 
 /**
@@ -4806,7 +4992,7 @@ gs_app_add_key_color (GsApp *app, GdkRGBA *key_color)
 
 	priv->user_key_colors = FALSE;
 	g_array_append_val (priv->key_colors, *key_color);
-	gs_app_queue_notify (app, obj_props[PROP_KEY_COLORS]);
+	gs_app_queue_notify (app, PROP_KEY_COLORS);
 }
 
 /**
@@ -5035,7 +5221,7 @@ gs_app_add_quirk (GsApp *app, GsAppQuirk quirk)
 
 	locker = g_mutex_locker_new (&priv->mutex);
 	priv->quirk |= quirk;
-	gs_app_queue_notify (app, obj_props[PROP_QUIRK]);
+	gs_app_queue_notify (app, PROP_QUIRK);
 }
 
 /**
@@ -5060,7 +5246,7 @@ gs_app_remove_quirk (GsApp *app, GsAppQuirk quirk)
 
 	locker = g_mutex_locker_new (&priv->mutex);
 	priv->quirk &= ~quirk;
-	gs_app_queue_notify (app, obj_props[PROP_QUIRK]);
+	gs_app_queue_notify (app, PROP_QUIRK);
 }
 
 /**
@@ -5398,7 +5584,7 @@ gs_app_set_property (GObject *object, guint prop_id, const GValue *value, GParam
 		gs_app_set_special_kind (app, g_value_get_enum (value));
 		break;
 	case PROP_STATE:
-		gs_app_set_state_internal (app, g_value_get_enum (value));
+		gs_app_set_state (app, g_value_get_enum (value));
 		break;
 	case PROP_PROGRESS:
 		gs_app_set_progress (app, g_value_get_uint (value));
@@ -5518,6 +5704,7 @@ gs_app_finalize (GObject *object)
 	GsAppPrivate *priv = gs_app_get_instance_private (app);
 
 	g_mutex_clear (&priv->mutex);
+	g_clear_pointer (&priv->index_watches, g_array_unref);
 	g_free (priv->id);
 	g_free (priv->unique_id);
 	g_free (priv->branch);
@@ -6225,7 +6412,7 @@ gs_app_set_origin_ui (GsApp *app,
 
 	g_free (priv->origin_ui);
 	priv->origin_ui = g_strdup (origin_ui);
-	gs_app_queue_notify (app, obj_props[PROP_ORIGIN_UI]);
+	gs_app_queue_notify (app, PROP_ORIGIN_UI);
 }
 
 /**
@@ -6388,7 +6575,7 @@ gs_app_set_permissions (GsApp *app,
 	g_clear_object (&priv->permissions);
 	if (permissions != NULL)
 		priv->permissions = g_object_ref (permissions);
-	gs_app_queue_notify (app, obj_props[PROP_PERMISSIONS]);
+	gs_app_queue_notify (app, PROP_PERMISSIONS);
 }
 
 /**
@@ -6594,7 +6781,7 @@ gs_app_add_relation (GsApp      *app,
 		priv->relations = g_ptr_array_new_with_free_func (g_object_unref);
 	g_ptr_array_add (priv->relations, g_object_ref (relation));
 
-	gs_app_queue_notify (app, obj_props[PROP_RELATIONS]);
+	gs_app_queue_notify (app, PROP_RELATIONS);
 }
 
 /**
@@ -6629,7 +6816,7 @@ gs_app_set_relations (GsApp     *app,
 	if (relations != NULL)
 		priv->relations = g_ptr_array_ref (relations);
 
-	gs_app_queue_notify (app, obj_props[PROP_RELATIONS]);
+	gs_app_queue_notify (app, PROP_RELATIONS);
 }
 
 /**
@@ -6675,7 +6862,7 @@ gs_app_set_has_translations (GsApp    *app,
 		return;
 
 	priv->has_translations = has_translations;
-	gs_app_queue_notify (app, obj_props[PROP_HAS_TRANSLATIONS]);
+	gs_app_queue_notify (app, PROP_HAS_TRANSLATIONS);
 }
 
 /**
@@ -368,6 +368,7 @@ GIcon		*gs_app_get_icon_for_size	(GsApp		*app,
 						 guint		 scale,
 						 const gchar	*fallback_icon_name);
 GPtrArray	*gs_app_get_icons		(GsApp		*app);
+GPtrArray	*gs_app_dup_icons		(GsApp		*app);
 void		 gs_app_add_icon		(GsApp		*app,
 						 GIcon		*icon);
 void		 gs_app_remove_all_icons	(GsApp		*app);
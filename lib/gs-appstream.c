@@ -11,6 +11,11 @@
 
 #include <gnome-software.h>
 #include <locale.h>
+#include <string.h>
+
+#ifdef HAVE_LIBSTEMMER
+#include <libstemmer.h>
+#endif
 
 #include "gs-appstream.h"
 
@@ -288,6 +293,125 @@ traverse_component_icons (GsApp *app,
 	}
 }
 
+/* The AppStream data may be split across several silos, see
+ * gs_appstream_silo_set_siblings(). Only weak references to the siblings are
+ * kept, so that silos which are each other’s siblings can still be freed.
+ *
+ * The siblings can be replaced while another thread is querying the silo,
+ * so readers take a reference on them rather than borrowing them. */
+#define GS_APPSTREAM_SILO_SIBLINGS_DATA_KEY	"gs-appstream-silo-siblings"
+
+typedef struct {
+	gatomicrefcount	 ref_count;
+	guint		 n_refs;
+	GWeakRef	 refs[];
+} GsAppstreamSiloSiblings;
+
+static gpointer
+gs_appstream_silo_siblings_ref (gpointer data,
+				gpointer user_data)
+{
+	GsAppstreamSiloSiblings *siblings = data;
+	if (siblings != NULL)
+		g_atomic_ref_count_inc (&siblings->ref_count);
+	return siblings;
+}
+
+static void
+gs_appstream_silo_siblings_unref (GsAppstreamSiloSiblings *siblings)
+{
+	if (!g_atomic_ref_count_dec (&siblings->ref_count))
+		return;
+	for (guint i = 0; i < siblings->n_refs; i++)
+		g_weak_ref_clear (&siblings->refs[i]);
+	g_free (siblings);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GsAppstreamSiloSiblings, gs_appstream_silo_siblings_unref)
+
+/**
+ * gs_appstream_silo_set_siblings:
+ * @silo: an #XbSilo
+ * @siblings: (element-type XbSilo) (nullable): the other silos, or %NULL
+ *
+ * Sets the silos holding the rest of the AppStream data, when it is split
+ * across several silos rather than compiled into one.
+ *
+ * Components in @silo can refer to components in other sources, for example
+ * to inherit the icon of a .desktop file, or to find the releases of an app
+ * which are already installed. gs_appstream_refine_app() follows those
+ * references into @siblings as well as @silo.
+ *
+ * @silo may itself be in @siblings, in which case it’s skipped.
+ **/
+void
+gs_appstream_silo_set_siblings (XbSilo *silo, GPtrArray *siblings)
+{
+	GsAppstreamSiloSiblings *data;
+	guint n_refs = 0;
+
+	g_return_if_fail (XB_IS_SILO (silo));
+
+	if (siblings == NULL || siblings->len == 0) {
+		g_object_set_data (G_OBJECT (silo), GS_APPSTREAM_SILO_SIBLINGS_DATA_KEY, NULL);
+		return;
+	}
+
+	data = g_malloc0 (sizeof (GsAppstreamSiloSiblings) + siblings->len * sizeof (GWeakRef));
+	g_atomic_ref_count_init (&data->ref_count);
+	for (guint i = 0; i < siblings->len; i++) {
+		XbSilo *sibling = g_ptr_array_index (siblings, i);
+		if (sibling == silo)
+			continue;
+		g_weak_ref_init (&data->refs[n_refs++], sibling);
+	}
+	data->n_refs = n_refs;
+	g_object_set_data_full (G_OBJECT (silo), GS_APPSTREAM_SILO_SIBLINGS_DATA_KEY,
+				data, (GDestroyNotify) gs_appstream_silo_siblings_unref);
+}
+
+/* Like xb_silo_query(), but also returns the matches in the siblings of
+ * @silo, after those in @silo itself. @limit applies to each silo. */
+static GPtrArray *
+gs_appstream_silo_query_with_siblings (XbSilo *silo,
+				       const gchar *xpath,
+				       guint limit,
+				       GError **error)
+{
+	g_autoptr(GsAppstreamSiloSiblings) siblings = NULL;
+	g_autoptr(GPtrArray) results = NULL;
+	g_autoptr(GError) error_local = NULL;
+
+	results = xb_silo_query (silo, xpath, limit, &error_local);
+	if (results == NULL &&
+	    !g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
+		g_propagate_error (error, g_steal_pointer (&error_local));
+		return NULL;
+	}
+
+	siblings = g_object_dup_data (G_OBJECT (silo), GS_APPSTREAM_SILO_SIBLINGS_DATA_KEY,
+				      gs_appstream_silo_siblings_ref, NULL);
+	for (guint i = 0; siblings != NULL && i < siblings->n_refs; i++) {
+		g_autoptr(XbSilo) sibling = g_weak_ref_get (&siblings->refs[i]);
+		g_autoptr(GPtrArray) sibling_results = NULL;
+
+		if (sibling == NULL)
+			continue;
+		sibling_results = xb_silo_query (sibling, xpath, limit, NULL);
+		if (sibling_results == NULL)
+			continue;
+		if (results == NULL)
+			results = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+		g_ptr_array_extend_and_steal (results, g_steal_pointer (&sibling_results));
+	}
+
+	if (results == NULL) {
+		g_propagate_error (error, g_steal_pointer (&error_local));
+		return NULL;
+	}
+	return g_steal_pointer (&results);
+}
+
 static void
 traverse_components_xpath_for_icons (GsApp *app,
 				     XbSilo *silo,
@@ -297,7 +421,7 @@ traverse_components_xpath_for_icons (GsApp *app,
 	g_autoptr(GPtrArray) components = NULL;
 	g_autoptr(GError) local_error = NULL;
 
-	components = xb_silo_query (silo, xpath, 0, &local_error);
+	components = gs_appstream_silo_query_with_siblings (silo, xpath, 0, &local_error);
 	if (components) {
 		for (guint i = 0; i < components->len; i++) {
 			g_autoptr(GPtrArray) icons = NULL;  /* (element-type XbNode) */
@@ -364,7 +488,7 @@ gs_appstream_refine_add_addons (GsPlugin *plugin,
 	/* get all components */
 	xpath = g_strdup_printf ("components/component/extends[text()='%s']/..",
 				 gs_app_get_id (app));
-	addons = xb_silo_query (silo, xpath, 0, &error_local);
+	addons = gs_appstream_silo_query_with_siblings (silo, xpath, 0, &error_local);
 	if (addons == NULL) {
 		if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
 			return TRUE;
@@ -640,7 +764,7 @@ gs_appstream_refine_app_updates (GsApp *app,
 	/* find out which releases are already installed */
 	xpath = g_strdup_printf ("component/id[text()='%s']/../releases/*[@version]",
 				 gs_app_get_id (app));
-	releases_inst = xb_silo_query (silo, xpath, 0, &error_local);
+	releases_inst = gs_appstream_silo_query_with_siblings (silo, xpath, 0, &error_local);
 	if (releases_inst == NULL) {
 		if (!g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
 			g_propagate_error (error, g_steal_pointer (&error_local));
@@ -1395,6 +1519,562 @@ gs_appstream_refine_app (GsPlugin *plugin,
 	return TRUE;
 }
 
+/* The search index maps each folded token found in the searchable fields of
+ * a component to a posting list of (component index, field bitmask) pairs.
+ * It is only ever used to narrow down the set of components which could
+ * possibly match a search; the candidates are then checked with the same
+ * XPath queries as before, so the results are unchanged.
+ *
+ * There are two token tables. The tokens as written are used by the
+ * type-ahead search. The stems table holds each token and its stem, as
+ * produced by the same Snowball stemmer libxmlb uses for stem(), so the
+ * stemmed search term is a prefix of a stem in the table whenever one of
+ * the stem(?) queries can match. It is left empty if gnome-software was
+ * built without libstemmer, in which case searches scan every component.
+ *
+ * The serialised form is a flat, native-endian blob which can be mmap()ed
+ * straight from the cache directory:
+ *
+ *   header | tokens[n_tokens] | stems[n_stems] | postings[n_postings] | string table
+ *
+ * Each token table is sorted by strcmp() so that all tokens sharing a prefix
+ * form a contiguous range which can be found with a binary search. */
+#define GS_APPSTREAM_SEARCH_INDEX_MAGIC		"GSSIDX02"
+#define GS_APPSTREAM_SEARCH_INDEX_DATA_KEY	"gs-appstream-search-index"
+#define GS_APPSTREAM_TYPE_AHEAD_MAX_TERM_LEN	32
+#define GS_APPSTREAM_TYPE_AHEAD_CACHE_SIZE	16
+
+typedef enum {
+	GS_APPSTREAM_SEARCH_FIELD_NONE			= 0,
+	GS_APPSTREAM_SEARCH_FIELD_MIMETYPE		= 1 << 0,
+	GS_APPSTREAM_SEARCH_FIELD_PKGNAME		= 1 << 1,
+	GS_APPSTREAM_SEARCH_FIELD_SUMMARY		= 1 << 2,
+	GS_APPSTREAM_SEARCH_FIELD_NAME			= 1 << 3,
+	GS_APPSTREAM_SEARCH_FIELD_KEYWORD		= 1 << 4,
+	GS_APPSTREAM_SEARCH_FIELD_ID			= 1 << 5,
+	GS_APPSTREAM_SEARCH_FIELD_LAUNCHABLE		= 1 << 6,
+	GS_APPSTREAM_SEARCH_FIELD_ORIGIN		= 1 << 7,
+	GS_APPSTREAM_SEARCH_FIELD_DEVELOPER_NAME	= 1 << 8,
+	GS_APPSTREAM_SEARCH_FIELD_PROJECT_GROUP		= 1 << 9,
+} GsAppstreamSearchField;
+
+typedef struct {
+	gchar		magic[8];
+	gchar		guid[40];
+	guint32		n_components;
+	guint32		n_tokens;
+	guint32		n_stems;
+	guint32		n_postings;
+	guint32		strtab_size;
+} GsAppstreamSearchIndexHeader;
+
+typedef struct {
+	guint32		str_offset;
+	guint32		postings_start;
+	guint32		postings_len;
+} GsAppstreamSearchIndexToken;
+
+typedef struct {
+	guint32		component;
+	guint32		fields;
+} GsAppstreamSearchIndexPosting;
+
+typedef struct {
+	guint32		token;
+	guint8		distance;
+} GsAppstreamTypeAheadMatch;
+
+typedef struct {
+	gchar		*term;
+	guint		 max_distance;
+	GArray		*matches;  /* (element-type GsAppstreamTypeAheadMatch) */
+} GsAppstreamTypeAheadCacheEntry;
+
+typedef struct {
+	GBytes					*bytes;
+	const GsAppstreamSearchIndexHeader	*header;
+	const GsAppstreamSearchIndexToken	*tokens;
+	const GsAppstreamSearchIndexToken	*stems;
+	const GsAppstreamSearchIndexPosting	*postings;
+	const gchar				*strtab;
+
+#ifdef HAVE_LIBSTEMMER
+	/* the stemmer is not thread safe */
+	GMutex					 stemmer_mutex;
+	struct sb_stemmer			*stemmer;  /* (owned) (nullable) */
+#endif
+
+	/* the tokens matched by recent type-ahead terms, most recently used
+	 * last, so that each keystroke only has to narrow down the matches
+	 * for the term before it */
+	GMutex					 type_ahead_mutex;
+	GPtrArray				*type_ahead_cache;  /* (element-type GsAppstreamTypeAheadCacheEntry) */
+} GsAppstreamSearchIndex;
+
+static void
+gs_appstream_type_ahead_cache_entry_free (GsAppstreamTypeAheadCacheEntry *entry)
+{
+	g_free (entry->term);
+	g_array_unref (entry->matches);
+	g_free (entry);
+}
+
+static void
+gs_appstream_search_index_free (GsAppstreamSearchIndex *index)
+{
+	g_bytes_unref (index->bytes);
+	g_ptr_array_unref (index->type_ahead_cache);
+	g_mutex_clear (&index->type_ahead_mutex);
+#ifdef HAVE_LIBSTEMMER
+	g_clear_pointer (&index->stemmer, sb_stemmer_delete);
+	g_mutex_clear (&index->stemmer_mutex);
+#endif
+	g_free (index);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GsAppstreamSearchIndex, gs_appstream_search_index_free)
+
+/* takes ownership of @bytes; returns %NULL if the data is not a valid index
+ * for @silo */
+static GsAppstreamSearchIndex *
+gs_appstream_search_index_new_from_bytes (XbSilo *silo, GBytes *bytes)
+{
+	g_autoptr(GsAppstreamSearchIndex) index = g_new0 (GsAppstreamSearchIndex, 1);
+	const GsAppstreamSearchIndexHeader *header;
+	const gchar *guid = xb_silo_get_guid (silo);
+	gsize sz;
+	const guint8 *data = g_bytes_get_data (bytes, &sz);
+	guint64 expected_sz;
+
+	index->bytes = bytes;
+	g_mutex_init (&index->type_ahead_mutex);
+	index->type_ahead_cache = g_ptr_array_new_with_free_func ((GDestroyNotify) gs_appstream_type_ahead_cache_entry_free);
+#ifdef HAVE_LIBSTEMMER
+	g_mutex_init (&index->stemmer_mutex);
+#endif
+	if (data == NULL || sz < sizeof (GsAppstreamSearchIndexHeader))
+		return NULL;
+	header = (const GsAppstreamSearchIndexHeader *) data;
+	if (memcmp (header->magic, GS_APPSTREAM_SEARCH_INDEX_MAGIC, sizeof (header->magic)) != 0)
+		return NULL;
+	if (guid == NULL || strnlen (header->guid, sizeof (header->guid)) == sizeof (header->guid) ||
+	    g_strcmp0 (header->guid, guid) != 0)
+		return NULL;
+
+	expected_sz = sizeof (GsAppstreamSearchIndexHeader) +
+		      ((guint64) header->n_tokens + header->n_stems) * sizeof (GsAppstreamSearchIndexToken) +
+		      (guint64) header->n_postings * sizeof (GsAppstreamSearchIndexPosting) +
+		      header->strtab_size;
+	if (expected_sz != sz || header->strtab_size == 0)
+		return NULL;
+
+	index->header = header;
+	index->tokens = (const GsAppstreamSearchIndexToken *) (data + sizeof (GsAppstreamSearchIndexHeader));
+	index->stems = index->tokens + header->n_tokens;
+	index->postings = (const GsAppstreamSearchIndexPosting *) (index->stems + header->n_stems);
+	index->strtab = (const gchar *) (index->postings + header->n_postings);
+	if (index->strtab[header->strtab_size - 1] != '\0')
+		return NULL;
+
+	/* check every offset once here so that lookups do not have to; the
+	 * stems directly follow the tokens */
+	for (guint32 i = 0; i < header->n_tokens + header->n_stems; i++) {
+		const GsAppstreamSearchIndexToken *token = &index->tokens[i];
+		if (token->str_offset >= header->strtab_size ||
+		    (guint64) token->postings_start + token->postings_len > header->n_postings)
+			return NULL;
+	}
+	for (guint32 i = 0; i < header->n_postings; i++) {
+		if (index->postings[i].component >= header->n_components)
+			return NULL;
+	}
+
+	return g_steal_pointer (&index);
+}
+
+static void
+gs_appstream_search_index_add_token (GHashTable *tokens,
+				     guint32 component_idx,
+				     GsAppstreamSearchField field,
+				     const gchar *token)
+{
+	GArray *postings = g_hash_table_lookup (tokens, token);
+	GsAppstreamSearchIndexPosting *last = NULL;
+
+	if (postings == NULL) {
+		postings = g_array_new (FALSE, FALSE, sizeof (GsAppstreamSearchIndexPosting));
+		g_hash_table_insert (tokens, g_strdup (token), postings);
+	}
+
+	/* components are visited in order, so any existing posting for this
+	 * component is always the last one */
+	if (postings->len > 0)
+		last = &g_array_index (postings, GsAppstreamSearchIndexPosting, postings->len - 1);
+	if (last != NULL && last->component == component_idx) {
+		last->fields |= field;
+	} else {
+		GsAppstreamSearchIndexPosting posting = { component_idx, field };
+		g_array_append_val (postings, posting);
+	}
+}
+
+#ifdef HAVE_LIBSTEMMER
+/* Returns: (transfer full): @word stemmed the same way as by the stem()
+ * function in libxmlb queries */
+static gchar *
+gs_appstream_search_index_stem (struct sb_stemmer *stemmer, const gchar *word)
+{
+	const sb_symbol *stemmed = sb_stemmer_stem (stemmer, (const sb_symbol *) word, strlen (word));
+
+	if (stemmed == NULL)
+		return g_strdup (word);
+	return g_strndup ((const gchar *) stemmed, sb_stemmer_length (stemmer));
+}
+#endif
+
+typedef struct {
+	GHashTable		*tokens;  /* (owned) (element-type utf8 GArray<GsAppstreamSearchIndexPosting>) */
+	GHashTable		*stems;  /* (owned) (element-type utf8 GArray<GsAppstreamSearchIndexPosting>) */
+#ifdef HAVE_LIBSTEMMER
+	struct sb_stemmer	*stemmer;  /* (owned) (nullable) */
+#endif
+} GsAppstreamSearchIndexBuilder;
+
+static void
+gs_appstream_search_index_builder_clear (GsAppstreamSearchIndexBuilder *builder)
+{
+	g_clear_pointer (&builder->tokens, g_hash_table_unref);
+	g_clear_pointer (&builder->stems, g_hash_table_unref);
+#ifdef HAVE_LIBSTEMMER
+	g_clear_pointer (&builder->stemmer, sb_stemmer_delete);
+#endif
+}
+
+G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC (GsAppstreamSearchIndexBuilder, gs_appstream_search_index_builder_clear)
+
+static void
+gs_appstream_search_index_builder_add_word (GsAppstreamSearchIndexBuilder *builder,
+					    guint32 component_idx,
+					    GsAppstreamSearchField field,
+					    const gchar *word)
+{
+	gs_appstream_search_index_add_token (builder->tokens, component_idx, field, word);
+
+#ifdef HAVE_LIBSTEMMER
+	/* libxmlb may compare the stemmed search term against the word as
+	 * written or against its stem, so index both */
+	if (builder->stemmer != NULL) {
+		g_autofree gchar *stem = gs_appstream_search_index_stem (builder->stemmer, word);
+
+		gs_appstream_search_index_add_token (builder->stems, component_idx, field, word);
+		if (strcmp (stem, word) != 0)
+			gs_appstream_search_index_add_token (builder->stems, component_idx, field, stem);
+	}
+#endif
+}
+
+static void
+gs_appstream_search_index_add_text (GsAppstreamSearchIndexBuilder *builder,
+				    guint32 component_idx,
+				    GsAppstreamSearchField field,
+				    const gchar *text)
+{
+	g_auto(GStrv) folded = NULL;
+	g_auto(GStrv) ascii = NULL;
+
+	if (text == NULL)
+		return;
+
+	folded = g_str_tokenize_and_fold (text, NULL, &ascii);
+	for (guint i = 0; folded[i] != NULL; i++)
+		gs_appstream_search_index_builder_add_word (builder, component_idx, field, folded[i]);
+	for (guint i = 0; ascii != NULL && ascii[i] != NULL; i++)
+		gs_appstream_search_index_builder_add_word (builder, component_idx, field, ascii[i]);
+}
+
+static void
+gs_appstream_search_index_add_children (GsAppstreamSearchIndexBuilder *builder,
+					guint32 component_idx,
+					GsAppstreamSearchField field,
+					XbNode *parent)
+{
+	g_autoptr(XbNode) child = xb_node_get_child (parent);
+
+	while (child != NULL) {
+		g_autoptr(XbNode) next = xb_node_get_next (child);
+		gs_appstream_search_index_add_text (builder, component_idx, field,
+						    xb_node_get_text (child));
+		g_set_object (&child, next);
+	}
+}
+
+static gint
+gs_appstream_search_index_sort_cb (gconstpointer a, gconstpointer b)
+{
+	return strcmp (*(const gchar **) a, *(const gchar **) b);
+}
+
+/* Appends the sorted token table for @table to @buf, the strings to @strtab
+ * and the posting lists to @postings. Returns the number of tokens. */
+static guint32
+gs_appstream_search_index_write_tokens (GByteArray *buf,
+					GString *strtab,
+					GByteArray *postings,
+					GHashTable *table)
+{
+	g_autofree const gchar **keys = NULL;
+	guint n_keys = 0;
+
+	keys = (const gchar **) g_hash_table_get_keys_as_array (table, &n_keys);
+	qsort (keys, n_keys, sizeof (const gchar *), gs_appstream_search_index_sort_cb);
+	for (guint i = 0; i < n_keys; i++) {
+		GArray *token_postings = g_hash_table_lookup (table, keys[i]);
+		GsAppstreamSearchIndexToken token;
+
+		token.str_offset = strtab->len;
+		token.postings_start = postings->len / sizeof (GsAppstreamSearchIndexPosting);
+		token.postings_len = token_postings->len;
+		g_string_append_len (strtab, keys[i], strlen (keys[i]) + 1);
+		g_byte_array_append (buf, (const guint8 *) &token, sizeof (token));
+		g_byte_array_append (postings, (const guint8 *) token_postings->data,
+				     token_postings->len * sizeof (GsAppstreamSearchIndexPosting));
+	}
+
+	return n_keys;
+}
+
+static GsAppstreamSearchIndex *
+gs_appstream_search_index_build (XbSilo *silo,
+				 GCancellable *cancellable,
+				 GError **error)
+{
+	GsAppstreamSearchIndexHeader header = { { 0, }, };
+	GsAppstreamSearchIndex *index;
+	g_autoptr(GByteArray) buf = g_byte_array_new ();
+	g_autoptr(GByteArray) postings = g_byte_array_new ();
+	g_autoptr(GPtrArray) components = NULL;
+	g_auto(GsAppstreamSearchIndexBuilder) builder = { NULL, };
+	g_autoptr(GString) strtab = g_string_new (NULL);
+	g_autoptr(GError) error_local = NULL;
+
+	builder.tokens = g_hash_table_new_full (g_str_hash, g_str_equal,
+						g_free, (GDestroyNotify) g_array_unref);
+	builder.stems = g_hash_table_new_full (g_str_hash, g_str_equal,
+					       g_free, (GDestroyNotify) g_array_unref);
+#ifdef HAVE_LIBSTEMMER
+	/* the same stemmer as libxmlb uses for stem() */
+	builder.stemmer = sb_stemmer_new ("en", NULL);
+#endif
+	components = xb_silo_query (silo, "components/component", 0, &error_local);
+	if (components == NULL) {
+		if (!g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
+			g_propagate_error (error, g_steal_pointer (&error_local));
+			return NULL;
+		}
+		components = g_ptr_array_new ();
+	}
+
+	for (guint32 i = 0; i < components->len; i++) {
+		XbNode *component = g_ptr_array_index (components, i);
+		g_autoptr(XbNode) child = NULL;
+
+		if (g_cancellable_set_error_if_cancelled (cancellable, error))
+			return NULL;
+
+		gs_appstream_search_index_add_text (&builder, i, GS_APPSTREAM_SEARCH_FIELD_ORIGIN,
+						    xb_node_query_attr (component, "..", "origin", NULL));
+
+		/* walk the children directly rather than querying each field,
+		 * which is much cheaper than going through the XPath engine */
+		child = xb_node_get_child (component);
+		while (child != NULL) {
+			g_autoptr(XbNode) next = xb_node_get_next (child);
+			const gchar *element = xb_node_get_element (child);
+			const gchar *text = xb_node_get_text (child);
+
+			if (g_strcmp0 (element, "mimetypes") == 0)
+				gs_appstream_search_index_add_children (&builder, i, GS_APPSTREAM_SEARCH_FIELD_MIMETYPE, child);
+			else if (g_strcmp0 (element, "keywords") == 0)
+				gs_appstream_search_index_add_children (&builder, i, GS_APPSTREAM_SEARCH_FIELD_KEYWORD, child);
+			else if (g_strcmp0 (element, "pkgname") == 0)
+				gs_appstream_search_index_add_text (&builder, i, GS_APPSTREAM_SEARCH_FIELD_PKGNAME, text);
+			else if (g_strcmp0 (element, "summary") == 0)
+				gs_appstream_search_index_add_text (&builder, i, GS_APPSTREAM_SEARCH_FIELD_SUMMARY, text);
+			else if (g_strcmp0 (element, "name") == 0)
+				gs_appstream_search_index_add_text (&builder, i, GS_APPSTREAM_SEARCH_FIELD_NAME, text);
+			else if (g_strcmp0 (element, "id") == 0)
+				gs_appstream_search_index_add_text (&builder, i, GS_APPSTREAM_SEARCH_FIELD_ID, text);
+			else if (g_strcmp0 (element, "launchable") == 0)
+				gs_appstream_search_index_add_text (&builder, i, GS_APPSTREAM_SEARCH_FIELD_LAUNCHABLE, text);
+			else if (g_strcmp0 (element, "developer_name") == 0)
+				gs_appstream_search_index_add_text (&builder, i, GS_APPSTREAM_SEARCH_FIELD_DEVELOPER_NAME, text);
+			else if (g_strcmp0 (element, "project_group") == 0)
+				gs_appstream_search_index_add_text (&builder, i, GS_APPSTREAM_SEARCH_FIELD_PROJECT_GROUP, text);
+
+			g_set_object (&child, next);
+		}
+	}
+
+	memcpy (header.magic, GS_APPSTREAM_SEARCH_INDEX_MAGIC, sizeof (header.magic));
+	g_strlcpy (header.guid, xb_silo_get_guid (silo), sizeof (header.guid));
+	header.n_components = components->len;
+	g_byte_array_append (buf, (const guint8 *) &header, sizeof (header));
+
+	header.n_tokens = gs_appstream_search_index_write_tokens (buf, strtab, postings, builder.tokens);
+	header.n_stems = gs_appstream_search_index_write_tokens (buf, strtab, postings, builder.stems);
+	header.n_postings = postings->len / sizeof (GsAppstreamSearchIndexPosting);
+	g_byte_array_append (buf, postings->data, postings->len);
+	if (strtab->len == 0)
+		g_string_append_len (strtab, "", 1);
+	g_byte_array_append (buf, (const guint8 *) strtab->str, strtab->len);
+	header.strtab_size = strtab->len;
+
+	/* the header was written before the sizes were known */
+	memcpy (buf->data, &header, sizeof (header));
+
+	index = gs_appstream_search_index_new_from_bytes (silo, g_byte_array_free_to_bytes (g_steal_pointer (&buf)));
+	if (index == NULL) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+				     "failed to build search index");
+		return NULL;
+	}
+	return index;
+}
+
+/**
+ * gs_appstream_silo_ensure_search_index:
+ * @silo: an #XbSilo
+ * @filename: (nullable): cache file to load the index from and save it to
+ * @cancellable: a #GCancellable, or %NULL
+ * @error: a #GError, or %NULL
+ *
+ * Builds the token index used by gs_appstream_search() and
+ * gs_appstream_search_developer_apps() to avoid running the search queries
+ * against every component in @silo, and attaches it to @silo.
+ *
+ * If @filename contains an index built for the same silo GUID it is mapped
+ * rather than rebuilt, otherwise the new index is saved there.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+gs_appstream_silo_ensure_search_index (XbSilo *silo,
+				       const gchar *filename,
+				       GCancellable *cancellable,
+				       GError **error)
+{
+	GsAppstreamSearchIndex *index = NULL;
+	g_autoptr(GTimer) timer = g_timer_new ();
+
+	g_return_val_if_fail (XB_IS_SILO (silo), FALSE);
+
+	if (g_object_get_data (G_OBJECT (silo), GS_APPSTREAM_SEARCH_INDEX_DATA_KEY) != NULL)
+		return TRUE;
+
+	/* try the cached copy first */
+	if (filename != NULL) {
+		g_autoptr(GMappedFile) mapped = g_mapped_file_new (filename, FALSE, NULL);
+		if (mapped != NULL) {
+			index = gs_appstream_search_index_new_from_bytes (silo, g_mapped_file_get_bytes (mapped));
+			if (index == NULL)
+				g_debug ("ignoring stale search index %s", filename);
+		}
+	}
+
+	if (index == NULL) {
+		index = gs_appstream_search_index_build (silo, cancellable, error);
+		if (index == NULL)
+			return FALSE;
+
+		if (filename != NULL) {
+			g_autoptr(GError) error_local = NULL;
+			gsize sz;
+			const gchar *data = g_bytes_get_data (index->bytes, &sz);
+			if (!g_file_set_contents (filename, data, sz, &error_local))
+				g_debug ("failed to save search index: %s", error_local->message);
+		}
+	}
+
+	g_debug ("search index with %u tokens and %u stems for %u components took %fms",
+		 index->header->n_tokens, index->header->n_stems, index->header->n_components,
+		 g_timer_elapsed (timer, NULL) * 1000);
+	g_object_set_data_full (G_OBJECT (silo), GS_APPSTREAM_SEARCH_INDEX_DATA_KEY,
+				index, (GDestroyNotify) gs_appstream_search_index_free);
+	return TRUE;
+}
+
+/* Marks the components which could match @search in any of @fields by
+ * bumping @hits[component] from @n_filtered to @n_filtered + 1, so that after
+ * all search terms have been processed only components matching every term
+ * have the final count.
+ *
+ * Returns %FALSE if the index cannot be used for this search term, in which
+ * case @hits is untouched. */
+static gboolean
+gs_appstream_search_index_filter (GsAppstreamSearchIndex *index,
+				  const gchar *search,
+				  guint fields,
+				  guint16 *hits,
+				  guint16 n_filtered)
+{
+#ifdef HAVE_LIBSTEMMER
+	g_auto(GStrv) folded = NULL;
+	g_autofree gchar *key = NULL;
+	gsize key_len;
+	guint lo = 0;
+	guint hi = index->header->n_stems;
+
+	/* the stems are only there if the index was built with libstemmer */
+	if (index->header->n_stems == 0)
+		return FALSE;
+
+	/* the stem can differ from the word in any character, eg. “tries”
+	 * and “try” both stem to “tri”, so look up the term stemmed the same
+	 * way as by the stem(?) queries; only do so for a single folded
+	 * word, where the index is known to hold the same tokens as libxmlb */
+	folded = g_str_tokenize_and_fold (search, NULL, NULL);
+	if (g_strv_length (folded) != 1 || strcmp (folded[0], search) != 0)
+		return FALSE;
+
+	g_mutex_lock (&index->stemmer_mutex);
+	if (index->stemmer == NULL)
+		index->stemmer = sb_stemmer_new ("en", NULL);
+	if (index->stemmer != NULL)
+		key = gs_appstream_search_index_stem (index->stemmer, search);
+	g_mutex_unlock (&index->stemmer_mutex);
+	if (key == NULL)
+		return FALSE;
+	key_len = strlen (key);
+	if (key_len == 0)
+		return FALSE;
+
+	/* find the first stem >= key */
+	while (lo < hi) {
+		guint mid = lo + (hi - lo) / 2;
+		if (strcmp (index->strtab + index->stems[mid].str_offset, key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (guint i = lo; i < index->header->n_stems; i++) {
+		const GsAppstreamSearchIndexToken *token = &index->stems[i];
+		if (strncmp (index->strtab + token->str_offset, key, key_len) != 0)
+			break;
+		for (guint32 j = 0; j < token->postings_len; j++) {
+			const GsAppstreamSearchIndexPosting *posting = &index->postings[token->postings_start + j];
+			if ((posting->fields & fields) != 0 && hits[posting->component] == n_filtered)
+				hits[posting->component] = n_filtered + 1;
+		}
+	}
+
+	return TRUE;
+#else
+	/* without the stemmer the stem(?) queries can't be predicted */
+	return FALSE;
+#endif
+}
+
 typedef struct {
 	AsSearchTokenMatch	 match_value;
 	XbQuery			*query;
@@ -1447,9 +2127,58 @@ gs_appstream_silo_search_component (GPtrArray *array, XbNode *component, const g
 
 typedef struct {
 	AsSearchTokenMatch	match_value;
+	GsAppstreamSearchField	field;
 	const gchar		*xpath;
 } Query;
 
+/* adds the app for a @component which matched a search to @list */
+static gboolean
+gs_appstream_search_add_result (GsPlugin *plugin,
+				XbSilo *silo,
+				XbNode *component,
+				guint16 match_value,
+				GsAppList *list,
+				GError **error)
+{
+	g_autoptr(GsApp) app = gs_appstream_create_app (plugin, silo, component, error);
+
+	if (app == NULL)
+		return FALSE;
+	if (gs_app_has_quirk (app, GS_APP_QUIRK_IS_WILDCARD)) {
+		g_debug ("not returning wildcard %s",
+			 gs_app_get_unique_id (app));
+		return TRUE;
+	}
+	g_debug ("add %s", gs_app_get_unique_id (app));
+
+	/* The match value is used for prioritising results.
+	 * Drop the ID token from it as it’s the highest
+	 * numeric value but isn’t visible to the user in the
+	 * UI, which leads to confusing results ordering. */
+	gs_app_set_match_value (app, match_value & (~AS_SEARCH_TOKEN_MATCH_ID));
+	gs_app_list_add (list, app);
+
+	if (gs_app_get_kind (app) == AS_COMPONENT_KIND_ADDON) {
+		g_autoptr(GPtrArray) extends = NULL;
+
+		/* add the parent app as a wildcard, to be refined later */
+		extends = xb_node_query (component, "extends", 0, NULL);
+		for (guint jj = 0; extends && jj < extends->len; jj++) {
+			XbNode *extend = g_ptr_array_index (extends, jj);
+			g_autoptr(GsApp) app2 = NULL;
+			const gchar *tmp;
+			app2 = gs_app_new (xb_node_get_text (extend));
+			gs_app_add_quirk (app2, GS_APP_QUIRK_IS_WILDCARD);
+			tmp = xb_node_query_attr (extend, "../..", "origin", NULL);
+			if (gs_appstream_origin_valid (tmp))
+				gs_app_set_origin_appstream (app2, tmp);
+			gs_app_list_add (list, app2);
+		}
+	}
+
+	return TRUE;
+}
+
 static gboolean
 gs_appstream_do_search (GsPlugin *plugin,
 			XbSilo *silo,
@@ -1463,6 +2192,10 @@ gs_appstream_do_search (GsPlugin *plugin,
 	g_autoptr(GPtrArray) array = g_ptr_array_new_with_free_func ((GDestroyNotify) gs_appstream_search_helper_free);
 	g_autoptr(GPtrArray) components = NULL;
 	g_autoptr(GTimer) timer = g_timer_new ();
+	g_autofree guint16 *hits = NULL;
+	GsAppstreamSearchIndex *index;
+	guint16 n_filtered = 0;
+	guint fields = GS_APPSTREAM_SEARCH_FIELD_NONE;
 
 	g_return_val_if_fail (GS_IS_PLUGIN (plugin), FALSE);
 	g_return_val_if_fail (XB_IS_SILO (silo), FALSE);
@@ -1478,6 +2211,7 @@ gs_appstream_do_search (GsPlugin *plugin,
 			helper->match_value = queries[i].match_value;
 			helper->query = g_steal_pointer (&query);
 			g_ptr_array_add (array, helper);
+			fields |= queries[i].field;
 		} else {
 			g_debug ("ignoring: %s", error_query->message);
 		}
@@ -1491,47 +2225,32 @@ gs_appstream_do_search (GsPlugin *plugin,
 		g_propagate_error (error, g_steal_pointer (&error_local));
 		return FALSE;
 	}
+
+	/* use the index, if there is one, to skip components which cannot
+	 * possibly match all of the search terms */
+	index = g_object_get_data (G_OBJECT (silo), GS_APPSTREAM_SEARCH_INDEX_DATA_KEY);
+	if (index != NULL && index->header->n_components == components->len) {
+		hits = g_new0 (guint16, components->len);
+		for (guint i = 0; values[i] != NULL && n_filtered < G_MAXUINT16; i++) {
+			if (gs_appstream_search_index_filter (index, values[i], fields, hits, n_filtered))
+				n_filtered++;
+		}
+	}
+
 	for (guint i = 0; i < components->len; i++) {
 		XbNode *component = g_ptr_array_index (components, i);
-		guint16 match_value = gs_appstream_silo_search_component (array, component, values);
-		if (match_value != 0) {
-			g_autoptr(GsApp) app = gs_appstream_create_app (plugin, silo, component, error);
-			if (app == NULL)
-				return FALSE;
-			if (gs_app_has_quirk (app, GS_APP_QUIRK_IS_WILDCARD)) {
-				g_debug ("not returning wildcard %s",
-					 gs_app_get_unique_id (app));
-				continue;
-			}
-			g_debug ("add %s", gs_app_get_unique_id (app));
+		guint16 match_value;
 
-			/* The match value is used for prioritising results.
-			 * Drop the ID token from it as it’s the highest
-			 * numeric value but isn’t visible to the user in the
-			 * UI, which leads to confusing results ordering. */
-			gs_app_set_match_value (app, match_value & (~AS_SEARCH_TOKEN_MATCH_ID));
-			gs_app_list_add (list, app);
+		if (n_filtered > 0 && hits[i] != n_filtered)
+			continue;
 
-			if (gs_app_get_kind (app) == AS_COMPONENT_KIND_ADDON) {
-				g_autoptr(GPtrArray) extends = NULL;
-
-				/* add the parent app as a wildcard, to be refined later */
-				extends = xb_node_query (component, "extends", 0, NULL);
-				for (guint jj = 0; extends && jj < extends->len; jj++) {
-					XbNode *extend = g_ptr_array_index (extends, jj);
-					g_autoptr(GsApp) app2 = NULL;
-					const gchar *tmp;
-					app2 = gs_app_new (xb_node_get_text (extend));
-					gs_app_add_quirk (app2, GS_APP_QUIRK_IS_WILDCARD);
-					tmp = xb_node_query_attr (extend, "../..", "origin", NULL);
-					if (gs_appstream_origin_valid (tmp))
-						gs_app_set_origin_appstream (app2, tmp);
-					gs_app_list_add (list, app2);
-				}
-			}
-		}
+		match_value = gs_appstream_silo_search_component (array, component, values);
+		if (match_value != 0 &&
+		    !gs_appstream_search_add_result (plugin, silo, component, match_value, list, error))
+			return FALSE;
 	}
-	g_debug ("search took %fms", g_timer_elapsed (timer, NULL) * 1000);
+	g_debug ("search took %fms (%s index)", g_timer_elapsed (timer, NULL) * 1000,
+		 n_filtered > 0 ? "with" : "without");
 	return TRUE;
 }
 
@@ -1546,15 +2265,15 @@ gs_appstream_search (GsPlugin *plugin,
 		     GError **error)
 {
 	const Query queries[] = {
-		{ AS_SEARCH_TOKEN_MATCH_MIMETYPE,	"mimetypes/mimetype[text()~=stem(?)]" },
-		{ AS_SEARCH_TOKEN_MATCH_PKGNAME,	"pkgname[text()~=stem(?)]" },
-		{ AS_SEARCH_TOKEN_MATCH_SUMMARY,	"summary[text()~=stem(?)]" },
-		{ AS_SEARCH_TOKEN_MATCH_NAME,	"name[text()~=stem(?)]" },
-		{ AS_SEARCH_TOKEN_MATCH_KEYWORD,	"keywords/keyword[text()~=stem(?)]" },
-		{ AS_SEARCH_TOKEN_MATCH_ID,	"id[text()~=stem(?)]" },
-		{ AS_SEARCH_TOKEN_MATCH_ID,	"launchable[text()~=stem(?)]" },
-		{ AS_SEARCH_TOKEN_MATCH_ORIGIN,	"../components[@origin~=stem(?)]" },
-		{ AS_SEARCH_TOKEN_MATCH_NONE,	NULL }
+		{ AS_SEARCH_TOKEN_MATCH_MIMETYPE,	GS_APPSTREAM_SEARCH_FIELD_MIMETYPE, "mimetypes/mimetype[text()~=stem(?)]" },
+		{ AS_SEARCH_TOKEN_MATCH_PKGNAME,	GS_APPSTREAM_SEARCH_FIELD_PKGNAME, "pkgname[text()~=stem(?)]" },
+		{ AS_SEARCH_TOKEN_MATCH_SUMMARY,	GS_APPSTREAM_SEARCH_FIELD_SUMMARY, "summary[text()~=stem(?)]" },
+		{ AS_SEARCH_TOKEN_MATCH_NAME,	GS_APPSTREAM_SEARCH_FIELD_NAME, "name[text()~=stem(?)]" },
+		{ AS_SEARCH_TOKEN_MATCH_KEYWORD,	GS_APPSTREAM_SEARCH_FIELD_KEYWORD, "keywords/keyword[text()~=stem(?)]" },
+		{ AS_SEARCH_TOKEN_MATCH_ID,	GS_APPSTREAM_SEARCH_FIELD_ID, "id[text()~=stem(?)]" },
+		{ AS_SEARCH_TOKEN_MATCH_ID,	GS_APPSTREAM_SEARCH_FIELD_LAUNCHABLE, "launchable[text()~=stem(?)]" },
+		{ AS_SEARCH_TOKEN_MATCH_ORIGIN,	GS_APPSTREAM_SEARCH_FIELD_ORIGIN, "../components[@origin~=stem(?)]" },
+		{ AS_SEARCH_TOKEN_MATCH_NONE,	GS_APPSTREAM_SEARCH_FIELD_NONE, NULL }
 	};
 
 	return gs_appstream_do_search (plugin, silo, values, queries, list, cancellable, error);
@@ -1569,14 +2288,359 @@ gs_appstream_search_developer_apps (GsPlugin *plugin,
 				    GError **error)
 {
 	const Query queries[] = {
-		{ AS_SEARCH_TOKEN_MATCH_PKGNAME,	"developer_name[text()~=stem(?)]" },
-		{ AS_SEARCH_TOKEN_MATCH_SUMMARY,	"project_group[text()~=stem(?)]" },
-		{ AS_SEARCH_TOKEN_MATCH_NONE,		NULL }
+		{ AS_SEARCH_TOKEN_MATCH_PKGNAME,	GS_APPSTREAM_SEARCH_FIELD_DEVELOPER_NAME, "developer_name[text()~=stem(?)]" },
+		{ AS_SEARCH_TOKEN_MATCH_SUMMARY,	GS_APPSTREAM_SEARCH_FIELD_PROJECT_GROUP, "project_group[text()~=stem(?)]" },
+		{ AS_SEARCH_TOKEN_MATCH_NONE,		GS_APPSTREAM_SEARCH_FIELD_NONE, NULL }
 	};
 
 	return gs_appstream_do_search (plugin, silo, values, queries, list, cancellable, error);
 }
 
+/* allow more typos the more of a word has been typed */
+static guint
+gs_appstream_type_ahead_get_max_distance (gsize term_len)
+{
+	if (term_len < 4)
+		return 0;
+	if (term_len < 8)
+		return 1;
+	return 2;
+}
+
+/* Fills in @row of the edit distance table between @term and a token prefix
+ * ending in @c, from the @prev row for the prefix without @c. Returns the
+ * smallest value in @row, which no longer prefix can improve on. */
+static guint8
+gs_appstream_type_ahead_next_row (const guint8 *prev,
+				  guint8 *row,
+				  const gchar *term,
+				  gsize term_len,
+				  gchar c)
+{
+	guint8 row_min;
+
+	row[0] = prev[0] + 1;
+	row_min = row[0];
+	for (gsize j = 1; j <= term_len; j++) {
+		guint8 cost = prev[j - 1] + ((term[j - 1] == c) ? 0 : 1);
+		cost = MIN (cost, prev[j] + 1);
+		cost = MIN (cost, row[j - 1] + 1);
+		row[j] = cost;
+		row_min = MIN (row_min, cost);
+	}
+	return row_min;
+}
+
+/* Returns the smallest edit distance between @term and any prefix of @token,
+ * or %G_MAXUINT8 if that is more than @max_distance. */
+static guint8
+gs_appstream_type_ahead_distance (const gchar *term,
+				  gsize term_len,
+				  const gchar *token,
+				  guint max_distance)
+{
+	guint8 rows[2][GS_APPSTREAM_TYPE_AHEAD_MAX_TERM_LEN + 1];
+	gsize max_depth = term_len + max_distance;
+	guint8 best;
+
+	for (gsize j = 0; j <= term_len; j++)
+		rows[0][j] = j;
+	best = rows[0][term_len];
+
+	for (gsize i = 0; i < max_depth && token[i] != '\0'; i++) {
+		guint8 *row = rows[(i + 1) % 2];
+		guint8 row_min = gs_appstream_type_ahead_next_row (rows[i % 2], row, term, term_len, token[i]);
+
+		best = MIN (best, row[term_len]);
+		if (row_min > max_distance)
+			break;
+	}
+
+	return (best <= max_distance) ? best : G_MAXUINT8;
+}
+
+/* Appends every token in @index within @max_distance of starting with @term
+ * to @matches. */
+static void
+gs_appstream_type_ahead_match_all (const GsAppstreamSearchIndex *index,
+				   const gchar *term,
+				   gsize term_len,
+				   guint max_distance,
+				   GArray *matches)
+{
+	guint8 rows[GS_APPSTREAM_TYPE_AHEAD_MAX_TERM_LEN + 3][GS_APPSTREAM_TYPE_AHEAD_MAX_TERM_LEN + 1];
+	guint8 best[GS_APPSTREAM_TYPE_AHEAD_MAX_TERM_LEN + 3];
+	gsize max_depth = term_len + max_distance;
+	const gchar *prev = "";
+	gsize n_valid = 0;
+	gsize stop_depth = G_MAXSIZE;
+
+	/* exact prefixes are a contiguous range of the sorted tokens */
+	if (max_distance == 0) {
+		guint lo = 0;
+		guint hi = index->header->n_tokens;
+
+		while (lo < hi) {
+			guint mid = lo + (hi - lo) / 2;
+			if (strcmp (index->strtab + index->tokens[mid].str_offset, term) < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		for (guint32 i = lo; i < index->header->n_tokens; i++) {
+			GsAppstreamTypeAheadMatch match = { i, 0 };
+			if (strncmp (index->strtab + index->tokens[i].str_offset, term, term_len) != 0)
+				break;
+			g_array_append_val (matches, match);
+		}
+		return;
+	}
+
+	/* Otherwise walk the sorted tokens as if they were a trie: the rows
+	 * for the prefix a token shares with the one before it are reused,
+	 * and once a prefix can no longer match, every token sharing it is
+	 * settled without looking any further. rows[0..n_valid] are valid for
+	 * the first n_valid bytes of @prev. */
+	for (gsize j = 0; j <= term_len; j++)
+		rows[0][j] = j;
+	best[0] = term_len;
+
+	for (guint32 i = 0; i < index->header->n_tokens; i++) {
+		const gchar *token = index->strtab + index->tokens[i].str_offset;
+		gsize depth = 0;
+
+		while (depth < n_valid && token[depth] == prev[depth])
+			depth++;
+
+		if (depth >= stop_depth) {
+			depth = stop_depth;
+		} else {
+			stop_depth = G_MAXSIZE;
+			while (token[depth] != '\0') {
+				guint8 row_min;
+
+				if (depth == max_depth) {
+					stop_depth = depth;
+					break;
+				}
+				row_min = gs_appstream_type_ahead_next_row (rows[depth], rows[depth + 1],
+									    term, term_len, token[depth]);
+				best[depth + 1] = MIN (best[depth], rows[depth + 1][term_len]);
+				depth++;
+				if (row_min > max_distance) {
+					stop_depth = depth;
+					break;
+				}
+			}
+			prev = token;
+			n_valid = depth;
+		}
+
+		if (best[depth] <= max_distance) {
+			GsAppstreamTypeAheadMatch match = { i, best[depth] };
+			g_array_append_val (matches, match);
+		}
+	}
+}
+
+/* Returns the tokens in @index which start with @term, give or take a few
+ * edits. Extending a term can only remove matches or make them worse, so if
+ * a prefix of @term was looked up recently only its matches are checked. */
+static GArray *
+gs_appstream_type_ahead_match (GsAppstreamSearchIndex *index,
+			       const gchar *term)
+{
+	g_autoptr(GMutexLocker) locker = NULL;
+	gsize term_len = MIN (strlen (term), GS_APPSTREAM_TYPE_AHEAD_MAX_TERM_LEN);
+	g_autofree gchar *key = g_strndup (term, term_len);
+	guint max_distance = gs_appstream_type_ahead_get_max_distance (term_len);
+	GsAppstreamTypeAheadCacheEntry *base = NULL;
+	GsAppstreamTypeAheadCacheEntry *entry;
+	GArray *matches;
+	guint base_idx = 0;
+
+	locker = g_mutex_locker_new (&index->type_ahead_mutex);
+
+	for (guint i = 0; i < index->type_ahead_cache->len; i++) {
+		entry = g_ptr_array_index (index->type_ahead_cache, i);
+		if (entry->max_distance != max_distance || !g_str_has_prefix (key, entry->term))
+			continue;
+		if (base == NULL || strlen (entry->term) > strlen (base->term)) {
+			base = entry;
+			base_idx = i;
+		}
+	}
+
+	if (base != NULL && strcmp (base->term, key) == 0) {
+		g_ptr_array_add (index->type_ahead_cache,
+				 g_ptr_array_steal_index (index->type_ahead_cache, base_idx));
+		return g_array_ref (base->matches);
+	}
+
+	matches = g_array_new (FALSE, FALSE, sizeof (GsAppstreamTypeAheadMatch));
+	if (base != NULL) {
+		for (guint i = 0; i < base->matches->len; i++) {
+			const GsAppstreamTypeAheadMatch *base_match = &g_array_index (base->matches, GsAppstreamTypeAheadMatch, i);
+			const gchar *token = index->strtab + index->tokens[base_match->token].str_offset;
+			GsAppstreamTypeAheadMatch match = { base_match->token, 0 };
+
+			match.distance = gs_appstream_type_ahead_distance (key, term_len, token, max_distance);
+			if (match.distance != G_MAXUINT8)
+				g_array_append_val (matches, match);
+		}
+	} else {
+		gs_appstream_type_ahead_match_all (index, key, term_len, max_distance, matches);
+	}
+
+	entry = g_new0 (GsAppstreamTypeAheadCacheEntry, 1);
+	entry->term = g_steal_pointer (&key);
+	entry->max_distance = max_distance;
+	entry->matches = g_array_ref (matches);
+	g_ptr_array_add (index->type_ahead_cache, entry);
+	if (index->type_ahead_cache->len > GS_APPSTREAM_TYPE_AHEAD_CACHE_SIZE)
+		g_ptr_array_remove_index (index->type_ahead_cache, 0);
+
+	return matches;
+}
+
+static guint16
+gs_appstream_type_ahead_get_match_value (guint fields)
+{
+	guint16 match_value = 0;
+
+	if (fields & GS_APPSTREAM_SEARCH_FIELD_NAME)
+		match_value |= AS_SEARCH_TOKEN_MATCH_NAME;
+	if (fields & GS_APPSTREAM_SEARCH_FIELD_KEYWORD)
+		match_value |= AS_SEARCH_TOKEN_MATCH_KEYWORD;
+	if (fields & (GS_APPSTREAM_SEARCH_FIELD_ID | GS_APPSTREAM_SEARCH_FIELD_LAUNCHABLE))
+		match_value |= AS_SEARCH_TOKEN_MATCH_ID;
+	return match_value;
+}
+
+/**
+ * gs_appstream_search_type_ahead:
+ * @plugin: a #GsPlugin
+ * @silo: an #XbSilo
+ * @values: search terms, as typed so far
+ * @list: a #GsAppList to add the results to
+ * @cancellable: a #GCancellable, or %NULL
+ * @error: a #GError, or %NULL
+ *
+ * Searches the names, IDs and keywords of the components in @silo for words
+ * starting with each of @values, allowing for a typo or two in the longer
+ * ones. This only uses the index from gs_appstream_silo_ensure_search_index(),
+ * rather than running any queries, so it is fast enough to run on every
+ * keystroke; it falls back to gs_appstream_search() if there is no index.
+ *
+ * Returns: %TRUE for success
+ *
+ * Since: 43
+ **/
+gboolean
+gs_appstream_search_type_ahead (GsPlugin *plugin,
+				XbSilo *silo,
+				const gchar * const *values,
+				GsAppList *list,
+				GCancellable *cancellable,
+				GError **error)
+{
+	const guint fields = GS_APPSTREAM_SEARCH_FIELD_NAME |
+			     GS_APPSTREAM_SEARCH_FIELD_KEYWORD |
+			     GS_APPSTREAM_SEARCH_FIELD_ID |
+			     GS_APPSTREAM_SEARCH_FIELD_LAUNCHABLE;
+	GsAppstreamSearchIndex *index;
+	g_autoptr(GPtrArray) terms = g_ptr_array_new_with_free_func (g_free);
+	g_autoptr(GPtrArray) components = NULL;
+	g_autoptr(GError) error_local = NULL;
+	g_autoptr(GTimer) timer = g_timer_new ();
+	g_autofree guint16 *hits = NULL;
+	g_autofree guint16 *match_values = NULL;
+	g_autofree guint8 *term_distances = NULL;
+	g_autofree guint *distances = NULL;
+
+	g_return_val_if_fail (GS_IS_PLUGIN (plugin), FALSE);
+	g_return_val_if_fail (XB_IS_SILO (silo), FALSE);
+	g_return_val_if_fail (values != NULL, FALSE);
+	g_return_val_if_fail (GS_IS_APP_LIST (list), FALSE);
+
+	components = xb_silo_query (silo, "components/component", 0, &error_local);
+	if (components == NULL) {
+		if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+			return TRUE;
+		g_propagate_error (error, g_steal_pointer (&error_local));
+		return FALSE;
+	}
+
+	index = g_object_get_data (G_OBJECT (silo), GS_APPSTREAM_SEARCH_INDEX_DATA_KEY);
+	if (index == NULL || index->header->n_components != components->len)
+		return gs_appstream_search (plugin, silo, values, list, cancellable, error);
+
+	for (guint i = 0; values[i] != NULL; i++) {
+		g_auto(GStrv) folded = g_str_tokenize_and_fold (values[i], NULL, NULL);
+		for (guint j = 0; folded[j] != NULL; j++) {
+			if (*folded[j] != '\0')
+				g_ptr_array_add (terms, g_strdup (folded[j]));
+		}
+	}
+	if (terms->len == 0 || terms->len >= G_MAXUINT16)
+		return TRUE;
+
+	hits = g_new0 (guint16, components->len);
+	match_values = g_new0 (guint16, components->len);
+	term_distances = g_new (guint8, components->len);
+	distances = g_new0 (guint, components->len);
+
+	/* a component has to match every term, as in gs_appstream_search() */
+	for (guint16 t = 0; t < terms->len; t++) {
+		g_autoptr(GArray) matches = NULL;
+
+		if (g_cancellable_set_error_if_cancelled (cancellable, error))
+			return FALSE;
+
+		matches = gs_appstream_type_ahead_match (index, g_ptr_array_index (terms, t));
+		memset (term_distances, G_MAXUINT8, components->len);
+
+		for (guint i = 0; i < matches->len; i++) {
+			const GsAppstreamTypeAheadMatch *match = &g_array_index (matches, GsAppstreamTypeAheadMatch, i);
+			const GsAppstreamSearchIndexToken *token = &index->tokens[match->token];
+
+			for (guint32 j = 0; j < token->postings_len; j++) {
+				const GsAppstreamSearchIndexPosting *posting = &index->postings[token->postings_start + j];
+				guint32 c = posting->component;
+
+				if ((posting->fields & fields) == 0 || hits[c] != t)
+					continue;
+				term_distances[c] = MIN (term_distances[c], match->distance);
+				match_values[c] |= gs_appstream_type_ahead_get_match_value (posting->fields);
+			}
+		}
+
+		for (guint c = 0; c < components->len; c++) {
+			if (hits[c] == t && term_distances[c] != G_MAXUINT8) {
+				hits[c]++;
+				distances[c] += term_distances[c];
+			}
+		}
+	}
+
+	for (guint c = 0; c < components->len; c++) {
+		guint16 match_value;
+
+		if (hits[c] != terms->len)
+			continue;
+
+		/* rank words with typos in below those typed correctly */
+		match_value = match_values[c] & ~AS_SEARCH_TOKEN_MATCH_ID;
+		match_value = (distances[c] < 16) ? match_value >> distances[c] : 0;
+		if (!gs_appstream_search_add_result (plugin, silo, g_ptr_array_index (components, c),
+						     match_value, list, error))
+			return FALSE;
+	}
+
+	g_debug ("type-ahead search took %fms", g_timer_elapsed (timer, NULL) * 1000);
+	return TRUE;
+}
+
 gboolean
 gs_appstream_add_category_apps (GsPlugin *plugin,
 				XbSilo *silo,
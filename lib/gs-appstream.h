@@ -13,6 +13,24 @@
 
 G_BEGIN_DECLS
 
+/* The data gs_appstream_refine_app() can set on an app, to declare with
+ * gs_plugin_set_refine_flags(); this includes the app ID and kind */
+#define GS_APPSTREAM_REFINE_FLAGS_PROVIDED	(GS_PLUGIN_REFINE_FLAGS_REQUIRE_ID | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_LICENSE | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_URL | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_DESCRIPTION | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_UPDATE_DETAILS | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_ORIGIN | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_ADDONS | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_PERMISSIONS | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_SCREENSHOTS | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_CATEGORIES | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_PROJECT_GROUP | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_DEVELOPER_NAME | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_KUDOS | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_CONTENT_RATING)
+
 GsApp		*gs_appstream_create_app		(GsPlugin	*plugin,
 							 XbSilo		*silo,
 							 XbNode		*component,
@@ -35,6 +53,18 @@ gboolean	 gs_appstream_search_developer_apps	(GsPlugin	*plugin,
 							 GsAppList	*list,
 							 GCancellable	*cancellable,
 							 GError		**error);
+gboolean	 gs_appstream_search_type_ahead		(GsPlugin	*plugin,
+							 XbSilo		*silo,
+							 const gchar * const *values,
+							 GsAppList	*list,
+							 GCancellable	*cancellable,
+							 GError		**error);
+void		 gs_appstream_silo_set_siblings		(XbSilo		*silo,
+							 GPtrArray	*siblings);
+gboolean	 gs_appstream_silo_ensure_search_index	(XbSilo		*silo,
+							 const gchar	*filename,
+							 GCancellable	*cancellable,
+							 GError		**error);
 gboolean	 gs_appstream_refine_category_sizes	(XbSilo		*silo,
 							 GPtrArray	*list,
 							 GCancellable	*cancellable,
@@ -0,0 +1,539 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2023 Vanilla OS Contributors
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+/*
+ * Keeps the per-user cache directories handed out by
+ * gs_utils_get_cache_filename() within a size budget.
+ *
+ * A budget is set for a top level cache kind, such as `screenshots`, and
+ * covers all the directories below it. Each time a filename in a budgeted
+ * kind is handed out, it is noted as used; the times are kept in memory and
+ * merged into an index file in the kind’s directory by
+ * gs_cache_manager_flush(). Access times from the filesystem can’t be used,
+ * as most filesystems are mounted with `relatime` or `noatime`.
+ *
+ * gs_cache_manager_compact() then deletes the least recently used files
+ * until each kind is within its budget. Files which aren’t in the index yet
+ * count as used when they were last modified.
+ *
+ * All the functions here are thread safe.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "gs-cache-manager.h"
+#include "gs-ioprio.h"
+
+#define GS_CACHE_MANAGER_INDEX_FILENAME	".access-index"
+#define GS_CACHE_MANAGER_INDEX_TYPE	"a{sx}"
+
+static GMutex cache_manager_mutex;
+static GHashTable *budgets = NULL;  /* (element-type utf8 guint64) (owned) (nullable) */
+static GHashTable *accesses = NULL;  /* (element-type utf8 GHashTable) (owned) (nullable), of relative path to gint64 */
+static gboolean compacting = FALSE;
+
+typedef struct {
+	gchar		*path;  /* relative to the kind’s directory */
+	guint64		 size;
+	gint64		 used_secs;
+} CacheEntry;
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+	g_free (entry->path);
+	g_free (entry);
+}
+
+static gchar *
+gs_cache_manager_get_kind_dir (const gchar *kind)
+{
+	const gchar *tmp = g_getenv ("GS_SELF_TEST_CACHEDIR");
+
+	/* as in gs_utils_get_cache_filename() */
+	if (tmp != NULL)
+		return g_build_filename (tmp, kind, NULL);
+	return g_build_filename (g_get_user_cache_dir (), "gnome-software", kind, NULL);
+}
+
+static GHashTable *
+gs_cache_manager_new_times (void)
+{
+	return g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+}
+
+static void
+gs_cache_manager_add_time (GHashTable *times,
+			   const gchar *path,
+			   gint64 used_secs)
+{
+	gint64 *old = g_hash_table_lookup (times, path);
+
+	if (old != NULL)
+		*old = MAX (*old, used_secs);
+	else
+		g_hash_table_insert (times, g_strdup (path), g_memdup2 (&used_secs, sizeof (used_secs)));
+}
+
+static GHashTable *
+gs_cache_manager_load_index (const gchar *index_filename)
+{
+	g_autoptr(GHashTable) times = gs_cache_manager_new_times ();
+	g_autoptr(GMappedFile) mapped_file = NULL;
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GVariant) index = NULL;
+	GVariantIter iter;
+	const gchar *path;
+	gint64 used_secs;
+
+	mapped_file = g_mapped_file_new (index_filename, FALSE, NULL);
+	if (mapped_file == NULL)
+		return g_steal_pointer (&times);
+	bytes = g_mapped_file_get_bytes (mapped_file);
+	index = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (GS_CACHE_MANAGER_INDEX_TYPE), bytes, FALSE));
+
+	g_variant_iter_init (&iter, index);
+	while (g_variant_iter_next (&iter, "{&sx}", &path, &used_secs))
+		gs_cache_manager_add_time (times, path, used_secs);
+
+	return g_steal_pointer (&times);
+}
+
+static gboolean
+gs_cache_manager_save_index (const gchar *index_filename,
+			     GHashTable *times,
+			     GError **error)
+{
+	g_auto(GVariantBuilder) builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE (GS_CACHE_MANAGER_INDEX_TYPE));
+	g_autoptr(GVariant) index = NULL;
+	GHashTableIter iter;
+	gpointer key, value;
+
+	g_hash_table_iter_init (&iter, times);
+	while (g_hash_table_iter_next (&iter, &key, &value))
+		g_variant_builder_add (&builder, "{sx}", key, *((gint64 *) value));
+	index = g_variant_ref_sink (g_variant_builder_end (&builder));
+
+	return g_file_set_contents (index_filename,
+				    g_variant_get_data (index),
+				    (gssize) g_variant_get_size (index),
+				    error);
+}
+
+/* returns the accesses noted for @kind since they were last taken */
+static GHashTable *
+gs_cache_manager_take_accesses (const gchar *kind)
+{
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&cache_manager_mutex);
+	gpointer times = NULL;
+
+	if (accesses == NULL || !g_hash_table_steal_extended (accesses, kind, NULL, &times))
+		return NULL;
+	return times;
+}
+
+/* Merges the accesses noted for @kind into its index file, and returns the
+ * resulting access times, or %NULL if nothing has been noted. */
+static GHashTable *
+gs_cache_manager_flush_kind (const gchar *kind,
+			     gboolean force,
+			     GError **error)
+{
+	g_autoptr(GHashTable) pending = gs_cache_manager_take_accesses (kind);
+	g_autoptr(GHashTable) times = NULL;
+	g_autofree gchar *kind_dir = gs_cache_manager_get_kind_dir (kind);
+	g_autofree gchar *index_filename = g_build_filename (kind_dir, GS_CACHE_MANAGER_INDEX_FILENAME, NULL);
+	GHashTableIter iter;
+	gpointer key, value;
+
+	if (pending == NULL && !force)
+		return NULL;
+
+	times = gs_cache_manager_load_index (index_filename);
+	if (pending == NULL)
+		return g_steal_pointer (&times);
+
+	g_hash_table_iter_init (&iter, pending);
+	while (g_hash_table_iter_next (&iter, &key, &value))
+		gs_cache_manager_add_time (times, key, *((gint64 *) value));
+
+	if (g_file_test (kind_dir, G_FILE_TEST_IS_DIR) &&
+	    !gs_cache_manager_save_index (index_filename, times, error))
+		return NULL;
+
+	return g_steal_pointer (&times);
+}
+
+/* adds the regular files below @dir to @entries, without following symlinks */
+static gboolean
+gs_cache_manager_list_files (const gchar *kind_dir,
+			     const gchar *path,
+			     GHashTable *times,
+			     GPtrArray *entries,
+			     GCancellable *cancellable,
+			     GError **error)
+{
+	g_autofree gchar *dir_path = g_build_filename (kind_dir, path, NULL);
+	g_autoptr(GDir) dir = NULL;
+	const gchar *name;
+
+	dir = g_dir_open (dir_path, 0, error);
+	if (dir == NULL)
+		return FALSE;
+
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		g_autofree gchar *child_path = NULL;
+		g_autofree gchar *child_filename = NULL;
+		GStatBuf st;
+
+		if (g_cancellable_set_error_if_cancelled (cancellable, error))
+			return FALSE;
+
+		/* the index, and anything else private */
+		if (name[0] == '.')
+			continue;
+
+		child_path = (*path != '\0') ? g_build_filename (path, name, NULL) : g_strdup (name);
+		child_filename = g_build_filename (kind_dir, child_path, NULL);
+		if (g_lstat (child_filename, &st) != 0)
+			continue;
+
+		if (S_ISDIR (st.st_mode)) {
+			g_autoptr(GError) error_local = NULL;
+
+			if (!gs_cache_manager_list_files (kind_dir, child_path, times, entries,
+							  cancellable, &error_local)) {
+				if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+					g_propagate_error (error, g_steal_pointer (&error_local));
+					return FALSE;
+				}
+				g_debug ("Failed to list cache directory %s: %s",
+					 child_filename, error_local->message);
+			}
+		} else if (S_ISREG (st.st_mode)) {
+			CacheEntry *entry = g_new0 (CacheEntry, 1);
+			gint64 *used_secs = g_hash_table_lookup (times, child_path);
+
+			entry->path = g_steal_pointer (&child_path);
+			entry->size = (guint64) st.st_size;
+			entry->used_secs = MAX (st.st_mtime, (used_secs != NULL) ? *used_secs : 0);
+			g_ptr_array_add (entries, entry);
+		}
+	}
+
+	return TRUE;
+}
+
+static gint
+cache_entry_sort_cb (gconstpointer a,
+		     gconstpointer b)
+{
+	const CacheEntry *entry_a = *((const CacheEntry **) a);
+	const CacheEntry *entry_b = *((const CacheEntry **) b);
+
+	if (entry_a->used_secs < entry_b->used_secs)
+		return -1;
+	if (entry_a->used_secs > entry_b->used_secs)
+		return 1;
+	return g_strcmp0 (entry_a->path, entry_b->path);
+}
+
+static gboolean
+gs_cache_manager_compact_kind (const gchar *kind,
+			       guint64 max_size,
+			       GCancellable *cancellable,
+			       GError **error)
+{
+	g_autofree gchar *kind_dir = gs_cache_manager_get_kind_dir (kind);
+	g_autofree gchar *index_filename = g_build_filename (kind_dir, GS_CACHE_MANAGER_INDEX_FILENAME, NULL);
+	g_autoptr(GHashTable) times = NULL;
+	g_autoptr(GHashTable) new_times = gs_cache_manager_new_times ();
+	g_autoptr(GPtrArray) entries = g_ptr_array_new_with_free_func ((GDestroyNotify) cache_entry_free);
+	g_autoptr(GError) error_local = NULL;
+	guint64 total_size = 0;
+	guint n_evicted = 0;
+
+	if (!g_file_test (kind_dir, G_FILE_TEST_IS_DIR))
+		return TRUE;
+
+	times = gs_cache_manager_flush_kind (kind, TRUE, error);
+	if (times == NULL)
+		return FALSE;
+	if (!gs_cache_manager_list_files (kind_dir, "", times, entries, cancellable, error))
+		return FALSE;
+
+	for (guint i = 0; i < entries->len; i++) {
+		CacheEntry *entry = g_ptr_array_index (entries, i);
+		total_size += entry->size;
+	}
+
+	/* least recently used first */
+	g_ptr_array_sort (entries, cache_entry_sort_cb);
+	for (guint i = 0; i < entries->len; i++) {
+		CacheEntry *entry = g_ptr_array_index (entries, i);
+
+		if (max_size > 0 && total_size > max_size) {
+			g_autofree gchar *filename = g_build_filename (kind_dir, entry->path, NULL);
+
+			if (g_unlink (filename) == 0) {
+				total_size -= entry->size;
+				n_evicted++;
+				continue;
+			}
+			g_debug ("Failed to evict %s from the cache: %s", filename, g_strerror (errno));
+		}
+
+		/* forget about files which no longer exist */
+		gs_cache_manager_add_time (new_times, entry->path, entry->used_secs);
+	}
+
+	g_debug ("Cache %s is %" G_GUINT64_FORMAT " bytes after evicting %u files",
+		 kind, total_size, n_evicted);
+
+	if (!gs_cache_manager_save_index (index_filename, new_times, &error_local))
+		g_debug ("Failed to save cache index %s: %s", index_filename, error_local->message);
+
+	return TRUE;
+}
+
+static GStrv
+gs_cache_manager_get_kinds (GHashTable **budgets_out)
+{
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&cache_manager_mutex);
+	g_autoptr(GHashTable) budgets_copy = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_autoptr(GStrvBuilder) kinds = g_strv_builder_new ();
+	GHashTableIter iter;
+	gpointer key, value;
+
+	if (budgets != NULL) {
+		g_hash_table_iter_init (&iter, budgets);
+		while (g_hash_table_iter_next (&iter, &key, &value)) {
+			g_hash_table_insert (budgets_copy, g_strdup (key), g_memdup2 (value, sizeof (guint64)));
+			g_strv_builder_add (kinds, key);
+		}
+	}
+
+	if (budgets_out != NULL)
+		*budgets_out = g_steal_pointer (&budgets_copy);
+	return g_strv_builder_end (kinds);
+}
+
+/**
+ * gs_cache_manager_set_budget:
+ * @kind: a top level cache kind, e.g. "screenshots"
+ * @max_size: the most bytes to keep in the cache, or 0 for no limit
+ *
+ * Sets the size budget for @kind, and starts noting which of its files are
+ * used, so that gs_cache_manager_compact() can evict the least recently used
+ * ones.
+ *
+ * Since: 43
+ */
+void
+gs_cache_manager_set_budget (const gchar *kind,
+			     guint64 max_size)
+{
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&cache_manager_mutex);
+
+	g_return_if_fail (kind != NULL && strchr (kind, '/') == NULL);
+
+	if (budgets == NULL)
+		budgets = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_hash_table_replace (budgets, g_strdup (kind), g_memdup2 (&max_size, sizeof (max_size)));
+}
+
+/**
+ * gs_cache_manager_note_access:
+ * @kind: a cache kind, e.g. "screenshots/112x63"
+ * @filename: a filename in the cache for @kind
+ *
+ * Notes that @filename has just been used. This does nothing unless a budget
+ * has been set for the top level directory of @kind, or if @filename isn’t in
+ * the per-user cache.
+ *
+ * Since: 43
+ */
+void
+gs_cache_manager_note_access (const gchar *kind,
+			      const gchar *filename)
+{
+	g_autoptr(GMutexLocker) locker = NULL;
+	g_autofree gchar *top_kind = NULL;
+	g_autofree gchar *kind_dir = NULL;
+	const gchar *tmp;
+	GHashTable *times;
+
+	g_return_if_fail (kind != NULL);
+	g_return_if_fail (filename != NULL);
+
+	tmp = strchr (kind, '/');
+	top_kind = (tmp != NULL) ? g_strndup (kind, tmp - kind) : g_strdup (kind);
+
+	locker = g_mutex_locker_new (&cache_manager_mutex);
+	if (budgets == NULL || !g_hash_table_contains (budgets, top_kind))
+		return;
+
+	kind_dir = gs_cache_manager_get_kind_dir (top_kind);
+	if (!g_str_has_prefix (filename, kind_dir) || filename[strlen (kind_dir)] != G_DIR_SEPARATOR)
+		return;
+
+	if (accesses == NULL)
+		accesses = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_hash_table_unref);
+	times = g_hash_table_lookup (accesses, top_kind);
+	if (times == NULL) {
+		times = gs_cache_manager_new_times ();
+		g_hash_table_insert (accesses, g_strdup (top_kind), times);
+	}
+	gs_cache_manager_add_time (times, filename + strlen (kind_dir) + 1, g_get_real_time () / G_USEC_PER_SEC);
+}
+
+/**
+ * gs_cache_manager_flush:
+ * @error: a #GError, or %NULL
+ *
+ * Saves the accesses noted since the last flush to the index files, without
+ * evicting anything.
+ *
+ * Returns: %TRUE for success
+ *
+ * Since: 43
+ */
+gboolean
+gs_cache_manager_flush (GError **error)
+{
+	g_auto(GStrv) kinds = gs_cache_manager_get_kinds (NULL);
+
+	for (guint i = 0; kinds[i] != NULL; i++) {
+		g_autoptr(GHashTable) times = NULL;
+		g_autoptr(GError) error_local = NULL;
+
+		times = gs_cache_manager_flush_kind (kinds[i], FALSE, &error_local);
+		if (times == NULL && error_local != NULL) {
+			g_propagate_error (error, g_steal_pointer (&error_local));
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/**
+ * gs_cache_manager_compact:
+ * @cancellable: a #GCancellable, or %NULL
+ * @error: a #GError, or %NULL
+ *
+ * Deletes the least recently used files from each cache kind with a budget,
+ * until it is within its budget.
+ *
+ * This does blocking I/O; see gs_cache_manager_compact_async().
+ *
+ * Returns: %TRUE for success
+ *
+ * Since: 43
+ */
+gboolean
+gs_cache_manager_compact (GCancellable *cancellable,
+			  GError **error)
+{
+	g_autoptr(GHashTable) budgets_copy = NULL;
+	g_auto(GStrv) kinds = gs_cache_manager_get_kinds (&budgets_copy);
+
+	for (guint i = 0; kinds[i] != NULL; i++) {
+		guint64 *max_size = g_hash_table_lookup (budgets_copy, kinds[i]);
+		if (!gs_cache_manager_compact_kind (kinds[i], *max_size, cancellable, error))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void
+gs_cache_manager_compact_thread_cb (GTask *task,
+				    gpointer source_object,
+				    gpointer task_data,
+				    GCancellable *cancellable)
+{
+	g_autoptr(GError) error_local = NULL;
+	gboolean ret;
+
+	/* keep out of the way of anything interactive; the thread is shared
+	 * with other tasks, so its priority is put back afterwards */
+	gs_ioprio_set (G_PRIORITY_LOW);
+	ret = gs_cache_manager_compact (cancellable, &error_local);
+	gs_ioprio_set (G_PRIORITY_DEFAULT);
+
+	g_mutex_lock (&cache_manager_mutex);
+	compacting = FALSE;
+	g_mutex_unlock (&cache_manager_mutex);
+
+	if (ret)
+		g_task_return_boolean (task, TRUE);
+	else
+		g_task_return_error (task, g_steal_pointer (&error_local));
+}
+
+/**
+ * gs_cache_manager_compact_async:
+ * @cancellable: a #GCancellable, or %NULL
+ * @callback: function to call when the compaction is done
+ * @user_data: data to pass to @callback
+ *
+ * Runs gs_cache_manager_compact() in a thread with an idle I/O priority. If
+ * a compaction is already running, this completes straight away.
+ *
+ * Since: 43
+ */
+void
+gs_cache_manager_compact_async (GCancellable *cancellable,
+				GAsyncReadyCallback callback,
+				gpointer user_data)
+{
+	g_autoptr(GTask) task = NULL;
+	gboolean already_compacting;
+
+	task = g_task_new (NULL, cancellable, callback, user_data);
+	g_task_set_source_tag (task, gs_cache_manager_compact_async);
+	g_task_set_priority (task, G_PRIORITY_LOW);
+
+	g_mutex_lock (&cache_manager_mutex);
+	already_compacting = compacting;
+	compacting = TRUE;
+	g_mutex_unlock (&cache_manager_mutex);
+
+	if (already_compacting) {
+		g_task_return_boolean (task, TRUE);
+		return;
+	}
+
+	g_task_run_in_thread (task, gs_cache_manager_compact_thread_cb);
+}
+
+/**
+ * gs_cache_manager_compact_finish:
+ * @result: a #GAsyncResult
+ * @error: a #GError, or %NULL
+ *
+ * Finishes a compaction started with gs_cache_manager_compact_async().
+ *
+ * Returns: %TRUE for success
+ *
+ * Since: 43
+ */
+gboolean
+gs_cache_manager_compact_finish (GAsyncResult *result,
+				 GError **error)
+{
+	g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+	g_return_val_if_fail (g_async_result_is_tagged (result, gs_cache_manager_compact_async), FALSE);
+
+	return g_task_propagate_boolean (G_TASK (result), error);
+}
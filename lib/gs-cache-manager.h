@@ -0,0 +1,28 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2023 Vanilla OS Contributors
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+void		 gs_cache_manager_set_budget		(const gchar		*kind,
+							 guint64		 max_size);
+void		 gs_cache_manager_note_access		(const gchar		*kind,
+							 const gchar		*filename);
+gboolean	 gs_cache_manager_flush			(GError			**error);
+gboolean	 gs_cache_manager_compact		(GCancellable		*cancellable,
+							 GError			**error);
+void		 gs_cache_manager_compact_async		(GCancellable		*cancellable,
+							 GAsyncReadyCallback	 callback,
+							 gpointer		 user_data);
+gboolean	 gs_cache_manager_compact_finish	(GAsyncResult		*result,
+							 GError			**error);
+
+G_END_DECLS
@@ -11,12 +11,61 @@
 
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
+#include <json-glib/json-glib.h>
 #include <locale.h>
+#ifdef HAVE_MALLINFO2
+#include <malloc.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
 
 #include "gnome-software-private.h"
 
 #include "gs-debug.h"
 
+/* Everything except what needs ODRS, so results don’t depend on the network */
+#define GS_CMD_BENCHMARK_FULL_REFINE_FLAGS	(GS_PLUGIN_REFINE_FLAGS_MASK & \
+						 ~(GS_PLUGIN_REFINE_FLAGS_DISABLE_FILTERING | \
+						   GS_PLUGIN_REFINE_FLAGS_ALLOW_PACKAGES | \
+						   GS_PLUGIN_REFINE_FLAGS_REQUIRE_RATING | \
+						   GS_PLUGIN_REFINE_FLAGS_REQUIRE_REVIEWS | \
+						   GS_PLUGIN_REFINE_FLAGS_REQUIRE_REVIEW_RATINGS))
+
+/* Keep in sync with GS_DETAILS_PAGE_REFINE_FLAGS in src/gs-details-page.c */
+#define GS_CMD_BENCHMARK_DETAILS_REFINE_FLAGS	(GS_PLUGIN_REFINE_FLAGS_REQUIRE_ADDONS | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_CATEGORIES | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_CONTENT_RATING | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_DESCRIPTION | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_DEVELOPER_NAME | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_HISTORY | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_KUDOS | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_LICENSE | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_ORIGIN_HOSTNAME | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_PERMISSIONS | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_PROJECT_GROUP | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_PROVENANCE | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_RELATED | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_RUNTIME | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_SCREENSHOTS | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_SETUP_ACTION | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_SIZE | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_SIZE_DATA | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_URL | \
+						 GS_PLUGIN_REFINE_FLAGS_REQUIRE_VERSION)
+
+#ifdef HAVE_MALLINFO2
+/* The number of bytes the heap has in use, for `gs-cmd benchmark`. */
+static gsize
+gs_cmd_get_heap_in_use (void)
+{
+	struct mallinfo2 info = mallinfo2 ();
+
+	/* allocated in the arenas, plus allocated directly with mmap() */
+	return info.uordblks + info.hblkhd;
+}
+#endif  /* HAVE_MALLINFO2 */
+
 typedef struct {
 	GsPluginLoader	*plugin_loader;
 	guint64		 refine_flags;
@@ -303,6 +352,354 @@ app_sort_kind_cb (GsApp *app1, GsApp *app2, gpointer user_data)
 	return 0;
 }
 
+static void
+gs_cmd_show_worker_metrics (void)
+{
+	g_autoptr(GPtrArray) workers = gs_worker_thread_dup_all ();
+
+	g_print ("%-28s %6s %7s %9s %8s %10s %10s %10s %10s\n",
+		 "worker", "queued", "running", "completed", "promoted",
+		 "wait p50", "wait p99", "run p50", "run p99");
+	for (guint i = 0; i < workers->len; i++) {
+		GsWorkerThread *worker = g_ptr_array_index (workers, i);
+		GsWorkerThreadMetrics metrics;
+
+		gs_worker_thread_get_metrics (worker, &metrics);
+		g_print ("%-28s %6u %7u %9" G_GUINT64_FORMAT " %8" G_GUINT64_FORMAT
+			 " %8.1fms %8.1fms %8.1fms %8.1fms\n",
+			 gs_worker_thread_get_name (worker),
+			 metrics.n_queued, metrics.n_running,
+			 metrics.n_completed, metrics.n_promoted,
+			 (gdouble) metrics.wait_p50_usec / 1000,
+			 (gdouble) metrics.wait_p99_usec / 1000,
+			 (gdouble) metrics.run_p50_usec / 1000,
+			 (gdouble) metrics.run_p99_usec / 1000);
+	}
+}
+
+typedef struct {
+	GsCmdSelf	*self;  /* (unowned) */
+	const gchar	*search;
+	GsAppList	*search_results;  /* (owned) (nullable) */
+	GsAppList	*installed;  /* (owned) (nullable) */
+
+	/* from gs_cmd_benchmark_span_cb() */
+	GMutex		 plugin_times_mutex;
+	GHashTable	*plugin_times;  /* (mutex plugin_times_mutex) (owned) (element-type utf8 gint64) */
+	gint64		 since_usec;
+} GsCmdBenchmark;
+
+typedef gboolean (*GsCmdBenchmarkFunc) (GsCmdBenchmark  *bench,
+					GError         **error);
+
+static gboolean
+gs_cmd_benchmark_search (GsCmdBenchmark *bench, GError **error)
+{
+	g_autoptr(GsAppQuery) query = NULL;
+	g_autoptr(GsPluginJob) plugin_job = NULL;
+	const gchar *keywords[2] = { bench->search, NULL };
+	GsAppList *list;
+
+	query = gs_app_query_new ("keywords", keywords,
+				  "refine-flags", bench->self->refine_flags | GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON,
+				  "max-results", bench->self->max_results,
+				  "dedupe-flags", GS_PLUGIN_JOB_DEDUPE_FLAGS_DEFAULT,
+				  "sort-func", gs_utils_app_sort_match_value,
+				  NULL);
+	plugin_job = gs_plugin_job_list_apps_new (query, GS_PLUGIN_LIST_APPS_FLAGS_NONE);
+	list = gs_plugin_loader_job_process (bench->self->plugin_loader, plugin_job, NULL, error);
+	if (list == NULL)
+		return FALSE;
+
+	g_clear_object (&bench->search_results);
+	bench->search_results = list;
+	return TRUE;
+}
+
+static gboolean
+gs_cmd_benchmark_categories (GsCmdBenchmark *bench, GError **error)
+{
+	g_autoptr(GsPluginJob) plugin_job = NULL;
+
+	plugin_job = gs_plugin_job_list_categories_new (GS_PLUGIN_REFINE_CATEGORIES_FLAGS_SIZE);
+	return gs_plugin_loader_job_action (bench->self->plugin_loader, plugin_job, NULL, error);
+}
+
+static gboolean
+gs_cmd_benchmark_prepare_installed (GsCmdBenchmark *bench, GError **error)
+{
+	g_autoptr(GsAppQuery) query = NULL;
+	g_autoptr(GsPluginJob) plugin_job = NULL;
+
+	if (bench->installed != NULL)
+		return TRUE;
+
+	query = gs_app_query_new ("is-installed", GS_APP_QUERY_TRISTATE_TRUE,
+				  "dedupe-flags", GS_PLUGIN_JOB_DEDUPE_FLAGS_DEFAULT,
+				  NULL);
+	plugin_job = gs_plugin_job_list_apps_new (query, GS_PLUGIN_LIST_APPS_FLAGS_NONE);
+	bench->installed = gs_plugin_loader_job_process (bench->self->plugin_loader, plugin_job, NULL, error);
+	return (bench->installed != NULL);
+}
+
+static gboolean
+gs_cmd_benchmark_refine_full (GsCmdBenchmark *bench, GError **error)
+{
+	g_autoptr(GsPluginJob) plugin_job = NULL;
+
+	plugin_job = gs_plugin_job_refine_new (bench->installed, GS_CMD_BENCHMARK_FULL_REFINE_FLAGS);
+	return gs_plugin_loader_job_action (bench->self->plugin_loader, plugin_job, NULL, error);
+}
+
+static gboolean
+gs_cmd_benchmark_updates (GsCmdBenchmark *bench, GError **error)
+{
+	g_autoptr(GsPluginJob) plugin_job = NULL;
+	g_autoptr(GsAppList) list = NULL;
+
+	plugin_job = gs_plugin_job_newv (GS_PLUGIN_ACTION_GET_UPDATES,
+					 "refine-flags", bench->self->refine_flags,
+					 NULL);
+	list = gs_plugin_loader_job_process (bench->self->plugin_loader, plugin_job, NULL, error);
+	return (list != NULL);
+}
+
+static gboolean
+gs_cmd_benchmark_prepare_details (GsCmdBenchmark *bench, GError **error)
+{
+	if (bench->search_results == NULL || gs_app_list_length (bench->search_results) == 0) {
+		g_set_error (error,
+			     GS_PLUGIN_ERROR,
+			     GS_PLUGIN_ERROR_NOT_SUPPORTED,
+			     "no search results for '%s' to show details for",
+			     bench->search);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static gboolean
+gs_cmd_benchmark_details_refine (GsCmdBenchmark *bench, GError **error)
+{
+	g_autoptr(GsPluginJob) plugin_job = NULL;
+	GsApp *app = gs_app_list_index (bench->search_results, 0);
+
+	plugin_job = gs_plugin_job_refine_new_for_app (app, GS_CMD_BENCHMARK_DETAILS_REFINE_FLAGS);
+	return gs_plugin_loader_job_action (bench->self->plugin_loader, plugin_job, NULL, error);
+}
+
+static const struct {
+	const gchar		*name;
+	gboolean		 once;  /* only meaningful the first time */
+	GsCmdBenchmarkFunc	 prepare;  /* (nullable); not timed */
+	GsCmdBenchmarkFunc	 run;
+} benchmark_scenarios[] = {
+	{ "search-cold", TRUE, NULL, gs_cmd_benchmark_search },
+	{ "search-warm", FALSE, NULL, gs_cmd_benchmark_search },
+	{ "categories", FALSE, NULL, gs_cmd_benchmark_categories },
+	{ "refine-full", FALSE, gs_cmd_benchmark_prepare_installed, gs_cmd_benchmark_refine_full },
+	{ "updates", FALSE, NULL, gs_cmd_benchmark_updates },
+	{ "details-refine", FALSE, gs_cmd_benchmark_prepare_details, gs_cmd_benchmark_details_refine },
+};
+
+static int
+compare_durations (gconstpointer a,
+                   gconstpointer b)
+{
+	gint64 duration_a = *((const gint64 *) a);
+	gint64 duration_b = *((const gint64 *) b);
+
+	return (duration_a > duration_b) - (duration_a < duration_b);
+}
+
+/* Add up the time each plugin spends on the plugin jobs which start after
+ * @since_usec, as each traced span finishes. Spans nested inside these aren’t
+ * counted again. This is called in whichever thread finishes the span. */
+static void
+gs_cmd_benchmark_span_cb (const gchar *name,
+			  gint64       begin_usec,
+			  gint64       duration_usec,
+			  gpointer     user_data)
+{
+	GsCmdBenchmark *bench = user_data;
+	const gchar *prefixes[] = { "vfunc:", "refine:", "list-apps:", "list-categories:" };
+	g_autoptr(GMutexLocker) locker = NULL;
+	g_autofree gchar *plugin_name = NULL;
+	gint64 *total_usec;
+
+	if (begin_usec < bench->since_usec)
+		return;
+
+	for (gsize j = 0; j < G_N_ELEMENTS (prefixes) && plugin_name == NULL; j++) {
+		if (g_str_has_prefix (name, prefixes[j])) {
+			const gchar *tmp = name + strlen (prefixes[j]);
+			plugin_name = g_strndup (tmp, strcspn (tmp, ":"));
+		}
+	}
+	if (plugin_name == NULL)
+		return;
+
+	locker = g_mutex_locker_new (&bench->plugin_times_mutex);
+	total_usec = g_hash_table_lookup (bench->plugin_times, plugin_name);
+	if (total_usec == NULL) {
+		total_usec = g_new0 (gint64, 1);
+		g_hash_table_insert (bench->plugin_times, g_steal_pointer (&plugin_name), total_usec);
+	}
+	*total_usec += duration_usec;
+}
+
+static gboolean
+gs_cmd_benchmark_scenario (GsCmdBenchmark *bench,
+			   guint           idx,
+			   guint           repeat,
+			   JsonBuilder    *builder)
+{
+	g_autofree gint64 *durations = NULL;
+	g_autoptr(GHashTable) plugin_times = NULL;
+	g_autoptr(GError) error = NULL;
+	GHashTableIter iter;
+	gpointer key, value;
+	gint64 total_usec = 0;
+	guint n_iterations = benchmark_scenarios[idx].once ? 1 : repeat;
+	guint n_done = 0;
+#ifdef HAVE_MALLINFO2
+	gsize heap_in_use_start;
+#endif
+
+	json_builder_begin_object (builder);
+	json_builder_set_member_name (builder, "name");
+	json_builder_add_string_value (builder, benchmark_scenarios[idx].name);
+
+	if (benchmark_scenarios[idx].prepare != NULL &&
+	    !benchmark_scenarios[idx].prepare (bench, &error)) {
+		json_builder_set_member_name (builder, "error");
+		json_builder_add_string_value (builder, error->message);
+		json_builder_end_object (builder);
+		return FALSE;
+	}
+
+	durations = g_new0 (gint64, n_iterations);
+	bench->plugin_times = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	bench->since_usec = g_get_monotonic_time ();
+	gs_trace_set_span_func (gs_cmd_benchmark_span_cb, bench);
+#ifdef HAVE_MALLINFO2
+	heap_in_use_start = gs_cmd_get_heap_in_use ();
+#endif
+
+	for (; n_done < n_iterations; n_done++) {
+		gint64 iteration_start_usec = g_get_monotonic_time ();
+
+		if (!benchmark_scenarios[idx].run (bench, &error))
+			break;
+
+		durations[n_done] = g_get_monotonic_time () - iteration_start_usec;
+		total_usec += durations[n_done];
+	}
+
+	/* no more spans are counted once this returns */
+	gs_trace_set_span_func (NULL, NULL);
+	g_mutex_lock (&bench->plugin_times_mutex);
+	plugin_times = g_steal_pointer (&bench->plugin_times);
+	g_mutex_unlock (&bench->plugin_times_mutex);
+
+	if (n_done < n_iterations) {
+		json_builder_set_member_name (builder, "error");
+		json_builder_add_string_value (builder, error->message);
+		json_builder_end_object (builder);
+		return FALSE;
+	}
+
+	qsort (durations, n_iterations, sizeof (*durations), compare_durations);
+
+	json_builder_set_member_name (builder, "iterations");
+	json_builder_add_int_value (builder, n_iterations);
+	json_builder_set_member_name (builder, "wall-time-ms");
+	json_builder_add_double_value (builder, (gdouble) total_usec / 1000);
+	json_builder_set_member_name (builder, "p50-ms");
+	json_builder_add_double_value (builder, (gdouble) durations[(n_iterations - 1) * 50 / 100] / 1000);
+	json_builder_set_member_name (builder, "p95-ms");
+	json_builder_add_double_value (builder, (gdouble) durations[(n_iterations - 1) * 95 / 100] / 1000);
+	json_builder_set_member_name (builder, "p99-ms");
+	json_builder_add_double_value (builder, (gdouble) durations[(n_iterations - 1) * 99 / 100] / 1000);
+
+#ifdef HAVE_MALLINFO2
+	/* per iteration; this is how much the heap grew, so anything freed
+	 * again isn’t counted, and it includes anything done by other
+	 * threads meanwhile */
+	json_builder_set_member_name (builder, "heap-growth-bytes");
+	json_builder_add_int_value (builder, ((gint64) gs_cmd_get_heap_in_use () - (gint64) heap_in_use_start) / n_iterations);
+#endif
+
+	/* per iteration, and plugins run in parallel, so this can add up to
+	 * more than the wall time */
+	json_builder_set_member_name (builder, "plugins-ms");
+	json_builder_begin_object (builder);
+	g_hash_table_iter_init (&iter, plugin_times);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		json_builder_set_member_name (builder, key);
+		json_builder_add_double_value (builder, (gdouble) *((gint64 *) value) / 1000 / n_iterations);
+	}
+	json_builder_end_object (builder);
+
+	json_builder_end_object (builder);
+
+	return TRUE;
+}
+
+/* Print a JSON report of how long each scenario takes, suitable for
+ * comparing between builds. */
+static gboolean
+gs_cmd_benchmark (GsCmdSelf    *self,
+		  const gchar  *search,
+		  guint         repeat,
+		  GError      **error)
+{
+	g_autoptr(JsonBuilder) builder = json_builder_new ();
+	g_autoptr(JsonGenerator) generator = json_generator_new ();
+	g_autoptr(JsonNode) root = NULL;
+	g_autofree gchar *json = NULL;
+	GsCmdBenchmark bench = { self, search, NULL, NULL, };
+	guint n_failed = 0;
+
+	g_mutex_init (&bench.plugin_times_mutex);
+
+	json_builder_begin_object (builder);
+	json_builder_set_member_name (builder, "search");
+	json_builder_add_string_value (builder, search);
+	json_builder_set_member_name (builder, "repeat");
+	json_builder_add_int_value (builder, repeat);
+	json_builder_set_member_name (builder, "scenarios");
+	json_builder_begin_array (builder);
+
+	for (gsize i = 0; i < G_N_ELEMENTS (benchmark_scenarios); i++) {
+		if (!gs_cmd_benchmark_scenario (&bench, i, repeat, builder))
+			n_failed++;
+	}
+
+	json_builder_end_array (builder);
+	json_builder_end_object (builder);
+
+	g_clear_object (&bench.search_results);
+	g_clear_object (&bench.installed);
+	g_mutex_clear (&bench.plugin_times_mutex);
+
+	root = json_builder_get_root (builder);
+	json_generator_set_root (generator, root);
+	json_generator_set_pretty (generator, TRUE);
+	json = json_generator_to_data (generator, NULL);
+	g_print ("%s\n", json);
+
+	if (n_failed > 0) {
+		g_set_error (error,
+			     GS_PLUGIN_ERROR,
+			     GS_PLUGIN_ERROR_FAILED,
+			     "%u benchmark scenarios failed", n_failed);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 int
 main (int argc, char **argv)
 {
@@ -310,10 +707,11 @@ main (int argc, char **argv)
 	gboolean prefer_local = FALSE;
 	gboolean ret;
 	gboolean show_results = FALSE;
+	gboolean show_worker_metrics = FALSE;
 	gboolean verbose = FALSE;
 	gint i;
 	guint64 cache_age_secs = 0;
-	gint repeat = 1;
+	gint repeat = -1;
 	g_auto(GStrv) plugin_blocklist = NULL;
 	g_auto(GStrv) plugin_allowlist = NULL;
 	g_autoptr(GError) error = NULL;
@@ -323,12 +721,15 @@ main (int argc, char **argv)
 	g_autofree gchar *plugin_blocklist_str = NULL;
 	g_autofree gchar *plugin_allowlist_str = NULL;
 	g_autofree gchar *refine_flags_str = NULL;
+	g_autofree gchar *fixture = NULL;
 	g_autoptr(GsApp) app = NULL;
 	g_autoptr(GFile) file = NULL;
 	g_autoptr(GsCmdSelf) self = g_new0 (GsCmdSelf, 1);
 	const GOptionEntry options[] = {
 		{ "show-results", '\0', 0, G_OPTION_ARG_NONE, &show_results,
 		  "Show the results for the action", NULL },
+		{ "show-worker-metrics", '\0', 0, G_OPTION_ARG_NONE, &show_worker_metrics,
+		  "Show how busy each plugin worker thread was", NULL },
 		{ "refine-flags", '\0', 0, G_OPTION_ARG_STRING, &refine_flags_str,
 		  "Set any refine flags required for the action", NULL },
 		{ "repeat", '\0', 0, G_OPTION_ARG_INT, &repeat,
@@ -343,6 +744,8 @@ main (int argc, char **argv)
 		  "Do not load specific plugins", NULL },
 		{ "plugin-allowlist", '\0', 0, G_OPTION_ARG_STRING, &plugin_allowlist_str,
 		  "Only load specific plugins", NULL },
+		{ "fixture", '\0', 0, G_OPTION_ARG_FILENAME, &fixture,
+		  "Load AppStream data only from this XML file or directory", NULL },
 		{ "verbose", '\0', 0, G_OPTION_ARG_NONE, &verbose,
 		  "Show verbose debugging information", NULL },
 		{ "interactive", 'i', 0, G_OPTION_ARG_NONE, &self->interactive,
@@ -368,10 +771,28 @@ main (int argc, char **argv)
 	}
 	gs_debug_set_verbose (debug, verbose);
 
+	/* benchmarks need several samples by default */
+	if (argc >= 2 && g_strcmp0 (argv[1], "benchmark") == 0 && repeat < 0)
+		repeat = 10;
+	else if (repeat < 0)
+		repeat = 1;
+
 	/* prefer local sources */
 	if (prefer_local)
 		g_setenv ("GNOME_SOFTWARE_PREFER_LOCAL", "true", TRUE);
 
+	/* load AppStream data from a fixture rather than from the system, so
+	 * benchmark results can be compared between machines */
+	if (fixture != NULL) {
+		g_autofree gchar *fixture_path = g_canonicalize_filename (fixture, NULL);
+
+		if (!g_file_test (fixture_path, G_FILE_TEST_EXISTS)) {
+			g_print ("Fixture not found: %s\n", fixture_path);
+			return EXIT_FAILURE;
+		}
+		g_setenv ("GS_APPSTREAM_FIXTURE", fixture_path, TRUE);
+	}
+
 	/* parse any refine flags */
 	self->refine_flags = gs_cmd_parse_refine_flags (refine_flags_str, &error);
 	if (self->refine_flags == G_MAXUINT64) {
@@ -813,6 +1234,8 @@ main (int argc, char **argv)
 		plugin_job = gs_plugin_job_refresh_metadata_new (cache_age_secs, refresh_metadata_flags);
 		ret = gs_plugin_loader_job_action (self->plugin_loader, plugin_job,
 						    NULL, &error);
+	} else if ((argc == 2 || argc == 3) && g_strcmp0 (argv[1], "benchmark") == 0) {
+		ret = gs_cmd_benchmark (self, (argc == 3) ? argv[2] : "gnome", MAX (repeat, 1), &error);
 	} else if (argc >= 1 && g_strcmp0 (argv[1], "user-hash") == 0) {
 		g_autofree gchar *user_hash = gs_utils_get_user_hash (&error);
 		if (user_hash == NULL) {
@@ -830,7 +1253,7 @@ main (int argc, char **argv)
 				     "'updates', 'popular', 'get-categories', "
 				     "'get-category-apps', 'get-alternates', 'filename-to-app', "
 				     "'action install', 'action remove', "
-				     "'sources', 'refresh', 'launch' or 'search'");
+				     "'sources', 'refresh', 'launch', 'benchmark' or 'search'");
 	}
 	if (!ret) {
 		g_print ("Failed: %s\n", error->message);
@@ -843,5 +1266,7 @@ main (int argc, char **argv)
 		if (categories != NULL)
 			gs_cmd_show_results_categories (categories);
 	}
+	if (show_worker_metrics)
+		gs_cmd_show_worker_metrics ();
 	return EXIT_SUCCESS;
 }
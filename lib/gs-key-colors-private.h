@@ -0,0 +1,31 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2021 Endless OS Foundation LLC
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+/**
+ * GsKeyColorsKernel:
+ * @GS_KEY_COLORS_KERNEL_AUTO:		Use the fastest kernel the CPU supports
+ * @GS_KEY_COLORS_KERNEL_SCALAR:	Use the plain C kernel
+ *
+ * The implementation used to assign pixels to clusters.
+ **/
+typedef enum {
+	GS_KEY_COLORS_KERNEL_AUTO,
+	GS_KEY_COLORS_KERNEL_SCALAR,
+} GsKeyColorsKernel;
+
+GArray	*gs_calculate_key_colors_with_kernel	(GdkPixbuf		*pixbuf,
+						 GsKeyColorsKernel	 kernel);
+
+G_END_DECLS
@@ -23,6 +23,10 @@
  *
  * Use gs_calculate_key_colors() to calculate the key colors from an app’s icon.
  *
+ * As calculating the key colors takes a while, they can be saved to a cache
+ * file named after gs_key_colors_get_cache_key() with gs_key_colors_save(),
+ * and loaded again with gs_key_colors_load().
+ *
  * Since: 40
  */
 
@@ -31,8 +35,22 @@
 #include <glib.h>
 #include <gdk/gdk.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define HAVE_AVX2_KERNEL 1
+#endif
 
 #include "gs-key-colors.h"
+#include "gs-key-colors-private.h"
+
+/* Bump this whenever the algorithm changes enough that cached key colors
+ * should be recalculated. */
+#define KEY_COLORS_CACHE_VERSION 1
 
 /* Hard-code the number of clusters to split the icon color space into. This
  * gives the maximum number of key colors returned for an icon. This number has
@@ -119,6 +137,193 @@ nearest_cluster (const Pixel8 *pixel,
 	return nearest_cluster;
 }
 
+/* Assign each opaque pixel in [@p, @p_end) to its nearest cluster, one pixel at
+ * a time. Returns the number of pixels whose assignment changed. */
+static guint
+assign_clusters_scalar (ClusterPixel8       *p,
+                        const ClusterPixel8 *p_end,
+                        const Pixel8        *cluster_centres,
+                        gsize                n_cluster_centres)
+{
+	guint n_assignments_changed = 0;
+
+	for (; p < p_end; p++) {
+		gsize new_cluster;
+
+		if (p->cluster >= n_cluster_centres)
+			continue;
+
+		new_cluster = nearest_cluster (&p->color, cluster_centres, n_cluster_centres);
+		if (new_cluster != p->cluster)
+			n_assignments_changed++;
+		p->cluster = new_cluster;
+	}
+
+	return n_assignments_changed;
+}
+
+/* Write back the clusters chosen by one of the vectorised kernels, leaving the
+ * transparent pixels (which have an out of range cluster) alone. */
+static inline guint
+store_clusters (ClusterPixel8 *p,
+                const gint32  *new_clusters,
+                gsize          n_pixels,
+                gsize          n_cluster_centres)
+{
+	guint n_assignments_changed = 0;
+
+	for (gsize i = 0; i < n_pixels; i++) {
+		if (p[i].cluster >= n_cluster_centres)
+			continue;
+		if ((gint32) p[i].cluster != new_clusters[i])
+			n_assignments_changed++;
+		p[i].cluster = new_clusters[i];
+	}
+
+	return n_assignments_changed;
+}
+
+#if defined(__SSE2__)
+/* Squared distances from the four pixels in @px to @centre, which is the
+ * centre color widened to 16 bits and repeated for two pixels. The cluster
+ * byte of each pixel must already have been masked out of @px. */
+static inline __m128i
+color_distances_sse2 (__m128i px,
+                      __m128i centre)
+{
+	const __m128i zero = _mm_setzero_si128 ();
+	__m128i lo = _mm_sub_epi16 (_mm_unpacklo_epi8 (px, zero), centre);
+	__m128i hi = _mm_sub_epi16 (_mm_unpackhi_epi8 (px, zero), centre);
+	/* (r² + g², b² + 0²) for each pixel */
+	__m128 sq_lo = _mm_castsi128_ps (_mm_madd_epi16 (lo, lo));
+	__m128 sq_hi = _mm_castsi128_ps (_mm_madd_epi16 (hi, hi));
+	__m128i even = _mm_castps_si128 (_mm_shuffle_ps (sq_lo, sq_hi, _MM_SHUFFLE (2, 0, 2, 0)));
+	__m128i odd = _mm_castps_si128 (_mm_shuffle_ps (sq_lo, sq_hi, _MM_SHUFFLE (3, 1, 3, 1)));
+
+	return _mm_add_epi32 (even, odd);
+}
+
+/* Four pixels at a time. Ties go to the lowest cluster index, exactly as in
+ * nearest_cluster(), so the results are identical to the scalar version. */
+static guint
+assign_clusters_sse2 (ClusterPixel8       *p,
+                      const ClusterPixel8 *p_end,
+                      const Pixel8        *cluster_centres,
+                      gsize                n_cluster_centres)
+{
+	const __m128i color_mask = _mm_set1_epi32 (0x00ffffff);
+	__m128i centres[n_cluster_centres];
+	guint n_assignments_changed = 0;
+
+	for (gsize i = 0; i < n_cluster_centres; i++)
+		centres[i] = _mm_setr_epi16 (cluster_centres[i].red, cluster_centres[i].green, cluster_centres[i].blue, 0,
+					     cluster_centres[i].red, cluster_centres[i].green, cluster_centres[i].blue, 0);
+
+	for (; p + 4 <= p_end; p += 4) {
+		__m128i px = _mm_and_si128 (_mm_loadu_si128 ((const __m128i *) p), color_mask);
+		__m128i best_distance = color_distances_sse2 (px, centres[0]);
+		__m128i best_cluster = _mm_setzero_si128 ();
+		gint32 new_clusters[4];
+
+		for (gsize i = 1; i < n_cluster_centres; i++) {
+			__m128i distance = color_distances_sse2 (px, centres[i]);
+			__m128i closer = _mm_cmplt_epi32 (distance, best_distance);
+
+			best_distance = _mm_or_si128 (_mm_and_si128 (closer, distance),
+						      _mm_andnot_si128 (closer, best_distance));
+			best_cluster = _mm_or_si128 (_mm_and_si128 (closer, _mm_set1_epi32 (i)),
+						     _mm_andnot_si128 (closer, best_cluster));
+		}
+
+		_mm_storeu_si128 ((__m128i *) new_clusters, best_cluster);
+		n_assignments_changed += store_clusters (p, new_clusters, 4, n_cluster_centres);
+	}
+
+	return n_assignments_changed + assign_clusters_scalar (p, p_end, cluster_centres, n_cluster_centres);
+}
+#endif  /* __SSE2__ */
+
+#ifdef HAVE_AVX2_KERNEL
+__attribute__((target("avx2")))
+static inline __m256i
+color_distances_avx2 (__m256i px,
+                      __m256i centre)
+{
+	const __m256i zero = _mm256_setzero_si256 ();
+	__m256i lo = _mm256_sub_epi16 (_mm256_unpacklo_epi8 (px, zero), centre);
+	__m256i hi = _mm256_sub_epi16 (_mm256_unpackhi_epi8 (px, zero), centre);
+	__m256 sq_lo = _mm256_castsi256_ps (_mm256_madd_epi16 (lo, lo));
+	__m256 sq_hi = _mm256_castsi256_ps (_mm256_madd_epi16 (hi, hi));
+	/* The unpacks and shuffles work within each 128-bit lane, so the
+	 * pixel order is the same as for the SSE2 version, per lane. */
+	__m256i even = _mm256_castps_si256 (_mm256_shuffle_ps (sq_lo, sq_hi, _MM_SHUFFLE (2, 0, 2, 0)));
+	__m256i odd = _mm256_castps_si256 (_mm256_shuffle_ps (sq_lo, sq_hi, _MM_SHUFFLE (3, 1, 3, 1)));
+
+	return _mm256_add_epi32 (even, odd);
+}
+
+/* Eight pixels at a time; see assign_clusters_sse2(). */
+__attribute__((target("avx2")))
+static guint
+assign_clusters_avx2 (ClusterPixel8       *p,
+                      const ClusterPixel8 *p_end,
+                      const Pixel8        *cluster_centres,
+                      gsize                n_cluster_centres)
+{
+	const __m256i color_mask = _mm256_set1_epi32 (0x00ffffff);
+	__m256i centres[n_cluster_centres];
+	guint n_assignments_changed = 0;
+
+	for (gsize i = 0; i < n_cluster_centres; i++)
+		centres[i] = _mm256_setr_epi16 (cluster_centres[i].red, cluster_centres[i].green, cluster_centres[i].blue, 0,
+						cluster_centres[i].red, cluster_centres[i].green, cluster_centres[i].blue, 0,
+						cluster_centres[i].red, cluster_centres[i].green, cluster_centres[i].blue, 0,
+						cluster_centres[i].red, cluster_centres[i].green, cluster_centres[i].blue, 0);
+
+	for (; p + 8 <= p_end; p += 8) {
+		__m256i px = _mm256_and_si256 (_mm256_loadu_si256 ((const __m256i *) p), color_mask);
+		__m256i best_distance = color_distances_avx2 (px, centres[0]);
+		__m256i best_cluster = _mm256_setzero_si256 ();
+		gint32 new_clusters[8];
+
+		for (gsize i = 1; i < n_cluster_centres; i++) {
+			__m256i distance = color_distances_avx2 (px, centres[i]);
+			__m256i closer = _mm256_cmpgt_epi32 (best_distance, distance);
+
+			best_distance = _mm256_blendv_epi8 (best_distance, distance, closer);
+			best_cluster = _mm256_blendv_epi8 (best_cluster, _mm256_set1_epi32 (i), closer);
+		}
+
+		_mm256_storeu_si256 ((__m256i *) new_clusters, best_cluster);
+		n_assignments_changed += store_clusters (p, new_clusters, 8, n_cluster_centres);
+	}
+
+	return n_assignments_changed + assign_clusters_scalar (p, p_end, cluster_centres, n_cluster_centres);
+}
+#endif  /* HAVE_AVX2_KERNEL */
+
+typedef guint (*AssignClustersFunc) (ClusterPixel8       *p,
+                                     const ClusterPixel8 *p_end,
+                                     const Pixel8        *cluster_centres,
+                                     gsize                n_cluster_centres);
+
+static AssignClustersFunc
+get_assign_clusters_func (GsKeyColorsKernel kernel)
+{
+	if (kernel == GS_KEY_COLORS_KERNEL_SCALAR)
+		return assign_clusters_scalar;
+
+#ifdef HAVE_AVX2_KERNEL
+	if (__builtin_cpu_supports ("avx2"))
+		return assign_clusters_avx2;
+#endif
+#if defined(__SSE2__)
+	return assign_clusters_sse2;
+#else
+	return assign_clusters_scalar;
+#endif
+}
+
 /* A variant of g_random_int_range() which chooses without replacement,
  * tracking the used integers in @used_ints and @n_used_ints.
  * Once all integers in 0..max_ints have been used once, it will choose
@@ -173,8 +378,9 @@ random_int_range_no_replacement (guint max_ints,
  * faster. That’s fine — it doesn’t matter if the results this function produces
  * are optimal, only that they’re good enough. */
 static void
-k_means (GArray    *colors,
-         GdkPixbuf *pb)
+k_means (GArray            *colors,
+         GdkPixbuf         *pb,
+         GsKeyColorsKernel  kernel)
 {
 	gint rowstride, n_channels;
 	gint width, height;
@@ -188,6 +394,7 @@ k_means (GArray    *colors,
 	guint n_assignments_changed;
 	guint n_iterations = 0;
 	guint assignments_termination_limit;
+	AssignClustersFunc assign_clusters = get_assign_clusters_func (kernel);
 
 	n_channels = gdk_pixbuf_get_n_channels (pb);
 	rowstride = gdk_pixbuf_get_rowstride (pb);
@@ -262,18 +469,8 @@ k_means (GArray    *colors,
 		}
 
 		/* Update assignments of colors to clusters. */
-		n_assignments_changed = 0;
-		for (ClusterPixel8 *p = pixels; p < pixels_end; p++) {
-			gsize new_cluster;
-
-			if (p->cluster >= G_N_ELEMENTS (cluster_centres))
-				continue;
-
-			new_cluster = nearest_cluster (&p->color, cluster_centres, G_N_ELEMENTS (cluster_centres));
-			if (new_cluster != p->cluster)
-				n_assignments_changed++;
-			p->cluster = new_cluster;
-		}
+		n_assignments_changed = assign_clusters (pixels, pixels_end,
+							 cluster_centres, G_N_ELEMENTS (cluster_centres));
 
 		n_iterations++;
 	} while (n_assignments_changed > assignments_termination_limit && n_iterations < 50);
@@ -310,6 +507,15 @@ k_means (GArray    *colors,
  */
 GArray *
 gs_calculate_key_colors (GdkPixbuf *pixbuf)
+{
+	return gs_calculate_key_colors_with_kernel (pixbuf, GS_KEY_COLORS_KERNEL_AUTO);
+}
+
+/* Only exposed separately so that lib/tools/profile-key-colors.c can compare
+ * the kernels. */
+GArray *
+gs_calculate_key_colors_with_kernel (GdkPixbuf         *pixbuf,
+                                     GsKeyColorsKernel  kernel)
 {
 	g_autoptr(GdkPixbuf) pb_small = NULL;
 	g_autoptr(GArray) colors = g_array_new (FALSE, FALSE, sizeof (GdkRGBA));
@@ -328,7 +534,115 @@ gs_calculate_key_colors (GdkPixbuf *pixbuf)
 	}
 
 	/* get a list of key colors */
-	k_means (colors, pb_small);
+	k_means (colors, pb_small, kernel);
 
 	return g_steal_pointer (&colors);
 }
+
+/**
+ * gs_key_colors_get_cache_key:
+ * @pixbuf: an app icon to calculate key colors from
+ *
+ * Get a key which identifies the contents of @pixbuf, and hence its key
+ * colors, suitable for use as a cache file name.
+ *
+ * Returns: (transfer full): a cache key
+ * Since: 43
+ */
+gchar *
+gs_key_colors_get_cache_key (GdkPixbuf *pixbuf)
+{
+	g_autoptr(GChecksum) checksum = g_checksum_new (G_CHECKSUM_SHA1);
+	gint width = gdk_pixbuf_get_width (pixbuf);
+	gint height = gdk_pixbuf_get_height (pixbuf);
+	gint n_channels = gdk_pixbuf_get_n_channels (pixbuf);
+	gint rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+	gsize row_length = (gsize) width * n_channels * gdk_pixbuf_get_bits_per_sample (pixbuf) / 8;
+	const guint8 *pixels = gdk_pixbuf_read_pixels (pixbuf);
+	gint header[] = { KEY_COLORS_CACHE_VERSION, width, height, n_channels };
+
+	g_checksum_update (checksum, (const guchar *) header, sizeof (header));
+
+	/* skip the padding at the end of each row, which is undefined */
+	for (gint y = 0; y < height; y++)
+		g_checksum_update (checksum, pixels + (gsize) y * rowstride, row_length);
+
+	return g_strdup (g_checksum_get_string (checksum));
+}
+
+/**
+ * gs_key_colors_load:
+ * @filename: a cache file written by gs_key_colors_save()
+ * @error: return location for a #GError, or %NULL
+ *
+ * Load a set of key colors from @filename.
+ *
+ * Returns: (transfer full) (element-type GdkRGBA): key colors, or %NULL on error
+ * Since: 43
+ */
+GArray *
+gs_key_colors_load (const gchar  *filename,
+                    GError      **error)
+{
+	g_autofree gchar *contents = NULL;
+	g_autoptr(GVariant) variant = NULL;
+	g_autoptr(GArray) colors = g_array_new (FALSE, FALSE, sizeof (GdkRGBA));
+	GVariantIter iter;
+	guint8 red, green, blue;
+
+	if (!g_file_get_contents (filename, &contents, NULL, error))
+		return NULL;
+
+	/* this is the same format as the GnomeSoftware::key-colors override */
+	variant = g_variant_parse (G_VARIANT_TYPE ("a(yyy)"), contents, NULL, NULL, error);
+	if (variant == NULL)
+		return NULL;
+
+	g_variant_iter_init (&iter, variant);
+	while (g_variant_iter_next (&iter, "(yyy)", &red, &green, &blue)) {
+		GdkRGBA rgba;
+		rgba.red = (gdouble) red / 255.0;
+		rgba.green = (gdouble) green / 255.0;
+		rgba.blue = (gdouble) blue / 255.0;
+		rgba.alpha = 1.0;
+		g_array_append_val (colors, rgba);
+	}
+
+	return g_steal_pointer (&colors);
+}
+
+/**
+ * gs_key_colors_save:
+ * @filename: the cache file to write
+ * @colors: (element-type GdkRGBA): key colors, as returned by
+ *   gs_calculate_key_colors()
+ * @error: return location for a #GError, or %NULL
+ *
+ * Save a set of key colors to @filename, to be loaded again with
+ * gs_key_colors_load().
+ *
+ * Returns: %TRUE on success
+ * Since: 43
+ */
+gboolean
+gs_key_colors_save (const gchar  *filename,
+                    GArray       *colors,
+                    GError      **error)
+{
+	g_autoptr(GVariantBuilder) builder = g_variant_builder_new (G_VARIANT_TYPE ("a(yyy)"));
+	g_autoptr(GVariant) variant = NULL;
+	g_autofree gchar *contents = NULL;
+
+	for (guint i = 0; i < colors->len; i++) {
+		GdkRGBA *rgba = &g_array_index (colors, GdkRGBA, i);
+		g_variant_builder_add (builder, "(yyy)",
+				       (guint8) (rgba->red * 255),
+				       (guint8) (rgba->green * 255),
+				       (guint8) (rgba->blue * 255));
+	}
+
+	variant = g_variant_ref_sink (g_variant_builder_end (builder));
+	contents = g_variant_print (variant, FALSE);
+
+	return g_file_set_contents (filename, contents, -1, error);
+}
@@ -24,4 +24,11 @@ G_BEGIN_DECLS
 
 GArray	*gs_calculate_key_colors	(GdkPixbuf	*pixbuf);
 
+gchar	*gs_key_colors_get_cache_key	(GdkPixbuf	*pixbuf);
+GArray	*gs_key_colors_load		(const gchar	*filename,
+					 GError		**error);
+gboolean gs_key_colors_save		(const gchar	*filename,
+					 GArray		*colors,
+					 GError		**error);
+
 G_END_DECLS
@@ -34,6 +34,7 @@
 #include <glib.h>
 #include <glib-object.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 #include <gnome-software.h>
 #include <json-glib/json-glib.h>
 #include <libsoup/soup.h>
@@ -43,23 +44,45 @@
 
 G_DEFINE_QUARK (gs-odrs-provider-error-quark, gs_odrs_provider_error)
 
-/* Element in self->ratings, all allocated in one big block and sorted
- * alphabetically to reduce the number of allocations and fragmentation. */
+/* The ratings are compiled from the JSON downloaded from the server into a
+ * binary file, which is mmap()ed and searched in place. It is laid out as a
+ * #GsOdrsRatingsHeader, then a #GsOdrsRating for each app sorted by app ID,
+ * then a pool of nul-terminated app IDs which the ratings point into.
+ *
+ * The file is in host byte order, and is only a cache of the JSON: if it
+ * doesn’t match the version or the JSON file it was compiled from, it’s
+ * compiled again. */
+#define GS_ODRS_RATINGS_MAGIC "GSODRSR"
+#define GS_ODRS_RATINGS_VERSION 1
+
+typedef struct {
+	gchar magic[8];
+	guint32 version;  /* also catches a byte order mismatch */
+	guint32 n_ratings;
+	guint64 source_mtime;  /* of the JSON file, in seconds */
+	guint64 source_size;  /* of the JSON file, in bytes */
+	guint32 pool_size;
+	guint32 padding;
+} GsOdrsRatingsHeader;
+
 typedef struct {
-	gchar *app_id;  /* (owned) */
+	guint32 app_id_offset;  /* into the string pool */
 	guint32 n_star_ratings[6];
 } GsOdrsRating;
 
-static int
-rating_compare (const GsOdrsRating *a, const GsOdrsRating *b)
-{
-	return g_strcmp0 (a->app_id, b->app_id);
-}
+G_STATIC_ASSERT (sizeof (GsOdrsRatingsHeader) == 40);
+G_STATIC_ASSERT (sizeof (GsOdrsRating) == 28);
 
-static void
-rating_clear (GsOdrsRating *rating)
+/* Only used while compiling the JSON */
+typedef struct {
+	const gchar *app_id;  /* (unowned) */
+	guint32 n_star_ratings[6];
+} GsOdrsRatingEntry;
+
+static int
+rating_entry_compare (const GsOdrsRatingEntry *a, const GsOdrsRatingEntry *b)
 {
-	g_free (rating->app_id);
+	return strcmp (a->app_id, b->app_id);
 }
 
 struct _GsOdrsProvider
@@ -69,7 +92,7 @@ struct _GsOdrsProvider
 	gchar		*distro;  /* (not nullable) (owned) */
 	gchar		*user_hash;  /* (not nullable) (owned) */
 	gchar		*review_server;  /* (not nullable) (owned) */
-	GArray		*ratings;  /* (element-type GsOdrsRating) (mutex ratings_mutex) (owned) (nullable) */
+	GBytes		*ratings;  /* (mutex ratings_mutex) (owned) (nullable), mapped compiled ratings */
 	GMutex		 ratings_mutex;
 	guint64		 max_cache_age_secs;
 	guint		 n_results_max;
@@ -90,9 +113,9 @@ typedef enum {
 static GParamSpec *obj_props[PROP_SESSION + 1] = { NULL, };
 
 static gboolean
-gs_odrs_provider_load_ratings_for_app (JsonObject   *json_app,
-                                       const gchar  *app_id,
-                                       GsOdrsRating *rating_out)
+gs_odrs_provider_load_ratings_for_app (JsonObject        *json_app,
+                                       const gchar       *app_id,
+                                       GsOdrsRatingEntry *rating_out)
 {
 	guint i;
 	const gchar *names[] = { "star0", "star1", "star2", "star3",
@@ -104,15 +127,19 @@ gs_odrs_provider_load_ratings_for_app (JsonObject   *json_app,
 		rating_out->n_star_ratings[i] = (guint64) json_object_get_int_member (json_app, names[i]);
 	}
 
-	rating_out->app_id = g_strdup (app_id);
+	rating_out->app_id = app_id;
 
 	return TRUE;
 }
 
+/* Parses the ratings JSON in @filename and writes it out in the binary
+ * format to @compiled_filename. The file is replaced atomically, so any
+ * existing mappings of it stay valid. */
 static gboolean
-gs_odrs_provider_load_ratings (GsOdrsProvider  *self,
-                               const gchar     *filename,
-                               GError         **error)
+gs_odrs_provider_compile_ratings (const gchar     *filename,
+                                  const GStatBuf  *st,
+                                  const gchar     *compiled_filename,
+                                  GError         **error)
 {
 	JsonNode *json_root;
 	JsonObject *json_item;
@@ -120,8 +147,10 @@ gs_odrs_provider_load_ratings (GsOdrsProvider  *self,
 	const gchar *app_id;
 	JsonNode *json_app_node;
 	JsonObjectIter iter;
-	g_autoptr(GArray) new_ratings = NULL;
-	g_autoptr(GMutexLocker) locker = NULL;
+	g_autoptr(GArray) entries = NULL;
+	g_autoptr(GByteArray) buf = NULL;
+	GsOdrsRatingsHeader header = { GS_ODRS_RATINGS_MAGIC, 0, };
+	guint64 pool_size = 0;
 	g_autoptr(GError) local_error = NULL;
 
 	/* parse the data and find the success */
@@ -151,32 +180,201 @@ gs_odrs_provider_load_ratings (GsOdrsProvider  *self,
 
 	json_item = json_node_get_object (json_root);
 
-	new_ratings = g_array_sized_new (FALSE,  /* don’t zero-terminate */
-					 FALSE,  /* don’t clear */
-					 sizeof (GsOdrsRating),
-					 json_object_get_size (json_item));
-	g_array_set_clear_func (new_ratings, (GDestroyNotify) rating_clear);
+	entries = g_array_sized_new (FALSE,  /* don’t zero-terminate */
+				     FALSE,  /* don’t clear */
+				     sizeof (GsOdrsRatingEntry),
+				     json_object_get_size (json_item));
 
 	/* parse each app */
 	json_object_iter_init (&iter, json_item);
 	while (json_object_iter_next (&iter, &app_id, &json_app_node)) {
-		GsOdrsRating rating;
+		GsOdrsRatingEntry entry;
 		JsonObject *json_app;
 
 		if (!JSON_NODE_HOLDS_OBJECT (json_app_node))
 			continue;
 		json_app = json_node_get_object (json_app_node);
 
-		if (gs_odrs_provider_load_ratings_for_app (json_app, app_id, &rating))
-			g_array_append_val (new_ratings, rating);
+		if (gs_odrs_provider_load_ratings_for_app (json_app, app_id, &entry)) {
+			g_array_append_val (entries, entry);
+			pool_size += strlen (app_id) + 1;
+		}
+	}
+
+	if (pool_size > G_MAXUINT32) {
+		g_set_error_literal (error,
+				     GS_ODRS_PROVIDER_ERROR,
+				     GS_ODRS_PROVIDER_ERROR_PARSING_DATA,
+				     "too many ratings");
+		return FALSE;
 	}
 
 	/* Allow for binary searches later. */
-	g_array_sort (new_ratings, (GCompareFunc) rating_compare);
+	g_array_sort (entries, (GCompareFunc) rating_entry_compare);
+
+	header.version = GS_ODRS_RATINGS_VERSION;
+	header.n_ratings = entries->len;
+	header.source_mtime = st->st_mtime;
+	header.source_size = st->st_size;
+	header.pool_size = pool_size;
+
+	buf = g_byte_array_sized_new (sizeof (header) +
+				      entries->len * sizeof (GsOdrsRating) +
+				      pool_size);
+	g_byte_array_append (buf, (const guint8 *) &header, sizeof (header));
+
+	pool_size = 0;
+	for (guint i = 0; i < entries->len; i++) {
+		const GsOdrsRatingEntry *entry = &g_array_index (entries, GsOdrsRatingEntry, i);
+		GsOdrsRating rating;
+
+		rating.app_id_offset = pool_size;
+		memcpy (rating.n_star_ratings, entry->n_star_ratings, sizeof (rating.n_star_ratings));
+		g_byte_array_append (buf, (const guint8 *) &rating, sizeof (rating));
+		pool_size += strlen (entry->app_id) + 1;
+	}
+	for (guint i = 0; i < entries->len; i++) {
+		const GsOdrsRatingEntry *entry = &g_array_index (entries, GsOdrsRatingEntry, i);
+		g_byte_array_append (buf, (const guint8 *) entry->app_id, strlen (entry->app_id) + 1);
+	}
+
+	if (!g_file_set_contents (compiled_filename, (const gchar *) buf->data, buf->len, &local_error)) {
+		g_set_error (error,
+			     GS_ODRS_PROVIDER_ERROR,
+			     GS_ODRS_PROVIDER_ERROR_PARSING_DATA,
+			     "Error writing compiled ODRS data: %s", local_error->message);
+		return FALSE;
+	}
+
+	g_debug ("Compiled %u ODRS ratings into ‘%s’", entries->len, compiled_filename);
+
+	return TRUE;
+}
+
+/* Maps @compiled_filename, returning %NULL if it doesn’t exist, is corrupt,
+ * or wasn’t compiled from a JSON file matching @st. Pass %NULL for @st to
+ * accept it regardless of what it was compiled from. */
+static GBytes *
+gs_odrs_provider_map_ratings (const gchar    *compiled_filename,
+                              const GStatBuf *st)
+{
+	g_autoptr(GMappedFile) mapped_file = NULL;
+	g_autoptr(GBytes) bytes = NULL;
+	const GsOdrsRatingsHeader *header;
+	const gchar *data;
+	gsize size;
+	g_autoptr(GError) local_error = NULL;
+
+	mapped_file = g_mapped_file_new (compiled_filename, FALSE, &local_error);
+	if (mapped_file == NULL) {
+		if (!g_error_matches (local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+			g_debug ("Failed to map ‘%s’: %s", compiled_filename, local_error->message);
+		return NULL;
+	}
+
+	bytes = g_mapped_file_get_bytes (mapped_file);
+	data = g_bytes_get_data (bytes, &size);
+	header = (const GsOdrsRatingsHeader *) data;
+
+	if (size < sizeof (*header) ||
+	    memcmp (header->magic, GS_ODRS_RATINGS_MAGIC, sizeof (header->magic)) != 0 ||
+	    header->version != GS_ODRS_RATINGS_VERSION ||
+	    (guint64) sizeof (*header) + (guint64) header->n_ratings * sizeof (GsOdrsRating) +
+	    header->pool_size != size ||
+	    (header->pool_size > 0 && data[size - 1] != '\0')) {
+		g_debug ("Ignoring invalid compiled ODRS data in ‘%s’", compiled_filename);
+		return NULL;
+	}
+
+	if (st != NULL &&
+	    (header->source_mtime != (guint64) st->st_mtime ||
+	     header->source_size != (guint64) st->st_size)) {
+		g_debug ("Compiled ODRS data in ‘%s’ is out of date", compiled_filename);
+		return NULL;
+	}
+
+	return g_steal_pointer (&bytes);
+}
+
+/* Binary searches the mapped @ratings for @app_id, touching only the pages
+ * it needs. The app ID offsets are bounds checked here rather than when
+ * mapping the file, so loading it doesn’t touch every page. */
+static const GsOdrsRating *
+gs_odrs_provider_lookup_rating (GBytes      *ratings,
+                                const gchar *app_id)
+{
+	gsize size;
+	const guint8 *data = g_bytes_get_data (ratings, &size);
+	const GsOdrsRatingsHeader *header = (const GsOdrsRatingsHeader *) data;
+	const GsOdrsRating *records = (const GsOdrsRating *) (data + sizeof (*header));
+	const gchar *pool = (const gchar *) (records + header->n_ratings);
+	guint lower = 0;
+	guint upper = header->n_ratings;
+
+	while (lower < upper) {
+		guint mid = lower + (upper - lower) / 2;
+		int cmp;
+
+		if (records[mid].app_id_offset >= header->pool_size)
+			return NULL;
+
+		cmp = strcmp (app_id, pool + records[mid].app_id_offset);
+		if (cmp == 0)
+			return &records[mid];
+		else if (cmp < 0)
+			upper = mid;
+		else
+			lower = mid + 1;
+	}
+
+	return NULL;
+}
+
+/* Loads the ratings from the JSON in @filename, via the compiled copy of
+ * it next to it. That is only compiled again if it’s missing or out of
+ * date, so normally no JSON is parsed at all. */
+static gboolean
+gs_odrs_provider_load_ratings (GsOdrsProvider  *self,
+                               const gchar     *filename,
+                               GError         **error)
+{
+	g_autofree gchar *dirname = g_path_get_dirname (filename);
+	g_autofree gchar *compiled_filename = g_build_filename (dirname, "ratings.bin", NULL);
+	g_autoptr(GBytes) new_ratings = NULL;
+	g_autoptr(GMutexLocker) locker = NULL;
+	GStatBuf st;
+	gboolean have_source;
+
+	have_source = (g_stat (filename, &st) == 0);
+
+	new_ratings = gs_odrs_provider_map_ratings (compiled_filename, have_source ? &st : NULL);
+	if (new_ratings == NULL) {
+		if (!have_source) {
+			g_set_error (error,
+				     GS_ODRS_PROVIDER_ERROR,
+				     GS_ODRS_PROVIDER_ERROR_PARSING_DATA,
+				     "Error parsing ODRS data: %s does not exist", filename);
+			return FALSE;
+		}
+
+		if (!gs_odrs_provider_compile_ratings (filename, &st, compiled_filename, error)) {
+			g_unlink (compiled_filename);
+			return FALSE;
+		}
+
+		new_ratings = gs_odrs_provider_map_ratings (compiled_filename, &st);
+		if (new_ratings == NULL) {
+			g_set_error (error,
+				     GS_ODRS_PROVIDER_ERROR,
+				     GS_ODRS_PROVIDER_ERROR_PARSING_DATA,
+				     "Error loading compiled ODRS data from %s", compiled_filename);
+			return FALSE;
+		}
+	}
 
 	/* Update the shared state */
 	locker = g_mutex_locker_new (&self->ratings_mutex);
-	g_clear_pointer (&self->ratings, g_array_unref);
+	g_clear_pointer (&self->ratings, g_bytes_unref);
 	self->ratings = g_steal_pointer (&new_ratings);
 
 	return TRUE;
@@ -561,6 +759,7 @@ gs_odrs_provider_refine_ratings (GsOdrsProvider  *self,
 	g_autoptr(GArray) review_ratings = NULL;
 	g_autoptr(GPtrArray) reviewable_ids = NULL;
 	g_autoptr(GMutexLocker) locker = NULL;
+	g_autoptr(GBytes) ratings = NULL;
 
 	/* get ratings for each reviewable ID */
 	reviewable_ids = _gs_app_get_reviewable_ids (app);
@@ -596,18 +795,19 @@ gs_odrs_provider_refine_ratings (GsOdrsProvider  *self,
 			return TRUE;
 	}
 
+	/* Hold a reference to the mapping rather than the lock while searching
+	 * it, so a concurrent refresh can swap it out. */
+	ratings = g_bytes_ref (self->ratings);
+	g_clear_pointer (&locker, g_mutex_locker_free);
+
 	for (guint i = 0; i < reviewable_ids->len; i++) {
 		const gchar *id = g_ptr_array_index (reviewable_ids, i);
-		const GsOdrsRating search_rating = { (gchar *) id, { 0, }};
-		guint found_index;
 		const GsOdrsRating *found_rating;
 
-		if (!g_array_binary_search (self->ratings, &search_rating,
-					    (GCompareFunc) rating_compare, &found_index))
+		found_rating = gs_odrs_provider_lookup_rating (ratings, id);
+		if (found_rating == NULL)
 			continue;
 
-		found_rating = &g_array_index (self->ratings, GsOdrsRating, found_index);
-
 		/* copy into accumulator array */
 		for (guint j = 0; j < 6; j++)
 			ratings_raw[j] += found_rating->n_star_ratings[j];
@@ -616,9 +816,6 @@ gs_odrs_provider_refine_ratings (GsOdrsProvider  *self,
 	if (cnt == 0)
 		return TRUE;
 
-	/* Done with self->ratings now */
-	g_clear_pointer (&locker, g_mutex_locker_free);
-
 	/* merge to accumulator array back to one GArray blob */
 	review_ratings = g_array_sized_new (FALSE, TRUE, sizeof(guint32), 6);
 	for (guint i = 0; i < 6; i++)
@@ -1194,7 +1391,7 @@ gs_odrs_provider_finalize (GObject *object)
 	g_free (self->user_hash);
 	g_free (self->distro);
 	g_free (self->review_server);
-	g_clear_pointer (&self->ratings, g_array_unref);
+	g_clear_pointer (&self->ratings, g_bytes_unref);
 	g_mutex_clear (&self->ratings_mutex);
 
 	G_OBJECT_CLASS (gs_odrs_provider_parent_class)->finalize (object);
@@ -0,0 +1,411 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2016 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+/*
+ * The per-plugin cache of #GsApp instances, as used by gs_plugin_cache_add()
+ * and friends.
+ *
+ * Lookups by key are by far the most common operation, and happen from many
+ * refine threads at once, so the key space is split into shards, each with its
+ * own lock. Two keys which are equal according to as_utils_data_id_equal()
+ * always hash to the same shard.
+ *
+ * Each distinct #GsApp in the cache (an app may be cached under several keys)
+ * is also indexed by its state, kind and sources, so that listing e.g. all
+ * installed apps is proportional to the number of results rather than the size
+ * of the cache. The indexes are protected by a separate lock, and are kept up
+ * to date by a #GsAppIndexFunc watch on each app. As the watch is called with
+ * the app’s lock held, it only queues the app as dirty; the dirty apps are
+ * reindexed before the indexes are next used.
+ *
+ * Lock ordering is: shard lock, then index lock, then #GsApp lock.
+ */
+
+#include "config.h"
+
+#include "gs-app-private.h"
+#include "gs-plugin-cache.h"
+
+#define N_SHARDS 16
+
+typedef struct {
+	GMutex		 mutex;
+	GHashTable	*apps;  /* (owned) (element-type utf8 GsApp) */
+} Shard;
+
+typedef struct {
+	GsApp		*app;  /* (owned) */
+	guint		 n_keys;
+	GsAppState	 state;
+	AsComponentKind	 kind;
+	GPtrArray	*sources;  /* (owned) (element-type utf8) */
+} IndexEntry;
+
+struct _GsPluginAppCache {
+	Shard		 shards[N_SHARDS];
+
+	GMutex		 index_mutex;
+	GHashTable	*entries;  /* (owned) (element-type GsApp IndexEntry) */
+	GHashTable	*by_state;  /* (owned) (element-type GsAppState GHashTable<GsApp>) */
+	GHashTable	*by_kind;  /* (owned) (element-type AsComponentKind GHashTable<GsApp>) */
+	GHashTable	*by_source;  /* (owned) (element-type utf8 GHashTable<GsApp>) */
+	GAsyncQueue	*dirty;  /* (owned) (element-type GsApp) */
+};
+
+static void
+index_entry_free (IndexEntry *entry)
+{
+	g_object_unref (entry->app);
+	g_ptr_array_unref (entry->sources);
+	g_free (entry);
+}
+
+static Shard *
+get_shard (GsPluginAppCache *cache, const gchar *key)
+{
+	return &cache->shards[as_utils_data_id_hash (key) % N_SHARDS];
+}
+
+/* called with the app lock held, so must not take the index lock */
+static void
+app_index_changed_cb (GsApp *app, gpointer user_data)
+{
+	GsPluginAppCache *cache = user_data;
+	g_async_queue_push (cache->dirty, g_object_ref (app));
+}
+
+/* index lock must be held */
+static void
+index_set_add (GHashTable *index, gpointer index_key, GDestroyNotify key_free_func, GsApp *app)
+{
+	GHashTable *set = g_hash_table_lookup (index, index_key);
+
+	if (set == NULL) {
+		set = g_hash_table_new (g_direct_hash, g_direct_equal);
+		g_hash_table_insert (index,
+				     (key_free_func != NULL) ? g_strdup (index_key) : index_key,
+				     set);
+	}
+	g_hash_table_add (set, app);
+}
+
+/* index lock must be held */
+static void
+index_set_remove (GHashTable *index, gconstpointer index_key, GsApp *app)
+{
+	GHashTable *set = g_hash_table_lookup (index, index_key);
+
+	if (set == NULL)
+		return;
+	g_hash_table_remove (set, app);
+	if (g_hash_table_size (set) == 0)
+		g_hash_table_remove (index, index_key);
+}
+
+/* index lock must be held */
+static void
+index_entry_link (GsPluginAppCache *cache, IndexEntry *entry)
+{
+	GPtrArray *sources = gs_app_get_sources (entry->app);
+
+	entry->state = gs_app_get_state (entry->app);
+	entry->kind = gs_app_get_kind (entry->app);
+	g_ptr_array_set_size (entry->sources, 0);
+	for (guint i = 0; i < sources->len; i++)
+		g_ptr_array_add (entry->sources, g_strdup (g_ptr_array_index (sources, i)));
+
+	index_set_add (cache->by_state, GUINT_TO_POINTER (entry->state), NULL, entry->app);
+	index_set_add (cache->by_kind, GUINT_TO_POINTER (entry->kind), NULL, entry->app);
+	for (guint i = 0; i < entry->sources->len; i++)
+		index_set_add (cache->by_source, g_ptr_array_index (entry->sources, i), g_free, entry->app);
+}
+
+/* index lock must be held */
+static void
+index_entry_unlink (GsPluginAppCache *cache, IndexEntry *entry)
+{
+	index_set_remove (cache->by_state, GUINT_TO_POINTER (entry->state), entry->app);
+	index_set_remove (cache->by_kind, GUINT_TO_POINTER (entry->kind), entry->app);
+	for (guint i = 0; i < entry->sources->len; i++)
+		index_set_remove (cache->by_source, g_ptr_array_index (entry->sources, i), entry->app);
+}
+
+/* index lock must be held */
+static void
+index_flush_dirty (GsPluginAppCache *cache)
+{
+	GsApp *app;
+
+	while ((app = g_async_queue_try_pop (cache->dirty)) != NULL) {
+		IndexEntry *entry = g_hash_table_lookup (cache->entries, app);
+
+		/* the app may have been removed from the cache since */
+		if (entry != NULL) {
+			index_entry_unlink (cache, entry);
+			index_entry_link (cache, entry);
+		}
+		g_object_unref (app);
+	}
+}
+
+/* index lock must be held */
+static void
+index_ref_app (GsPluginAppCache *cache, GsApp *app)
+{
+	IndexEntry *entry = g_hash_table_lookup (cache->entries, app);
+
+	if (entry != NULL) {
+		entry->n_keys++;
+		return;
+	}
+
+	/* add the watch before reading the indexed properties, so that no
+	 * change in between can be missed */
+	gs_app_add_index_watch (app, app_index_changed_cb, cache);
+
+	entry = g_new0 (IndexEntry, 1);
+	entry->app = g_object_ref (app);
+	entry->n_keys = 1;
+	entry->sources = g_ptr_array_new_with_free_func (g_free);
+	index_entry_link (cache, entry);
+	g_hash_table_insert (cache->entries, app, entry);
+}
+
+/* index lock must be held */
+static void
+index_unref_app (GsPluginAppCache *cache, GsApp *app)
+{
+	IndexEntry *entry = g_hash_table_lookup (cache->entries, app);
+
+	g_return_if_fail (entry != NULL);
+
+	if (--entry->n_keys > 0)
+		return;
+
+	gs_app_remove_index_watch (app, app_index_changed_cb, cache);
+	index_entry_unlink (cache, entry);
+	g_hash_table_remove (cache->entries, app);
+}
+
+GsPluginAppCache *
+gs_plugin_app_cache_new (void)
+{
+	GsPluginAppCache *cache = g_new0 (GsPluginAppCache, 1);
+
+	for (guint i = 0; i < N_SHARDS; i++) {
+		g_mutex_init (&cache->shards[i].mutex);
+		cache->shards[i].apps = g_hash_table_new_full ((GHashFunc) as_utils_data_id_hash,
+							       (GEqualFunc) as_utils_data_id_equal,
+							       g_free,
+							       (GDestroyNotify) g_object_unref);
+	}
+
+	g_mutex_init (&cache->index_mutex);
+	cache->entries = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+						NULL, (GDestroyNotify) index_entry_free);
+	cache->by_state = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+						 NULL, (GDestroyNotify) g_hash_table_unref);
+	cache->by_kind = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+						NULL, (GDestroyNotify) g_hash_table_unref);
+	cache->by_source = g_hash_table_new_full (g_str_hash, g_str_equal,
+						  g_free, (GDestroyNotify) g_hash_table_unref);
+	cache->dirty = g_async_queue_new_full ((GDestroyNotify) g_object_unref);
+
+	return cache;
+}
+
+void
+gs_plugin_app_cache_free (GsPluginAppCache *cache)
+{
+	GHashTableIter iter;
+	gpointer key;
+
+	/* once the watches are removed, nothing else can touch the cache */
+	g_hash_table_iter_init (&iter, cache->entries);
+	while (g_hash_table_iter_next (&iter, &key, NULL))
+		gs_app_remove_index_watch (GS_APP (key), app_index_changed_cb, cache);
+
+	for (guint i = 0; i < N_SHARDS; i++) {
+		g_hash_table_unref (cache->shards[i].apps);
+		g_mutex_clear (&cache->shards[i].mutex);
+	}
+
+	g_hash_table_unref (cache->by_state);
+	g_hash_table_unref (cache->by_kind);
+	g_hash_table_unref (cache->by_source);
+	g_hash_table_unref (cache->entries);
+	g_async_queue_unref (cache->dirty);
+	g_mutex_clear (&cache->index_mutex);
+	g_free (cache);
+}
+
+/* Returns: (transfer full) (nullable) */
+GsApp *
+gs_plugin_app_cache_lookup (GsPluginAppCache *cache, const gchar *key)
+{
+	Shard *shard = get_shard (cache, key);
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&shard->mutex);
+	GsApp *app;
+
+	app = g_hash_table_lookup (shard->apps, key);
+	if (app == NULL)
+		return NULL;
+	return g_object_ref (app);
+}
+
+void
+gs_plugin_app_cache_add (GsPluginAppCache *cache, const gchar *key, GsApp *app)
+{
+	Shard *shard = get_shard (cache, key);
+	g_autoptr(GsApp) old_app = NULL;
+	g_autofree gchar *old_key = NULL;
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&shard->mutex);
+	g_autoptr(GMutexLocker) index_locker = NULL;
+
+	if (g_hash_table_lookup (shard->apps, key) == app)
+		return;
+
+	g_hash_table_steal_extended (shard->apps, key,
+				     (gpointer *) &old_key, (gpointer *) &old_app);
+	g_hash_table_insert (shard->apps, g_strdup (key), g_object_ref (app));
+
+	index_locker = g_mutex_locker_new (&cache->index_mutex);
+	index_flush_dirty (cache);
+	index_ref_app (cache, app);
+	if (old_app != NULL)
+		index_unref_app (cache, old_app);
+}
+
+void
+gs_plugin_app_cache_remove (GsPluginAppCache *cache, const gchar *key)
+{
+	Shard *shard = get_shard (cache, key);
+	g_autoptr(GsApp) old_app = NULL;
+	g_autofree gchar *old_key = NULL;
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&shard->mutex);
+	g_autoptr(GMutexLocker) index_locker = NULL;
+
+	if (!g_hash_table_steal_extended (shard->apps, key,
+					  (gpointer *) &old_key, (gpointer *) &old_app))
+		return;
+
+	index_locker = g_mutex_locker_new (&cache->index_mutex);
+	index_unref_app (cache, old_app);
+}
+
+void
+gs_plugin_app_cache_remove_all (GsPluginAppCache *cache)
+{
+	for (guint i = 0; i < N_SHARDS; i++) {
+		Shard *shard = &cache->shards[i];
+		g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&shard->mutex);
+		g_autoptr(GMutexLocker) index_locker = g_mutex_locker_new (&cache->index_mutex);
+		GHashTableIter iter;
+		gpointer value;
+
+		g_hash_table_iter_init (&iter, shard->apps);
+		while (g_hash_table_iter_next (&iter, NULL, &value))
+			index_unref_app (cache, GS_APP (value));
+
+		/* the last reference to an app may be dropped here */
+		g_clear_pointer (&index_locker, g_mutex_locker_free);
+		g_hash_table_remove_all (shard->apps);
+	}
+}
+
+/* index lock must be held */
+static void
+add_index_set_to_list (GHashTable *set, GPtrArray *apps)
+{
+	GHashTableIter iter;
+	gpointer key;
+
+	if (set == NULL)
+		return;
+
+	g_hash_table_iter_init (&iter, set);
+	while (g_hash_table_iter_next (&iter, &key, NULL))
+		g_ptr_array_add (apps, g_object_ref (key));
+}
+
+static void
+add_apps_to_list (GPtrArray *apps, GsAppList *list)
+{
+	for (guint i = 0; i < apps->len; i++)
+		gs_app_list_add (list, g_ptr_array_index (apps, i));
+}
+
+/* Adds each cached app with @state to @list, or all of them if @state is
+ * %GS_APP_STATE_UNKNOWN. */
+void
+gs_plugin_app_cache_list_by_state (GsPluginAppCache *cache,
+				   GsAppList        *list,
+				   GsAppState        state)
+{
+	g_autoptr(GPtrArray) apps = NULL;
+
+	if (state == GS_APP_STATE_UNKNOWN) {
+		apps = gs_plugin_app_cache_dup_apps (cache);
+	} else {
+		g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&cache->index_mutex);
+
+		apps = g_ptr_array_new_with_free_func (g_object_unref);
+		index_flush_dirty (cache);
+		add_index_set_to_list (g_hash_table_lookup (cache->by_state, GUINT_TO_POINTER (state)), apps);
+	}
+
+	/* outside the lock, as adding to the list takes the app locks */
+	add_apps_to_list (apps, list);
+}
+
+void
+gs_plugin_app_cache_list_by_kind (GsPluginAppCache *cache,
+				  GsAppList        *list,
+				  AsComponentKind   kind)
+{
+	g_autoptr(GPtrArray) apps = g_ptr_array_new_with_free_func (g_object_unref);
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&cache->index_mutex);
+
+	index_flush_dirty (cache);
+	add_index_set_to_list (g_hash_table_lookup (cache->by_kind, GUINT_TO_POINTER (kind)), apps);
+	g_clear_pointer (&locker, g_mutex_locker_free);
+
+	add_apps_to_list (apps, list);
+}
+
+void
+gs_plugin_app_cache_list_by_source (GsPluginAppCache *cache,
+				    GsAppList        *list,
+				    const gchar      *source)
+{
+	g_autoptr(GPtrArray) apps = g_ptr_array_new_with_free_func (g_object_unref);
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&cache->index_mutex);
+
+	index_flush_dirty (cache);
+	add_index_set_to_list (g_hash_table_lookup (cache->by_source, source), apps);
+	g_clear_pointer (&locker, g_mutex_locker_free);
+
+	add_apps_to_list (apps, list);
+}
+
+/* Returns: (transfer container) (element-type GsApp): each distinct cached app */
+GPtrArray *
+gs_plugin_app_cache_dup_apps (GsPluginAppCache *cache)
+{
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&cache->index_mutex);
+	GPtrArray *apps = g_ptr_array_new_full (g_hash_table_size (cache->entries),
+						g_object_unref);
+	GHashTableIter iter;
+	gpointer key;
+
+	g_hash_table_iter_init (&iter, cache->entries);
+	while (g_hash_table_iter_next (&iter, &key, NULL))
+		g_ptr_array_add (apps, g_object_ref (key));
+
+	return apps;
+}
@@ -0,0 +1,45 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2016 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include "gs-app.h"
+#include "gs-app-list.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GsPluginAppCache GsPluginAppCache;
+
+GsPluginAppCache	*gs_plugin_app_cache_new		(void);
+void			 gs_plugin_app_cache_free		(GsPluginAppCache	*cache);
+
+GsApp			*gs_plugin_app_cache_lookup		(GsPluginAppCache	*cache,
+								 const gchar		*key);
+void			 gs_plugin_app_cache_add		(GsPluginAppCache	*cache,
+								 const gchar		*key,
+								 GsApp			*app);
+void			 gs_plugin_app_cache_remove		(GsPluginAppCache	*cache,
+								 const gchar		*key);
+void			 gs_plugin_app_cache_remove_all		(GsPluginAppCache	*cache);
+
+void			 gs_plugin_app_cache_list_by_state	(GsPluginAppCache	*cache,
+								 GsAppList		*list,
+								 GsAppState		 state);
+void			 gs_plugin_app_cache_list_by_kind	(GsPluginAppCache	*cache,
+								 GsAppList		*list,
+								 AsComponentKind	 kind);
+void			 gs_plugin_app_cache_list_by_source	(GsPluginAppCache	*cache,
+								 GsAppList		*list,
+								 const gchar		*source);
+GPtrArray		*gs_plugin_app_cache_dup_apps		(GsPluginAppCache	*cache);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GsPluginAppCache, gs_plugin_app_cache_free)
+
+G_END_DECLS
@@ -27,6 +27,12 @@
  * Retrieve the resulting #GsAppList using
  * gs_plugin_job_list_apps_get_result_list().
  *
+ * The listed and refined apps are cached by the #GsPluginLoader, and shared
+ * between jobs with equivalent queries, including any which are running at
+ * the same time. Each job then filters, sorts and truncates them itself.
+ * The cache is dropped whenever a plugin reports that apps, updates or
+ * repositories changed, and around every job which may change them.
+ *
  * See also: #GsPluginClass.list_apps_async
  * Since: 43
  */
@@ -44,8 +50,10 @@
 #include "gs-plugin-job-list-apps.h"
 #include "gs-plugin-job-private.h"
 #include "gs-plugin-job-refine.h"
+#include "gs-plugin-loader-private.h"
 #include "gs-plugin-private.h"
 #include "gs-plugin-types.h"
+#include "gs-trace.h"
 #include "gs-utils.h"
 
 struct _GsPluginJobListApps
@@ -60,6 +68,9 @@ struct _GsPluginJobListApps
 	GsAppList *merged_list;  /* (owned) (nullable) */
 	GError *saved_error;  /* (owned) (nullable) */
 	guint n_pending_ops;
+	GHashTable *trace_spans;  /* (element-type GsPlugin GsTraceSpan) (owned) (nullable) */
+	gchar *cache_key;  /* (owned) (nullable) */
+	GsPluginLoaderListAppsEntry *cache_entry;  /* (owned) (nullable) */
 
 	/* Results. */
 	GsAppList *result_list;  /* (owned) (nullable) */
@@ -82,8 +93,11 @@ gs_plugin_job_list_apps_dispose (GObject *object)
 	g_assert (self->merged_list == NULL);
 	g_assert (self->saved_error == NULL);
 	g_assert (self->n_pending_ops == 0);
+	g_assert (self->cache_entry == NULL);
 
 	g_clear_object (&self->result_list);
+	g_clear_pointer (&self->trace_spans, g_hash_table_unref);
+	g_clear_pointer (&self->cache_key, g_free);
 
 	G_OBJECT_CLASS (gs_plugin_job_list_apps_parent_class)->dispose (object);
 }
@@ -172,6 +186,85 @@ app_filter_qt_for_gtk_and_compatible (GsApp    *app,
 	return gs_plugin_loader_app_is_compatible (plugin_loader, app);
 }
 
+static void
+append_strv (GString            *key,
+             const gchar        *name,
+             const gchar * const *strv)
+{
+	if (strv == NULL)
+		return;
+
+	g_string_append_printf (key, "%s=", name);
+	for (gsize i = 0; strv[i] != NULL; i++)
+		g_string_append_printf (key, "%s%s", (i > 0) ? "\x1f" : "", strv[i]);
+	g_string_append_c (key, ';');
+}
+
+/* Build a string which is equal for queries which list the same apps with
+ * the same refine flags, ignoring anything which finish_task() applies
+ * afterwards. Returns %NULL if the query can’t be cached. */
+static gchar *
+build_cache_key (GsPluginJobListApps *self)
+{
+	g_autoptr(GString) key = g_string_new (NULL);
+	GsPluginListAppsFlags flags = self->flags & ~GS_PLUGIN_LIST_APPS_FLAGS_INTERACTIVE;
+	GDateTime *released_since;
+	GsCategory *category;
+	GsApp *alternate_of;
+	GsAppQueryProvidesType provides_type;
+	const gchar *provides_tag = NULL;
+
+	g_string_append_printf (key, "flags=%x;", (guint) flags);
+
+	if (self->query == NULL)
+		return g_string_free (g_steal_pointer (&key), FALSE);
+
+	g_string_append_printf (key, "refine=%" G_GINT64_MODIFIER "x;",
+				(guint64) gs_app_query_get_refine_flags (self->query));
+
+	/* callers pass the current time minus some days, so only the day is
+	 * significant */
+	released_since = gs_app_query_get_released_since (self->query);
+	if (released_since != NULL) {
+		g_autofree gchar *date = g_date_time_format (released_since, "%F");
+		g_string_append_printf (key, "released-since=%s;", date);
+	}
+
+	g_string_append_printf (key, "curated=%d;featured=%d;installed=%d;",
+				gs_app_query_get_is_curated (self->query),
+				gs_app_query_get_is_featured (self->query),
+				gs_app_query_get_is_installed (self->query));
+
+	category = gs_app_query_get_category (self->query);
+	if (category != NULL) {
+		g_string_append (key, "category=");
+		for (GsCategory *c = category; c != NULL; c = gs_category_get_parent (c)) {
+			if (gs_category_get_id (c) == NULL)
+				return NULL;
+			g_string_append_printf (key, "%s/", gs_category_get_id (c));
+		}
+		g_string_append_c (key, ';');
+	}
+
+	append_strv (key, "deployment-featured", gs_app_query_get_deployment_featured (self->query));
+	append_strv (key, "developers", gs_app_query_get_developers (self->query));
+	append_strv (key, "keywords", gs_app_query_get_keywords (self->query));
+	append_strv (key, "provides-files", gs_app_query_get_provides_files (self->query));
+
+	alternate_of = gs_app_query_get_alternate_of (self->query);
+	if (alternate_of != NULL) {
+		if (gs_app_get_unique_id (alternate_of) == NULL)
+			return NULL;
+		g_string_append_printf (key, "alternate-of=%s;", gs_app_get_unique_id (alternate_of));
+	}
+
+	provides_type = gs_app_query_get_provides (self->query, &provides_tag);
+	if (provides_tag != NULL)
+		g_string_append_printf (key, "provides=%u:%s;", (guint) provides_type, provides_tag);
+
+	return g_string_free (g_steal_pointer (&key), FALSE);
+}
+
 static void plugin_list_apps_cb (GObject      *source_object,
                                  GAsyncResult *result,
                                  gpointer      user_data);
@@ -182,6 +275,10 @@ static void refine_cb (GObject      *source_object,
                        gpointer      user_data);
 static void finish_task (GTask     *task,
                          GsAppList *merged_list);
+static void run_query (GTask *task);
+static void cached_results_cb (GTask        *task,
+                               GsAppList    *list,
+                               const GError *error);
 
 static void
 gs_plugin_job_list_apps_run_async (GsPluginJob         *job,
@@ -192,22 +289,92 @@ gs_plugin_job_list_apps_run_async (GsPluginJob         *job,
 {
 	GsPluginJobListApps *self = GS_PLUGIN_JOB_LIST_APPS (job);
 	g_autoptr(GTask) task = NULL;
-	GPtrArray *plugins;  /* (element-type GsPlugin) */
-	gboolean anything_ran = FALSE;
 
 	task = g_task_new (job, cancellable, callback, user_data);
 	g_task_set_source_tag (task, gs_plugin_job_list_apps_run_async);
 	g_task_set_task_data (task, g_object_ref (plugin_loader), (GDestroyNotify) g_object_unref);
 
+	/* share the results of an equivalent query if possible */
+	g_clear_pointer (&self->cache_key, g_free);
+	self->cache_key = build_cache_key (self);
+
+	if (self->cache_key != NULL &&
+	    gs_plugin_loader_list_apps_cache_lookup (plugin_loader, self->cache_key, task,
+						     cached_results_cb, &self->cache_entry))
+		return;
+
+	run_query (task);
+}
+
+static void
+cached_results_cb (GTask        *task,
+                   GsAppList    *list,
+                   const GError *error)
+{
+	GsPluginJobListApps *self = g_task_get_source_object (task);
+	GsPluginLoader *plugin_loader = g_task_get_task_data (task);
+
+	if (g_task_return_error_if_cancelled (task))
+		return;
+
+	/* the job whose results were being waited for was cancelled, but
+	 * this one wasn’t, so try again */
+	if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED) ||
+	    g_error_matches (error, GS_PLUGIN_ERROR, GS_PLUGIN_ERROR_CANCELLED)) {
+		if (!gs_plugin_loader_list_apps_cache_lookup (plugin_loader, self->cache_key, task,
+							      cached_results_cb, &self->cache_entry))
+			run_query (task);
+		return;
+	}
+
+	if (error != NULL) {
+		g_task_return_error (task, g_error_copy (error));
+		return;
+	}
+
+	finish_task (task, list);
+}
+
+/* Pass the results of running the query to any equivalent jobs waiting for
+ * them, and cache them. */
+static void
+complete_cache_entry (GTask        *task,
+                      GsAppList    *list,
+                      const GError *error)
+{
+	GsPluginJobListApps *self = g_task_get_source_object (task);
+	GsPluginLoader *plugin_loader = g_task_get_task_data (task);
+
+	if (self->cache_entry == NULL)
+		return;
+
+	gs_plugin_loader_list_apps_cache_complete (plugin_loader, g_steal_pointer (&self->cache_entry),
+						   list, error);
+}
+
+static void
+run_query (GTask *task)
+{
+	GsPluginJobListApps *self = g_task_get_source_object (task);
+	GsPluginLoader *plugin_loader = g_task_get_task_data (task);
+	GCancellable *cancellable = g_task_get_cancellable (task);
+	GPtrArray *plugins;  /* (element-type GsPlugin) */
+	gboolean anything_ran = FALSE;
+
 	/* run each plugin, keeping a counter of pending operations which is
 	 * initialised to 1 until all the operations are started */
 	self->n_pending_ops = 1;
+	g_clear_pointer (&self->trace_spans, g_hash_table_unref);
+	self->trace_spans = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify) gs_trace_span_end);
 	self->merged_list = gs_app_list_new ();
 	plugins = gs_plugin_loader_get_plugins (plugin_loader);
 
 	for (guint i = 0; i < plugins->len; i++) {
 		GsPlugin *plugin = g_ptr_array_index (plugins, i);
 		GsPluginClass *plugin_class = GS_PLUGIN_GET_CLASS (plugin);
+		g_autofree gchar *trace_name = NULL;
+		GsTraceSpan *trace_span;
+		guint old_span_id;
 
 		if (!gs_plugin_get_enabled (plugin))
 			continue;
@@ -217,9 +384,15 @@ gs_plugin_job_list_apps_run_async (GsPluginJob         *job,
 		/* at least one plugin supports this vfunc */
 		anything_ran = TRUE;
 
-		/* run the plugin */
+		/* run the plugin, tracing anything it does inside a span */
+		trace_name = g_strconcat ("list-apps:", gs_plugin_get_name (plugin), NULL);
+		trace_span = gs_trace_span_begin (trace_name);
+		g_hash_table_insert (self->trace_spans, plugin, trace_span);
+		old_span_id = gs_trace_set_current_span_id (gs_trace_span_get_id (trace_span));
+
 		self->n_pending_ops++;
 		plugin_class->list_apps_async (plugin, self->query, self->flags, cancellable, plugin_list_apps_cb, g_object_ref (task));
+		gs_trace_set_current_span_id (old_span_id);
 	}
 
 	if (!anything_ran)
@@ -242,6 +415,7 @@ plugin_list_apps_cb (GObject      *source_object,
 
 	plugin_apps = plugin_class->list_apps_finish (plugin, result, &local_error);
 	gs_plugin_status_update (plugin, NULL, GS_PLUGIN_STATUS_FINISHED);
+	g_hash_table_remove (self->trace_spans, plugin);
 
 	if (plugin_apps != NULL)
 		gs_app_list_add_list (self->merged_list, plugin_apps);
@@ -282,6 +456,7 @@ finish_op (GTask  *task,
 	merged_list = g_steal_pointer (&self->merged_list);
 
 	if (self->saved_error != NULL) {
+		complete_cache_entry (task, NULL, self->saved_error);
 		g_task_return_error (task, g_steal_pointer (&self->saved_error));
 		return;
 	}
@@ -304,6 +479,7 @@ finish_op (GTask  *task,
 						    g_object_ref (task));
 	} else {
 		g_debug ("No apps to refine");
+		complete_cache_entry (task, merged_list, NULL);
 		finish_task (task, merged_list);
 	}
 }
@@ -321,10 +497,12 @@ refine_cb (GObject      *source_object,
 	new_list = gs_plugin_loader_job_process_finish (plugin_loader, result, &local_error);
 	if (new_list == NULL) {
 		gs_utils_error_convert_gio (&local_error);
+		complete_cache_entry (task, NULL, local_error);
 		g_task_return_error (task, g_steal_pointer (&local_error));
 		return;
 	}
 
+	complete_cache_entry (task, new_list, NULL);
 	finish_task (task, new_list);
 }
 
@@ -42,6 +42,7 @@
 #include "gs-plugin-job-private.h"
 #include "gs-plugin-private.h"
 #include "gs-plugin-types.h"
+#include "gs-trace.h"
 #include "gs-utils.h"
 
 struct _GsPluginJobListCategories
@@ -55,6 +56,7 @@ struct _GsPluginJobListCategories
 	GPtrArray *category_list;  /* (element-type GsCategory) (owned) (nullable) */
 	GError *saved_error;  /* (owned) (nullable) */
 	guint n_pending_ops;
+	GHashTable *trace_spans;  /* (element-type GsPlugin GsTraceSpan) (owned) (nullable) */
 
 	/* Results. */
 	GPtrArray *result_list;  /* (element-type GsCategory) (owned) (nullable) */
@@ -78,6 +80,7 @@ gs_plugin_job_list_categories_dispose (GObject *object)
 	g_assert (self->n_pending_ops == 0);
 
 	g_clear_pointer (&self->result_list, g_ptr_array_unref);
+	g_clear_pointer (&self->trace_spans, g_hash_table_unref);
 
 	G_OBJECT_CLASS (gs_plugin_job_list_categories_parent_class)->dispose (object);
 }
@@ -155,11 +158,16 @@ gs_plugin_job_list_categories_run_async (GsPluginJob         *job,
 	/* run each plugin, keeping a counter of pending operations which is
 	 * initialised to 1 until all the operations are started */
 	self->n_pending_ops = 1;
+	g_clear_pointer (&self->trace_spans, g_hash_table_unref);
+	self->trace_spans = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify) gs_trace_span_end);
 	plugins = gs_plugin_loader_get_plugins (plugin_loader);
 
 	for (guint i = 0; i < plugins->len; i++) {
 		GsPlugin *plugin = g_ptr_array_index (plugins, i);
 		GsPluginClass *plugin_class = GS_PLUGIN_GET_CLASS (plugin);
+		g_autofree gchar *trace_name = NULL;
+		GsTraceSpan *trace_span;
+		guint old_span_id;
 
 		if (!gs_plugin_get_enabled (plugin))
 			continue;
@@ -169,9 +177,15 @@ gs_plugin_job_list_categories_run_async (GsPluginJob         *job,
 		/* at least one plugin supports this vfunc */
 		anything_ran = TRUE;
 
-		/* run the plugin */
+		/* run the plugin, tracing anything it does inside a span */
+		trace_name = g_strconcat ("list-categories:", gs_plugin_get_name (plugin), NULL);
+		trace_span = gs_trace_span_begin (trace_name);
+		g_hash_table_insert (self->trace_spans, plugin, trace_span);
+		old_span_id = gs_trace_set_current_span_id (gs_trace_span_get_id (trace_span));
+
 		self->n_pending_ops++;
 		plugin_class->refine_categories_async (plugin, self->category_list, self->flags, cancellable, plugin_refine_categories_cb, g_object_ref (task));
+		gs_trace_set_current_span_id (old_span_id);
 	}
 
 	if (!anything_ran)
@@ -188,8 +202,11 @@ plugin_refine_categories_cb (GObject      *source_object,
 	GsPlugin *plugin = GS_PLUGIN (source_object);
 	GsPluginClass *plugin_class = GS_PLUGIN_GET_CLASS (plugin);
 	g_autoptr(GTask) task = G_TASK (user_data);
+	GsPluginJobListCategories *self = g_task_get_source_object (task);
 	g_autoptr(GError) local_error = NULL;
 
+	g_hash_table_remove (self->trace_spans, plugin);
+
 	if (!plugin_class->refine_categories_finish (plugin, result, &local_error)) {
 		finish_op (task, g_steal_pointer (&local_error));
 		return;
@@ -33,17 +33,21 @@
  * into the job will not be modified.
  *
  * Internally, the #GsPluginClass.refine_async() functions are called on all
- * the plugins in series, and in series with a call to
- * gs_odrs_provider_refine_async(). Once all of those calls are finished,
- * zero or more recursive calls to run_refine_internal_async() are made in
- * parallel to do a similar refine process on the addons, runtime and related
- * components for all the components in the input #GsAppList. The refine job is
- * complete once all these recursive calls complete.
+ * the plugins, followed by a call to gs_odrs_provider_refine_async(). Once all
+ * of those calls are finished, zero or more recursive calls to
+ * run_refine_internal_async() are made in parallel to do a similar refine
+ * process on the addons, runtime and related components for all the
+ * components in the input #GsAppList. The refine job is complete once all
+ * these recursive calls complete.
  *
- * FIXME: Ideally, the #GsPluginClass.refine_async() calls would happen in
- * parallel, but this cannot be the case until the results of the refine_async()
- * call in one plugin don’t depend on the results of refine_async() in another.
- * This still happens with several pairs of plugins.
+ * The refine_async() calls are scheduled as a dependency graph built from the
+ * plugin order. A plugin waits for an earlier plugin to finish refining if it
+ * has a %GS_PLUGIN_RULE_RUN_AFTER or %GS_PLUGIN_RULE_RUN_BEFORE rule relating
+ * the two, or if the refine flags they declared with
+ * gs_plugin_set_refine_flags() overlap. Plugins which have not declared
+ * their refine flags wait for all earlier plugins, and all later plugins wait
+ * for them, so they are still refined in series. Independent plugins are
+ * refined in parallel on their own worker threads.
  *
  * ```
  *                                    run_async()
@@ -89,6 +93,8 @@
 #include "gs-enums.h"
 #include "gs-plugin-job-private.h"
 #include "gs-plugin-job-refine.h"
+#include "gs-plugin-private.h"
+#include "gs-trace.h"
 #include "gs-utils.h"
 
 struct _GsPluginJobRefine
@@ -212,6 +218,10 @@ app_is_non_wildcard (GsApp *app, gpointer user_data)
 	return !gs_app_has_quirk (app, GS_APP_QUIRK_IS_WILDCARD);
 }
 
+static gboolean refine_plugin_depends_on (GsPlugin *later,
+                                          GsPlugin *earlier);
+static void start_plugin_refine (GTask *task,
+                                 guint  node_index);
 static void plugin_refine_cb (GObject      *source_object,
                               GAsyncResult *result,
                               gpointer      user_data);
@@ -229,16 +239,33 @@ static gboolean run_refine_internal_finish (GsPluginJobRefine  *self,
                                             GAsyncResult       *result,
                                             GError            **error);
 
+typedef struct {
+	GsPlugin *plugin;  /* (owned) */
+	guint n_pending_deps;
+	GArray *dependents;  /* (element-type guint) (owned) */
+	GsTraceSpan *trace_span;  /* (owned) (nullable); set while refining */
+} RefineNode;
+
+static void
+refine_node_clear (RefineNode *node)
+{
+	g_clear_object (&node->plugin);
+	g_clear_pointer (&node->dependents, g_array_unref);
+	g_clear_pointer (&node->trace_span, gs_trace_span_end);
+}
+
 typedef struct {
 	/* Input data. */
 	GsPluginLoader *plugin_loader;  /* (not nullable) (owned) */
 	GsAppList *list;  /* (not nullable) (owned) */
 	GsPluginRefineFlags flags;
+	guint trace_span_id;  /* span to nest each plugin’s refine inside */
 
 	/* In-progress data. */
 	guint n_pending_ops;
 	guint n_pending_recursions;
-	guint next_plugin_index;
+	GArray *nodes;  /* (element-type RefineNode) (owned) (nullable) */
+	gboolean odrs_started;
 
 	/* Output data. */
 	GError *error;  /* (nullable) (owned) */
@@ -249,6 +276,7 @@ refine_internal_data_free (RefineInternalData *data)
 {
 	g_clear_object (&data->plugin_loader);
 	g_clear_object (&data->list);
+	g_clear_pointer (&data->nodes, g_array_unref);
 
 	g_assert (data->n_pending_ops == 0);
 	g_assert (data->n_pending_recursions == 0);
@@ -283,52 +311,125 @@ run_refine_internal_async (GsPluginJobRefine   *self,
 	data->plugin_loader = g_object_ref (plugin_loader);
 	data->list = g_object_ref (list);
 	data->flags = flags;
+	data->trace_span_id = gs_trace_get_current_span_id ();
 	g_task_set_task_data (task, g_steal_pointer (&data_owned), (GDestroyNotify) refine_internal_data_free);
 
 	/* try to adopt each application with a plugin */
 	gs_plugin_loader_run_adopt (plugin_loader, list);
 
-	data->n_pending_ops = 0;
-
-	/* run each plugin
-	 *
-	 * FIXME: For now, we have to run these vfuncs sequentially rather than
-	 * all in parallel. This is because there are still dependencies between
-	 * some of the plugins, where the code to refine an app in one plugin
-	 * depends on the results of refining it in another plugin first.
-	 *
-	 * Eventually, the plugins should all be changed/removed so that they
-	 * can operate independently. At that point, this code can be reverted
-	 * so that the refine_async() vfuncs are called in parallel. */
+	/* build the dependency graph; the plugins are already sorted by their
+	 * order, so edges only ever point forwards and there are no cycles */
 	plugins = gs_plugin_loader_get_plugins (plugin_loader);
+	data->nodes = g_array_new (FALSE, TRUE, sizeof (RefineNode));
+	g_array_set_clear_func (data->nodes, (GDestroyNotify) refine_node_clear);
 
 	for (guint i = 0; i < plugins->len; i++) {
 		GsPlugin *plugin = g_ptr_array_index (plugins, i);
 		GsPluginClass *plugin_class = GS_PLUGIN_GET_CLASS (plugin);
+		RefineNode node = { NULL, 0, NULL, NULL };
+		guint node_index = data->nodes->len;
 
 		if (!gs_plugin_get_enabled (plugin))
 			continue;
 		if (plugin_class->refine_async == NULL)
 			continue;
 
-		/* FIXME: The next refine_async() call is made in
-		 * finish_refine_internal_op(). */
-		data->next_plugin_index = i + 1;
+		node.plugin = g_object_ref (plugin);
+		node.dependents = g_array_new (FALSE, FALSE, sizeof (guint));
 
-		/* run the batched plugin symbol */
-		data->n_pending_ops++;
-		plugin_class->refine_async (plugin, list, flags,
-					    cancellable, plugin_refine_cb, g_object_ref (task));
+		for (guint j = 0; j < data->nodes->len; j++) {
+			RefineNode *earlier = &g_array_index (data->nodes, RefineNode, j);
 
-		/* FIXME: The next refine_async() call is made in
-		 * finish_refine_internal_op(). */
-		return;
+			if (refine_plugin_depends_on (plugin, earlier->plugin)) {
+				g_array_append_val (earlier->dependents, node_index);
+				node.n_pending_deps++;
+			}
+		}
+
+		g_array_append_val (data->nodes, node);
+	}
+
+	/* start everything with no dependencies; the rest are started from
+	 * plugin_refine_cb() as their dependencies finish. The extra pending op
+	 * stops the job completing before all the roots have been started. */
+	data->n_pending_ops = 1;
+
+	for (guint i = 0; i < data->nodes->len; i++) {
+		if (g_array_index (data->nodes, RefineNode, i).n_pending_deps == 0)
+			start_plugin_refine (task, i);
 	}
 
-	data->n_pending_ops++;
 	finish_refine_internal_op (task, NULL);
 }
 
+static gboolean
+plugin_has_rule_for (GsPlugin     *plugin,
+                     GsPluginRule  rule,
+                     GsPlugin     *other)
+{
+	GPtrArray *names = gs_plugin_get_rules (plugin, rule);
+
+	for (guint i = 0; i < names->len; i++) {
+		if (g_strcmp0 (g_ptr_array_index (names, i), gs_plugin_get_name (other)) == 0)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* Whether @later has to wait for @earlier, which comes before it in the
+ * plugin order, to finish refining before it can start. */
+static gboolean
+refine_plugin_depends_on (GsPlugin *later,
+                          GsPlugin *earlier)
+{
+	GsPluginRefineFlags later_provided, later_required;
+	GsPluginRefineFlags earlier_provided, earlier_required;
+
+	if (!gs_plugin_get_refine_flags (later, &later_provided, &later_required) ||
+	    !gs_plugin_get_refine_flags (earlier, &earlier_provided, &earlier_required))
+		return TRUE;
+
+	/* plugins which can add apps to the list can’t run alongside anything
+	 * else which is iterating over it */
+	if (((later_provided | earlier_provided) & GS_PLUGIN_REFINE_FLAGS_REQUIRE_ID) != 0)
+		return TRUE;
+
+	if (plugin_has_rule_for (later, GS_PLUGIN_RULE_RUN_AFTER, earlier) ||
+	    plugin_has_rule_for (earlier, GS_PLUGIN_RULE_RUN_BEFORE, later))
+		return TRUE;
+
+	/* keep the results the same as when running in series: readers wait
+	 * for writers, and writers of the same data keep their order */
+	return ((later_required & earlier_provided) != 0 ||
+		(later_provided & earlier_provided) != 0 ||
+		(later_provided & earlier_required) != 0);
+}
+
+static void
+start_plugin_refine (GTask *task,
+                     guint  node_index)
+{
+	RefineInternalData *data = g_task_get_task_data (task);
+	RefineNode *node = &g_array_index (data->nodes, RefineNode, node_index);
+	GsPluginClass *plugin_class = GS_PLUGIN_GET_CLASS (node->plugin);
+	g_autofree gchar *trace_name = NULL;
+	guint old_span_id;
+
+	/* dependents are started from the main context, so nest explicitly */
+	trace_name = g_strconcat ("refine:", gs_plugin_get_name (node->plugin), NULL);
+	node->trace_span = gs_trace_span_begin_with_parent (data->trace_span_id, trace_name);
+	gs_trace_span_set_refine_flags (node->trace_span, data->flags);
+
+	/* run the batched plugin symbol */
+	data->n_pending_ops++;
+	old_span_id = gs_trace_set_current_span_id (gs_trace_span_get_id (node->trace_span));
+	plugin_class->refine_async (node->plugin, data->list, data->flags,
+				    g_task_get_cancellable (task),
+				    plugin_refine_cb, g_object_ref (task));
+	gs_trace_set_current_span_id (old_span_id);
+}
+
 static void
 plugin_refine_cb (GObject      *source_object,
                   GAsyncResult *result,
@@ -336,17 +437,35 @@ plugin_refine_cb (GObject      *source_object,
 {
 	GsPlugin *plugin = GS_PLUGIN (source_object);
 	g_autoptr(GTask) task = g_steal_pointer (&user_data);
+	RefineInternalData *data = g_task_get_task_data (task);
 	GsPluginClass *plugin_class = GS_PLUGIN_GET_CLASS (plugin);
 	g_autoptr(GError) local_error = NULL;
 
-	if (!plugin_class->refine_finish (plugin, result, &local_error)) {
-		finish_refine_internal_op (task, g_steal_pointer (&local_error));
-		return;
-	}
+	if (plugin_class->refine_finish (plugin, result, &local_error))
+		gs_plugin_status_update (plugin, NULL, GS_PLUGIN_STATUS_FINISHED);
 
-	gs_plugin_status_update (plugin, NULL, GS_PLUGIN_STATUS_FINISHED);
+	/* start any plugins which were only waiting for this one; this is
+	 * done even on error, as it was when the plugins ran in series */
+	for (guint i = 0; i < data->nodes->len; i++) {
+		RefineNode *node = &g_array_index (data->nodes, RefineNode, i);
 
-	finish_refine_internal_op (task, NULL);
+		if (node->plugin != plugin)
+			continue;
+
+		g_clear_pointer (&node->trace_span, gs_trace_span_end);
+
+		for (guint j = 0; j < node->dependents->len; j++) {
+			guint dependent_index = g_array_index (node->dependents, guint, j);
+			RefineNode *dependent = &g_array_index (data->nodes, RefineNode, dependent_index);
+
+			g_assert (dependent->n_pending_deps > 0);
+			if (--dependent->n_pending_deps == 0)
+				start_plugin_refine (task, dependent_index);
+		}
+		break;
+	}
+
+	finish_refine_internal_op (task, g_steal_pointer (&local_error));
 }
 
 static void
@@ -376,7 +495,6 @@ finish_refine_internal_op (GTask  *task,
 	GsPluginRefineFlags flags = data->flags;
 	GsOdrsProvider *odrs_provider;
 	GsOdrsProviderRefineFlags odrs_refine_flags = 0;
-	GPtrArray *plugins;  /* (element-type GsPlugin) */
 
 	if (data->error == NULL && error_owned != NULL) {
 		data->error = g_steal_pointer (&error_owned);
@@ -387,34 +505,9 @@ finish_refine_internal_op (GTask  *task,
 	g_assert (data->n_pending_ops > 0);
 	data->n_pending_ops--;
 
-	plugins = gs_plugin_loader_get_plugins (plugin_loader);
-
-	for (guint i = data->next_plugin_index; i < plugins->len; i++) {
-		GsPlugin *plugin = g_ptr_array_index (plugins, i);
-		GsPluginClass *plugin_class = GS_PLUGIN_GET_CLASS (plugin);
-
-		if (!gs_plugin_get_enabled (plugin))
-			continue;
-		if (plugin_class->refine_async == NULL)
-			continue;
-
-		/* FIXME: The next refine_async() call is made in
-		 * finish_refine_internal_op(). */
-		data->next_plugin_index = i + 1;
-
-		/* run the batched plugin symbol */
-		data->n_pending_ops++;
-		plugin_class->refine_async (plugin, list, flags,
-					    cancellable, plugin_refine_cb, g_object_ref (task));
-
-		/* FIXME: The next refine_async() call is made in
-		 * finish_refine_internal_op(). */
-		return;
-	}
-
-	if (data->next_plugin_index == plugins->len) {
-		/* Avoid the ODRS refine being run multiple times. */
-		data->next_plugin_index++;
+	/* once all the plugins have finished, add the ODRS data */
+	if (data->n_pending_ops == 0 && !data->odrs_started) {
+		data->odrs_started = TRUE;
 
 		/* Add ODRS data if needed */
 		odrs_provider = gs_plugin_loader_get_odrs_provider (plugin_loader);
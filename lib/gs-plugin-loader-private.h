@@ -0,0 +1,44 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2023 Vanilla OS Contributors
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+#include "gs-app-list.h"
+#include "gs-plugin-loader.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GsPluginLoaderListAppsEntry GsPluginLoaderListAppsEntry;
+
+/**
+ * GsPluginLoaderListAppsFunc:
+ * @task: the task passed to gs_plugin_loader_list_apps_cache_lookup()
+ * @list: (nullable) (transfer none): the results of the query, which the
+ *    callee may modify, or %NULL on error
+ * @error: (nullable): the error from the query, or %NULL on success
+ *
+ * Called with the results of a list-apps query which were cached or
+ * shared with another job running the same query.
+ */
+typedef void (*GsPluginLoaderListAppsFunc) (GTask		*task,
+					    GsAppList		*list,
+					    const GError	*error);
+
+gboolean	 gs_plugin_loader_list_apps_cache_lookup	(GsPluginLoader			*plugin_loader,
+								 const gchar			*key,
+								 GTask				*task,
+								 GsPluginLoaderListAppsFunc	 func,
+								 GsPluginLoaderListAppsEntry	**entry_out);
+void		 gs_plugin_loader_list_apps_cache_complete	(GsPluginLoader			*plugin_loader,
+								 GsPluginLoaderListAppsEntry	*entry,
+								 GsAppList			*list,
+								 const GError			*error);
+
+G_END_DECLS
@@ -14,6 +14,7 @@
 #include <glib/gstdio.h>
 #include <appstream.h>
 #include <math.h>
+#include <string.h>
 
 #ifdef HAVE_SYSPROF
 #include <sysprof-capture.h>
@@ -25,17 +26,26 @@
 #include "gs-category-manager.h"
 #include "gs-category-private.h"
 #include "gs-external-appstream-utils.h"
+#include "gs-cache-manager.h"
 #include "gs-ioprio.h"
 #include "gs-os-release.h"
 #include "gs-plugin-loader.h"
+#include "gs-plugin-loader-private.h"
 #include "gs-plugin.h"
 #include "gs-plugin-event.h"
 #include "gs-plugin-job-private.h"
 #include "gs-plugin-private.h"
+#include "gs-trace.h"
 #include "gs-utils.h"
+#include "gs-worker-thread.h"
 
 #define GS_PLUGIN_LOADER_UPDATES_CHANGED_DELAY	3	/* s */
 #define GS_PLUGIN_LOADER_RELOAD_DELAY		5	/* s */
+#define GS_PLUGIN_LOADER_CACHE_COMPACT_DELAY	60	/* s */
+#define GS_PLUGIN_LOADER_CACHE_COMPACT_INTERVAL	(6 * 60 * 60)	/* s */
+#define GS_PLUGIN_LOADER_LIST_APPS_CACHE_SIZE	64
+
+typedef struct _GsPluginAdoptIndex GsPluginAdoptIndex;
 
 struct _GsPluginLoader
 {
@@ -45,6 +55,7 @@ struct _GsPluginLoader
 	GCancellable		*setup_complete_cancellable;  /* (nullable) (owned) */
 
 	GPtrArray		*plugins;
+	GsPluginAdoptIndex	*adopt_index;  /* (owned) (nullable); built at setup */
 	GPtrArray		*locations;
 	gchar			*language;
 	gboolean		 plugin_dir_dirty;
@@ -62,12 +73,18 @@ struct _GsPluginLoader
 	GMutex			 events_by_id_mutex;
 	GHashTable		*events_by_id;		/* unique-id : GsPluginEvent */
 
+	GMutex			 list_apps_cache_mutex;
+	GHashTable		*list_apps_cache;	/* key : GsPluginLoaderListAppsEntry */
+	GQueue			 list_apps_cache_lru;	/* (element-type GsPluginLoaderListAppsEntry) finished entries, least recently used first */
+	guint			 list_apps_cache_generation;
+
 	gchar			**compatible_projects;
 	guint			 scale;
 
 	guint			 updates_changed_id;
 	guint			 updates_changed_cnt;
 	guint			 reload_id;
+	guint			 cache_compact_id;
 	GHashTable		*disallow_updates;	/* GsPlugin : const char *name */
 
 	GNetworkMonitor		*network_monitor;
@@ -498,13 +515,178 @@ gs_plugin_error_handle_failure (GsPluginLoaderHelper *helper,
 	return TRUE;
 }
 
+typedef struct {
+	GsPlugin		*plugin;  /* (unowned) */
+	GsPluginAdoptAppFunc	 adopt_app_func;
+} GsPluginAdopter;
+
+/* Which plugins may adopt which apps, as declared with
+ * gs_plugin_add_adopt_bundle_kind() and friends. Each value is a #GArray of
+ * indices into @adopters, in plugin order. */
+struct _GsPluginAdoptIndex {
+	GArray		*adopters;  /* (element-type GsPluginAdopter) */
+	GHashTable	*by_bundle_kind;  /* (element-type AsBundleKind GArray<guint>) */
+	GHashTable	*by_component_kind;  /* (element-type AsComponentKind GArray<guint>) */
+	GHashTable	*by_origin;  /* (element-type utf8 GArray<guint>) */
+	GArray		*unclaimed;  /* (element-type guint), plugins which declared nothing */
+};
+
+static void
+gs_plugin_adopt_index_free (GsPluginAdoptIndex *index)
+{
+	g_array_unref (index->adopters);
+	g_hash_table_unref (index->by_bundle_kind);
+	g_hash_table_unref (index->by_component_kind);
+	g_hash_table_unref (index->by_origin);
+	g_array_unref (index->unclaimed);
+	g_free (index);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GsPluginAdoptIndex, gs_plugin_adopt_index_free)
+
+static void
+gs_plugin_adopt_index_add (GHashTable *table, gpointer key, guint adopter_idx)
+{
+	GArray *adopters = g_hash_table_lookup (table, key);
+
+	if (adopters == NULL) {
+		adopters = g_array_new (FALSE, FALSE, sizeof (guint));
+		g_hash_table_insert (table, key, adopters);
+	}
+
+	/* a plugin may have declared the same thing twice */
+	if (adopters->len > 0 &&
+	    g_array_index (adopters, guint, adopters->len - 1) == adopter_idx)
+		return;
+	g_array_append_val (adopters, adopter_idx);
+}
+
+/* The plugins must already be sorted. */
+static GsPluginAdoptIndex *
+gs_plugin_adopt_index_new (GPtrArray *plugins)
+{
+	g_autoptr(GsPluginAdoptIndex) index = g_new0 (GsPluginAdoptIndex, 1);
+
+	index->adopters = g_array_new (FALSE, FALSE, sizeof (GsPluginAdopter));
+	index->by_bundle_kind = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+						       NULL, (GDestroyNotify) g_array_unref);
+	index->by_component_kind = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+							  NULL, (GDestroyNotify) g_array_unref);
+	index->by_origin = g_hash_table_new_full (g_str_hash, g_str_equal,
+						  g_free, (GDestroyNotify) g_array_unref);
+	index->unclaimed = g_array_new (FALSE, FALSE, sizeof (guint));
+
+	for (guint i = 0; i < plugins->len; i++) {
+		GsPlugin *plugin = g_ptr_array_index (plugins, i);
+		GsPluginAdopter adopter = { plugin, NULL };
+		GArray *bundle_kinds, *component_kinds;
+		GPtrArray *origins;
+		guint idx;
+
+		/* the symbol is only looked up once, here */
+		adopter.adopt_app_func = gs_plugin_get_symbol (plugin, "gs_plugin_adopt_app");
+		if (adopter.adopt_app_func == NULL)
+			continue;
+
+		idx = index->adopters->len;
+		g_array_append_val (index->adopters, adopter);
+
+		if (!gs_plugin_get_adopt_claims (plugin, &bundle_kinds, &component_kinds, &origins)) {
+			g_array_append_val (index->unclaimed, idx);
+			continue;
+		}
+
+		for (guint j = 0; bundle_kinds != NULL && j < bundle_kinds->len; j++) {
+			AsBundleKind bundle_kind = g_array_index (bundle_kinds, AsBundleKind, j);
+			gs_plugin_adopt_index_add (index->by_bundle_kind, GUINT_TO_POINTER (bundle_kind), idx);
+		}
+		for (guint j = 0; component_kinds != NULL && j < component_kinds->len; j++) {
+			AsComponentKind kind = g_array_index (component_kinds, AsComponentKind, j);
+			gs_plugin_adopt_index_add (index->by_component_kind, GUINT_TO_POINTER (kind), idx);
+		}
+		for (guint j = 0; origins != NULL && j < origins->len; j++) {
+			const gchar *origin = g_ptr_array_index (origins, j);
+			if (!g_hash_table_contains (index->by_origin, origin))
+				g_hash_table_insert (index->by_origin, g_strdup (origin),
+						     g_array_new (FALSE, FALSE, sizeof (guint)));
+			gs_plugin_adopt_index_add (index->by_origin, (gpointer) origin, idx);
+		}
+	}
+
+	return g_steal_pointer (&index);
+}
+
+static void
+gs_plugin_adopt_index_adopt (GsPluginAdoptIndex *index, GsApp *app)
+{
+	GArray *sources[4];
+	guint candidates[64];
+	guint n_candidates = 0;
+	const gchar *origin = gs_app_get_origin (app);
+
+	sources[0] = g_hash_table_lookup (index->by_bundle_kind,
+					  GUINT_TO_POINTER (gs_app_get_bundle_kind (app)));
+	sources[1] = g_hash_table_lookup (index->by_component_kind,
+					  GUINT_TO_POINTER (gs_app_get_kind (app)));
+	sources[2] = (origin != NULL) ? g_hash_table_lookup (index->by_origin, origin) : NULL;
+	sources[3] = index->unclaimed;
+
+	/* merge the candidates into plugin order, each at most once; there
+	 * are only a handful, so an insertion sort is fine */
+	for (gsize i = 0; i < G_N_ELEMENTS (sources); i++) {
+		for (guint j = 0; sources[i] != NULL && j < sources[i]->len; j++) {
+			guint idx = g_array_index (sources[i], guint, j);
+			guint pos = n_candidates;
+
+			while (pos > 0 && candidates[pos - 1] > idx)
+				pos--;
+			if (pos > 0 && candidates[pos - 1] == idx)
+				continue;
+			if (n_candidates == G_N_ELEMENTS (candidates)) {
+				g_warn_if_reached ();
+				break;
+			}
+			memmove (&candidates[pos + 1], &candidates[pos],
+				 (n_candidates - pos) * sizeof (guint));
+			candidates[pos] = idx;
+			n_candidates++;
+		}
+	}
+
+	/* call them in order until one of them adopts the app */
+	for (guint i = 0; i < n_candidates; i++) {
+		const GsPluginAdopter *adopter;
+
+		adopter = &g_array_index (index->adopters, GsPluginAdopter, candidates[i]);
+
+		/* the index is built before setup, which may disable plugins */
+		if (!gs_plugin_get_enabled (adopter->plugin))
+			continue;
+
+		adopter->adopt_app_func (adopter->plugin, app);
+
+		if (!gs_app_has_management_plugin (app, NULL)) {
+			g_debug ("%s adopted %s",
+				 gs_plugin_get_name (adopter->plugin),
+				 gs_app_get_unique_id (app));
+			return;
+		}
+	}
+
+	g_debug ("nothing adopted %s", gs_app_get_unique_id (app));
+}
+
 /**
  * gs_plugin_loader_run_adopt:
  * @plugin_loader: a #GsPluginLoader
  * @list: list of apps to try and adopt
  *
- * Call the gs_plugin_adopt_app() function on each plugin on each app in @list
- * to try and find the plugin which should manage each app.
+ * Call the gs_plugin_adopt_app() function on each plugin which may adopt each
+ * app in @list, to try and find the plugin which should manage each app.
+ *
+ * Plugins are only asked about the apps they declared they may adopt, using
+ * gs_plugin_add_adopt_bundle_kind() and friends. Plugins which declared
+ * nothing are asked about every app.
  *
  * This function is intended to be used by internal gnome-software code.
  *
@@ -513,42 +695,22 @@ gs_plugin_error_handle_failure (GsPluginLoaderHelper *helper,
 void
 gs_plugin_loader_run_adopt (GsPluginLoader *plugin_loader, GsAppList *list)
 {
-	guint i;
-	guint j;
+	g_autoptr(GsPluginAdoptIndex) index_tmp = NULL;
+	GsPluginAdoptIndex *index = plugin_loader->adopt_index;
 
-	/* go through each plugin in order */
-	for (i = 0; i < plugin_loader->plugins->len; i++) {
-		GsPluginAdoptAppFunc adopt_app_func = NULL;
-		GsPlugin *plugin = g_ptr_array_index (plugin_loader->plugins, i);
-		adopt_app_func = gs_plugin_get_symbol (plugin, "gs_plugin_adopt_app");
-		if (adopt_app_func == NULL)
-			continue;
-		for (j = 0; j < gs_app_list_length (list); j++) {
-			GsApp *app = gs_app_list_index (list, j);
+	/* not set up yet */
+	if (index == NULL)
+		index = index_tmp = gs_plugin_adopt_index_new (plugin_loader->plugins);
 
-			if (gs_app_has_quirk (app, GS_APP_QUIRK_IS_WILDCARD))
-				continue;
-			if (!gs_app_has_management_plugin (app, NULL))
-				continue;
-
-			adopt_app_func (plugin, app);
-
-			if (!gs_app_has_management_plugin (app, NULL)) {
-				g_debug ("%s adopted %s",
-					 gs_plugin_get_name (plugin),
-					 gs_app_get_unique_id (app));
-			}
-		}
-	}
-	for (j = 0; j < gs_app_list_length (list); j++) {
-		GsApp *app = gs_app_list_index (list, j);
+	for (guint i = 0; i < gs_app_list_length (list); i++) {
+		GsApp *app = gs_app_list_index (list, i);
 
 		if (gs_app_has_quirk (app, GS_APP_QUIRK_IS_WILDCARD))
 			continue;
 		if (!gs_app_has_management_plugin (app, NULL))
 			continue;
 
-		g_debug ("nothing adopted %s", gs_app_get_unique_id (app));
+		gs_plugin_adopt_index_adopt (index, app);
 	}
 }
 
@@ -567,6 +729,9 @@ gs_plugin_loader_call_vfunc (GsPluginLoaderHelper *helper,
 	gpointer func = NULL;
 	g_autoptr(GError) error_local = NULL;
 	g_autoptr(GTimer) timer = g_timer_new ();
+	g_autoptr(GsTraceSpan) trace_span = NULL;
+	g_autofree gchar *trace_name = NULL;
+	guint old_span_id;
 #ifdef HAVE_SYSPROF
 	gint64 begin_time_nsec = SYSPROF_CAPTURE_CURRENT_TIME;
 #endif
@@ -590,6 +755,15 @@ gs_plugin_loader_call_vfunc (GsPluginLoaderHelper *helper,
 	/* set what plugin is running on the job */
 	gs_plugin_job_set_plugin (helper->plugin_job, plugin);
 
+	/* anything the plugin traces is nested inside this */
+	trace_name = g_strconcat ("vfunc:", gs_plugin_get_name (plugin), ":",
+				  helper->function_name, NULL);
+	trace_span = gs_trace_span_begin (trace_name);
+	if (app != NULL)
+		gs_trace_span_set_app_id (trace_span, gs_app_get_id (app));
+	gs_trace_span_set_refine_flags (trace_span, refine_flags);
+	old_span_id = gs_trace_set_current_span_id (gs_trace_span_get_id (trace_span));
+
 	/* run the correct vfunc */
 	if (gs_plugin_job_get_interactive (helper->plugin_job))
 		gs_plugin_interactive_inc (plugin);
@@ -669,6 +843,7 @@ gs_plugin_loader_call_vfunc (GsPluginLoaderHelper *helper,
 	}
 	if (gs_plugin_job_get_interactive (helper->plugin_job))
 		gs_plugin_interactive_dec (plugin);
+	gs_trace_set_current_span_id (old_span_id);
 
 	/* plugin did not return error on cancellable abort */
 	if (ret && g_cancellable_set_error_if_cancelled (cancellable, &error_local)) {
@@ -1517,6 +1692,221 @@ gs_plugin_loader_ask_untrusted_cb (GsPlugin *plugin,
 	return accepts;
 }
 
+/* The results of a list-apps query, keyed by the query. The apps are listed
+ * and refined, but the query’s own filtering, sorting and truncation haven’t
+ * been applied yet, as those can differ between callers. */
+struct _GsPluginLoaderListAppsEntry {
+	gchar			*key;  /* (owned) */
+	guint			 generation;
+	GsAppList		*list;  /* (owned) (nullable); NULL while the query is in flight */
+	GPtrArray		*waiters;  /* (element-type ListAppsWaiter) (owned) (nullable) */
+};
+
+typedef struct {
+	GTask			*task;  /* (owned) */
+	GsPluginLoaderListAppsFunc func;
+	GsAppList		*list;  /* (owned) (nullable) */
+	GError			*error;  /* (owned) (nullable) */
+} ListAppsWaiter;
+
+static void
+list_apps_waiter_free (ListAppsWaiter *waiter)
+{
+	g_object_unref (waiter->task);
+	g_clear_object (&waiter->list);
+	g_clear_error (&waiter->error);
+	g_free (waiter);
+}
+
+static void
+list_apps_entry_free (GsPluginLoaderListAppsEntry *entry)
+{
+	g_free (entry->key);
+	g_clear_object (&entry->list);
+	g_clear_pointer (&entry->waiters, g_ptr_array_unref);
+	g_free (entry);
+}
+
+static void
+gs_plugin_loader_list_apps_cache_invalidate (GsPluginLoader *plugin_loader)
+{
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&plugin_loader->list_apps_cache_mutex);
+	GHashTableIter iter;
+	gpointer value;
+
+	g_debug ("invalidating %u cached list-apps results",
+		 g_queue_get_length (&plugin_loader->list_apps_cache_lru));
+
+	/* queries which are in flight are detached rather than removed, as
+	 * the jobs running them still need them; the new generation stops
+	 * their results from being cached */
+	plugin_loader->list_apps_cache_generation++;
+	g_queue_clear (&plugin_loader->list_apps_cache_lru);
+
+	g_hash_table_iter_init (&iter, plugin_loader->list_apps_cache);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		GsPluginLoaderListAppsEntry *entry = value;
+
+		if (entry->list == NULL)
+			g_hash_table_iter_steal (&iter);
+		else
+			g_hash_table_iter_remove (&iter);
+	}
+}
+
+/**
+ * gs_plugin_loader_list_apps_cache_lookup:
+ * @plugin_loader: a #GsPluginLoader
+ * @key: a string identifying the query and how its results are refined
+ * @task: the task for the job running the query
+ * @func: function to call with the results for @task
+ * @entry_out: (out): return location for the entry to complete
+ *
+ * Looks up the results of a list-apps query in the cache.
+ *
+ * If they are cached, @func is called with a copy of them straight away. If
+ * an identical query is in flight, @func will be called with its results
+ * once it completes, in the thread-default main context of @task. In both
+ * cases %TRUE is returned.
+ *
+ * Otherwise %FALSE is returned, and the caller has to run the query and pass
+ * its results to gs_plugin_loader_list_apps_cache_complete() with
+ * @entry_out, so that other callers of this function can share them.
+ *
+ * Returns: %TRUE if @func will be called with the results
+ */
+gboolean
+gs_plugin_loader_list_apps_cache_lookup (GsPluginLoader			*plugin_loader,
+					 const gchar			*key,
+					 GTask				*task,
+					 GsPluginLoaderListAppsFunc	 func,
+					 GsPluginLoaderListAppsEntry	**entry_out)
+{
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&plugin_loader->list_apps_cache_mutex);
+	GsPluginLoaderListAppsEntry *entry;
+
+	entry = g_hash_table_lookup (plugin_loader->list_apps_cache, key);
+
+	if (entry != NULL && entry->list != NULL) {
+		g_autoptr(GsAppList) list = gs_app_list_copy (entry->list);
+
+		/* keep the most recently used last */
+		g_queue_remove (&plugin_loader->list_apps_cache_lru, entry);
+		g_queue_push_tail (&plugin_loader->list_apps_cache_lru, entry);
+		g_clear_pointer (&locker, g_mutex_locker_free);
+
+		g_debug ("using cached results for list-apps %s", key);
+		func (task, list, NULL);
+		return TRUE;
+	}
+
+	if (entry != NULL) {
+		ListAppsWaiter *waiter = g_new0 (ListAppsWaiter, 1);
+
+		waiter->task = g_object_ref (task);
+		waiter->func = func;
+		g_ptr_array_add (entry->waiters, waiter);
+
+		g_debug ("waiting for identical list-apps %s", key);
+		return TRUE;
+	}
+
+	entry = g_new0 (GsPluginLoaderListAppsEntry, 1);
+	entry->key = g_strdup (key);
+	entry->generation = plugin_loader->list_apps_cache_generation;
+	entry->waiters = g_ptr_array_new_with_free_func ((GDestroyNotify) list_apps_waiter_free);
+	g_hash_table_insert (plugin_loader->list_apps_cache, entry->key, entry);
+
+	*entry_out = entry;
+	return FALSE;
+}
+
+static gboolean
+list_apps_waiter_cb (gpointer user_data)
+{
+	ListAppsWaiter *waiter = user_data;
+
+	waiter->func (waiter->task, waiter->list, waiter->error);
+
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * gs_plugin_loader_list_apps_cache_complete:
+ * @plugin_loader: a #GsPluginLoader
+ * @entry: (transfer full): the entry from gs_plugin_loader_list_apps_cache_lookup()
+ * @list: (nullable): the results of the query, or %NULL on error
+ * @error: (nullable): the error from the query, or %NULL on success
+ *
+ * Passes the results of a query to everything waiting for them, and caches
+ * them unless the query failed or the cache was invalidated while it ran.
+ */
+void
+gs_plugin_loader_list_apps_cache_complete (GsPluginLoader		*plugin_loader,
+					   GsPluginLoaderListAppsEntry	*entry,
+					   GsAppList			*list,
+					   const GError			*error)
+{
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&plugin_loader->list_apps_cache_mutex);
+	g_autoptr(GPtrArray) waiters = g_steal_pointer (&entry->waiters);
+
+	if (entry->generation != plugin_loader->list_apps_cache_generation) {
+		/* detached by gs_plugin_loader_list_apps_cache_invalidate() */
+		list_apps_entry_free (entry);
+	} else if (error != NULL || list == NULL) {
+		g_hash_table_remove (plugin_loader->list_apps_cache, entry->key);
+	} else {
+		entry->list = gs_app_list_copy (list);
+		g_queue_push_tail (&plugin_loader->list_apps_cache_lru, entry);
+
+		while (g_queue_get_length (&plugin_loader->list_apps_cache_lru) > GS_PLUGIN_LOADER_LIST_APPS_CACHE_SIZE) {
+			GsPluginLoaderListAppsEntry *oldest = g_queue_pop_head (&plugin_loader->list_apps_cache_lru);
+			g_hash_table_remove (plugin_loader->list_apps_cache, oldest->key);
+		}
+	}
+	g_clear_pointer (&locker, g_mutex_locker_free);
+
+	/* each waiter gets its own copy, as the job filters and sorts it */
+	g_ptr_array_set_free_func (waiters, NULL);
+	for (guint i = 0; i < waiters->len; i++) {
+		ListAppsWaiter *waiter = g_ptr_array_index (waiters, i);
+
+		if (list != NULL && error == NULL)
+			waiter->list = gs_app_list_copy (list);
+		else
+			waiter->error = (error != NULL) ? g_error_copy (error) : g_error_new_literal (GS_PLUGIN_ERROR, GS_PLUGIN_ERROR_FAILED, "No results");
+
+		g_main_context_invoke_full (g_task_get_context (waiter->task), G_PRIORITY_DEFAULT,
+					    list_apps_waiter_cb, waiter,
+					    (GDestroyNotify) list_apps_waiter_free);
+	}
+}
+
+/* Whether running @plugin_job may change which apps any list-apps query
+ * returns, or their state. */
+static gboolean
+plugin_job_may_change_apps (GsPluginJob *plugin_job)
+{
+	if (GS_IS_PLUGIN_JOB_REFINE (plugin_job) ||
+	    GS_IS_PLUGIN_JOB_LIST_APPS (plugin_job) ||
+	    GS_IS_PLUGIN_JOB_LIST_CATEGORIES (plugin_job) ||
+	    GS_IS_PLUGIN_JOB_LIST_DISTRO_UPGRADES (plugin_job))
+		return FALSE;
+
+	switch (gs_plugin_job_get_action (plugin_job)) {
+	case GS_PLUGIN_ACTION_LAUNCH:
+	case GS_PLUGIN_ACTION_GET_UPDATES:
+	case GS_PLUGIN_ACTION_GET_SOURCES:
+	case GS_PLUGIN_ACTION_FILE_TO_APP:
+	case GS_PLUGIN_ACTION_URL_TO_APP:
+	case GS_PLUGIN_ACTION_GET_UPDATES_HISTORICAL:
+	case GS_PLUGIN_ACTION_GET_LANGPACKS:
+		return FALSE;
+	default:
+		return TRUE;
+	}
+}
+
 static gboolean
 gs_plugin_loader_job_updates_changed_delay_cb (gpointer user_data)
 {
@@ -1549,6 +1939,7 @@ gs_plugin_loader_job_updates_changed_cb (GsPlugin *plugin,
 					 GsPluginLoader *plugin_loader)
 {
 	plugin_loader->updates_changed_cnt++;
+	gs_plugin_loader_list_apps_cache_invalidate (plugin_loader);
 
 	/* Schedule emit of updates changed when no job is active.
 	   This helps to avoid a race condition when a plugin calls
@@ -1576,6 +1967,8 @@ static void
 gs_plugin_loader_reload_cb (GsPlugin *plugin,
 			    GsPluginLoader *plugin_loader)
 {
+	gs_plugin_loader_list_apps_cache_invalidate (plugin_loader);
+
 	if (plugin_loader->reload_id != 0)
 		return;
 	plugin_loader->reload_id =
@@ -1591,6 +1984,8 @@ gs_plugin_loader_repository_changed_cb (GsPlugin *plugin,
 {
 	GApplication *application = g_application_get_default ();
 
+	gs_plugin_loader_list_apps_cache_invalidate (plugin_loader);
+
 	/* Can be NULL when running the self tests */
 	if (application) {
 		g_signal_emit_by_name (application,
@@ -1748,6 +2143,8 @@ gs_plugin_loader_clear_caches (GsPluginLoader *plugin_loader)
 		GsPlugin *plugin = g_ptr_array_index (plugin_loader->plugins, i);
 		gs_plugin_cache_invalidate (plugin);
 	}
+
+	gs_plugin_loader_list_apps_cache_invalidate (plugin_loader);
 }
 
 static void
@@ -1921,6 +2318,48 @@ notify_setup_complete (GsPluginLoader *plugin_loader)
 	g_clear_object (&plugin_loader->setup_complete_cancellable);
 }
 
+static void
+gs_plugin_loader_cache_compact_finished_cb (GObject      *source_object,
+                                            GAsyncResult *result,
+                                            gpointer      user_data)
+{
+	g_autoptr(GError) local_error = NULL;
+
+	if (!gs_cache_manager_compact_finish (result, &local_error))
+		g_debug ("Failed to compact the cache: %s", local_error->message);
+}
+
+static gboolean
+gs_plugin_loader_cache_compact_cb (gpointer user_data)
+{
+	GsPluginLoader *plugin_loader = GS_PLUGIN_LOADER (user_data);
+
+	gs_cache_manager_compact_async (NULL, gs_plugin_loader_cache_compact_finished_cb, NULL);
+
+	/* and again every so often, for long running sessions */
+	plugin_loader->cache_compact_id =
+		g_timeout_add_seconds_full (G_PRIORITY_LOW,
+					    GS_PLUGIN_LOADER_CACHE_COMPACT_INTERVAL,
+					    gs_plugin_loader_cache_compact_cb,
+					    plugin_loader, NULL);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Keeps the screenshot and icon caches within their budgets, once startup
+ * has settled down. */
+static void
+gs_plugin_loader_schedule_cache_compact (GsPluginLoader *plugin_loader)
+{
+	if (plugin_loader->cache_compact_id != 0)
+		return;
+	plugin_loader->cache_compact_id =
+		g_timeout_add_seconds_full (G_PRIORITY_LOW,
+					    GS_PLUGIN_LOADER_CACHE_COMPACT_DELAY,
+					    gs_plugin_loader_cache_compact_cb,
+					    plugin_loader, NULL);
+}
+
 /**
  * gs_plugin_loader_setup_async:
  * @plugin_loader: a #GsPluginLoader
@@ -2246,6 +2685,10 @@ finish_setup_get_bus (GTask *task)
 		}
 	} while (changes);
 
+	/* work out which plugins can adopt which apps, now they are in order */
+	g_clear_pointer (&plugin_loader->adopt_index, gs_plugin_adopt_index_free);
+	plugin_loader->adopt_index = gs_plugin_adopt_index_new (plugin_loader->plugins);
+
 	/* run setup */
 	data->n_pending = 1;  /* incremented until all operations have been started */
 #ifdef HAVE_SYSPROF
@@ -2334,6 +2777,7 @@ finish_setup_op (GTask *task)
 	 * processed. Indeed, the final step in setup is to refine the install
 	 * queue apps, which requires @setup_complete to be %TRUE. */
 	notify_setup_complete (plugin_loader);
+	gs_plugin_loader_schedule_cache_compact (plugin_loader);
 
 #ifdef HAVE_SYSPROF
 	if (plugin_loader->sysprof_writer != NULL) {
@@ -2450,6 +2894,9 @@ gs_plugin_loader_dump_state (GsPluginLoader *plugin_loader)
 {
 	g_autoptr(GString) str_enabled = g_string_new (NULL);
 	g_autoptr(GString) str_disabled = g_string_new (NULL);
+	g_autofree gchar *trace_filename = NULL;
+	g_autoptr(GError) error_local = NULL;
+	g_autoptr(GPtrArray) workers = NULL;
 
 	/* print what the priorities are if verbose */
 	for (guint i = 0; i < plugin_loader->plugins->len; i++) {
@@ -2467,6 +2914,70 @@ gs_plugin_loader_dump_state (GsPluginLoader *plugin_loader)
 		g_string_truncate (str_disabled, str_disabled->len - 2);
 	g_info ("enabled plugins: %s", str_enabled->str);
 	g_info ("disabled plugins: %s", str_disabled->str);
+
+	/* how busy the plugins’ worker threads are */
+	workers = gs_worker_thread_dup_all ();
+	for (guint i = 0; i < workers->len; i++) {
+		GsWorkerThread *worker = g_ptr_array_index (workers, i);
+		GsWorkerThreadMetrics metrics;
+
+		gs_worker_thread_get_metrics (worker, &metrics);
+		g_info ("worker %s: %u queued, %u running, %" G_GUINT64_FORMAT " completed, "
+			"%" G_GUINT64_FORMAT " promoted, wait p50/p99 %" G_GINT64_FORMAT "/%" G_GINT64_FORMAT "us, "
+			"run p50/p99 %" G_GINT64_FORMAT "/%" G_GINT64_FORMAT "us",
+			gs_worker_thread_get_name (worker),
+			metrics.n_queued, metrics.n_running,
+			metrics.n_completed, metrics.n_promoted,
+			metrics.wait_p50_usec, metrics.wait_p99_usec,
+			metrics.run_p50_usec, metrics.run_p99_usec);
+	}
+
+	/* save what recently ran, for opening in a trace viewer; this writes
+	 * to disk on the main thread, so only when debugging */
+	if (g_getenv ("GS_DEBUG_TRACE") == NULL &&
+	    g_getenv ("GS_DEBUG") == NULL &&
+	    g_log_writer_default_would_drop (G_LOG_LEVEL_DEBUG, G_LOG_DOMAIN))
+		return;
+
+	trace_filename = gs_plugin_loader_dump_trace (plugin_loader, &error_local);
+	if (trace_filename == NULL)
+		g_debug ("failed to save trace: %s", error_local->message);
+}
+
+/**
+ * gs_plugin_loader_dump_trace:
+ * @plugin_loader: a #GsPluginLoader
+ * @error: return location for a #GError, or %NULL
+ *
+ * Save the recently finished jobs, plugin vfuncs and other traced
+ * operations to a JSON file in the cache directory, in the format understood
+ * by Perfetto and `chrome://tracing`. See gs_trace_dump().
+ *
+ * Returns: (transfer full) (nullable): the filename the trace was saved to,
+ *    or %NULL on error
+ * Since: 43
+ */
+gchar *
+gs_plugin_loader_dump_trace (GsPluginLoader  *plugin_loader,
+                             GError         **error)
+{
+	g_autofree gchar *filename = NULL;
+	g_autoptr(GError) error_local = NULL;
+
+	g_return_val_if_fail (GS_IS_PLUGIN_LOADER (plugin_loader), NULL);
+	g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+	filename = gs_utils_get_cache_filename ("trace", "trace.json",
+						GS_UTILS_CACHE_FLAG_WRITEABLE |
+						GS_UTILS_CACHE_FLAG_CREATE_DIRECTORY,
+						&error_local);
+	if (filename == NULL || !gs_trace_dump (filename, &error_local)) {
+		g_propagate_error (error, g_steal_pointer (&error_local));
+		return NULL;
+	}
+
+	g_info ("saved trace to %s", filename);
+	return g_steal_pointer (&filename);
 }
 
 static void
@@ -2541,10 +3052,21 @@ gs_plugin_loader_dispose (GObject *object)
 
 		g_clear_pointer (&plugin_loader->plugins, g_ptr_array_unref);
 	}
+	g_clear_pointer (&plugin_loader->adopt_index, gs_plugin_adopt_index_free);
 	if (plugin_loader->updates_changed_id != 0) {
 		g_source_remove (plugin_loader->updates_changed_id);
 		plugin_loader->updates_changed_id = 0;
 	}
+	if (plugin_loader->cache_compact_id != 0) {
+		g_autoptr(GError) local_error = NULL;
+
+		g_source_remove (plugin_loader->cache_compact_id);
+		plugin_loader->cache_compact_id = 0;
+
+		/* keep the cache accesses from this session for next time */
+		if (!gs_cache_manager_flush (&local_error))
+			g_debug ("Failed to save cache accesses: %s", local_error->message);
+	}
 	if (plugin_loader->network_changed_handler != 0) {
 		g_signal_handler_disconnect (plugin_loader->network_monitor,
 					     plugin_loader->network_changed_handler);
@@ -2574,6 +3096,8 @@ gs_plugin_loader_dispose (GObject *object)
 	g_clear_object (&plugin_loader->setup_complete_cancellable);
 
 #ifdef HAVE_SYSPROF
+	if (plugin_loader->sysprof_writer != NULL)
+		gs_trace_set_sysprof_writer (NULL);
 	g_clear_pointer (&plugin_loader->sysprof_writer, sysprof_capture_writer_unref);
 #endif
 
@@ -2594,9 +3118,12 @@ gs_plugin_loader_finalize (GObject *object)
 	g_ptr_array_unref (plugin_loader->file_monitors);
 	g_hash_table_unref (plugin_loader->events_by_id);
 	g_hash_table_unref (plugin_loader->disallow_updates);
+	g_queue_clear (&plugin_loader->list_apps_cache_lru);
+	g_hash_table_unref (plugin_loader->list_apps_cache);
 
 	g_mutex_clear (&plugin_loader->pending_apps_mutex);
 	g_mutex_clear (&plugin_loader->events_by_id_mutex);
+	g_mutex_clear (&plugin_loader->list_apps_cache_mutex);
 
 	G_OBJECT_CLASS (gs_plugin_loader_parent_class)->finalize (object);
 }
@@ -2736,6 +3263,20 @@ gs_plugin_loader_allow_updates_recheck (GsPluginLoader *plugin_loader)
 	}
 }
 
+static void
+gs_plugin_loader_update_cache_budgets (GsPluginLoader *plugin_loader)
+{
+	g_autoptr(GVariant) sizes = NULL;
+	GVariantIter iter;
+	const gchar *kind;
+	guint32 size_mib;
+
+	sizes = g_settings_get_value (plugin_loader->settings, "cache-size-maximum");
+	g_variant_iter_init (&iter, sizes);
+	while (g_variant_iter_next (&iter, "{&su}", &kind, &size_mib))
+		gs_cache_manager_set_budget (kind, (guint64) size_mib * 1024 * 1024);
+}
+
 static void
 gs_plugin_loader_settings_changed_cb (GSettings *settings,
 				      const gchar *key,
@@ -2743,6 +3284,8 @@ gs_plugin_loader_settings_changed_cb (GSettings *settings,
 {
 	if (g_strcmp0 (key, "allow-updates") == 0)
 		gs_plugin_loader_allow_updates_recheck (plugin_loader);
+	else if (g_strcmp0 (key, "cache-size-maximum") == 0)
+		gs_plugin_loader_update_cache_budgets (plugin_loader);
 }
 
 static gint
@@ -2771,6 +3314,8 @@ gs_plugin_loader_init (GsPluginLoader *plugin_loader)
 
 #ifdef HAVE_SYSPROF
 	plugin_loader->sysprof_writer = sysprof_capture_writer_new_from_env (0);
+	if (plugin_loader->sysprof_writer != NULL)
+		gs_trace_set_sysprof_writer (plugin_loader->sysprof_writer);
 #endif  /* HAVE_SYSPROF */
 
 	plugin_loader->setup_complete_cancellable = g_cancellable_new ();
@@ -2787,6 +3332,7 @@ gs_plugin_loader_init (GsPluginLoader *plugin_loader)
 	plugin_loader->settings = g_settings_new ("org.gnome.software");
 	g_signal_connect (plugin_loader->settings, "changed",
 			  G_CALLBACK (gs_plugin_loader_settings_changed_cb), plugin_loader);
+	gs_plugin_loader_update_cache_budgets (plugin_loader);
 	plugin_loader->events_by_id = g_hash_table_new_full ((GHashFunc) as_utils_data_id_hash,
 							     (GEqualFunc) as_utils_data_id_equal,
 							     g_free,
@@ -2850,6 +3396,9 @@ gs_plugin_loader_init (GsPluginLoader *plugin_loader)
 
 	g_mutex_init (&plugin_loader->pending_apps_mutex);
 	g_mutex_init (&plugin_loader->events_by_id_mutex);
+	g_mutex_init (&plugin_loader->list_apps_cache_mutex);
+	plugin_loader->list_apps_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+								NULL, (GDestroyNotify) list_apps_entry_free);
 
 	/* monitor the network as the many UI operations need the network */
 	gs_plugin_loader_monitor_network (plugin_loader);
@@ -3455,6 +4004,22 @@ gs_plugin_loader_process_thread_cb (GTask *task,
 	g_task_return_pointer (task, g_object_ref (list), (GDestroyNotify) g_object_unref);
 }
 
+/* Nest everything the job does inside the span from
+ * gs_plugin_loader_job_process_async(). */
+static void
+gs_plugin_loader_process_traced_thread_cb (GTask *task,
+					   gpointer object,
+					   gpointer task_data,
+					   GCancellable *cancellable)
+{
+	GsTraceSpan *trace_span = g_object_get_data (G_OBJECT (task), "gs-trace-span");
+	guint old_span_id;
+
+	old_span_id = gs_trace_set_current_span_id (gs_trace_span_get_id (trace_span));
+	gs_plugin_loader_process_thread_cb (task, object, task_data, cancellable);
+	gs_trace_set_current_span_id (old_span_id);
+}
+
 static void
 gs_plugin_loader_process_in_thread_pool_cb (gpointer data,
 					    gpointer user_data)
@@ -3469,7 +4034,7 @@ gs_plugin_loader_process_in_thread_pool_cb (gpointer data,
 
 	gs_ioprio_set (G_PRIORITY_LOW);
 
-	gs_plugin_loader_process_thread_cb (task, source_object, task_data, cancellable);
+	gs_plugin_loader_process_traced_thread_cb (task, source_object, task_data, cancellable);
 
 	/* Clear any pending action set in gs_plugin_loader_schedule_task() */
 	if (app != NULL && gs_app_get_pending_action (app) == action)
@@ -3609,6 +4174,16 @@ plugin_loader_task_freed_cb (gpointer user_data,
 	}
 }
 
+static void
+plugin_loader_changing_task_freed_cb (gpointer user_data,
+				      GObject *freed_object)
+{
+	g_autoptr(GsPluginLoader) plugin_loader = user_data;
+
+	/* anything listed while the job ran may be out of date */
+	gs_plugin_loader_list_apps_cache_invalidate (plugin_loader);
+}
+
 static gboolean job_process_setup_complete_cb (GCancellable *cancellable,
                                                gpointer      user_data);
 static void job_process_cb (GTask *task);
@@ -3635,9 +4210,12 @@ gs_plugin_loader_job_process_async (GsPluginLoader *plugin_loader,
 {
 	GsPluginJobClass *job_class;
 	GsPluginAction action;
+	GsApp *app;
 	g_autoptr(GTask) task = NULL;
 	g_autoptr(GCancellable) cancellable_job = NULL;
 	g_autofree gchar *task_name = NULL;
+	g_autofree gchar *trace_name = NULL;
+	GsTraceSpan *trace_span;
 
 	g_return_if_fail (GS_IS_PLUGIN_LOADER (plugin_loader));
 	g_return_if_fail (GS_IS_PLUGIN_JOB (plugin_job));
@@ -3675,10 +4253,30 @@ gs_plugin_loader_job_process_async (GsPluginLoader *plugin_loader,
 	g_task_set_name (task, task_name);
 	g_task_set_task_data (task, g_object_ref (plugin_job), (GDestroyNotify) g_object_unref);
 
+	/* trace the job until the task is freed, after its callback is done */
+	trace_name = g_strconcat ("job:",
+				  (job_class->run_async != NULL) ? G_OBJECT_TYPE_NAME (plugin_job) : gs_plugin_action_to_string (action),
+				  NULL);
+	trace_span = gs_trace_span_begin (trace_name);
+	app = gs_plugin_job_get_app (plugin_job);
+	if (app != NULL)
+		gs_trace_span_set_app_id (trace_span, gs_app_get_id (app));
+	gs_trace_span_set_refine_flags (trace_span, gs_plugin_job_get_refine_flags (plugin_job));
+	g_object_set_data_full (G_OBJECT (task), "gs-trace-span", trace_span,
+				(GDestroyNotify) gs_trace_span_end);
+
 	g_atomic_int_inc (&plugin_loader->active_jobs);
 	g_object_weak_ref (G_OBJECT (task),
 		plugin_loader_task_freed_cb, g_object_ref (plugin_loader));
 
+	/* cached list-apps results can't be trusted once this starts, nor any
+	 * listed while it runs */
+	if (plugin_job_may_change_apps (plugin_job)) {
+		gs_plugin_loader_list_apps_cache_invalidate (plugin_loader);
+		g_object_weak_ref (G_OBJECT (task),
+			plugin_loader_changing_task_freed_cb, g_object_ref (plugin_loader));
+	}
+
 	/* Wait until the plugin has finished setting up.
 	 *
 	 * Do this using a #GCancellable. While we’re not using the #GCancellable
@@ -3723,14 +4321,19 @@ job_process_cb (GTask *task)
 	 * gs_plugin_loader_job_process_async() is removed. */
 
 	if (job_class->run_async != NULL) {
+		GsTraceSpan *trace_span = g_object_get_data (G_OBJECT (task), "gs-trace-span");
+		guint old_span_id;
 #ifdef HAVE_SYSPROF
 		gint64 begin_time_nsec G_GNUC_UNUSED = SYSPROF_CAPTURE_CURRENT_TIME;
 
 		g_task_set_task_data (task, GSIZE_TO_POINTER (begin_time_nsec), NULL);
 #endif
 
+		/* the job passes this on to any worker threads it queues work on */
+		old_span_id = gs_trace_set_current_span_id (gs_trace_span_get_id (trace_span));
 		job_class->run_async (plugin_job, plugin_loader, cancellable,
 				      run_job_cb, g_object_ref (task));
+		gs_trace_set_current_span_id (old_span_id);
 		return;
 	}
 
@@ -3812,7 +4415,7 @@ job_process_cb (GTask *task)
 	}
 
 	/* run in a thread */
-	g_task_run_in_thread (task, gs_plugin_loader_process_thread_cb);
+	g_task_run_in_thread (task, gs_plugin_loader_process_traced_thread_cb);
 }
 
 /******************************************************************************/
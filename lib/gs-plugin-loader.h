@@ -52,6 +52,8 @@ void		 gs_plugin_loader_shutdown		(GsPluginLoader	*plugin_loader,
 							 GCancellable	*cancellable);
 
 void		 gs_plugin_loader_dump_state		(GsPluginLoader	*plugin_loader);
+gchar		*gs_plugin_loader_dump_trace		(GsPluginLoader	*plugin_loader,
+							 GError		**error);
 gboolean	 gs_plugin_loader_get_enabled		(GsPluginLoader	*plugin_loader,
 							 const gchar	*plugin_name);
 void		 gs_plugin_loader_add_location		(GsPluginLoader	*plugin_loader,
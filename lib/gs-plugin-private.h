@@ -43,6 +43,13 @@ void		 gs_plugin_set_auth_array		(GsPlugin	*plugin,
 							 GPtrArray	*auth_array);
 GPtrArray	*gs_plugin_get_rules			(GsPlugin	*plugin,
 							 GsPluginRule	 rule);
+gboolean	 gs_plugin_get_refine_flags		(GsPlugin	*plugin,
+							 GsPluginRefineFlags *provided_out,
+							 GsPluginRefineFlags *required_out);
+gboolean	 gs_plugin_get_adopt_claims		(GsPlugin	*plugin,
+							 GArray		**bundle_kinds_out,
+							 GArray		**component_kinds_out,
+							 GPtrArray	**origins_out);
 gpointer	 gs_plugin_get_symbol			(GsPlugin	*plugin,
 							 const gchar	*function_name);
 void		 gs_plugin_interactive_inc		(GsPlugin	*plugin);
@@ -174,6 +174,10 @@ typedef enum {
  * GsPluginListAppsFlags:
  * @GS_PLUGIN_LIST_APPS_FLAGS_NONE: No flags set.
  * @GS_PLUGIN_LIST_APPS_FLAGS_INTERACTIVE: User initiated the job.
+ * @GS_PLUGIN_LIST_APPS_FLAGS_TYPE_AHEAD: The #GsAppQuery:keywords are still
+ *   being typed, so match them as prefixes of app names, IDs and keywords,
+ *   allowing for typos, rather than doing a full search. Plugins which don’t
+ *   support this do a full search instead.
  *
  * Flags for an operation to list apps matching a given query.
  *
@@ -182,6 +186,7 @@ typedef enum {
 typedef enum {
 	GS_PLUGIN_LIST_APPS_FLAGS_NONE = 0,
 	GS_PLUGIN_LIST_APPS_FLAGS_INTERACTIVE = 1 << 0,
+	GS_PLUGIN_LIST_APPS_FLAGS_TYPE_AHEAD = 1 << 1,
 } GsPluginListAppsFlags;
 
 /**
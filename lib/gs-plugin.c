@@ -40,17 +40,23 @@
 #include "gs-download-utils.h"
 #include "gs-enums.h"
 #include "gs-os-release.h"
+#include "gs-plugin-cache.h"
 #include "gs-plugin-private.h"
 #include "gs-plugin.h"
 #include "gs-utils.h"
 
 typedef struct
 {
-	GHashTable		*cache;
-	GMutex			 cache_mutex;
+	GsPluginAppCache	*cache;
 	GModule			*module;
 	GsPluginFlags		 flags;
 	GPtrArray		*rules[GS_PLUGIN_RULE_LAST];
+	gboolean		 refine_flags_set;
+	GsPluginRefineFlags	 refine_flags_provided;
+	GsPluginRefineFlags	 refine_flags_required;
+	GArray			*adopt_bundle_kinds;	/* (nullable) (element-type AsBundleKind) */
+	GArray			*adopt_component_kinds;	/* (nullable) (element-type AsComponentKind) */
+	GPtrArray		*adopt_origins;		/* (nullable) (element-type utf8) */
 	GHashTable		*vfuncs;		/* string:pointer */
 	GMutex			 vfuncs_mutex;
 	gboolean		 enabled;
@@ -252,9 +258,11 @@ gs_plugin_finalize (GObject *object)
 	g_free (priv->language);
 	if (priv->network_monitor != NULL)
 		g_object_unref (priv->network_monitor);
-	g_hash_table_unref (priv->cache);
+	gs_plugin_app_cache_free (priv->cache);
+	g_clear_pointer (&priv->adopt_bundle_kinds, g_array_unref);
+	g_clear_pointer (&priv->adopt_component_kinds, g_array_unref);
+	g_clear_pointer (&priv->adopt_origins, g_ptr_array_unref);
 	g_hash_table_unref (priv->vfuncs);
-	g_mutex_clear (&priv->cache_mutex);
 	g_mutex_clear (&priv->interactive_mutex);
 	g_mutex_clear (&priv->timer_mutex);
 	g_mutex_clear (&priv->vfuncs_mutex);
@@ -675,6 +683,185 @@ gs_plugin_get_rules (GsPlugin *plugin, GsPluginRule rule)
 	return priv->rules[rule];
 }
 
+/**
+ * gs_plugin_set_refine_flags:
+ * @plugin: a #GsPlugin
+ * @provided: the #GsPluginRefineFlags for the data the plugin sets
+ * @required: the #GsPluginRefineFlags for the data the plugin reads
+ *
+ * Declares which data the #GsPluginClass.refine_async vfunc of the plugin
+ * sets on apps, and which data it relies on another plugin having set first.
+ *
+ * Plugins which declare this can be refined in parallel with other plugins
+ * which do not set or read the same data, subject to any
+ * %GS_PLUGIN_RULE_RUN_AFTER and %GS_PLUGIN_RULE_RUN_BEFORE rules. Plugins
+ * which do not declare this are refined in series with all other plugins.
+ *
+ * A plugin which can add apps to the list being refined, for example to
+ * resolve wildcards, must include %GS_PLUGIN_REFINE_FLAGS_REQUIRE_ID in
+ * @provided, and is then refined in series with all other plugins.
+ *
+ * Since: 43
+ **/
+void
+gs_plugin_set_refine_flags (GsPlugin            *plugin,
+                            GsPluginRefineFlags  provided,
+                            GsPluginRefineFlags  required)
+{
+	GsPluginPrivate *priv = gs_plugin_get_instance_private (plugin);
+
+	g_return_if_fail (GS_IS_PLUGIN (plugin));
+
+	priv->refine_flags_set = TRUE;
+	priv->refine_flags_provided = provided;
+	priv->refine_flags_required = required;
+}
+
+/**
+ * gs_plugin_get_refine_flags:
+ * @plugin: a #GsPlugin
+ * @provided_out: (out) (optional): return location for the provided flags
+ * @required_out: (out) (optional): return location for the required flags
+ *
+ * Gets the refine flags declared with gs_plugin_set_refine_flags().
+ *
+ * Returns: %TRUE if the plugin has declared its refine flags
+ *
+ * Since: 43
+ **/
+gboolean
+gs_plugin_get_refine_flags (GsPlugin            *plugin,
+                            GsPluginRefineFlags *provided_out,
+                            GsPluginRefineFlags *required_out)
+{
+	GsPluginPrivate *priv = gs_plugin_get_instance_private (plugin);
+
+	g_return_val_if_fail (GS_IS_PLUGIN (plugin), FALSE);
+
+	if (provided_out != NULL)
+		*provided_out = priv->refine_flags_provided;
+	if (required_out != NULL)
+		*required_out = priv->refine_flags_required;
+	return priv->refine_flags_set;
+}
+
+/**
+ * gs_plugin_add_adopt_bundle_kind:
+ * @plugin: a #GsPlugin
+ * @bundle_kind: an #AsBundleKind
+ *
+ * Declares that the plugin may adopt apps with the bundle kind @bundle_kind
+ * in gs_plugin_adopt_app().
+ *
+ * Plugins which declare what they adopt, using this,
+ * gs_plugin_add_adopt_component_kind() or gs_plugin_add_adopt_origin(), only
+ * have gs_plugin_adopt_app() called for apps which match at least one of
+ * their declarations. Plugins which declare nothing have it called for every
+ * unowned app.
+ *
+ * This should be called from the plugin’s init function.
+ *
+ * Since: 43
+ **/
+void
+gs_plugin_add_adopt_bundle_kind (GsPlugin     *plugin,
+                                 AsBundleKind  bundle_kind)
+{
+	GsPluginPrivate *priv = gs_plugin_get_instance_private (plugin);
+
+	g_return_if_fail (GS_IS_PLUGIN (plugin));
+
+	if (priv->adopt_bundle_kinds == NULL)
+		priv->adopt_bundle_kinds = g_array_new (FALSE, FALSE, sizeof (AsBundleKind));
+	g_array_append_val (priv->adopt_bundle_kinds, bundle_kind);
+}
+
+/**
+ * gs_plugin_add_adopt_component_kind:
+ * @plugin: a #GsPlugin
+ * @kind: an #AsComponentKind
+ *
+ * Declares that the plugin may adopt apps of kind @kind in
+ * gs_plugin_adopt_app(). See gs_plugin_add_adopt_bundle_kind().
+ *
+ * Since: 43
+ **/
+void
+gs_plugin_add_adopt_component_kind (GsPlugin        *plugin,
+                                    AsComponentKind  kind)
+{
+	GsPluginPrivate *priv = gs_plugin_get_instance_private (plugin);
+
+	g_return_if_fail (GS_IS_PLUGIN (plugin));
+
+	if (priv->adopt_component_kinds == NULL)
+		priv->adopt_component_kinds = g_array_new (FALSE, FALSE, sizeof (AsComponentKind));
+	g_array_append_val (priv->adopt_component_kinds, kind);
+}
+
+/**
+ * gs_plugin_add_adopt_origin:
+ * @plugin: a #GsPlugin
+ * @origin: an origin, e.g. `vanilla_meta`
+ *
+ * Declares that the plugin may adopt apps from @origin in
+ * gs_plugin_adopt_app(). See gs_plugin_add_adopt_bundle_kind().
+ *
+ * Since: 43
+ **/
+void
+gs_plugin_add_adopt_origin (GsPlugin    *plugin,
+                            const gchar *origin)
+{
+	GsPluginPrivate *priv = gs_plugin_get_instance_private (plugin);
+
+	g_return_if_fail (GS_IS_PLUGIN (plugin));
+	g_return_if_fail (origin != NULL);
+
+	if (priv->adopt_origins == NULL)
+		priv->adopt_origins = g_ptr_array_new_with_free_func (g_free);
+	g_ptr_array_add (priv->adopt_origins, g_strdup (origin));
+}
+
+/**
+ * gs_plugin_get_adopt_claims:
+ * @plugin: a #GsPlugin
+ * @bundle_kinds_out: (out) (transfer none) (nullable) (optional): return
+ *   location for the declared #AsBundleKinds
+ * @component_kinds_out: (out) (transfer none) (nullable) (optional): return
+ *   location for the declared #AsComponentKinds
+ * @origins_out: (out) (transfer none) (nullable) (optional): return location
+ *   for the declared origins
+ *
+ * Gets the apps the plugin declared it may adopt, using
+ * gs_plugin_add_adopt_bundle_kind() and friends.
+ *
+ * Returns: %TRUE if the plugin has declared anything
+ *
+ * Since: 43
+ **/
+gboolean
+gs_plugin_get_adopt_claims (GsPlugin   *plugin,
+                            GArray    **bundle_kinds_out,
+                            GArray    **component_kinds_out,
+                            GPtrArray **origins_out)
+{
+	GsPluginPrivate *priv = gs_plugin_get_instance_private (plugin);
+
+	g_return_val_if_fail (GS_IS_PLUGIN (plugin), FALSE);
+
+	if (bundle_kinds_out != NULL)
+		*bundle_kinds_out = priv->adopt_bundle_kinds;
+	if (component_kinds_out != NULL)
+		*component_kinds_out = priv->adopt_component_kinds;
+	if (origins_out != NULL)
+		*origins_out = priv->adopt_origins;
+
+	return (priv->adopt_bundle_kinds != NULL ||
+		priv->adopt_component_kinds != NULL ||
+		priv->adopt_origins != NULL);
+}
+
 /**
  * gs_plugin_check_distro_id:
  * @plugin: a #GsPlugin
@@ -1323,17 +1510,11 @@ GsApp *
 gs_plugin_cache_lookup (GsPlugin *plugin, const gchar *key)
 {
 	GsPluginPrivate *priv = gs_plugin_get_instance_private (plugin);
-	GsApp *app;
-	g_autoptr(GMutexLocker) locker = NULL;
 
 	g_return_val_if_fail (GS_IS_PLUGIN (plugin), NULL);
 	g_return_val_if_fail (key != NULL, NULL);
 
-	locker = g_mutex_locker_new (&priv->cache_mutex);
-	app = g_hash_table_lookup (priv->cache, key);
-	if (app == NULL)
-		return NULL;
-	return g_object_ref (app);
+	return gs_plugin_app_cache_lookup (priv->cache, key);
 }
 
 /**
@@ -1346,6 +1527,9 @@ gs_plugin_cache_lookup (GsPlugin *plugin, const gchar *key)
  * When the state is %GS_APP_STATE_UNKNOWN, then adds all
  * cached applications.
  *
+ * This takes time proportional to the number of matching applications,
+ * not the size of the cache.
+ *
  * Since: 40
  **/
 void
@@ -1354,24 +1538,61 @@ gs_plugin_cache_lookup_by_state (GsPlugin *plugin,
 				 GsAppState state)
 {
 	GsPluginPrivate *priv;
-	GHashTableIter iter;
-	gpointer value;
-	g_autoptr(GMutexLocker) locker = NULL;
 
 	g_return_if_fail (GS_IS_PLUGIN (plugin));
 	g_return_if_fail (GS_IS_APP_LIST (list));
 
 	priv = gs_plugin_get_instance_private (plugin);
-	locker = g_mutex_locker_new (&priv->cache_mutex);
+	gs_plugin_app_cache_list_by_state (priv->cache, list, state);
+}
+
+/**
+ * gs_plugin_cache_lookup_by_kind:
+ * @plugin: a #GsPlugin
+ * @list: a #GsAppList to add applications to
+ * @kind: an #AsComponentKind
+ *
+ * Adds each cached #GsApp of kind @kind into the @list.
+ *
+ * Since: 43
+ **/
+void
+gs_plugin_cache_lookup_by_kind (GsPlugin *plugin,
+				GsAppList *list,
+				AsComponentKind kind)
+{
+	GsPluginPrivate *priv;
+
+	g_return_if_fail (GS_IS_PLUGIN (plugin));
+	g_return_if_fail (GS_IS_APP_LIST (list));
+
+	priv = gs_plugin_get_instance_private (plugin);
+	gs_plugin_app_cache_list_by_kind (priv->cache, list, kind);
+}
+
+/**
+ * gs_plugin_cache_lookup_by_source:
+ * @plugin: a #GsPlugin
+ * @list: a #GsAppList to add applications to
+ * @source: a source, e.g. a package name
+ *
+ * Adds each cached #GsApp which has @source in its sources into the @list.
+ *
+ * Since: 43
+ **/
+void
+gs_plugin_cache_lookup_by_source (GsPlugin *plugin,
+				  GsAppList *list,
+				  const gchar *source)
+{
+	GsPluginPrivate *priv;
 
-	g_hash_table_iter_init (&iter, priv->cache);
-	while (g_hash_table_iter_next (&iter, NULL, &value)) {
-		GsApp *app = value;
+	g_return_if_fail (GS_IS_PLUGIN (plugin));
+	g_return_if_fail (GS_IS_APP_LIST (list));
+	g_return_if_fail (source != NULL);
 
-		if (state == GS_APP_STATE_UNKNOWN ||
-		    state == gs_app_get_state (app))
-			gs_app_list_add (list, app);
-	}
+	priv = gs_plugin_get_instance_private (plugin);
+	gs_plugin_app_cache_list_by_source (priv->cache, list, source);
 }
 
 /**
@@ -1387,13 +1608,11 @@ void
 gs_plugin_cache_remove (GsPlugin *plugin, const gchar *key)
 {
 	GsPluginPrivate *priv = gs_plugin_get_instance_private (plugin);
-	g_autoptr(GMutexLocker) locker = NULL;
 
 	g_return_if_fail (GS_IS_PLUGIN (plugin));
 	g_return_if_fail (key != NULL);
 
-	locker = g_mutex_locker_new (&priv->cache_mutex);
-	g_hash_table_remove (priv->cache, key);
+	gs_plugin_app_cache_remove (priv->cache, key);
 }
 
 /**
@@ -1411,13 +1630,10 @@ void
 gs_plugin_cache_add (GsPlugin *plugin, const gchar *key, GsApp *app)
 {
 	GsPluginPrivate *priv = gs_plugin_get_instance_private (plugin);
-	g_autoptr(GMutexLocker) locker = NULL;
 
 	g_return_if_fail (GS_IS_PLUGIN (plugin));
 	g_return_if_fail (GS_IS_APP (app));
 
-	locker = g_mutex_locker_new (&priv->cache_mutex);
-
 	/* the user probably doesn't want to do this */
 	if (gs_app_has_quirk (app, GS_APP_QUIRK_IS_WILDCARD)) {
 		g_warning ("adding wildcard app %s to plugin cache",
@@ -1430,9 +1646,7 @@ gs_plugin_cache_add (GsPlugin *plugin, const gchar *key, GsApp *app)
 
 	g_return_if_fail (key != NULL);
 
-	if (g_hash_table_lookup (priv->cache, key) == app)
-		return;
-	g_hash_table_insert (priv->cache, g_strdup (key), g_object_ref (app));
+	gs_plugin_app_cache_add (priv->cache, key, app);
 }
 
 /**
@@ -1453,12 +1667,10 @@ void
 gs_plugin_cache_invalidate (GsPlugin *plugin)
 {
 	GsPluginPrivate *priv = gs_plugin_get_instance_private (plugin);
-	g_autoptr(GMutexLocker) locker = NULL;
 
 	g_return_if_fail (GS_IS_PLUGIN (plugin));
 
-	locker = g_mutex_locker_new (&priv->cache_mutex);
-	g_hash_table_remove_all (priv->cache);
+	gs_plugin_app_cache_remove_all (priv->cache);
 }
 
 /**
@@ -1961,13 +2173,9 @@ gs_plugin_init (GsPlugin *plugin)
 
 	priv->enabled = TRUE;
 	priv->scale = 1;
-	priv->cache = g_hash_table_new_full ((GHashFunc) as_utils_data_id_hash,
-					     (GEqualFunc) as_utils_data_id_equal,
-					     g_free,
-					     (GDestroyNotify) g_object_unref);
+	priv->cache = gs_plugin_app_cache_new ();
 	priv->vfuncs = g_hash_table_new_full (g_str_hash, g_str_equal,
 					      g_free, NULL);
-	g_mutex_init (&priv->cache_mutex);
 	g_mutex_init (&priv->interactive_mutex);
 	g_mutex_init (&priv->timer_mutex);
 	g_mutex_init (&priv->vfuncs_mutex);
@@ -2072,9 +2280,7 @@ gs_plugin_update_cache_state_for_repository (GsPlugin *plugin,
 					     GsApp *repository)
 {
 	GsPluginPrivate *priv;
-	GHashTableIter iter;
-	g_autoptr(GMutexLocker) locker = NULL;
-	gpointer value;
+	g_autoptr(GPtrArray) apps = NULL;
 	const gchar *repo_id;
 	GsAppState repo_state;
 
@@ -2085,11 +2291,9 @@ gs_plugin_update_cache_state_for_repository (GsPlugin *plugin,
 	repo_id = gs_app_get_id (repository);
 	repo_state = gs_app_get_state (repository);
 
-	locker = g_mutex_locker_new (&priv->cache_mutex);
-
-	g_hash_table_iter_init (&iter, priv->cache);
-	while (g_hash_table_iter_next (&iter, NULL, &value)) {
-		GsApp *app = value;
+	apps = gs_plugin_app_cache_dup_apps (priv->cache);
+	for (guint i = 0; i < apps->len; i++) {
+		GsApp *app = g_ptr_array_index (apps, i);
 		GsAppState app_state = gs_app_get_state (app);
 
 		if (((app_state == GS_APP_STATE_AVAILABLE &&
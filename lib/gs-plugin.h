@@ -247,6 +247,15 @@ const gchar	*gs_plugin_get_language			(GsPlugin	*plugin);
 void		 gs_plugin_add_rule			(GsPlugin	*plugin,
 							 GsPluginRule	 rule,
 							 const gchar	*name);
+void		 gs_plugin_set_refine_flags		(GsPlugin	*plugin,
+							 GsPluginRefineFlags provided,
+							 GsPluginRefineFlags required);
+void		 gs_plugin_add_adopt_bundle_kind	(GsPlugin	*plugin,
+							 AsBundleKind	 bundle_kind);
+void		 gs_plugin_add_adopt_component_kind	(GsPlugin	*plugin,
+							 AsComponentKind kind);
+void		 gs_plugin_add_adopt_origin		(GsPlugin	*plugin,
+							 const gchar	*origin);
 
 /* helpers */
 gboolean	 gs_plugin_download_file		(GsPlugin	*plugin,
@@ -268,6 +277,12 @@ GsApp		*gs_plugin_cache_lookup			(GsPlugin	*plugin,
 void		 gs_plugin_cache_lookup_by_state	(GsPlugin	*plugin,
 							 GsAppList	*list,
 							 GsAppState	 state);
+void		 gs_plugin_cache_lookup_by_kind		(GsPlugin	*plugin,
+							 GsAppList	*list,
+							 AsComponentKind kind);
+void		 gs_plugin_cache_lookup_by_source	(GsPlugin	*plugin,
+							 GsAppList	*list,
+							 const gchar	*source);
 void		 gs_plugin_cache_add			(GsPlugin	*plugin,
 							 const gchar	*key,
 							 GsApp		*app);
@@ -34,8 +34,10 @@
 #include <glib.h>
 #include <glib-object.h>
 #include <libsoup/soup.h>
+#include <string.h>
 
 #include "gs-remote-icon.h"
+#include "gs-trace.h"
 #include "gs-utils.h"
 
 /* FIXME: Work around the fact that GFileIcon is not derivable, by deriving from
@@ -232,19 +234,74 @@ gs_remote_icon_get_uri (GsRemoteIcon *self)
 	return self->uri;
 }
 
-static GdkPixbuf *
-gs_icon_download (SoupSession   *session,
-                  const gchar   *uri,
-                  const gchar   *destination_path,
-                  guint          max_size,
-                  GCancellable  *cancellable,
-                  GError       **error)
+/* The first bytes of every PNG file, followed by the IHDR chunk which holds
+ * its dimensions. */
+static const guint8 png_signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+/* Reads the dimensions of a PNG image from its header, without decoding it.
+ * Returns %FALSE if @data is not a PNG image. */
+static gboolean
+gs_icon_get_png_size (GBytes *data,
+                      guint  *width_out,
+                      guint  *height_out)
+{
+	gsize len;
+	const guint8 *buf = g_bytes_get_data (data, &len);
+	guint32 width, height;
+
+	if (len < 24 ||
+	    memcmp (buf, png_signature, sizeof (png_signature)) != 0 ||
+	    memcmp (buf + 12, "IHDR", 4) != 0)
+		return FALSE;
+
+	memcpy (&width, buf + 16, sizeof (width));
+	memcpy (&height, buf + 20, sizeof (height));
+	*width_out = GUINT32_FROM_BE (width);
+	*height_out = GUINT32_FROM_BE (height);
+
+	return (*width_out > 0 && *height_out > 0);
+}
+
+/**
+ * gs_remote_icon_download:
+ * @self: a #GsRemoteIcon
+ * @soup_session: a #SoupSession to use to download the icon
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @error: return location for a #GError, or %NULL
+ *
+ * Download the icon from its remote server, without decoding it or saving it
+ * to the cache. Pass the result to gs_remote_icon_save_cached() to do that.
+ *
+ * This is split out of gs_remote_icon_ensure_cached() so that several icons
+ * can be downloaded at once, while the CPU-bound decoding is done elsewhere.
+ *
+ * This can be called from any thread.
+ *
+ * Returns: (transfer full): the encoded icon, or %NULL on error
+ * Since: 43
+ */
+GBytes *
+gs_remote_icon_download (GsRemoteIcon  *self,
+                         SoupSession   *soup_session,
+                         GCancellable  *cancellable,
+                         GError       **error)
 {
+	const gchar *uri;
 	guint status_code;
 	g_autoptr(SoupMessage) msg = NULL;
 	g_autoptr(GInputStream) stream = NULL;
-	g_autoptr(GdkPixbuf) pixbuf = NULL;
-	g_autoptr(GdkPixbuf) scaled_pixbuf = NULL;
+	g_autoptr(GOutputStream) buffer = NULL;
+	g_autoptr(GsTraceSpan) trace_span = NULL;
+
+	g_return_val_if_fail (GS_IS_REMOTE_ICON (self), NULL);
+	g_return_val_if_fail (SOUP_IS_SESSION (soup_session), NULL);
+	g_return_val_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable), NULL);
+	g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+	uri = gs_remote_icon_get_uri (self);
+
+	trace_span = gs_trace_span_begin ("download:icon");
+	gs_trace_span_set_detail (trace_span, uri);
 
 	/* Create the request */
 	msg = soup_message_new (SOUP_METHOD_GET, uri);
@@ -257,7 +314,7 @@ gs_icon_download (SoupSession   *session,
 	}
 
 	/* Send request synchronously and start reading the response. */
-	stream = soup_session_send (session, msg, cancellable, error);
+	stream = soup_session_send (soup_session, msg, cancellable, error);
 
 #if SOUP_CHECK_VERSION(3, 0, 0)
 	status_code = soup_message_get_status (msg);
@@ -275,26 +332,103 @@ gs_icon_download (SoupSession   *session,
 		return NULL;
 	}
 
-	/* Typically these icons are 64x64px PNG files. If not, resize down
-	 * so it’s at most @max_size square, to minimise the size of the on-disk
-	 * cache.*/
+	buffer = g_memory_output_stream_new_resizable ();
+	if (g_output_stream_splice (buffer, stream,
+				    G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+				    G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+				    cancellable, error) < 0)
+		return NULL;
+
+	return g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (buffer));
+}
+
+/**
+ * gs_remote_icon_save_cached:
+ * @self: a #GsRemoteIcon
+ * @data: the encoded icon, as returned by gs_remote_icon_download()
+ * @maximum_icon_size: maximum size (in device pixels) of the icon to save
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @error: return location for a #GError, or %NULL
+ *
+ * Save a downloaded icon to the local cache, scaling it down to at most
+ * @maximum_icon_size square if needed, and store its dimensions on @self.
+ *
+ * PNG icons which are small enough already are saved as they are, without
+ * being re-encoded, once they have been checked to decode. Anything else is
+ * converted to PNG. Data which can’t be decoded is never saved.
+ *
+ * This can be called from any thread.
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 43
+ */
+gboolean
+gs_remote_icon_save_cached (GsRemoteIcon  *self,
+                            GBytes        *data,
+                            guint          maximum_icon_size,
+                            GCancellable  *cancellable,
+                            GError       **error)
+{
+	g_autofree gchar *cache_filename = NULL;
+	g_autoptr(GInputStream) stream = NULL;
+	g_autoptr(GdkPixbuf) pixbuf = NULL;
+	g_autoptr(GdkPixbuf) scaled_pixbuf = NULL;
+	guint width, height;
+
+	g_return_val_if_fail (GS_IS_REMOTE_ICON (self), FALSE);
+	g_return_val_if_fail (data != NULL, FALSE);
+	g_return_val_if_fail (maximum_icon_size > 0, FALSE);
+	g_return_val_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable), FALSE);
+	g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+	cache_filename = gs_remote_icon_get_cache_filename (gs_remote_icon_get_uri (self), TRUE, error);
+	if (cache_filename == NULL)
+		return FALSE;
+
+	/* Decode it even if it’s going to be cached as-is, as the PNG header
+	 * being valid doesn’t mean the rest of the data is. */
+	stream = g_memory_input_stream_new_from_bytes (data);
 	pixbuf = gdk_pixbuf_new_from_stream (stream, cancellable, error);
 	if (pixbuf == NULL)
-		return NULL;
+		return FALSE;
+
+	/* Typically these icons are 64x64px PNG files, which can be cached
+	 * as-is, saving re-encoding them. */
+	if (gs_icon_get_png_size (data, &width, &height) &&
+	    width == (guint) gdk_pixbuf_get_width (pixbuf) &&
+	    height == (guint) gdk_pixbuf_get_height (pixbuf) &&
+	    width <= maximum_icon_size && height <= maximum_icon_size) {
+		if (!g_file_set_contents (cache_filename,
+					  g_bytes_get_data (data, NULL),
+					  g_bytes_get_size (data),
+					  error))
+			return FALSE;
+
+		g_object_set_data (G_OBJECT (self), "width", GUINT_TO_POINTER (width));
+		g_object_set_data (G_OBJECT (self), "height", GUINT_TO_POINTER (height));
+
+		return TRUE;
+	}
 
-	if ((guint) gdk_pixbuf_get_height (pixbuf) <= max_size &&
-	    (guint) gdk_pixbuf_get_width (pixbuf) <= max_size) {
+	/* If not, resize down so it’s at most @maximum_icon_size square, to
+	 * minimise the size of the on-disk cache. */
+	if ((guint) gdk_pixbuf_get_height (pixbuf) <= maximum_icon_size &&
+	    (guint) gdk_pixbuf_get_width (pixbuf) <= maximum_icon_size) {
 		scaled_pixbuf = g_object_ref (pixbuf);
 	} else {
-		scaled_pixbuf = gdk_pixbuf_scale_simple (pixbuf, max_size, max_size,
+		scaled_pixbuf = gdk_pixbuf_scale_simple (pixbuf, maximum_icon_size, maximum_icon_size,
 							 GDK_INTERP_BILINEAR);
 	}
 
 	/* write file */
-	if (!gdk_pixbuf_save (scaled_pixbuf, destination_path, "png", error, NULL))
-		return NULL;
+	if (!gdk_pixbuf_save (scaled_pixbuf, cache_filename, "png", error, NULL))
+		return FALSE;
+
+	/* Ensure the dimensions are set correctly on the icon. */
+	g_object_set_data (G_OBJECT (self), "width", GUINT_TO_POINTER (gdk_pixbuf_get_width (scaled_pixbuf)));
+	g_object_set_data (G_OBJECT (self), "height", GUINT_TO_POINTER (gdk_pixbuf_get_height (scaled_pixbuf)));
 
-	return g_steal_pointer (&scaled_pixbuf);
+	return TRUE;
 }
 
 /**
@@ -329,7 +463,7 @@ gs_remote_icon_ensure_cached (GsRemoteIcon  *self,
 {
 	const gchar *uri;
 	g_autofree gchar *cache_filename = NULL;
-	g_autoptr(GdkPixbuf) cached_pixbuf = NULL;
+	g_autoptr(GBytes) data = NULL;
 
 	g_return_val_if_fail (GS_IS_REMOTE_ICON (self), FALSE);
 	g_return_val_if_fail (SOUP_IS_SESSION (soup_session), FALSE);
@@ -356,13 +490,9 @@ gs_remote_icon_ensure_cached (GsRemoteIcon  *self,
 		return TRUE;
 	}
 
-	cached_pixbuf = gs_icon_download (soup_session, uri, cache_filename, maximum_icon_size, cancellable, error);
-	if (cached_pixbuf == NULL)
+	data = gs_remote_icon_download (self, soup_session, cancellable, error);
+	if (data == NULL)
 		return FALSE;
 
-	/* Ensure the dimensions are set correctly on the icon. */
-	g_object_set_data (G_OBJECT (self), "width", GUINT_TO_POINTER (gdk_pixbuf_get_width (cached_pixbuf)));
-	g_object_set_data (G_OBJECT (self), "height", GUINT_TO_POINTER (gdk_pixbuf_get_height (cached_pixbuf)));
-
-	return TRUE;
+	return gs_remote_icon_save_cached (self, data, maximum_icon_size, cancellable, error);
 }
@@ -34,4 +34,14 @@ gboolean	 gs_remote_icon_ensure_cached	(GsRemoteIcon		 *self,
 						 GCancellable		 *cancellable,
 						 GError			**error);
 
+GBytes		*gs_remote_icon_download	(GsRemoteIcon		 *self,
+						 SoupSession		 *soup_session,
+						 GCancellable		 *cancellable,
+						 GError			**error);
+gboolean	 gs_remote_icon_save_cached	(GsRemoteIcon		 *self,
+						 GBytes			 *data,
+						 guint			  maximum_icon_size,
+						 GCancellable		 *cancellable,
+						 GError			**error);
+
 G_END_DECLS
@@ -9,9 +9,15 @@
 
 #include "config.h"
 
+#include <glib/gstdio.h>
+#include <json-glib/json-glib.h>
+#include <utime.h>
+
 #include "gnome-software-private.h"
 
 #include "gs-debug.h"
+#include "gs-key-colors.h"
+#include "gs-key-colors-private.h"
 #include "gs-test.h"
 
 static gboolean
@@ -131,6 +137,143 @@ gs_utils_cache_func (void)
 	g_assert (g_str_has_suffix (fn2, "test/295099f59d12b3eb0b955325fcb699cd23792a89-baz"));
 }
 
+static void
+gs_cache_manager_func (void)
+{
+	const gchar *names[] = { "a.png", "b.png", "c.png" };
+	const gint64 ages[] = { 300, 200, 100 };
+	g_autofree gchar *data = g_strnfill (1024, 'x');
+	g_autoptr(GPtrArray) filenames = g_ptr_array_new_with_free_func (g_free);
+	g_autofree gchar *fn = NULL;
+	g_autofree gchar *index_fn = NULL;
+	g_autoptr(GError) error = NULL;
+	gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+	gboolean ret;
+
+	/* three files, last modified in order, before there is a budget */
+	for (guint i = 0; i < G_N_ELEMENTS (names); i++) {
+		struct utimbuf times;
+		gchar *filename;
+
+		filename = gs_utils_get_cache_filename ("test-lru/64x64", names[i],
+							GS_UTILS_CACHE_FLAG_WRITEABLE |
+							GS_UTILS_CACHE_FLAG_CREATE_DIRECTORY,
+							&error);
+		g_assert_no_error (error);
+		ret = g_file_set_contents (filename, data, 1024, &error);
+		g_assert_no_error (error);
+		g_assert_true (ret);
+		times.actime = times.modtime = now - ages[i];
+		g_assert_cmpint (g_utime (filename, &times), ==, 0);
+		g_ptr_array_add (filenames, filename);
+	}
+
+	/* room for two of them, and the oldest one has been used since */
+	gs_cache_manager_set_budget ("test-lru", 2 * 1024);
+	fn = gs_utils_get_cache_filename ("test-lru/64x64", "a.png",
+					  GS_UTILS_CACHE_FLAG_NONE, NULL);
+	g_assert_cmpstr (fn, ==, g_ptr_array_index (filenames, 0));
+
+	ret = gs_cache_manager_compact (NULL, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	g_assert_true (g_file_test (g_ptr_array_index (filenames, 0), G_FILE_TEST_EXISTS));
+	g_assert_false (g_file_test (g_ptr_array_index (filenames, 1), G_FILE_TEST_EXISTS));
+	g_assert_true (g_file_test (g_ptr_array_index (filenames, 2), G_FILE_TEST_EXISTS));
+
+	/* the access time was kept */
+	index_fn = g_build_filename (g_get_user_cache_dir (), "gnome-software", "test-lru",
+				     ".access-index", NULL);
+	g_assert_true (g_file_test (index_fn, G_FILE_TEST_EXISTS));
+
+	/* already within budget */
+	ret = gs_cache_manager_compact (NULL, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	g_assert_true (g_file_test (g_ptr_array_index (filenames, 0), G_FILE_TEST_EXISTS));
+	g_assert_true (g_file_test (g_ptr_array_index (filenames, 2), G_FILE_TEST_EXISTS));
+}
+
+static gboolean
+gs_utils_file_size_exclude_b_cb (const gchar *filename,
+				 GFileTest    file_kind,
+				 gpointer     user_data)
+{
+	return g_strcmp0 (filename, "b") != 0;
+}
+
+static void
+gs_utils_file_size_func (void)
+{
+	g_autofree gchar *tmp_root = NULL;
+	g_autofree gchar *dir_a = NULL;
+	g_autofree gchar *dir_b = NULL;
+	g_autofree gchar *file_a = NULL;
+	g_autofree gchar *file_b = NULL;
+	g_autofree gchar *file_c = NULL;
+	g_autofree gchar *file_d = NULL;
+	g_autoptr(GError) error = NULL;
+	struct utimbuf times;
+	gboolean ret;
+
+	tmp_root = g_dir_make_tmp ("gnome-software-file-size-XXXXXX", &error);
+	g_assert_no_error (error);
+	dir_a = g_build_filename (tmp_root, "a", NULL);
+	dir_b = g_build_filename (tmp_root, "b", NULL);
+	file_a = g_build_filename (dir_a, "file", NULL);
+	file_b = g_build_filename (dir_b, "file", NULL);
+	file_c = g_build_filename (dir_a, "other", NULL);
+	file_d = g_build_filename (dir_a, "new", NULL);
+	g_assert_cmpint (g_mkdir (dir_a, 0755), ==, 0);
+	g_assert_cmpint (g_mkdir (dir_b, 0755), ==, 0);
+
+	ret = g_file_set_contents (file_a, "0123456789", 10, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	ret = g_file_set_contents (file_b, "01234", 5, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+
+	g_assert_cmpuint (gs_utils_get_file_size (file_a, NULL, NULL, NULL), ==, 10);
+	g_assert_cmpuint (gs_utils_get_file_size (tmp_root, NULL, NULL, NULL), ==, 15);
+	g_assert_cmpuint (gs_utils_get_file_size (tmp_root, gs_utils_file_size_exclude_b_cb, NULL, NULL), ==, 10);
+
+	/* adding a file is noticed even though the size is cached by now */
+	ret = g_file_set_contents (file_c, "0123", 4, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	g_assert_cmpuint (gs_utils_get_file_size (tmp_root, NULL, NULL, NULL), ==, 19);
+
+	/* and so is removing a whole directory */
+	g_assert_cmpint (g_unlink (file_b), ==, 0);
+	g_assert_cmpint (g_rmdir (dir_b), ==, 0);
+	g_assert_cmpuint (gs_utils_get_file_size (tmp_root, NULL, NULL, NULL), ==, 14);
+
+	/* once the directories are old enough for their timestamps to be
+	 * trusted, the cached size is reused, so a file changed in place
+	 * isn’t noticed */
+	times.actime = times.modtime = g_get_real_time () / G_USEC_PER_SEC - 60;
+	g_assert_cmpint (g_utime (tmp_root, &times), ==, 0);
+	g_assert_cmpint (g_utime (dir_a, &times), ==, 0);
+	g_assert_cmpuint (gs_utils_get_file_size (tmp_root, NULL, NULL, NULL), ==, 14);
+
+	ret = g_file_set_contents_full (file_a, "01234567890123456789", 20,
+					G_FILE_SET_CONTENTS_NONE, 0644, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	g_assert_cmpuint (gs_utils_get_file_size (tmp_root, NULL, NULL, NULL), ==, 14);
+
+	/* but adding a file next to it invalidates the cached size */
+	ret = g_file_set_contents (file_d, "012", 3, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	g_assert_cmpuint (gs_utils_get_file_size (tmp_root, NULL, NULL, NULL), ==, 27);
+
+	g_assert_cmpuint (gs_utils_get_file_size ("/nonexistent", NULL, NULL, NULL), ==, 0);
+
+	gs_utils_rmtree (tmp_root, NULL);
+}
+
 static void
 gs_utils_error_func (void)
 {
@@ -202,6 +345,91 @@ gs_plugin_download_rewrite_func (void)
 	g_assert (css != NULL);
 }
 
+static void
+gs_plugin_cache_func (void)
+{
+	g_autoptr(GsPlugin) plugin = g_object_new (GS_TYPE_PLUGIN, NULL);
+	g_autoptr(GsApp) app1 = gs_app_new ("a");
+	g_autoptr(GsApp) app2 = gs_app_new ("b");
+	g_autoptr(GsApp) app_tmp = NULL;
+	g_autoptr(GsAppList) list = NULL;
+
+	gs_app_set_state (app1, GS_APP_STATE_INSTALLED);
+	gs_app_set_kind (app1, AS_COMPONENT_KIND_DESKTOP_APP);
+	gs_app_add_source (app1, "pkg-a");
+	gs_app_set_state (app2, GS_APP_STATE_AVAILABLE);
+	gs_app_set_kind (app2, AS_COMPONENT_KIND_RUNTIME);
+
+	gs_plugin_cache_add (plugin, NULL, app1);
+	gs_plugin_cache_add (plugin, "b", app2);
+	/* the same app under a second key is only listed once */
+	gs_plugin_cache_add (plugin, "b-alias", app2);
+
+	app_tmp = gs_plugin_cache_lookup (plugin, "b");
+	g_assert_true (app_tmp == app2);
+	g_clear_object (&app_tmp);
+
+	list = gs_app_list_new ();
+	gs_plugin_cache_lookup_by_state (plugin, list, GS_APP_STATE_UNKNOWN);
+	g_assert_cmpint (gs_app_list_length (list), ==, 2);
+	g_clear_object (&list);
+
+	list = gs_app_list_new ();
+	gs_plugin_cache_lookup_by_state (plugin, list, GS_APP_STATE_INSTALLED);
+	g_assert_cmpint (gs_app_list_length (list), ==, 1);
+	g_assert_true (gs_app_list_index (list, 0) == app1);
+	g_clear_object (&list);
+
+	/* the indexes follow changes to cached apps */
+	gs_app_set_state (app2, GS_APP_STATE_INSTALLING);
+	gs_app_set_state (app2, GS_APP_STATE_INSTALLED);
+	gs_app_add_source (app2, "pkg-b");
+	list = gs_app_list_new ();
+	gs_plugin_cache_lookup_by_state (plugin, list, GS_APP_STATE_INSTALLED);
+	g_assert_cmpint (gs_app_list_length (list), ==, 2);
+	g_clear_object (&list);
+
+	list = gs_app_list_new ();
+	gs_plugin_cache_lookup_by_source (plugin, list, "pkg-b");
+	g_assert_cmpint (gs_app_list_length (list), ==, 1);
+	g_assert_true (gs_app_list_index (list, 0) == app2);
+	g_clear_object (&list);
+
+	list = gs_app_list_new ();
+	gs_plugin_cache_lookup_by_kind (plugin, list, AS_COMPONENT_KIND_DESKTOP_APP);
+	g_assert_cmpint (gs_app_list_length (list), ==, 1);
+	g_assert_true (gs_app_list_index (list, 0) == app1);
+	g_clear_object (&list);
+
+	/* as do changes made through the GObject property */
+	g_object_set (app1, "state", GS_APP_STATE_UPDATABLE, NULL);
+	list = gs_app_list_new ();
+	gs_plugin_cache_lookup_by_state (plugin, list, GS_APP_STATE_INSTALLED);
+	g_assert_cmpint (gs_app_list_length (list), ==, 1);
+	g_assert_true (gs_app_list_index (list, 0) == app2);
+	g_clear_object (&list);
+
+	/* removing one of two keys keeps the app indexed */
+	gs_plugin_cache_remove (plugin, "b");
+	list = gs_app_list_new ();
+	gs_plugin_cache_lookup_by_source (plugin, list, "pkg-b");
+	g_assert_cmpint (gs_app_list_length (list), ==, 1);
+	g_clear_object (&list);
+
+	gs_plugin_cache_remove (plugin, "b-alias");
+	list = gs_app_list_new ();
+	gs_plugin_cache_lookup_by_source (plugin, list, "pkg-b");
+	g_assert_cmpint (gs_app_list_length (list), ==, 0);
+	g_clear_object (&list);
+
+	gs_plugin_cache_invalidate (plugin);
+	list = gs_app_list_new ();
+	gs_plugin_cache_lookup_by_state (plugin, list, GS_APP_STATE_INSTALLED);
+	g_assert_cmpint (gs_app_list_length (list), ==, 0);
+	app_tmp = gs_plugin_cache_lookup (plugin, gs_app_get_unique_id (app1));
+	g_assert_null (app_tmp);
+}
+
 static void
 gs_plugin_func (void)
 {
@@ -669,6 +897,42 @@ gs_app_progress_clamping_func (void)
 	}
 }
 
+static void
+gs_app_notify_count_cb (GObject    *object,
+                        GParamSpec *pspec,
+                        gpointer    user_data)
+{
+	GHashTable *counts = user_data;
+	guint count = GPOINTER_TO_UINT (g_hash_table_lookup (counts, pspec->name));
+	g_hash_table_replace (counts, (gpointer) pspec->name, GUINT_TO_POINTER (count + 1));
+}
+
+static void
+gs_app_notify_coalesce_func (void)
+{
+	g_autoptr(GsApp) app = gs_app_new ("gnome-software.desktop");
+	g_autoptr(GHashTable) counts = g_hash_table_new (g_str_hash, g_str_equal);
+
+	gs_test_flush_main_context ();
+	g_signal_connect (app, "notify", G_CALLBACK (gs_app_notify_count_cb), counts);
+
+	/* nothing is notified until the main context is iterated */
+	for (guint i = 1; i <= 10; i++)
+		gs_app_set_progress (app, i * 10);
+	gs_app_set_state (app, GS_APP_STATE_AVAILABLE);
+	g_assert_cmpuint (g_hash_table_size (counts), ==, 0);
+
+	/* and then each changed property is notified once */
+	gs_test_flush_main_context ();
+	g_assert_cmpuint (GPOINTER_TO_UINT (g_hash_table_lookup (counts, "progress")), ==, 1);
+	g_assert_cmpuint (GPOINTER_TO_UINT (g_hash_table_lookup (counts, "state")), ==, 1);
+
+	/* changes after that are notified again */
+	gs_app_set_progress (app, 50);
+	gs_test_flush_main_context ();
+	g_assert_cmpuint (GPOINTER_TO_UINT (g_hash_table_lookup (counts, "progress")), ==, 2);
+}
+
 static void
 gs_app_list_wildcard_dedupe_func (void)
 {
@@ -736,6 +1000,52 @@ gs_app_list_performance_func (void)
 	g_print ("%.2fms ", g_timer_elapsed (timer, NULL) * 1000);
 }
 
+static guint64
+gs_app_list_count_comparisons (GPtrArray *apps, GPtrArray *copies, guint n_apps)
+{
+	g_autoptr(GsAppList) list = gs_app_list_new ();
+
+	for (guint i = 0; i < n_apps; i++)
+		gs_app_list_add (list, g_ptr_array_index (apps, i));
+	/* and again, which should all be detected as duplicates, both as the
+	 * same objects and as different objects with the same unique IDs */
+	for (guint i = 0; i < n_apps; i++)
+		gs_app_list_add (list, g_ptr_array_index (apps, i));
+	for (guint i = 0; i < n_apps; i++)
+		gs_app_list_add (list, g_ptr_array_index (copies, i));
+	g_assert_cmpint (gs_app_list_length (list), ==, n_apps);
+
+	return gs_app_list_get_n_comparisons (list);
+}
+
+static void
+gs_app_list_scaling_func (void)
+{
+	g_autoptr(GPtrArray) apps = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	g_autoptr(GPtrArray) copies = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	const guint n_apps = 50000;
+	guint64 n_small, n_large;
+
+	for (guint i = 0; i < n_apps; i++) {
+		g_autofree gchar *id = g_strdup_printf ("org.example.App%05u.desktop", i);
+		GsApp *app = gs_app_new (id);
+		GsApp *copy = gs_app_new (id);
+		gs_app_set_origin (app, "test");
+		gs_app_set_origin (copy, "test");
+		g_ptr_array_add (apps, app);
+		g_ptr_array_add (copies, copy);
+	}
+
+	/* each app is only compared with the apps sharing its ID, so 4× the
+	 * apps need 4× the comparisons, where comparing with the whole list
+	 * would need 16× */
+	n_small = gs_app_list_count_comparisons (apps, copies, n_apps / 4);
+	n_large = gs_app_list_count_comparisons (apps, copies, n_apps);
+	g_assert_cmpuint (n_small, >, 0);
+	g_assert_cmpuint (n_large, ==, 4 * n_small);
+	g_assert_cmpuint (n_large, <=, 2 * n_apps);
+}
+
 static void
 gs_app_list_related_func (void)
 {
@@ -756,6 +1066,267 @@ gs_app_list_related_func (void)
 	g_assert_cmpint (gs_app_list_get_progress (list), ==, 50);
 }
 
+static JsonObject *
+find_trace_event (JsonArray   *events,
+                  const gchar *name)
+{
+	for (guint i = 0; i < json_array_get_length (events); i++) {
+		JsonObject *event = json_array_get_object_element (events, i);
+
+		if (g_strcmp0 (json_object_get_string_member (event, "name"), name) == 0)
+			return event;
+	}
+
+	return NULL;
+}
+
+static void
+count_spans_cb (const gchar *name,
+                gint64       begin_usec,
+                gint64       duration_usec,
+                gpointer     user_data)
+{
+	guint *n_spans = user_data;
+
+	g_assert_cmpint (duration_usec, >=, 0);
+	if (g_strcmp0 (name, "test:many") == 0)
+		(*n_spans)++;
+}
+
+static void
+gs_trace_func (void)
+{
+	g_autoptr(GsTraceSpan) span = NULL;
+	g_autoptr(JsonParser) parser = json_parser_new ();
+	g_autoptr(GError) error = NULL;
+	g_autofree gchar *json = NULL;
+	JsonArray *events;
+	JsonObject *parent, *child, *args;
+	guint parent_id, old_span_id;
+	guint n_spans = 0;
+	gboolean ret;
+
+	/* spans nest inside the current span by default */
+	span = gs_trace_span_begin ("test:parent");
+	parent_id = gs_trace_span_get_id (span);
+	g_assert_cmpuint (parent_id, !=, 0);
+	old_span_id = gs_trace_set_current_span_id (parent_id);
+	{
+		g_autoptr(GsTraceSpan) child_span = gs_trace_span_begin ("test:child");
+
+		gs_trace_span_set_app_id (child_span, "org.example.App");
+		gs_trace_span_set_refine_flags (child_span, GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON);
+		gs_trace_span_set_queue_delay (child_span, 42);
+	}
+	g_assert_cmpuint (gs_trace_set_current_span_id (old_span_id), ==, parent_id);
+	g_clear_pointer (&span, gs_trace_span_end);
+
+	/* both are in the ring buffer, parent last */
+	json = gs_trace_to_json ();
+	ret = json_parser_load_from_data (parser, json, -1, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	events = json_object_get_array_member (json_node_get_object (json_parser_get_root (parser)),
+					       "traceEvents");
+
+	parent = find_trace_event (events, "test:parent");
+	g_assert_nonnull (parent);
+	args = json_object_get_object_member (parent, "args");
+	g_assert_cmpint (json_object_get_int_member (args, "id"), ==, parent_id);
+
+	child = find_trace_event (events, "test:child");
+	g_assert_nonnull (child);
+	g_assert_cmpstr (json_object_get_string_member (child, "ph"), ==, "X");
+	g_assert_cmpint (json_object_get_int_member (child, "ts"), >=,
+			 json_object_get_int_member (parent, "ts"));
+	g_assert_cmpint (json_object_get_int_member (child, "dur"), <=,
+			 json_object_get_int_member (parent, "dur"));
+	args = json_object_get_object_member (child, "args");
+	g_assert_cmpint (json_object_get_int_member (args, "parent"), ==, parent_id);
+	g_assert_cmpstr (json_object_get_string_member (args, "app-id"), ==, "org.example.App");
+	g_assert_cmpint (json_object_get_int_member (args, "refine-flags"), ==, GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON);
+	g_assert_cmpint (json_object_get_int_member (args, "queue-delay-us"), ==, 42);
+
+	/* the span func sees every span, even once the ring buffer has
+	 * wrapped around */
+	gs_trace_set_span_func (count_spans_cb, &n_spans);
+	for (guint i = 0; i < 10000; i++)
+		gs_trace_span_end (gs_trace_span_begin ("test:many"));
+	gs_trace_set_span_func (NULL, NULL);
+	gs_trace_span_end (gs_trace_span_begin ("test:many"));
+	g_assert_cmpuint (n_spans, ==, 10000);
+}
+
+static void
+worker_sleep_cb (GTask        *task,
+                 gpointer      source_object,
+                 gpointer      task_data,
+                 GCancellable *cancellable)
+{
+	g_usleep (GPOINTER_TO_UINT (task_data));
+	g_task_return_boolean (task, TRUE);
+}
+
+static void
+worker_result_cb (GObject      *source_object,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+	guint *n_done = user_data;
+
+	g_assert_true (g_task_propagate_boolean (G_TASK (result), NULL));
+	(*n_done)++;
+}
+
+static void
+async_result_cb (GObject      *source_object,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+	GAsyncResult **result_out = user_data;
+
+	*result_out = g_object_ref (result);
+}
+
+static void
+gs_worker_thread_metrics_func (void)
+{
+	g_autoptr(GsWorkerThread) worker = gs_worker_thread_new ("gs-self-test-worker");
+	g_autoptr(GPtrArray) workers = NULL;
+	g_autoptr(GAsyncResult) result = NULL;
+	GsWorkerThreadMetrics metrics;
+	guint n_done = 0;
+	gboolean found = FALSE;
+	gboolean ret;
+
+	workers = gs_worker_thread_dup_all ();
+	for (guint i = 0; i < workers->len; i++)
+		found = found || (g_ptr_array_index (workers, i) == worker);
+	g_assert_true (found);
+
+	/* block the worker for long enough that the low priority task queued
+	 * behind it gets promoted */
+	for (guint i = 0; i < 2; i++) {
+		g_autoptr(GTask) task = g_task_new (worker, NULL, worker_result_cb, &n_done);
+		guint sleep_usec = (i == 0) ? GS_WORKER_THREAD_AGING_STEP_USEC + G_USEC_PER_SEC / 2 : 0;
+
+		g_task_set_task_data (task, GUINT_TO_POINTER (sleep_usec), NULL);
+		gs_worker_thread_queue (worker, (i == 0) ? G_PRIORITY_DEFAULT : G_PRIORITY_LOW,
+					worker_sleep_cb, g_steal_pointer (&task));
+	}
+
+	gs_worker_thread_get_metrics (worker, &metrics);
+	g_assert_cmpuint (metrics.n_queued + metrics.n_running, ==, 2);
+
+	while (n_done < 2)
+		g_main_context_iteration (NULL, TRUE);
+
+	gs_worker_thread_get_metrics (worker, &metrics);
+	g_assert_cmpuint (metrics.n_queued, ==, 0);
+	g_assert_cmpuint (metrics.n_running, ==, 0);
+	g_assert_cmpuint (metrics.n_completed, ==, 2);
+	g_assert_cmpuint (metrics.n_promoted, >=, 1);
+	g_assert_cmpint (metrics.run_p99_usec, >=, GS_WORKER_THREAD_AGING_STEP_USEC);
+	g_assert_cmpint (metrics.wait_p99_usec, >=, GS_WORKER_THREAD_AGING_STEP_USEC);
+	g_assert_cmpint (metrics.wait_p50_usec, <=, metrics.wait_p99_usec);
+
+	gs_worker_thread_shutdown_async (worker, NULL, async_result_cb, &result);
+	while (result == NULL)
+		g_main_context_iteration (NULL, TRUE);
+	ret = gs_worker_thread_shutdown_finish (worker, result, NULL);
+	g_assert_true (ret);
+}
+
+static void
+gs_remote_icon_save_cached_func (void)
+{
+	g_autoptr(GIcon) icon = gs_remote_icon_new ("https://example.com/icons/small.png");
+	g_autoptr(GIcon) icon_scaled = gs_remote_icon_new ("https://example.com/icons/large.png");
+	g_autoptr(GIcon) icon_corrupt = gs_remote_icon_new ("https://example.com/icons/corrupt.png");
+	g_autoptr(GBytes) corrupt_data = NULL;
+	g_autoptr(GdkPixbuf) pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, 64, 64);
+	g_autoptr(GBytes) data = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autofree gchar *buf = NULL;
+	g_autofree gchar *cached = NULL;
+	gsize buf_len = 0;
+	gsize cached_len = 0;
+	gboolean ret;
+
+	gdk_pixbuf_fill (pixbuf, 0xff0000ff);
+	ret = gdk_pixbuf_save_to_buffer (pixbuf, &buf, &buf_len, "png", &error, NULL);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	data = g_bytes_new (buf, buf_len);
+
+	/* small enough already, so cached without being re-encoded */
+	ret = gs_remote_icon_save_cached (GS_REMOTE_ICON (icon), data, 160, NULL, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	ret = g_file_get_contents (g_file_peek_path (g_file_icon_get_file (G_FILE_ICON (icon))),
+				   &cached, &cached_len, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	g_assert_cmpmem (cached, cached_len, buf, buf_len);
+	g_assert_cmpuint (gs_icon_get_width (icon), ==, 64);
+	g_assert_cmpuint (gs_icon_get_height (icon), ==, 64);
+
+	/* too big, so scaled down */
+	ret = gs_remote_icon_save_cached (GS_REMOTE_ICON (icon_scaled), data, 32, NULL, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	g_assert_true (g_file_query_exists (g_file_icon_get_file (G_FILE_ICON (icon_scaled)), NULL));
+	g_assert_cmpuint (gs_icon_get_width (icon_scaled), ==, 32);
+	g_assert_cmpuint (gs_icon_get_height (icon_scaled), ==, 32);
+
+	/* only the signature and a valid header, which isn’t enough to be
+	 * cached as-is */
+	corrupt_data = g_bytes_new (buf, 33);
+	ret = gs_remote_icon_save_cached (GS_REMOTE_ICON (icon_corrupt), corrupt_data, 160, NULL, &error);
+	g_assert_nonnull (error);
+	g_assert_false (ret);
+	g_clear_error (&error);
+	g_assert_false (g_file_query_exists (g_file_icon_get_file (G_FILE_ICON (icon_corrupt)), NULL));
+}
+
+static void
+gs_key_colors_kernels_func (void)
+{
+	g_autoptr(GdkPixbuf) pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, 64, 64);
+	g_autoptr(GRand) rand = g_rand_new_with_seed (42);
+	guint8 *pixels = gdk_pixbuf_get_pixels (pixbuf);
+	gint rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+
+	/* noisy blobs of a few colours, with some transparent pixels */
+	for (gint y = 0; y < gdk_pixbuf_get_height (pixbuf); y++) {
+		for (gint x = 0; x < gdk_pixbuf_get_width (pixbuf); x++) {
+			guint8 *p = pixels + y * rowstride + x * 4;
+			guint blob = (x / 16 + y / 16) % 4;
+
+			p[0] = CLAMP ((gint) (blob * 60) + g_rand_int_range (rand, -20, 20), 0, 255);
+			p[1] = CLAMP ((gint) (255 - blob * 50) + g_rand_int_range (rand, -20, 20), 0, 255);
+			p[2] = CLAMP ((gint) ((blob % 2) * 200) + g_rand_int_range (rand, -20, 20), 0, 255);
+			p[3] = (g_rand_int_range (rand, 0, 10) == 0) ? 0 : 255;
+		}
+	}
+
+	/* k-means picks its starting centres at random, so both kernels have
+	 * to start from the same seed to be comparable */
+	for (guint32 seed = 1; seed <= 5; seed++) {
+		g_autoptr(GArray) scalar_colors = NULL;
+		g_autoptr(GArray) auto_colors = NULL;
+
+		g_random_set_seed (seed);
+		scalar_colors = gs_calculate_key_colors_with_kernel (pixbuf, GS_KEY_COLORS_KERNEL_SCALAR);
+		g_random_set_seed (seed);
+		auto_colors = gs_calculate_key_colors_with_kernel (pixbuf, GS_KEY_COLORS_KERNEL_AUTO);
+
+		g_assert_cmpuint (scalar_colors->len, >, 0);
+		g_assert_cmpmem (auto_colors->data, auto_colors->len * sizeof (GdkRGBA),
+				 scalar_colors->data, scalar_colors->len * sizeof (GdkRGBA));
+	}
+}
+
 int
 main (int argc, char **argv)
 {
@@ -768,18 +1339,27 @@ main (int argc, char **argv)
 	g_test_add_func ("/gnome-software/lib/utils{wilson}", gs_utils_wilson_func);
 	g_test_add_func ("/gnome-software/lib/utils{error}", gs_utils_error_func);
 	g_test_add_func ("/gnome-software/lib/utils{cache}", gs_utils_cache_func);
+	g_test_add_func ("/gnome-software/lib/cache-manager", gs_cache_manager_func);
+	g_test_add_func ("/gnome-software/lib/utils{file-size}", gs_utils_file_size_func);
 	g_test_add_func ("/gnome-software/lib/utils{append-kv}", gs_utils_append_kv_func);
 	g_test_add_func ("/gnome-software/lib/os-release", gs_os_release_func);
 	g_test_add_func ("/gnome-software/lib/app", gs_app_func);
 	g_test_add_func ("/gnome-software/lib/app/progress-clamping", gs_app_progress_clamping_func);
+	g_test_add_func ("/gnome-software/lib/app{notify-coalesce}", gs_app_notify_coalesce_func);
 	g_test_add_func ("/gnome-software/lib/app{addons}", gs_app_addons_func);
 	g_test_add_func ("/gnome-software/lib/app{unique-id}", gs_app_unique_id_func);
 	g_test_add_data_func ("/gnome-software/lib/app{thread}", debug, gs_app_thread_func);
 	g_test_add_func ("/gnome-software/lib/app{list}", gs_app_list_func);
 	g_test_add_func ("/gnome-software/lib/app{list-wildcard-dedupe}", gs_app_list_wildcard_dedupe_func);
 	g_test_add_func ("/gnome-software/lib/app{list-performance}", gs_app_list_performance_func);
+	g_test_add_func ("/gnome-software/lib/app{list-scaling}", gs_app_list_scaling_func);
 	g_test_add_func ("/gnome-software/lib/app{list-related}", gs_app_list_related_func);
+	g_test_add_func ("/gnome-software/lib/remote-icon{save-cached}", gs_remote_icon_save_cached_func);
+	g_test_add_func ("/gnome-software/lib/key-colors{kernels}", gs_key_colors_kernels_func);
+	g_test_add_func ("/gnome-software/lib/trace", gs_trace_func);
+	g_test_add_func ("/gnome-software/lib/worker-thread{metrics}", gs_worker_thread_metrics_func);
 	g_test_add_func ("/gnome-software/lib/plugin", gs_plugin_func);
+	g_test_add_func ("/gnome-software/lib/plugin{cache}", gs_plugin_cache_func);
 	g_test_add_func ("/gnome-software/lib/plugin{download-rewrite}", gs_plugin_download_rewrite_func);
 
 	return g_test_run ();
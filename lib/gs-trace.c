@@ -0,0 +1,515 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2023 Vanilla OS Contributors
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+/**
+ * SECTION:gs-trace
+ * @short_description: Nested timing spans for jobs, plugins and apps
+ *
+ * A #GsTraceSpan measures how long an operation took, along with what it was
+ * operating on: the ID of an app, the refine flags, or how long it waited in
+ * a worker thread’s queue before running. Spans are nested, so a slow page
+ * load can be attributed from the plugin job, to the plugin, to the app, to
+ * the network request.
+ *
+ * Each span has a parent, which is either given explicitly, or is the
+ * thread’s current span; see gs_trace_set_current_span_id(). #GsWorkerThread
+ * carries the current span over to the tasks it runs, so spans started in a
+ * plugin’s worker thread are nested inside the vfunc which queued them.
+ *
+ * Finished spans are added as marks to the sysprof capture if gnome-software
+ * is being profiled, and otherwise kept in a ring buffer of the most recent
+ * spans, which can be saved with gs_trace_dump() in the Chrome trace event
+ * format, as understood by Perfetto and `chrome://tracing`.
+ *
+ * All the functions here are thread safe.
+ *
+ * Since: 43
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <json-glib/json-glib.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYSPROF
+#include <sched.h>
+#include <sysprof-capture.h>
+#endif
+
+#include "gs-trace.h"
+
+/* The number of finished spans to keep in the ring buffer. */
+#define GS_TRACE_RING_SIZE 8192
+
+struct _GsTraceSpan
+{
+	guint		 id;
+	guint		 parent_id;  /* 0 if it has no parent */
+	guint		 thread_id;
+	gchar		*name;  /* (owned) */
+	gchar		*app_id;  /* (owned) (nullable) */
+	gchar		*detail;  /* (owned) (nullable) */
+	guint64		 refine_flags;
+	gint64		 queue_delay_usec;  /* -1 if unset */
+	gint64		 begin_usec;
+	gint64		 duration_usec;
+};
+
+static GMutex trace_mutex;
+static GsTraceSpan *ring[GS_TRACE_RING_SIZE];  /* (mutex trace_mutex) (owned) (nullable) */
+static guint ring_next = 0;  /* (mutex trace_mutex) */
+static gpointer sysprof_writer = NULL;  /* (mutex trace_mutex) (unowned) (nullable) */
+static GsTraceSpanFunc span_func = NULL;  /* (mutex trace_mutex) (nullable) */
+static gpointer span_func_data = NULL;  /* (mutex trace_mutex) */
+
+static guint next_span_id = 1;  /* (atomic) */
+static guint next_thread_id = 1;  /* (atomic) */
+
+static GPrivate current_span_id;
+static GPrivate thread_id;
+
+static void
+gs_trace_span_free (GsTraceSpan *span)
+{
+	g_free (span->name);
+	g_free (span->app_id);
+	g_free (span->detail);
+	g_free (span);
+}
+
+static guint
+get_thread_id (void)
+{
+	guint id = GPOINTER_TO_UINT (g_private_get (&thread_id));
+
+	if (id == 0) {
+		id = (guint) g_atomic_int_add (&next_thread_id, 1);
+		g_private_set (&thread_id, GUINT_TO_POINTER (id));
+	}
+
+	return id;
+}
+
+/**
+ * gs_trace_span_begin:
+ * @name: name of the operation, such as `refine:appstream`
+ *
+ * Start a span, nested inside the current span of the calling thread.
+ *
+ * Returns: (transfer full): a new span, to be finished with
+ *    gs_trace_span_end()
+ * Since: 43
+ */
+GsTraceSpan *
+gs_trace_span_begin (const gchar *name)
+{
+	return gs_trace_span_begin_with_parent (gs_trace_get_current_span_id (), name);
+}
+
+/**
+ * gs_trace_span_begin_with_parent:
+ * @parent_id: ID of the span to nest inside, or 0 for none
+ * @name: name of the operation, such as `refine:appstream`
+ *
+ * Start a span nested inside @parent_id, which needn’t have been started in
+ * the calling thread.
+ *
+ * Returns: (transfer full): a new span, to be finished with
+ *    gs_trace_span_end()
+ * Since: 43
+ */
+GsTraceSpan *
+gs_trace_span_begin_with_parent (guint        parent_id,
+                                 const gchar *name)
+{
+	GsTraceSpan *span;
+
+	g_return_val_if_fail (name != NULL, NULL);
+
+	span = g_new0 (GsTraceSpan, 1);
+	span->id = (guint) g_atomic_int_add (&next_span_id, 1);
+	span->parent_id = parent_id;
+	span->thread_id = get_thread_id ();
+	span->name = g_strdup (name);
+	span->queue_delay_usec = -1;
+	span->begin_usec = g_get_monotonic_time ();
+
+	return span;
+}
+
+/**
+ * gs_trace_span_get_id:
+ * @span: a #GsTraceSpan
+ *
+ * Get the ID of @span, to nest other spans inside it.
+ *
+ * Returns: the span ID, which is never 0
+ * Since: 43
+ */
+guint
+gs_trace_span_get_id (GsTraceSpan *span)
+{
+	g_return_val_if_fail (span != NULL, 0);
+
+	return span->id;
+}
+
+/**
+ * gs_trace_span_set_app_id:
+ * @span: a #GsTraceSpan
+ * @app_id: (nullable): ID of the app the operation is for
+ *
+ * Record which app the operation is for.
+ *
+ * Since: 43
+ */
+void
+gs_trace_span_set_app_id (GsTraceSpan *span,
+                          const gchar *app_id)
+{
+	g_return_if_fail (span != NULL);
+
+	g_free (span->app_id);
+	span->app_id = g_strdup (app_id);
+}
+
+/**
+ * gs_trace_span_set_refine_flags:
+ * @span: a #GsTraceSpan
+ * @refine_flags: the #GsPluginRefineFlags the operation was run with
+ *
+ * Record the refine flags the operation was run with.
+ *
+ * Since: 43
+ */
+void
+gs_trace_span_set_refine_flags (GsTraceSpan *span,
+                                guint64      refine_flags)
+{
+	g_return_if_fail (span != NULL);
+
+	span->refine_flags = refine_flags;
+}
+
+/**
+ * gs_trace_span_set_queue_delay:
+ * @span: a #GsTraceSpan
+ * @queue_delay_usec: time spent queued before the operation started, in
+ *    microseconds
+ *
+ * Record how long the operation waited before it could start running.
+ *
+ * Since: 43
+ */
+void
+gs_trace_span_set_queue_delay (GsTraceSpan *span,
+                               gint64       queue_delay_usec)
+{
+	g_return_if_fail (span != NULL);
+
+	span->queue_delay_usec = queue_delay_usec;
+}
+
+/**
+ * gs_trace_span_set_detail:
+ * @span: a #GsTraceSpan
+ * @detail: (nullable): anything else identifying the operation, such as the
+ *    URI being downloaded
+ *
+ * Record anything else identifying the operation.
+ *
+ * Since: 43
+ */
+void
+gs_trace_span_set_detail (GsTraceSpan *span,
+                          const gchar *detail)
+{
+	g_return_if_fail (span != NULL);
+
+	g_free (span->detail);
+	span->detail = g_strdup (detail);
+}
+
+#ifdef HAVE_SYSPROF
+static gchar *
+gs_trace_span_to_message (GsTraceSpan *span)
+{
+	g_autoptr(GString) str = g_string_new (NULL);
+
+	g_string_append_printf (str, "id=%u parent=%u", span->id, span->parent_id);
+	if (span->app_id != NULL)
+		g_string_append_printf (str, " app=%s", span->app_id);
+	if (span->refine_flags != 0)
+		g_string_append_printf (str, " refine-flags=0x%" G_GINT64_MODIFIER "x", span->refine_flags);
+	if (span->queue_delay_usec >= 0)
+		g_string_append_printf (str, " queue-delay=%" G_GINT64_FORMAT "us", span->queue_delay_usec);
+	if (span->detail != NULL)
+		g_string_append_printf (str, " %s", span->detail);
+
+	return g_string_free (g_steal_pointer (&str), FALSE);
+}
+#endif  /* HAVE_SYSPROF */
+
+/**
+ * gs_trace_span_end:
+ * @span: (transfer full): a #GsTraceSpan
+ *
+ * Finish @span and record it. @span is freed.
+ *
+ * This can be called from a different thread from the one which started
+ * @span.
+ *
+ * Since: 43
+ */
+void
+gs_trace_span_end (GsTraceSpan *span)
+{
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	g_return_if_fail (span != NULL);
+
+	span->duration_usec = g_get_monotonic_time () - span->begin_usec;
+
+	locker = g_mutex_locker_new (&trace_mutex);
+
+	if (span_func != NULL)
+		span_func (span->name, span->begin_usec, span->duration_usec, span_func_data);
+
+#ifdef HAVE_SYSPROF
+	if (sysprof_writer != NULL) {
+		g_autofree gchar *message = gs_trace_span_to_message (span);
+
+		sysprof_capture_writer_add_mark (sysprof_writer,
+						 span->begin_usec * 1000,
+						 sched_getcpu (),
+						 getpid (),
+						 span->duration_usec * 1000,
+						 "gnome-software",
+						 span->name,
+						 message);
+		gs_trace_span_free (span);
+		return;
+	}
+#endif  /* HAVE_SYSPROF */
+
+	g_clear_pointer (&ring[ring_next], gs_trace_span_free);
+	ring[ring_next] = span;
+	ring_next = (ring_next + 1) % GS_TRACE_RING_SIZE;
+}
+
+/**
+ * gs_trace_get_current_span_id:
+ *
+ * Get the ID of the calling thread’s current span, which new spans are nested
+ * inside by default.
+ *
+ * Returns: the span ID, or 0 if there is none
+ * Since: 43
+ */
+guint
+gs_trace_get_current_span_id (void)
+{
+	return GPOINTER_TO_UINT (g_private_get (&current_span_id));
+}
+
+/**
+ * gs_trace_set_current_span_id:
+ * @span_id: ID of the span, or 0 for none
+ *
+ * Set the calling thread’s current span, which new spans are nested inside
+ * by default. Restore the previous one once the operation is finished:
+ *
+ * |[
+ * g_autoptr(GsTraceSpan) span = gs_trace_span_begin ("my-operation");
+ * guint old_span_id = gs_trace_set_current_span_id (gs_trace_span_get_id (span));
+ *
+ * do_my_operation ();
+ *
+ * gs_trace_set_current_span_id (old_span_id);
+ * ]|
+ *
+ * Returns: the ID of the previous current span, or 0 if there was none
+ * Since: 43
+ */
+guint
+gs_trace_set_current_span_id (guint span_id)
+{
+	guint old_span_id = gs_trace_get_current_span_id ();
+
+	g_private_set (&current_span_id, GUINT_TO_POINTER (span_id));
+
+	return old_span_id;
+}
+
+/**
+ * gs_trace_set_sysprof_writer:
+ * @writer: (nullable) (type SysprofCaptureWriter): a sysprof capture writer,
+ *    or %NULL
+ *
+ * Record finished spans as marks using @writer, instead of in the ring
+ * buffer. The caller must keep @writer alive until this is called again with
+ * %NULL.
+ *
+ * This does nothing if gnome-software was built without sysprof support.
+ *
+ * Since: 43
+ */
+void
+gs_trace_set_sysprof_writer (gpointer writer)
+{
+#ifdef HAVE_SYSPROF
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&trace_mutex);
+
+	sysprof_writer = writer;
+#endif
+}
+
+/**
+ * GsTraceSpanFunc:
+ * @name: name of the span which has just finished
+ * @begin_usec: when the span started, in microseconds of monotonic time
+ * @duration_usec: how long the span took, in microseconds
+ * @user_data: data passed to gs_trace_set_span_func()
+ *
+ * Called for every span as it finishes; see gs_trace_set_span_func().
+ *
+ * Since: 43
+ */
+
+/**
+ * gs_trace_set_span_func:
+ * @func: (nullable): function to call as each span
+ *    finishes, or %NULL to stop
+ * @user_data: data to pass to @func
+ *
+ * Call @func for every span as it finishes, whether it’s recorded in the ring
+ * buffer or in a sysprof capture. This lets a caller add up every span,
+ * rather than only the most recent ones which are still in the ring buffer.
+ *
+ * @func is called in whichever thread finishes the span, with an internal
+ * lock held, so it must be thread safe and must not start or finish spans
+ * itself.
+ *
+ * Since: 43
+ */
+void
+gs_trace_set_span_func (GsTraceSpanFunc func,
+                        gpointer        user_data)
+{
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&trace_mutex);
+
+	span_func = func;
+	span_func_data = user_data;
+}
+
+/**
+ * gs_trace_to_json:
+ *
+ * Serialise the spans in the ring buffer, oldest first, in the Chrome trace
+ * event format. Timestamps are in microseconds of monotonic time.
+ *
+ * Returns: (transfer full): a JSON document
+ * Since: 43
+ */
+gchar *
+gs_trace_to_json (void)
+{
+	g_autoptr(JsonBuilder) builder = json_builder_new ();
+	g_autoptr(JsonGenerator) generator = json_generator_new ();
+	g_autoptr(JsonNode) root = NULL;
+	g_autoptr(GMutexLocker) locker = NULL;
+	gint pid = (gint) getpid ();
+
+	json_builder_begin_object (builder);
+	json_builder_set_member_name (builder, "displayTimeUnit");
+	json_builder_add_string_value (builder, "ms");
+	json_builder_set_member_name (builder, "traceEvents");
+	json_builder_begin_array (builder);
+
+	locker = g_mutex_locker_new (&trace_mutex);
+	for (guint i = 0; i < GS_TRACE_RING_SIZE; i++) {
+		GsTraceSpan *span = ring[(ring_next + i) % GS_TRACE_RING_SIZE];
+
+		if (span == NULL)
+			continue;
+
+		json_builder_begin_object (builder);
+		json_builder_set_member_name (builder, "name");
+		json_builder_add_string_value (builder, span->name);
+		json_builder_set_member_name (builder, "ph");
+		json_builder_add_string_value (builder, "X");
+		json_builder_set_member_name (builder, "ts");
+		json_builder_add_int_value (builder, span->begin_usec);
+		json_builder_set_member_name (builder, "dur");
+		json_builder_add_int_value (builder, span->duration_usec);
+		json_builder_set_member_name (builder, "pid");
+		json_builder_add_int_value (builder, pid);
+		json_builder_set_member_name (builder, "tid");
+		json_builder_add_int_value (builder, span->thread_id);
+
+		json_builder_set_member_name (builder, "args");
+		json_builder_begin_object (builder);
+		json_builder_set_member_name (builder, "id");
+		json_builder_add_int_value (builder, span->id);
+		json_builder_set_member_name (builder, "parent");
+		json_builder_add_int_value (builder, span->parent_id);
+		if (span->app_id != NULL) {
+			json_builder_set_member_name (builder, "app-id");
+			json_builder_add_string_value (builder, span->app_id);
+		}
+		if (span->refine_flags != 0) {
+			json_builder_set_member_name (builder, "refine-flags");
+			json_builder_add_int_value (builder, (gint64) span->refine_flags);
+		}
+		if (span->queue_delay_usec >= 0) {
+			json_builder_set_member_name (builder, "queue-delay-us");
+			json_builder_add_int_value (builder, span->queue_delay_usec);
+		}
+		if (span->detail != NULL) {
+			json_builder_set_member_name (builder, "detail");
+			json_builder_add_string_value (builder, span->detail);
+		}
+		json_builder_end_object (builder);
+
+		json_builder_end_object (builder);
+	}
+	g_clear_pointer (&locker, g_mutex_locker_free);
+
+	json_builder_end_array (builder);
+	json_builder_end_object (builder);
+
+	root = json_builder_get_root (builder);
+	json_generator_set_root (generator, root);
+
+	return json_generator_to_data (generator, NULL);
+}
+
+/**
+ * gs_trace_dump:
+ * @filename: file to save the trace to
+ * @error: return location for a #GError, or %NULL
+ *
+ * Save the spans in the ring buffer to @filename, as gs_trace_to_json().
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 43
+ */
+gboolean
+gs_trace_dump (const gchar  *filename,
+               GError      **error)
+{
+	g_autofree gchar *json = NULL;
+
+	g_return_val_if_fail (filename != NULL, FALSE);
+	g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+	json = gs_trace_to_json ();
+
+	return g_file_set_contents (filename, json, -1, error);
+}
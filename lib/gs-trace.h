@@ -0,0 +1,48 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2023 Vanilla OS Contributors
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GsTraceSpan GsTraceSpan;
+
+typedef void (*GsTraceSpanFunc) (const gchar	*name,
+				 gint64		 begin_usec,
+				 gint64		 duration_usec,
+				 gpointer	 user_data);
+
+GsTraceSpan	*gs_trace_span_begin			(const gchar	*name);
+GsTraceSpan	*gs_trace_span_begin_with_parent	(guint		 parent_id,
+							 const gchar	*name);
+guint		 gs_trace_span_get_id			(GsTraceSpan	*span);
+void		 gs_trace_span_set_app_id		(GsTraceSpan	*span,
+							 const gchar	*app_id);
+void		 gs_trace_span_set_refine_flags		(GsTraceSpan	*span,
+							 guint64	 refine_flags);
+void		 gs_trace_span_set_queue_delay		(GsTraceSpan	*span,
+							 gint64		 queue_delay_usec);
+void		 gs_trace_span_set_detail		(GsTraceSpan	*span,
+							 const gchar	*detail);
+void		 gs_trace_span_end			(GsTraceSpan	*span);
+
+guint		 gs_trace_get_current_span_id		(void);
+guint		 gs_trace_set_current_span_id		(guint		 span_id);
+
+void		 gs_trace_set_sysprof_writer		(gpointer	 writer);
+void		 gs_trace_set_span_func			(GsTraceSpanFunc func,
+							 gpointer	 user_data);
+gchar		*gs_trace_to_json			(void);
+gboolean	 gs_trace_dump				(const gchar	*filename,
+							 GError		**error);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GsTraceSpan, gs_trace_span_end)
+
+G_END_DECLS
@@ -20,10 +20,13 @@
 
 #include "config.h"
 
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <fnmatch.h>
 #include <math.h>
 #include <string.h>
+#include <unistd.h>
 #include <glib/gstdio.h>
 #include <json-glib/json-glib.h>
 
@@ -32,6 +35,7 @@
 #elif defined(__FreeBSD__)
 #include <sys/types.h>
 #include <sys/sysctl.h>
+#include <unistd.h>
 #endif
 
 #ifdef HAVE_POLKIT
@@ -40,6 +44,7 @@
 
 #include "gs-app.h"
 #include "gs-app-private.h"
+#include "gs-cache-manager.h"
 #include "gs-utils.h"
 #include "gs-plugin.h"
 
@@ -141,6 +146,8 @@ gs_utils_filename_array_return_newest (GPtrArray *array)
  * responsibility to remove the file when it is no longer valid or is too old
  * -- gnome-software will not ever clean the cache for the plugin.
  * For this reason it is a good idea to use the plugin name as @kind.
+ * The exceptions are the `screenshots` and `icons` kinds, which are kept
+ * within a size budget by evicting the least recently returned files.
  *
  * This function can only fail if %GS_UTILS_CACHE_FLAG_ENSURE_EMPTY or
  * %GS_UTILS_CACHE_FLAG_CREATE_DIRECTORY are passed in @flags.
@@ -156,6 +163,7 @@ gs_utils_get_cache_filename (const gchar *kind,
 	const gchar *tmp;
 	g_autofree gchar *basename = NULL;
 	g_autofree gchar *cachedir = NULL;
+	g_autofree gchar *cachefn = NULL;
 	g_autoptr(GFile) cachedir_file = NULL;
 	g_autoptr(GPtrArray) candidates = g_ptr_array_new_with_free_func (g_free);
 	g_autoptr(GError) local_error = NULL;
@@ -173,7 +181,9 @@ gs_utils_get_cache_filename (const gchar *kind,
 			return NULL;
 		}
 
-		return g_build_filename (cachedir, resource, NULL);;
+		cachefn = g_build_filename (cachedir, resource, NULL);
+		gs_cache_manager_note_access (kind, cachefn);
+		return g_steal_pointer (&cachefn);
 	}
 
 	/* get basename */
@@ -219,12 +229,17 @@ gs_utils_get_cache_filename (const gchar *kind,
 		return NULL;
 	g_ptr_array_add (candidates, g_build_filename (cachedir, basename, NULL));
 
-	/* common case: we only have one option */
+	/* common case: we only have one option, otherwise return the newest
+	 * (i.e. one with least age) */
 	if (candidates->len == 1)
-		return g_strdup (g_ptr_array_index (candidates, 0));
+		cachefn = g_strdup (g_ptr_array_index (candidates, 0));
+	else
+		cachefn = gs_utils_filename_array_return_newest (candidates);
+
+	/* so that it’s kept if the cache needs compacting */
+	gs_cache_manager_note_access (kind, cachefn);
 
-	/* return the newest (i.e. one with least age) */
-	return gs_utils_filename_array_return_newest (candidates);
+	return g_steal_pointer (&cachefn);
 }
 
 /**
@@ -1408,6 +1423,268 @@ gs_utils_pixbuf_blur (GdkPixbuf *src, guint radius, guint iterations)
 		gs_pixbuf_blur_private (src, tmp, radius, div_kernel_size);
 }
 
+/* Directory sizes are worked out by walking each directory once, in a thread
+ * pool, and the result for each directory is cached on disk so that walking
+ * it again can be skipped while it’s unchanged.
+ *
+ * A directory’s modification time only changes when entries are added to or
+ * removed from it, not when the files in it are changed, so a cached result
+ * is only trusted for %FILE_SIZE_CACHE_MAX_AGE_SECS. */
+#define FILE_SIZE_CACHE_MAX_AGE_SECS (30 * 60)
+
+/* Cached results for one directory tree, keyed by the path of each directory
+ * relative to the top of the tree. Each value is (mtime in nanoseconds, inode,
+ * time of walking it in seconds, total size of the files directly in it,
+ * names of the directories directly in it). */
+#define FILE_SIZE_CACHE_TYPE "a{s(ttttas)}"
+#define FILE_SIZE_ENTRY_TYPE "(ttttas)"
+
+typedef struct {
+	gint			 root_fd;
+	GsFileSizeIncludeFunc	 include_func;
+	gpointer		 user_data;
+	GCancellable		*cancellable;
+	gint64			 now_secs;
+	GHashTable		*old_entries;  /* (nullable) (owned) (element-type utf8 GVariant), read-only */
+
+	GMutex			 mutex;
+	GCond			 cond;
+	guint			 n_pending;  /* (mutex mutex) */
+	guint64			 size;  /* (mutex mutex) */
+	guint			 n_walked;  /* (mutex mutex) */
+	GHashTable		*new_entries;  /* (mutex mutex) (owned) (element-type utf8 GVariant) */
+} FileSizeWalk;
+
+static void file_size_walk_dir_cb (gpointer data,
+				   gpointer user_data);
+
+static GThreadPool *
+file_size_get_thread_pool (void)
+{
+	static gsize pool = 0;
+
+	if (g_once_init_enter (&pool)) {
+		GThreadPool *tmp = g_thread_pool_new (file_size_walk_dir_cb, NULL,
+						      (gint) MIN (g_get_num_processors (), 8),
+						      FALSE, NULL);
+		g_once_init_leave (&pool, (gsize) tmp);
+	}
+
+	return (GThreadPool *) pool;
+}
+
+typedef struct {
+	FileSizeWalk	*walk;  /* (unowned) */
+	gchar		*path;  /* (owned), relative to walk->root_fd, empty for the top */
+} FileSizeDir;
+
+/* Must be called with walk->mutex held. */
+static void
+file_size_walk_queue_dir (FileSizeWalk *walk,
+			  gchar        *path)
+{
+	FileSizeDir *dir = g_new0 (FileSizeDir, 1);
+
+	dir->walk = walk;
+	dir->path = path;
+	walk->n_pending++;
+	g_thread_pool_push (file_size_get_thread_pool (), dir, NULL);
+}
+
+static gchar *
+file_size_build_path (const gchar *parent,
+		      const gchar *name)
+{
+	return (*parent == '\0') ? g_strdup (name) : g_build_filename (parent, name, NULL);
+}
+
+/* Works out the size of the files directly in @dir->path, either from the
+ * cache or by reading the directory, and queues its subdirectories. */
+static void
+file_size_walk_dir_cb (gpointer data,
+		       gpointer user_data)
+{
+	FileSizeDir *dir = data;
+	FileSizeWalk *walk = dir->walk;
+	g_autofree gchar *path = g_steal_pointer (&dir->path);
+	g_autoptr(GPtrArray) subdirs = g_ptr_array_new_with_free_func (g_free);
+	g_autoptr(GVariant) entry = NULL;
+	guint64 size = 0;
+	guint64 walked_secs = 0;
+	gboolean walked = FALSE;
+	struct stat st;
+	gint fd;
+
+	g_free (dir);
+
+	if (g_cancellable_is_cancelled (walk->cancellable))
+		goto out;
+
+	fd = openat (walk->root_fd, (*path != '\0') ? path : ".",
+		     O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0)
+		goto out;
+	if (fstat (fd, &st) != 0) {
+		close (fd);
+		goto out;
+	}
+
+	/* unchanged since it was last walked? */
+	if (walk->old_entries != NULL) {
+		GVariant *old_entry = g_hash_table_lookup (walk->old_entries, path);
+		guint64 mtime_ns, ino;
+		g_autofree const gchar **names = NULL;
+
+		if (old_entry != NULL) {
+			g_variant_get (old_entry, "(tttt^a&s)", &mtime_ns, &ino, &walked_secs, &size, &names);
+			if (mtime_ns == (guint64) st.st_mtim.tv_sec * 1000000000 + (guint64) st.st_mtim.tv_nsec &&
+			    ino == (guint64) st.st_ino &&
+			    walk->now_secs - (gint64) walked_secs < FILE_SIZE_CACHE_MAX_AGE_SECS) {
+				for (gsize i = 0; names[i] != NULL; i++)
+					g_ptr_array_add (subdirs, file_size_build_path (path, names[i]));
+				entry = g_variant_ref (old_entry);
+				close (fd);
+			}
+		}
+	}
+
+	if (entry == NULL) {
+		DIR *d = fdopendir (fd);
+		struct dirent *de;
+		struct stat st_child;
+
+		if (d == NULL) {
+			close (fd);
+			goto out;
+		}
+
+		size = 0;
+		while ((de = readdir (d)) != NULL && !g_cancellable_is_cancelled (walk->cancellable)) {
+			g_autofree gchar *child_path = NULL;
+			GFileTest file_kind;
+
+			if (g_str_equal (de->d_name, ".") || g_str_equal (de->d_name, ".."))
+				continue;
+			if (fstatat (dirfd (d), de->d_name, &st_child, AT_SYMLINK_NOFOLLOW) != 0)
+				continue;
+
+			file_kind = S_ISLNK (st_child.st_mode) ? G_FILE_TEST_IS_SYMLINK :
+				    S_ISDIR (st_child.st_mode) ? G_FILE_TEST_IS_DIR :
+				    G_FILE_TEST_IS_REGULAR;
+			child_path = file_size_build_path (path, de->d_name);
+			if (walk->include_func != NULL &&
+			    !walk->include_func (child_path, file_kind, walk->user_data))
+				continue;
+
+			/* Skip symlinks, they can point to a shared storage */
+			if (file_kind == G_FILE_TEST_IS_DIR)
+				g_ptr_array_add (subdirs, g_steal_pointer (&child_path));
+			else if (file_kind == G_FILE_TEST_IS_REGULAR)
+				size += st_child.st_size;
+		}
+		closedir (d);
+
+		/* results filtered by @include_func aren’t reusable */
+		if (walk->include_func == NULL) {
+			g_autoptr(GPtrArray) names = g_ptr_array_new ();
+			gsize prefix_len = (*path != '\0') ? strlen (path) + 1 : 0;
+
+			for (guint i = 0; i < subdirs->len; i++) {
+				const gchar *subdir = g_ptr_array_index (subdirs, i);
+				g_ptr_array_add (names, (gpointer) (subdir + prefix_len));
+			}
+			g_ptr_array_add (names, NULL);
+
+			/* Filesystem timestamps are coarse, so if the directory
+			 * was modified very recently, it could be modified
+			 * again without its mtime changing. Don’t trust the
+			 * result next time in that case. */
+			walked_secs = (st.st_mtim.tv_sec < walk->now_secs - 1) ? (guint64) walk->now_secs : 0;
+
+			entry = g_variant_ref_sink (g_variant_new ("(tttt^as)",
+								   (guint64) st.st_mtim.tv_sec * 1000000000 + (guint64) st.st_mtim.tv_nsec,
+								   (guint64) st.st_ino,
+								   walked_secs,
+								   size,
+								   (gchar **) names->pdata));
+		}
+		walked = TRUE;
+	}
+
+	g_mutex_lock (&walk->mutex);
+	walk->size += size;
+	if (walked)
+		walk->n_walked++;
+	if (entry != NULL)
+		g_hash_table_insert (walk->new_entries, g_strdup (path), g_steal_pointer (&entry));
+	for (guint i = 0; i < subdirs->len; i++)
+		file_size_walk_queue_dir (walk, g_steal_pointer (&g_ptr_array_index (subdirs, i)));
+	g_mutex_unlock (&walk->mutex);
+
+ out:
+	g_mutex_lock (&walk->mutex);
+	if (--walk->n_pending == 0)
+		g_cond_signal (&walk->cond);
+	g_mutex_unlock (&walk->mutex);
+}
+
+static gchar *
+file_size_get_cache_filename (const gchar *filename)
+{
+	g_autofree gchar *basename = g_compute_checksum_for_string (G_CHECKSUM_SHA1, filename, -1);
+	return gs_utils_get_cache_filename ("file-sizes", basename,
+					    GS_UTILS_CACHE_FLAG_WRITEABLE |
+					    GS_UTILS_CACHE_FLAG_CREATE_DIRECTORY,
+					    NULL);
+}
+
+static GHashTable *
+file_size_load_cache (const gchar *cache_filename)
+{
+	g_autoptr(GMappedFile) mapped_file = NULL;
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GVariant) cache = NULL;
+	g_autoptr(GHashTable) entries = NULL;
+	GVariantIter iter;
+	gchar *path;
+	GVariant *entry;
+
+	mapped_file = g_mapped_file_new (cache_filename, FALSE, NULL);
+	if (mapped_file == NULL)
+		return NULL;
+	bytes = g_mapped_file_get_bytes (mapped_file);
+	cache = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (FILE_SIZE_CACHE_TYPE), bytes, FALSE));
+
+	entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_variant_unref);
+	g_variant_iter_init (&iter, cache);
+	while (g_variant_iter_next (&iter, "{s@" FILE_SIZE_ENTRY_TYPE "}", &path, &entry))
+		g_hash_table_insert (entries, path, entry);
+
+	return g_steal_pointer (&entries);
+}
+
+static void
+file_size_save_cache (const gchar *cache_filename,
+		      GHashTable  *entries)
+{
+	g_auto(GVariantBuilder) builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE (FILE_SIZE_CACHE_TYPE));
+	g_autoptr(GVariant) cache = NULL;
+	g_autoptr(GError) error_local = NULL;
+	GHashTableIter iter;
+	gpointer key, value;
+
+	g_hash_table_iter_init (&iter, entries);
+	while (g_hash_table_iter_next (&iter, &key, &value))
+		g_variant_builder_add (&builder, "{s@" FILE_SIZE_ENTRY_TYPE "}", key, value);
+	cache = g_variant_ref_sink (g_variant_builder_end (&builder));
+
+	if (!g_file_set_contents (cache_filename,
+				  g_variant_get_data (cache),
+				  (gssize) g_variant_get_size (cache),
+				  &error_local))
+		g_debug ("Failed to save file size cache: %s", error_local->message);
+}
+
 /**
  * gs_utils_get_file_size:
  * @filename: a file name to get the size of; it can be a file or a directory
@@ -1420,6 +1697,14 @@ gs_utils_pixbuf_blur (GdkPixbuf *src, guint radius, guint iterations)
  * When the @include_func is not %NULL, it can limit which files are included
  * in the resulting size. When it's %NULL, all files and subdirectories are included.
  *
+ * Symbolic links inside a directory are not followed, and don’t count
+ * towards its size.
+ *
+ * Subdirectories are walked in parallel. When @include_func is %NULL, the
+ * size of each directory is cached, and directories whose contents haven’t
+ * changed since are not read again on later calls. Files changed in place are
+ * only noticed once the cached size expires.
+ *
  * Returns: disk size of the @filename; or 0 when not found
  *
  * Since: 41
@@ -1430,63 +1715,57 @@ gs_utils_get_file_size (const gchar *filename,
 			gpointer user_data,
 			GCancellable *cancellable)
 {
-	guint64 size = 0;
+	FileSizeWalk walk = { 0, };
+	g_autofree gchar *cache_filename = NULL;
+	guint n_old_entries;
+	gint root_fd;
 
 	g_return_val_if_fail (filename != NULL, 0);
 
-	if (g_file_test (filename, G_FILE_TEST_IS_DIR)) {
-		GSList *dirs_to_do = NULL;
-		gsize base_len = strlen (filename);
-
-		/* The `include_func()` expects a path relative to the `filename`, without
-		   a leading dir separator. As the `dirs_to_do` contains the full path,
-		   constructed with `g_build_filename()`, the added dir separator needs
-		   to be skipped, when it's not part of the `filename` already. */
-		if (!g_str_has_suffix (filename, G_DIR_SEPARATOR_S))
-			base_len++;
-
-		dirs_to_do = g_slist_prepend (dirs_to_do, g_strdup (filename));
-		while (dirs_to_do != NULL && !g_cancellable_is_cancelled (cancellable)) {
-			g_autofree gchar *path = NULL;
-			g_autoptr(GDir) dir = NULL;
-
-			/* Steal the top `path` out of the `dirs_to_do`. */
-			path = dirs_to_do->data;
-			dirs_to_do = g_slist_remove (dirs_to_do, path);
-
-			dir = g_dir_open (path, 0, NULL);
-			if (dir) {
-				const gchar *name;
-				while (name = g_dir_read_name (dir), name != NULL && !g_cancellable_is_cancelled (cancellable)) {
-					g_autofree gchar *full_path = g_build_filename (path, name, NULL);
-					GStatBuf st;
-
-					if (g_stat (full_path, &st) == 0 && (include_func == NULL ||
-					    include_func (full_path + base_len,
-							  g_file_test (full_path, G_FILE_TEST_IS_SYMLINK) ? G_FILE_TEST_IS_SYMLINK :
-							  S_ISDIR (st.st_mode) ? G_FILE_TEST_IS_DIR :
-							  G_FILE_TEST_IS_REGULAR,
-							  user_data))) {
-						if (S_ISDIR (st.st_mode)) {
-							/* Skip symlinks, they can point to a shared storage */
-							if (!g_file_test (full_path, G_FILE_TEST_IS_SYMLINK))
-								dirs_to_do = g_slist_prepend (dirs_to_do, g_steal_pointer (&full_path));
-						} else {
-							size += st.st_size;
-						}
-					}
-				}
-			}
-		}
-		g_slist_free_full (dirs_to_do, g_free);
-	} else {
+	root_fd = open (filename, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (root_fd < 0) {
 		GStatBuf st;
 
 		if (g_stat (filename, &st) == 0)
-			size = st.st_size;
+			return st.st_size;
+		return 0;
+	}
+
+	walk.root_fd = root_fd;
+	walk.include_func = include_func;
+	walk.user_data = user_data;
+	walk.cancellable = cancellable;
+	walk.now_secs = g_get_real_time () / G_USEC_PER_SEC;
+	walk.new_entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_variant_unref);
+	g_mutex_init (&walk.mutex);
+	g_cond_init (&walk.cond);
+
+	if (include_func == NULL) {
+		cache_filename = file_size_get_cache_filename (filename);
+		if (cache_filename != NULL)
+			walk.old_entries = file_size_load_cache (cache_filename);
 	}
 
-	return size;
+	g_mutex_lock (&walk.mutex);
+	file_size_walk_queue_dir (&walk, g_strdup (""));
+	while (walk.n_pending > 0)
+		g_cond_wait (&walk.cond, &walk.mutex);
+	g_mutex_unlock (&walk.mutex);
+
+	/* only save the cache if something changed, which includes directories
+	 * having been removed */
+	n_old_entries = (walk.old_entries != NULL) ? g_hash_table_size (walk.old_entries) : 0;
+	if (cache_filename != NULL && !g_cancellable_is_cancelled (cancellable) &&
+	    (walk.n_walked > 0 || g_hash_table_size (walk.new_entries) != n_old_entries))
+		file_size_save_cache (cache_filename, walk.new_entries);
+
+	g_clear_pointer (&walk.old_entries, g_hash_table_unref);
+	g_hash_table_unref (walk.new_entries);
+	g_cond_clear (&walk.cond);
+	g_mutex_clear (&walk.mutex);
+	close (root_fd);
+
+	return walk.size;
 }
 
 #define METADATA_ETAG_ATTRIBUTE "xattr::gnome-software::etag"
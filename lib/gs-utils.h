@@ -121,6 +121,10 @@ void		 gs_utils_pixbuf_blur		(GdkPixbuf	*src,
  * The @filename is a relative path to the file name passed to
  * the #GsFileSizeIncludeFunc.
  *
+ * Directories are walked in a thread pool, so this may be called from
+ * several threads at once, and not from the thread which called
+ * gs_utils_get_file_size(). It must be thread-safe, as must @user_data.
+ *
  * Returns: Whether to include the @filename in the size calculation
  *
  * Since: 41
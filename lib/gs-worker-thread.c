@@ -29,6 +29,17 @@
  * become hard to ensure the thread pool isn’t overwhelmed and that tasks are
  * executed in the right order.
  *
+ * So that a steady stream of higher priority tasks can’t starve them, tasks
+ * queued at a priority lower than %G_PRIORITY_DEFAULT (up to and including
+ * %G_PRIORITY_LOW) are promoted by one priority level (100) for each
+ * #GS_WORKER_THREAD_AGING_STEP_USEC they spend waiting, until they reach
+ * %G_PRIORITY_DEFAULT. Their I/O priority is not affected.
+ *
+ * The depth of the queue and how long tasks wait in it and take to run are
+ * recorded, and can be read with gs_worker_thread_get_metrics(). All the
+ * worker threads in the process can be listed with
+ * gs_worker_thread_dup_all().
+ *
  * The worker thread will continue executing tasks until
  * gs_worker_thread_shutdown_async() is called. This must be called before the
  * final reference to the #GsWorkerThread is dropped.
@@ -40,10 +51,20 @@
 
 #include <glib.h>
 #include <glib-object.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "gs-ioprio.h"
+#include "gs-trace.h"
 #include "gs-worker-thread.h"
 
+/* How many of the most recent tasks to calculate the wait and run time
+ * percentiles from. */
+#define N_METRICS_SAMPLES 512
+
+/* How often to check for queued tasks which need promoting. */
+#define AGING_INTERVAL_MS 500
+
 typedef enum {
 	GS_WORKER_THREAD_STATE_RUNNING = 0,
 	GS_WORKER_THREAD_STATE_SHUTTING_DOWN = 1,
@@ -59,6 +80,18 @@ struct _GsWorkerThread
 	GsWorkerThreadState	 worker_state;  /* (atomic) */
 	GMainContext		*worker_context;  /* (owned); may be NULL before setup or after shutdown */
 	GThread			*worker_thread;  /* (atomic); may be NULL before setup or after shutdown */
+
+	GMutex			 queue_mutex;
+	GPtrArray		*agable_work;  /* (element-type WorkData) (unowned) (mutex queue_mutex); queued work which may be promoted */
+	GSource			*aging_source;  /* (owned) (nullable) (mutex queue_mutex) */
+
+	GMutex			 metrics_mutex;
+	guint			 n_queued;  /* (mutex metrics_mutex) */
+	guint			 n_running;  /* (mutex metrics_mutex) */
+	guint64			 n_completed;  /* (mutex metrics_mutex) */
+	guint64			 n_promoted;  /* (mutex metrics_mutex) */
+	gint64			 wait_samples[N_METRICS_SAMPLES];  /* (mutex metrics_mutex) */
+	gint64			 run_samples[N_METRICS_SAMPLES];  /* (mutex metrics_mutex) */
 };
 
 typedef enum {
@@ -69,6 +102,30 @@ static GParamSpec *props[PROP_NAME + 1] = { NULL, };
 
 G_DEFINE_TYPE (GsWorkerThread, gs_worker_thread, G_TYPE_OBJECT)
 
+/* All the #GsWorkerThreads in the process, for gs_worker_thread_dup_all(). */
+static GMutex all_mutex;
+static GPtrArray *all_workers = NULL;  /* (element-type GWeakRef) (owned) (nullable) (mutex all_mutex) */
+
+static void
+weak_ref_free (GWeakRef *weak_ref)
+{
+	g_weak_ref_clear (weak_ref);
+	g_free (weak_ref);
+}
+
+/* Drop the entries for finalised worker threads. Must be called with
+ * @all_mutex held. */
+static void
+prune_all_workers (void)
+{
+	for (guint i = all_workers->len; i > 0; i--) {
+		g_autoptr(GObject) obj = g_weak_ref_get (g_ptr_array_index (all_workers, i - 1));
+
+		if (obj == NULL)
+			g_ptr_array_remove_index_fast (all_workers, i - 1);
+	}
+}
+
 static void
 gs_worker_thread_get_property (GObject    *object,
                                guint       prop_id,
@@ -117,10 +174,24 @@ gs_worker_thread_dispose (GObject *object)
 
 	g_clear_pointer (&self->name, g_free);
 	g_clear_pointer (&self->worker_context, g_main_context_unref);
+	g_clear_pointer (&self->aging_source, g_source_unref);
 
 	G_OBJECT_CLASS (gs_worker_thread_parent_class)->dispose (object);
 }
 
+static void
+gs_worker_thread_finalize (GObject *object)
+{
+	GsWorkerThread *self = GS_WORKER_THREAD (object);
+
+	g_assert (self->agable_work->len == 0);
+	g_ptr_array_unref (self->agable_work);
+	g_mutex_clear (&self->queue_mutex);
+	g_mutex_clear (&self->metrics_mutex);
+
+	G_OBJECT_CLASS (gs_worker_thread_parent_class)->finalize (object);
+}
+
 static gpointer thread_cb (gpointer data);
 
 static void
@@ -136,6 +207,14 @@ gs_worker_thread_constructed (GObject *object)
 	self->worker_state = GS_WORKER_THREAD_STATE_RUNNING;
 	self->worker_context = g_main_context_new ();
 	self->worker_thread = g_thread_new (self->name, thread_cb, self);
+
+	g_mutex_lock (&all_mutex);
+	if (all_workers == NULL)
+		all_workers = g_ptr_array_new_with_free_func ((GDestroyNotify) weak_ref_free);
+	prune_all_workers ();
+	g_ptr_array_add (all_workers, g_new0 (GWeakRef, 1));
+	g_weak_ref_init (g_ptr_array_index (all_workers, all_workers->len - 1), self);
+	g_mutex_unlock (&all_mutex);
 }
 
 static void
@@ -147,6 +226,7 @@ gs_worker_thread_class_init (GsWorkerThreadClass *klass)
 	object_class->get_property = gs_worker_thread_get_property;
 	object_class->set_property = gs_worker_thread_set_property;
 	object_class->dispose = gs_worker_thread_dispose;
+	object_class->finalize = gs_worker_thread_finalize;
 
 	/**
 	 * GsWorkerThread:name: (not nullable):
@@ -180,6 +260,9 @@ thread_cb (gpointer data)
 static void
 gs_worker_thread_init (GsWorkerThread *self)
 {
+	g_mutex_init (&self->queue_mutex);
+	g_mutex_init (&self->metrics_mutex);
+	self->agable_work = g_ptr_array_new ();
 }
 
 /**
@@ -206,14 +289,32 @@ gs_worker_thread_new (const gchar *name)
 /* Essentially a wrapper around these elements to avoid the caller having to
  * return `G_SOURCE_REMOVE` from their `work_func` every time. */
 typedef struct {
+	GsWorkerThread *self;  /* (unowned); the worker thread outlives its queued work */
 	GTaskThreadFunc work_func;
 	GTask *task;  /* (owned) */
 	gint priority;
+	GSource *source;  /* (unowned) (nullable); NULL if run without being queued */
+	guint parent_span_id;  /* current trace span of the thread which queued the task */
+	gint64 queued_usec;
+	gboolean started;
 } WorkData;
 
 static void
 work_data_free (WorkData *data)
 {
+	GsWorkerThread *self = data->self;
+
+	/* Dropped without being run, when shutting down. */
+	if (!data->started) {
+		g_mutex_lock (&self->metrics_mutex);
+		self->n_queued--;
+		g_mutex_unlock (&self->metrics_mutex);
+	}
+
+	g_mutex_lock (&self->queue_mutex);
+	g_ptr_array_remove_fast (self->agable_work, data);
+	g_mutex_unlock (&self->queue_mutex);
+
 	g_clear_object (&data->task);
 	g_free (data);
 }
@@ -228,6 +329,26 @@ work_run_cb (gpointer _data)
 	gpointer source_object = g_task_get_source_object (task);
 	gpointer task_data = g_task_get_task_data (task);
 	GCancellable *cancellable = g_task_get_cancellable (task);
+	g_autofree gchar *trace_name = NULL;
+	g_autoptr(GsTraceSpan) trace_span = NULL;
+	GsWorkerThread *self = data->self;
+	gint64 start_usec = g_get_monotonic_time ();
+	gint64 wait_usec = start_usec - data->queued_usec;
+	guint old_span_id;
+
+	g_mutex_lock (&self->metrics_mutex);
+	self->n_queued--;
+	self->n_running++;
+	g_mutex_unlock (&self->metrics_mutex);
+	data->started = TRUE;
+
+	/* Nest the work inside whatever queued it, so it can be followed
+	 * across threads, and note how long it was queued for. */
+	trace_name = g_strconcat ("worker:", (self->name != NULL) ? self->name : "unnamed", NULL);
+	trace_span = gs_trace_span_begin_with_parent (data->parent_span_id, trace_name);
+	gs_trace_span_set_queue_delay (trace_span, wait_usec);
+	gs_trace_span_set_detail (trace_span, g_task_get_name (task));
+	old_span_id = gs_trace_set_current_span_id (gs_trace_span_get_id (trace_span));
 
 	/* Set the I/O priority of the thread to match the priority of the
 	 * task. */
@@ -235,9 +356,63 @@ work_run_cb (gpointer _data)
 
 	data->work_func (task, source_object, task_data, cancellable);
 
+	gs_trace_set_current_span_id (old_span_id);
+
+	/* Record how long it waited and ran for. Each sample goes into
+	 * a ring, indexed by how many tasks have completed. */
+	g_mutex_lock (&self->metrics_mutex);
+	self->wait_samples[self->n_completed % N_METRICS_SAMPLES] = wait_usec;
+	self->run_samples[self->n_completed % N_METRICS_SAMPLES] = g_get_monotonic_time () - start_usec;
+	self->n_completed++;
+	self->n_running--;
+	g_mutex_unlock (&self->metrics_mutex);
+
 	return G_SOURCE_REMOVE;
 }
 
+static gboolean
+is_agable_priority (gint priority)
+{
+	return (priority > G_PRIORITY_DEFAULT && priority <= G_PRIORITY_LOW);
+}
+
+/* Runs in the worker thread, which is also where queued work is dispatched
+ * and freed, so the sources in @agable_work can’t be destroyed under it. */
+static gboolean
+aging_cb (gpointer user_data)
+{
+	GsWorkerThread *self = GS_WORKER_THREAD (user_data);
+	gint64 now = g_get_monotonic_time ();
+	guint n_promoted = 0;
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&self->queue_mutex);
+
+	for (guint i = self->agable_work->len; i > 0; i--) {
+		WorkData *data = g_ptr_array_index (self->agable_work, i - 1);
+		gint64 n_steps = (now - data->queued_usec) / GS_WORKER_THREAD_AGING_STEP_USEC;
+		gint priority = (gint) MAX ((gint64) data->priority - n_steps * 100, G_PRIORITY_DEFAULT);
+
+		if (priority < g_source_get_priority (data->source)) {
+			g_source_set_priority (data->source, priority);
+			n_promoted++;
+		}
+		if (priority == G_PRIORITY_DEFAULT)
+			g_ptr_array_remove_index_fast (self->agable_work, i - 1);
+	}
+
+	if (n_promoted > 0) {
+		g_mutex_lock (&self->metrics_mutex);
+		self->n_promoted += n_promoted;
+		g_mutex_unlock (&self->metrics_mutex);
+	}
+
+	if (self->agable_work->len == 0) {
+		g_clear_pointer (&self->aging_source, g_source_unref);
+		return G_SOURCE_REMOVE;
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
 /**
  * gs_worker_thread_queue:
  * @self: a #GsWorkerThread
@@ -278,6 +453,7 @@ gs_worker_thread_queue (GsWorkerThread  *self,
                         GTask           *task)
 {
 	g_autoptr(WorkData) data = NULL;
+	g_autoptr(GSource) source = NULL;
 
 	g_return_if_fail (GS_IS_WORKER_THREAD (self));
 	g_return_if_fail (work_func != NULL);
@@ -287,12 +463,158 @@ gs_worker_thread_queue (GsWorkerThread  *self,
 		  g_task_get_source_tag (task) == gs_worker_thread_shutdown_async);
 
 	data = g_new0 (WorkData, 1);
+	data->self = self;
 	data->work_func = work_func;
 	data->task = g_steal_pointer (&task);
 	data->priority = priority;
+	data->parent_span_id = gs_trace_get_current_span_id ();
+	data->queued_usec = g_get_monotonic_time ();
+
+	g_mutex_lock (&self->metrics_mutex);
+	self->n_queued++;
+	g_mutex_unlock (&self->metrics_mutex);
+
+	/* Like g_main_context_invoke_full(), run it straight away if already
+	 * in the worker thread. */
+	if (g_main_context_is_owner (self->worker_context)) {
+		work_run_cb (data);
+		return;
+	}
+
+	source = g_idle_source_new ();
+	g_source_set_priority (source, priority);
+	g_source_set_callback (source, work_run_cb, data, (GDestroyNotify) work_data_free);
+	g_source_set_static_name (source, "[gnome-software] work_run_cb");
+	data->source = source;
+
+	if (!is_agable_priority (priority)) {
+		g_steal_pointer (&data);
+		g_source_attach (source, self->worker_context);
+		return;
+	}
+
+	/* Hold the lock until @source is attached, so the work can’t be
+	 * dispatched and freed before it’s tracked. */
+	g_mutex_lock (&self->queue_mutex);
+
+	g_ptr_array_add (self->agable_work, g_steal_pointer (&data));
+	g_source_attach (source, self->worker_context);
+
+	if (self->aging_source == NULL) {
+		self->aging_source = g_timeout_source_new (AGING_INTERVAL_MS);
+		g_source_set_priority (self->aging_source, G_PRIORITY_HIGH);
+		g_source_set_callback (self->aging_source, aging_cb, self, NULL);
+		g_source_set_static_name (self->aging_source, "[gnome-software] aging_cb");
+		g_source_attach (self->aging_source, self->worker_context);
+	}
+
+	g_mutex_unlock (&self->queue_mutex);
+}
+
+static int
+compare_samples (gconstpointer a,
+                 gconstpointer b)
+{
+	gint64 sample_a = *((const gint64 *) a);
+	gint64 sample_b = *((const gint64 *) b);
+
+	return (sample_a > sample_b) - (sample_a < sample_b);
+}
+
+/* Sorts @samples in place. */
+static gint64
+samples_get_percentile (gint64 *samples,
+                        guint   n_samples,
+                        guint   percentile)
+{
+	if (n_samples == 0)
+		return 0;
+
+	qsort (samples, n_samples, sizeof (*samples), compare_samples);
+	return samples[(n_samples - 1) * percentile / 100];
+}
+
+/**
+ * gs_worker_thread_get_metrics:
+ * @self: a #GsWorkerThread
+ * @metrics_out: (out caller-allocates): return location for the metrics
+ *
+ * Get how busy the worker thread is, and how long tasks have waited and run
+ * for. The wait and run time percentiles are calculated from the most recent
+ * tasks only, so they reflect the current load.
+ *
+ * This may be called from any thread.
+ *
+ * Since: 43
+ */
+void
+gs_worker_thread_get_metrics (GsWorkerThread        *self,
+                              GsWorkerThreadMetrics *metrics_out)
+{
+	gint64 wait_samples[N_METRICS_SAMPLES];
+	gint64 run_samples[N_METRICS_SAMPLES];
+	guint n_samples;
+
+	g_return_if_fail (GS_IS_WORKER_THREAD (self));
+	g_return_if_fail (metrics_out != NULL);
+
+	g_mutex_lock (&self->metrics_mutex);
+	metrics_out->n_queued = self->n_queued;
+	metrics_out->n_running = self->n_running;
+	metrics_out->n_completed = self->n_completed;
+	metrics_out->n_promoted = self->n_promoted;
+	n_samples = (guint) MIN (self->n_completed, N_METRICS_SAMPLES);
+	memcpy (wait_samples, self->wait_samples, n_samples * sizeof (*wait_samples));
+	memcpy (run_samples, self->run_samples, n_samples * sizeof (*run_samples));
+	g_mutex_unlock (&self->metrics_mutex);
+
+	metrics_out->wait_p50_usec = samples_get_percentile (wait_samples, n_samples, 50);
+	metrics_out->wait_p99_usec = samples_get_percentile (wait_samples, n_samples, 99);
+	metrics_out->run_p50_usec = samples_get_percentile (run_samples, n_samples, 50);
+	metrics_out->run_p99_usec = samples_get_percentile (run_samples, n_samples, 99);
+}
+
+/**
+ * gs_worker_thread_get_name:
+ * @self: a #GsWorkerThread
+ *
+ * Get the name of the worker thread, as passed to gs_worker_thread_new().
+ *
+ * Returns: the name
+ * Since: 43
+ */
+const gchar *
+gs_worker_thread_get_name (GsWorkerThread *self)
+{
+	g_return_val_if_fail (GS_IS_WORKER_THREAD (self), NULL);
+
+	return self->name;
+}
+
+/**
+ * gs_worker_thread_dup_all:
+ *
+ * Get all the #GsWorkerThreads which currently exist in the process, in the
+ * order they were created.
+ *
+ * Returns: (transfer container) (element-type GsWorkerThread): the worker
+ *    threads
+ * Since: 43
+ */
+GPtrArray *
+gs_worker_thread_dup_all (void)
+{
+	g_autoptr(GPtrArray) workers = g_ptr_array_new_with_free_func (g_object_unref);
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&all_mutex);
+
+	for (guint i = 0; all_workers != NULL && i < all_workers->len; i++) {
+		GsWorkerThread *worker = g_weak_ref_get (g_ptr_array_index (all_workers, i));
+
+		if (worker != NULL)
+			g_ptr_array_add (workers, worker);
+	}
 
-	g_main_context_invoke_full (self->worker_context, priority,
-				    work_run_cb, g_steal_pointer (&data), (GDestroyNotify) work_data_free);
+	return g_steal_pointer (&workers);
 }
 
 /**
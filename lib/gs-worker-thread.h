@@ -20,6 +20,43 @@ G_BEGIN_DECLS
 
 G_DECLARE_FINAL_TYPE (GsWorkerThread, gs_worker_thread, GS, WORKER_THREAD, GObject)
 
+/**
+ * GS_WORKER_THREAD_AGING_STEP_USEC:
+ *
+ * How long a low priority task waits in the queue before it is promoted by
+ * one priority level, in microseconds.
+ *
+ * Since: 43
+ */
+#define GS_WORKER_THREAD_AGING_STEP_USEC (2 * G_USEC_PER_SEC)
+
+/**
+ * GsWorkerThreadMetrics:
+ * @n_queued: number of tasks waiting to run
+ * @n_running: number of tasks running (0 or 1)
+ * @n_completed: number of tasks which have run since the worker was created
+ * @n_promoted: number of times a waiting task has had its priority raised
+ * @wait_p50_usec: median time recent tasks waited before running
+ * @wait_p99_usec: 99th percentile time recent tasks waited before running
+ * @run_p50_usec: median time recent tasks took to run
+ * @run_p99_usec: 99th percentile time recent tasks took to run
+ *
+ * A snapshot of how busy a #GsWorkerThread is; see
+ * gs_worker_thread_get_metrics().
+ *
+ * Since: 43
+ */
+typedef struct {
+	guint		n_queued;
+	guint		n_running;
+	guint64		n_completed;
+	guint64		n_promoted;
+	gint64		wait_p50_usec;
+	gint64		wait_p99_usec;
+	gint64		run_p50_usec;
+	gint64		run_p99_usec;
+} GsWorkerThreadMetrics;
+
 GsWorkerThread	*gs_worker_thread_new			(const gchar *name);
 
 void		 gs_worker_thread_queue			(GsWorkerThread  *self,
@@ -29,6 +66,11 @@ void		 gs_worker_thread_queue			(GsWorkerThread  *self,
 
 gboolean	 gs_worker_thread_is_in_worker_context	(GsWorkerThread *self);
 
+const gchar	*gs_worker_thread_get_name		(GsWorkerThread *self);
+void		 gs_worker_thread_get_metrics		(GsWorkerThread        *self,
+							 GsWorkerThreadMetrics *metrics_out);
+GPtrArray	*gs_worker_thread_dup_all		(void);
+
 void		 gs_worker_thread_shutdown_async	(GsWorkerThread      *self,
 							 GCancellable        *cancellable,
 							 GAsyncReadyCallback  callback,
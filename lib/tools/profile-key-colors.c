@@ -10,18 +10,23 @@
  */
 
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
 #include <gdk/gdk.h>
 #include <locale.h>
 #include <math.h>
+#include <string.h>
 
 #include "gs-key-colors.h"
+#include "gs-key-colors-private.h"
 
 /* Test program which can be used to check the output and performance of the
  * gs_calculate_key_colors() function. It is linked against libgnomesoftware, so
  * will use the function implementation from there. It outputs a HTML page which
  * lists each icon from the flathub appstream data in your home directory, along
- * with its extracted key colors and how long extraction took. */
+ * with its extracted key colors and how long extraction took using the scalar
+ * and the vectorised k-means kernels, and how long loading them back from the
+ * on-disk cache took. */
 
 static void
 print_colours (GString *html_output,
@@ -70,8 +75,9 @@ print_summary_statistics (GString *html_output,
 	stddev = sqrt (sum_of_square_deviations / n_measurements);
 
 	g_string_append_printf (html_output,
-				"[%" G_GINT64_FORMAT ", %" G_GINT64_FORMAT "]μs, mean %" G_GINT64_FORMAT "±%" G_GINT64_FORMAT "μs, n = %u",
-				min, max, mean, stddev, n_measurements);
+				"[%" G_GINT64_FORMAT ", %" G_GINT64_FORMAT "]μs, mean %" G_GINT64_FORMAT "±%" G_GINT64_FORMAT "μs, n = %u, %.0f icons/s",
+				min, max, mean, stddev, n_measurements,
+				(sum > 0) ? n_measurements * (gdouble) G_USEC_PER_SEC / sum : 0.0);
 }
 
 int
@@ -84,7 +90,11 @@ main (void)
 	g_autoptr(GPtrArray) filenames = g_ptr_array_new_with_free_func (g_free);
 	g_autoptr(GPtrArray) pixbufs = g_ptr_array_new_with_free_func (g_object_unref);
 	g_autoptr(GString) html_output = g_string_new ("");
-	g_autoptr(GArray) durations = g_array_new (FALSE, FALSE, sizeof (gint64));
+	g_autoptr(GArray) scalar_durations = g_array_new (FALSE, FALSE, sizeof (gint64));
+	g_autoptr(GArray) simd_durations = g_array_new (FALSE, FALSE, sizeof (gint64));
+	g_autoptr(GArray) cached_durations = g_array_new (FALSE, FALSE, sizeof (gint64));
+	g_autofree gchar *cache_dir = NULL;
+	g_autoptr(GError) local_error = NULL;
 
 	setlocale (LC_ALL, "");
 
@@ -107,6 +117,12 @@ main (void)
 	if (!pixbufs->len)
 		return 2;
 
+	cache_dir = g_dir_make_tmp ("profile-key-colors-XXXXXX", &local_error);
+	if (cache_dir == NULL) {
+		g_printerr ("%s\n", local_error->message);
+		return 3;
+	}
+
 	/* Set up an output page */
 	g_string_append (html_output,
 			 "<!DOCTYPE html>\n"
@@ -128,7 +144,9 @@ main (void)
 			 "        <tr>\n"
 			 "          <td>Filename</td>\n"
 			 "          <td>Icon</td>\n"
-			 "          <td>Code duration (μs)</td>\n"
+			 "          <td>Scalar duration (μs)</td>\n"
+			 "          <td>SIMD duration (μs)</td>\n"
+			 "          <td>Cached duration (μs)</td>\n"
 			 "          <td>Code colours</td>\n"
 			 "        </tr>\n"
 			 "      </thead>\n");
@@ -139,32 +157,85 @@ main (void)
 		const gchar *filename = filenames->pdata[i];
 		g_autofree gchar *basename = g_path_get_basename (filename);
 		g_autoptr(GArray) colours = NULL;
-		gint64 start_time, duration;
+		g_autoptr(GArray) simd_colours = NULL;
+		g_autoptr(GArray) cached_colours = NULL;
+		g_autofree gchar *cache_key = NULL;
+		g_autofree gchar *cache_fn = NULL;
+		gint64 start_time, scalar_duration, simd_duration, cached_duration;
 
 		g_message ("Processing %u of %u, %s", i + 1, pixbufs->len, filename);
 
+		/* k-means picks its starting centres at random, so seed both
+		 * runs the same for their results to be comparable. */
+		g_random_set_seed (i);
 		start_time = g_get_real_time ();
-		colours = gs_calculate_key_colors (pixbuf);
-		duration = g_get_real_time () - start_time;
+		colours = gs_calculate_key_colors_with_kernel (pixbuf, GS_KEY_COLORS_KERNEL_SCALAR);
+		scalar_duration = g_get_real_time () - start_time;
+
+		g_random_set_seed (i);
+		start_time = g_get_real_time ();
+		simd_colours = gs_calculate_key_colors_with_kernel (pixbuf, GS_KEY_COLORS_KERNEL_AUTO);
+		simd_duration = g_get_real_time () - start_time;
+
+		/* The kernels must agree exactly, or the cache would depend
+		 * on which CPU populated it. */
+		if (simd_colours->len != colours->len ||
+		    memcmp (simd_colours->data, colours->data, colours->len * sizeof (GdkRGBA)) != 0)
+			g_warning ("SIMD and scalar key colors differ for %s", filename);
+
+		/* Include computing the cache key, as that’s part of every
+		 * lookup in a real cache hit. */
+		cache_key = gs_key_colors_get_cache_key (pixbuf);
+		cache_fn = g_build_filename (cache_dir, cache_key, NULL);
+		if (!gs_key_colors_save (cache_fn, colours, &local_error)) {
+			g_printerr ("%s\n", local_error->message);
+			return 4;
+		}
+		g_clear_pointer (&cache_key, g_free);
+		g_clear_pointer (&cache_fn, g_free);
+
+		start_time = g_get_real_time ();
+		cache_key = gs_key_colors_get_cache_key (pixbuf);
+		cache_fn = g_build_filename (cache_dir, cache_key, NULL);
+		cached_colours = gs_key_colors_load (cache_fn, &local_error);
+		cached_duration = g_get_real_time () - start_time;
+
+		if (cached_colours == NULL) {
+			g_printerr ("%s\n", local_error->message);
+			return 4;
+		}
+		g_unlink (cache_fn);
 
 		g_string_append_printf (html_output,
 					"<tr>\n"
 					"<th>%s</th>\n"
 					"<td><img src='file:%s'></td>\n"
 					"<td class='number'>%" G_GINT64_FORMAT "</td>\n"
+					"<td class='number %s'>%" G_GINT64_FORMAT "</td>\n"
+					"<td class='number'>%" G_GINT64_FORMAT "</td>\n"
 					"<td>",
-					basename, filename, duration);
+					basename, filename, scalar_duration,
+					(simd_duration <= scalar_duration) ? "faster" : "slower",
+					simd_duration, cached_duration);
 		print_colours (html_output, colours);
 		g_string_append (html_output,
 				 "</td>\n"
 				 "</tr>\n");
 
-		g_array_append_val (durations, duration);
+		g_array_append_val (scalar_durations, scalar_duration);
+		g_array_append_val (simd_durations, simd_duration);
+		g_array_append_val (cached_durations, cached_duration);
 	}
 
+	g_rmdir (cache_dir);
+
 	/* Summary statistics for the timings. */
 	g_string_append (html_output, "<tfoot><tr><td></td><td></td><td>");
-	print_summary_statistics (html_output, durations);
+	print_summary_statistics (html_output, scalar_durations);
+	g_string_append (html_output, "</td><td>");
+	print_summary_statistics (html_output, simd_durations);
+	g_string_append (html_output, "</td><td>");
+	print_summary_statistics (html_output, cached_durations);
 	g_string_append (html_output, "</td><td></td></tr></tfoot>");
 
 	g_string_append (html_output, "</table></body></html>");
@@ -36,8 +36,10 @@ struct _GsPluginAppstream
 
 	GsWorkerThread		*worker;  /* (owned) */
 
-	XbSilo			*silo;
-	GRWLock			 silo_lock;
+	GPtrArray		*sources;  /* (element-type GsAppstreamSource) (owned) (nullable) (mutex sources_mutex) */
+	GMutex			 sources_mutex;
+	GMutex			 rebuild_mutex;  /* held while building new silos */
+	gint			 rebuild_queued;  /* (atomic) */
 	GSettings		*settings;
 };
 
@@ -51,9 +53,10 @@ gs_plugin_appstream_dispose (GObject *object)
 {
 	GsPluginAppstream *self = GS_PLUGIN_APPSTREAM (object);
 
-	g_clear_object (&self->silo);
+	g_clear_pointer (&self->sources, g_ptr_array_unref);
 	g_clear_object (&self->settings);
-	g_rw_lock_clear (&self->silo_lock);
+	g_mutex_clear (&self->sources_mutex);
+	g_mutex_clear (&self->rebuild_mutex);
 	g_clear_object (&self->worker);
 
 	G_OBJECT_CLASS (gs_plugin_appstream_parent_class)->dispose (object);
@@ -64,13 +67,19 @@ gs_plugin_appstream_init (GsPluginAppstream *self)
 {
 	GApplication *application = g_application_get_default ();
 
-	/* XbSilo needs external locking as we destroy the silo and build a new
-	 * one when something changes */
-	g_rw_lock_init (&self->silo_lock);
+	/* The silos are replaced rather than changed when something changes,
+	 * so this only guards the pointer to them */
+	g_mutex_init (&self->sources_mutex);
+	g_mutex_init (&self->rebuild_mutex);
 
 	/* need package name */
 	gs_plugin_add_rule (GS_PLUGIN (self), GS_PLUGIN_RULE_RUN_AFTER, "dpkg");
 
+	/* resolves wildcards, so this is refined in series with everything */
+	gs_plugin_set_refine_flags (GS_PLUGIN (self),
+				    GS_APPSTREAM_REFINE_FLAGS_PROVIDED,
+				    GS_PLUGIN_REFINE_FLAGS_NONE);
+
 	/* require settings */
 	self->settings = g_settings_new ("org.gnome.software");
 
@@ -643,32 +652,184 @@ gs_add_appstream_metainfo_location (GPtrArray *locations, const gchar *root)
 			 g_build_filename (root, "appdata", NULL));
 }
 
-static gboolean
-gs_plugin_appstream_check_silo (GsPluginAppstream  *self,
+/* Each directory of AppStream data is compiled into its own silo, so that a
+ * change in one of them only causes that silo to be rebuilt. Queries are run
+ * against each silo in turn, in the order the directories are listed. */
+typedef enum {
+	GS_APPSTREAM_SOURCE_KIND_CATALOG,
+	GS_APPSTREAM_SOURCE_KIND_METAINFO,
+	GS_APPSTREAM_SOURCE_KIND_DESKTOP,
+	GS_APPSTREAM_SOURCE_KIND_TEST,
+	GS_APPSTREAM_SOURCE_KIND_FIXTURE,
+} GsAppstreamSourceKind;
+
+typedef struct {
+	GsAppstreamSourceKind	 kind;
+	gchar			*path;  /* (owned) (nullable), NULL for GS_APPSTREAM_SOURCE_KIND_TEST */
+	XbSilo			*silo;  /* (owned) (nullable) */
+} GsAppstreamSource;
+
+static GsAppstreamSource *
+gs_appstream_source_new (GsAppstreamSourceKind kind, const gchar *path)
+{
+	GsAppstreamSource *source = g_new0 (GsAppstreamSource, 1);
+	source->kind = kind;
+	source->path = g_strdup (path);
+	return source;
+}
+
+static void
+gs_appstream_source_free (GsAppstreamSource *source)
+{
+	g_free (source->path);
+	g_clear_object (&source->silo);
+	g_free (source);
+}
+
+static void
+gs_plugin_appstream_add_sources (GPtrArray             *sources,
+                                 GsAppstreamSourceKind  kind,
+                                 GPtrArray             *paths)
+{
+	for (guint i = 0; i < paths->len; i++) {
+		g_ptr_array_add (sources,
+				 gs_appstream_source_new (kind, g_ptr_array_index (paths, i)));
+	}
+}
+
+/* Lists the directories to load AppStream data from, without loading
+ * anything. */
+static GPtrArray *
+gs_plugin_appstream_get_sources (GsPluginAppstream *self)
+{
+	g_autoptr(GPtrArray) sources = g_ptr_array_new_with_free_func ((GDestroyNotify) gs_appstream_source_free);
+	g_autoptr(GPtrArray) parent_appdata = g_ptr_array_new_with_free_func (g_free);
+	g_autoptr(GPtrArray) parent_appstream = g_ptr_array_new_with_free_func (g_free);
+	g_autofree gchar *state_cache_dir = NULL;
+	g_autofree gchar *state_lib_dir = NULL;
+	const gchar *fixture;
+
+	/* only when in self test */
+	if (g_getenv ("GS_SELF_TEST_APPSTREAM_XML") != NULL) {
+		g_ptr_array_add (sources, gs_appstream_source_new (GS_APPSTREAM_SOURCE_KIND_TEST, NULL));
+		return g_steal_pointer (&sources);
+	}
+
+	/* only when benchmarking, see `gs-cmd --fixture` */
+	fixture = g_getenv ("GS_APPSTREAM_FIXTURE");
+	if (fixture != NULL) {
+		g_ptr_array_add (sources, gs_appstream_source_new (GS_APPSTREAM_SOURCE_KIND_FIXTURE, fixture));
+		return g_steal_pointer (&sources);
+	}
+
+	/* add search paths */
+	gs_add_appstream_catalog_location (parent_appstream, DATADIR);
+	gs_add_appstream_metainfo_location (parent_appdata, DATADIR);
+
+	state_cache_dir = g_build_filename (LOCALSTATEDIR, "cache", NULL);
+	gs_add_appstream_catalog_location (parent_appstream, state_cache_dir);
+	state_lib_dir = g_build_filename (LOCALSTATEDIR, "lib", NULL);
+	gs_add_appstream_catalog_location (parent_appstream, state_lib_dir);
+
+#ifdef ENABLE_EXTERNAL_APPSTREAM
+	/* check for the corresponding setting */
+	if (!g_settings_get_boolean (self->settings, "external-appstream-system-wide")) {
+		g_autofree gchar *user_catalog_path = NULL;
+		g_autofree gchar *user_catalog_old_path = NULL;
+
+		/* migrate data paths */
+		user_catalog_path = g_build_filename (g_get_user_data_dir (), "swcatalog", NULL);
+		user_catalog_old_path = g_build_filename (g_get_user_data_dir (), "app-info", NULL);
+		if (g_file_test (user_catalog_old_path, G_FILE_TEST_IS_DIR) &&
+		    !g_file_test (user_catalog_path, G_FILE_TEST_IS_DIR)) {
+			g_debug ("Migrating external AppStream user location.");
+			if (g_rename (user_catalog_old_path, user_catalog_path) == 0) {
+				g_autofree gchar *user_catalog_xml_path = NULL;
+				g_autofree gchar *user_catalog_xml_old_path = NULL;
+
+				user_catalog_xml_path = g_build_filename (user_catalog_path, "xml", NULL);
+				user_catalog_xml_old_path = g_build_filename (user_catalog_path, "xmls", NULL);
+				if (g_file_test (user_catalog_xml_old_path, G_FILE_TEST_IS_DIR)) {
+					if (g_rename (user_catalog_xml_old_path, user_catalog_xml_path) != 0)
+						g_warning ("Unable to migrate external XML data location from '%s' to '%s': %s",
+							user_catalog_xml_old_path, user_catalog_xml_path, g_strerror (errno));
+				}
+			} else {
+				g_warning ("Unable to migrate external data location from '%s' to '%s': %s",
+					   user_catalog_old_path, user_catalog_path, g_strerror (errno));
+			}
+
+		}
+
+		/* add modern locations only */
+		g_ptr_array_add (parent_appstream,
+				g_build_filename (user_catalog_path, "xml", NULL));
+		g_ptr_array_add (parent_appstream,
+				g_build_filename (user_catalog_path, "yaml", NULL));
+	}
+#endif
+
+	/* Add the normal system directories if the installation prefix
+	 * is different from normal — typically this happens when doing
+	 * development builds. It’s useful to still list the system apps
+	 * during development. */
+	if (g_strcmp0 (DATADIR, "/usr/share") != 0) {
+		gs_add_appstream_catalog_location (parent_appstream, "/usr/share");
+		gs_add_appstream_metainfo_location (parent_appdata, "/usr/share");
+	}
+	if (g_strcmp0 (LOCALSTATEDIR, "/var") != 0) {
+		gs_add_appstream_catalog_location (parent_appstream, "/var/cache");
+		gs_add_appstream_catalog_location (parent_appstream, "/var/lib");
+	}
+
+	gs_plugin_appstream_add_sources (sources, GS_APPSTREAM_SOURCE_KIND_CATALOG, parent_appstream);
+	gs_plugin_appstream_add_sources (sources, GS_APPSTREAM_SOURCE_KIND_METAINFO, parent_appdata);
+	g_ptr_array_add (sources, gs_appstream_source_new (GS_APPSTREAM_SOURCE_KIND_DESKTOP,
+							   DATADIR "/applications"));
+	if (g_strcmp0 (DATADIR, "/usr/share") != 0) {
+		g_ptr_array_add (sources, gs_appstream_source_new (GS_APPSTREAM_SOURCE_KIND_DESKTOP,
+								   "/usr/share/applications"));
+	}
+
+	return g_steal_pointer (&sources);
+}
+
+/* Returns the name of the cache files for @source without an extension, e.g.
+ * `components-usr-share-swcatalog-xml` for `/usr/share/swcatalog/xml`. */
+static gchar *
+gs_appstream_source_get_cache_basename (GsAppstreamSource *source)
+{
+	g_autofree gchar *escaped = NULL;
+
+	if (source->path == NULL)
+		return g_strdup ("components");
+
+	escaped = g_strdup (source->path);
+	g_strdelimit (escaped, G_DIR_SEPARATOR_S, '-');
+	return g_strconcat ("components", escaped, NULL);
+}
+
+/* Compiles the silo for one @source. The silo is saved in the cache
+ * directory and reused from there until the files it was compiled from
+ * change. */
+static XbSilo *
+gs_plugin_appstream_build_silo (GsPluginAppstream  *self,
+                                GsAppstreamSource  *source,
                                 GCancellable       *cancellable,
                                 GError            **error)
 {
-	const gchar *test_xml;
+	const gchar *const *locales = g_get_language_names ();
+	g_autofree gchar *basename = NULL;
+	g_autofree gchar *blobfn_basename = NULL;
 	g_autofree gchar *blobfn = NULL;
+	g_autofree gchar *indexfn_basename = NULL;
+	g_autofree gchar *indexfn = NULL;
+	g_autoptr(GError) error_index = NULL;
 	g_autoptr(XbBuilder) builder = NULL;
-	g_autoptr(XbNode) n = NULL;
+	g_autoptr(XbSilo) silo = NULL;
 	g_autoptr(GFile) file = NULL;
-	g_autoptr(GRWLockReaderLocker) reader_locker = NULL;
-	g_autoptr(GRWLockWriterLocker) writer_locker = NULL;
-	g_autoptr(GPtrArray) parent_appdata = g_ptr_array_new_with_free_func (g_free);
-	g_autoptr(GPtrArray) parent_appstream = g_ptr_array_new_with_free_func (g_free);
-	const gchar *const *locales = g_get_language_names ();
 	g_autoptr(GMainContext) old_thread_default = NULL;
-
-	reader_locker = g_rw_lock_reader_locker_new (&self->silo_lock);
-	/* everything is okay */
-	if (self->silo != NULL && xb_silo_is_valid (self->silo))
-		return TRUE;
-	g_clear_pointer (&reader_locker, g_rw_lock_reader_locker_free);
-
-	/* drat! silo needs regenerating */
-	writer_locker = g_rw_lock_writer_locker_new (&self->silo_lock);
-	g_clear_object (&self->silo);
+	gboolean ret = FALSE;
 
 	/* FIXME: https://gitlab.gnome.org/GNOME/gnome-software/-/issues/1422 */
 	old_thread_default = g_main_context_ref_thread_default ();
@@ -692,127 +853,69 @@ gs_plugin_appstream_check_silo (GsPluginAppstream  *self,
 	for (guint i = 0; locales[i] != NULL; i++)
 		xb_builder_add_locale (builder, locales[i]);
 
-	/* only when in self test */
-	test_xml = g_getenv ("GS_SELF_TEST_APPSTREAM_XML");
-	if (test_xml != NULL) {
+	switch (source->kind) {
+	case GS_APPSTREAM_SOURCE_KIND_TEST: {
+		const gchar *test_xml = g_getenv ("GS_SELF_TEST_APPSTREAM_XML");
 		g_autoptr(XbBuilderFixup) fixup1 = NULL;
 		g_autoptr(XbBuilderFixup) fixup2 = NULL;
-		g_autoptr(XbBuilderSource) source = xb_builder_source_new ();
-		if (!xb_builder_source_load_xml (source, test_xml,
+		g_autoptr(XbBuilderSource) builder_source = xb_builder_source_new ();
+		if (!xb_builder_source_load_xml (builder_source, test_xml,
 						 XB_BUILDER_SOURCE_FLAG_NONE,
 						 error))
-			return FALSE;
+			return NULL;
 		fixup1 = xb_builder_fixup_new ("AddOriginKeywords",
 					       gs_plugin_appstream_add_origin_keyword_cb,
 					       self, NULL);
 		xb_builder_fixup_set_max_depth (fixup1, 1);
-		xb_builder_source_add_fixup (source, fixup1);
+		xb_builder_source_add_fixup (builder_source, fixup1);
 		fixup2 = xb_builder_fixup_new ("AddIcons",
 					       gs_plugin_appstream_add_icons_cb,
 					       self, NULL);
 		xb_builder_fixup_set_max_depth (fixup2, 2);
-		xb_builder_source_add_fixup (source, fixup2);
-		xb_builder_import_source (builder, source);
-	} else {
-		g_autofree gchar *state_cache_dir = NULL;
-		g_autofree gchar *state_lib_dir = NULL;
-
-		/* add search paths */
-		gs_add_appstream_catalog_location (parent_appstream, DATADIR);
-		gs_add_appstream_metainfo_location (parent_appdata, DATADIR);
-
-		state_cache_dir = g_build_filename (LOCALSTATEDIR, "cache", NULL);
-		gs_add_appstream_catalog_location (parent_appstream, state_cache_dir);
-		state_lib_dir = g_build_filename (LOCALSTATEDIR, "lib", NULL);
-		gs_add_appstream_catalog_location (parent_appstream, state_lib_dir);
-
-#ifdef ENABLE_EXTERNAL_APPSTREAM
-		/* check for the corresponding setting */
-		if (!g_settings_get_boolean (self->settings, "external-appstream-system-wide")) {
-			g_autofree gchar *user_catalog_path = NULL;
-			g_autofree gchar *user_catalog_old_path = NULL;
-
-			/* migrate data paths */
-			user_catalog_path = g_build_filename (g_get_user_data_dir (), "swcatalog", NULL);
-			user_catalog_old_path = g_build_filename (g_get_user_data_dir (), "app-info", NULL);
-			if (g_file_test (user_catalog_old_path, G_FILE_TEST_IS_DIR) &&
-			    !g_file_test (user_catalog_path, G_FILE_TEST_IS_DIR)) {
-				g_debug ("Migrating external AppStream user location.");
-				if (g_rename (user_catalog_old_path, user_catalog_path) == 0) {
-					g_autofree gchar *user_catalog_xml_path = NULL;
-					g_autofree gchar *user_catalog_xml_old_path = NULL;
-
-					user_catalog_xml_path = g_build_filename (user_catalog_path, "xml", NULL);
-					user_catalog_xml_old_path = g_build_filename (user_catalog_path, "xmls", NULL);
-					if (g_file_test (user_catalog_xml_old_path, G_FILE_TEST_IS_DIR)) {
-						if (g_rename (user_catalog_xml_old_path, user_catalog_xml_path) != 0)
-							g_warning ("Unable to migrate external XML data location from '%s' to '%s': %s",
-								user_catalog_xml_old_path, user_catalog_xml_path, g_strerror (errno));
-					}
-				} else {
-					g_warning ("Unable to migrate external data location from '%s' to '%s': %s",
-						   user_catalog_old_path, user_catalog_path, g_strerror (errno));
-				}
-
-			}
-
-			/* add modern locations only */
-			g_ptr_array_add (parent_appstream,
-					g_build_filename (user_catalog_path, "xml", NULL));
-			g_ptr_array_add (parent_appstream,
-					g_build_filename (user_catalog_path, "yaml", NULL));
-		}
-#endif
-
-		/* Add the normal system directories if the installation prefix
-		 * is different from normal — typically this happens when doing
-		 * development builds. It’s useful to still list the system apps
-		 * during development. */
-		if (g_strcmp0 (DATADIR, "/usr/share") != 0) {
-			gs_add_appstream_catalog_location (parent_appstream, "/usr/share");
-			gs_add_appstream_metainfo_location (parent_appdata, "/usr/share");
-		}
-		if (g_strcmp0 (LOCALSTATEDIR, "/var") != 0) {
-			gs_add_appstream_catalog_location (parent_appstream, "/var/cache");
-			gs_add_appstream_catalog_location (parent_appstream, "/var/lib");
-		}
-
-		/* import all files */
-		for (guint i = 0; i < parent_appstream->len; i++) {
-			const gchar *fn = g_ptr_array_index (parent_appstream, i);
-			if (!gs_plugin_appstream_load_appstream (self, builder, fn,
-								 cancellable, error))
-				return FALSE;
-		}
-		for (guint i = 0; i < parent_appdata->len; i++) {
-			const gchar *fn = g_ptr_array_index (parent_appdata, i);
-			if (!gs_plugin_appstream_load_appdata (self, builder, fn,
-							       cancellable, error))
-				return FALSE;
-		}
-		if (!gs_plugin_appstream_load_desktop (self, builder,
-						       DATADIR "/applications",
-						       cancellable, error)) {
-			return FALSE;
-		}
-		if (g_strcmp0 (DATADIR, "/usr/share") != 0 &&
-		    !gs_plugin_appstream_load_desktop (self, builder,
-						       "/usr/share/applications",
-						       cancellable, error)) {
-			return FALSE;
-		}
+		xb_builder_source_add_fixup (builder_source, fixup2);
+		xb_builder_import_source (builder, builder_source);
+		ret = TRUE;
+		break;
+	}
+	case GS_APPSTREAM_SOURCE_KIND_FIXTURE:
+		/* a single catalog file, or a directory of them */
+		if (g_file_test (source->path, G_FILE_TEST_IS_DIR))
+			ret = gs_plugin_appstream_load_appstream (self, builder, source->path,
+								  cancellable, error);
+		else
+			ret = gs_plugin_appstream_load_appstream_fn (self, builder, source->path,
+								     cancellable, error);
+		break;
+	case GS_APPSTREAM_SOURCE_KIND_CATALOG:
+		ret = gs_plugin_appstream_load_appstream (self, builder, source->path,
+							  cancellable, error);
+		break;
+	case GS_APPSTREAM_SOURCE_KIND_METAINFO:
+		ret = gs_plugin_appstream_load_appdata (self, builder, source->path,
+							cancellable, error);
+		break;
+	case GS_APPSTREAM_SOURCE_KIND_DESKTOP:
+		ret = gs_plugin_appstream_load_desktop (self, builder, source->path,
+							cancellable, error);
+		break;
+	default:
+		g_assert_not_reached ();
 	}
+	if (!ret)
+		return NULL;
 
 	/* regenerate with each minor release */
 	xb_builder_append_guid (builder, PACKAGE_VERSION);
 
 	/* create per-user cache */
-	blobfn = gs_utils_get_cache_filename ("appstream", "components.xmlb",
+	basename = gs_appstream_source_get_cache_basename (source);
+	blobfn_basename = g_strconcat (basename, ".xmlb", NULL);
+	blobfn = gs_utils_get_cache_filename ("appstream", blobfn_basename,
 					      GS_UTILS_CACHE_FLAG_WRITEABLE |
 					      GS_UTILS_CACHE_FLAG_CREATE_DIRECTORY,
 					      error);
 	if (blobfn == NULL)
-		return FALSE;
+		return NULL;
 	file = g_file_new_for_path (blobfn);
 	g_debug ("ensuring %s", blobfn);
 
@@ -823,42 +926,133 @@ gs_plugin_appstream_check_silo (GsPluginAppstream  *self,
 	if (old_thread_default != NULL)
 		g_main_context_pop_thread_default (old_thread_default);
 
-	self->silo = xb_builder_ensure (builder, file,
-					XB_BUILDER_COMPILE_FLAG_IGNORE_INVALID |
-					XB_BUILDER_COMPILE_FLAG_SINGLE_LANG,
-					NULL, error);
-	if (self->silo == NULL) {
-		if (old_thread_default != NULL)
-			g_main_context_push_thread_default (old_thread_default);
-		return FALSE;
+	silo = xb_builder_ensure (builder, file,
+				  XB_BUILDER_COMPILE_FLAG_IGNORE_INVALID |
+				  XB_BUILDER_COMPILE_FLAG_SINGLE_LANG,
+				  NULL, error);
+
+	/* watch the directory too, to notice files being added to it */
+	if (silo != NULL && source->path != NULL) {
+		g_autoptr(GFile) file_tmp = g_file_new_for_path (source->path);
+		if (!xb_silo_watch_file (silo, file_tmp, cancellable, error))
+			g_clear_object (&silo);
 	}
 
-	/* watch all directories too */
-	for (guint i = 0; i < parent_appstream->len; i++) {
-		const gchar *fn = g_ptr_array_index (parent_appstream, i);
-		g_autoptr(GFile) file_tmp = g_file_new_for_path (fn);
-		if (!xb_silo_watch_file (self->silo, file_tmp, cancellable, error)) {
-			if (old_thread_default != NULL)
-				g_main_context_push_thread_default (old_thread_default);
+	if (old_thread_default != NULL)
+		g_main_context_push_thread_default (old_thread_default);
+
+	if (silo == NULL)
+		return NULL;
+
+	/* index the searchable fields; search still works without it */
+	indexfn_basename = g_strconcat (basename, ".idx", NULL);
+	indexfn = gs_utils_get_cache_filename ("appstream", indexfn_basename,
+					       GS_UTILS_CACHE_FLAG_WRITEABLE |
+					       GS_UTILS_CACHE_FLAG_CREATE_DIRECTORY,
+					       NULL);
+	if (!gs_appstream_silo_ensure_search_index (silo, indexfn, cancellable, &error_index))
+		g_debug ("failed to build search index for %s: %s", blobfn, error_index->message);
+
+	return g_steal_pointer (&silo);
+}
+
+static gboolean
+gs_appstream_sources_are_valid (GPtrArray *sources)
+{
+	for (guint i = 0; i < sources->len; i++) {
+		GsAppstreamSource *source = g_ptr_array_index (sources, i);
+		if (!xb_silo_is_valid (source->silo))
 			return FALSE;
-		}
 	}
-	for (guint i = 0; i < parent_appdata->len; i++) {
-		const gchar *fn = g_ptr_array_index (parent_appdata, i);
-		g_autoptr(GFile) file_tmp = g_file_new_for_path (fn);
-		if (!xb_silo_watch_file (self->silo, file_tmp, cancellable, error)) {
-			if (old_thread_default != NULL)
-				g_main_context_push_thread_default (old_thread_default);
-			return FALSE;
-		}
+	return TRUE;
+}
+
+static GsAppstreamSource *
+gs_appstream_sources_find (GPtrArray             *sources,
+                           GsAppstreamSourceKind  kind,
+                           const gchar           *path)
+{
+	for (guint i = 0; sources != NULL && i < sources->len; i++) {
+		GsAppstreamSource *source = g_ptr_array_index (sources, i);
+		if (source->kind == kind && g_strcmp0 (source->path, path) == 0)
+			return source;
 	}
+	return NULL;
+}
 
-	if (old_thread_default != NULL)
-		g_main_context_push_thread_default (old_thread_default);
+static XbSilo *
+gs_appstream_sources_get_silo (GPtrArray *sources,
+                               guint      idx)
+{
+	GsAppstreamSource *source = g_ptr_array_index (sources, idx);
+	return source->silo;
+}
+
+/* Returns a reference to the published sources, or %NULL if none have been
+ * built yet. The sources and their silos are never changed once published,
+ * so they can be queried without any locking for as long as the reference is
+ * held, even if a rebuild replaces them meanwhile. */
+static GPtrArray *
+gs_plugin_appstream_ref_sources (GsPluginAppstream *self)
+{
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&self->sources_mutex);
+	return (self->sources != NULL) ? g_ptr_array_ref (self->sources) : NULL;
+}
+
+/* Builds new silos for the sources which are out of date, or for all of them
+ * if @force is set, and then publishes them in place of the old ones.
+ *
+ * The building is done without holding @sources_mutex, so readers carry on
+ * using the old silos until the new ones are swapped in. */
+static gboolean
+gs_plugin_appstream_rebuild (GsPluginAppstream  *self,
+                             gboolean            force,
+                             GCancellable       *cancellable,
+                             GError            **error)
+{
+	g_autoptr(GMutexLocker) rebuild_locker = NULL;
+	g_autoptr(GMutexLocker) locker = NULL;
+	g_autoptr(GPtrArray) old_sources = NULL;
+	g_autoptr(GPtrArray) sources = NULL;
+	g_autoptr(GPtrArray) silos = NULL;
+	gboolean has_components = FALSE;
+	guint n_rebuilt = 0;
+
+	/* only one rebuild at a time, and not again if another thread has
+	 * just done it */
+	rebuild_locker = g_mutex_locker_new (&self->rebuild_mutex);
+	old_sources = gs_plugin_appstream_ref_sources (self);
+	if (!force && old_sources != NULL && gs_appstream_sources_are_valid (old_sources))
+		return TRUE;
 
-	/* test we found something */
-	n = xb_silo_query_first (self->silo, "components/component", NULL);
-	if (n == NULL) {
+	/* only rebuild the silos whose files have changed, and keep the rest */
+	sources = gs_plugin_appstream_get_sources (self);
+	silos = g_ptr_array_new ();
+	for (guint i = 0; i < sources->len; i++) {
+		GsAppstreamSource *source = g_ptr_array_index (sources, i);
+		GsAppstreamSource *old_source = gs_appstream_sources_find (old_sources, source->kind, source->path);
+		g_autoptr(XbNode) n = NULL;
+
+		if (!force && old_source != NULL && xb_silo_is_valid (old_source->silo)) {
+			source->silo = g_object_ref (old_source->silo);
+		} else {
+			source->silo = gs_plugin_appstream_build_silo (self, source, cancellable, error);
+			if (source->silo == NULL)
+				return FALSE;
+			n_rebuilt++;
+		}
+		g_ptr_array_add (silos, source->silo);
+
+		n = xb_silo_query_first (source->silo, "components/component", NULL);
+		if (n != NULL)
+			has_components = TRUE;
+	}
+	g_debug ("rebuilt %u of %u AppStream silos", n_rebuilt, sources->len);
+
+	/* test we found something, and keep the published sources if not;
+	 * this has to be before the siblings are set, or the reused silos
+	 * would be left referring to the discarded ones */
+	if (!has_components) {
 		g_warning ("No AppStream data, try 'make install-sample-data' in data/");
 		g_set_error (error,
 			     GS_PLUGIN_ERROR,
@@ -867,10 +1061,82 @@ gs_plugin_appstream_check_silo (GsPluginAppstream  *self,
 		return FALSE;
 	}
 
+	/* let components refer to components in the other silos; this is
+	 * safe to change on silos which are already published */
+	for (guint i = 0; i < silos->len; i++)
+		gs_appstream_silo_set_siblings (g_ptr_array_index (silos, i), silos);
+
+	/* swap the new sources in; the old ones are freed once the last
+	 * reader drops its reference */
+	locker = g_mutex_locker_new (&self->sources_mutex);
+	g_clear_pointer (&old_sources, g_ptr_array_unref);
+	old_sources = g_steal_pointer (&self->sources);
+	self->sources = g_steal_pointer (&sources);
+	g_clear_pointer (&locker, g_mutex_locker_free);
+
 	/* success */
 	return TRUE;
 }
 
+static void
+rebuild_thread_cb (GTask        *task,
+                   gpointer      source_object,
+                   gpointer      task_data,
+                   GCancellable *cancellable)
+{
+	GsPluginAppstream *self = GS_PLUGIN_APPSTREAM (source_object);
+	gboolean force = GPOINTER_TO_INT (task_data);
+	g_autoptr(GError) local_error = NULL;
+
+	/* anything changing from now on needs another rebuild */
+	g_atomic_int_set (&self->rebuild_queued, FALSE);
+
+	if (!gs_plugin_appstream_rebuild (self, force, cancellable, &local_error))
+		g_task_return_error (task, g_steal_pointer (&local_error));
+	else
+		g_task_return_boolean (task, TRUE);
+}
+
+/* Rebuilds the out of date silos in a thread of their own, unless that is
+ * already queued. */
+static void
+gs_plugin_appstream_queue_rebuild (GsPluginAppstream *self)
+{
+	g_autoptr(GTask) task = NULL;
+
+	if (!g_atomic_int_compare_and_exchange (&self->rebuild_queued, FALSE, TRUE))
+		return;
+
+	task = g_task_new (self, NULL, NULL, NULL);
+	g_task_set_source_tag (task, gs_plugin_appstream_queue_rebuild);
+	g_task_set_task_data (task, GINT_TO_POINTER (FALSE), NULL);
+	g_task_run_in_thread (task, rebuild_thread_cb);
+}
+
+/* Returns a reference to the silos to query. If any of them are out of date,
+ * they are rebuilt in the background and the current ones are returned, so
+ * only the very first query has to wait for the silos to be built. */
+static GPtrArray *
+gs_plugin_appstream_ref_silos (GsPluginAppstream  *self,
+                               GCancellable       *cancellable,
+                               GError            **error)
+{
+	g_autoptr(GPtrArray) sources = gs_plugin_appstream_ref_sources (self);
+
+	if (sources == NULL) {
+		g_autoptr(GsTraceSpan) trace_span = gs_trace_span_begin ("rebuild-wait:appstream");
+
+		if (!gs_plugin_appstream_rebuild (self, FALSE, cancellable, error))
+			return NULL;
+		return gs_plugin_appstream_ref_sources (self);
+	}
+
+	if (!gs_appstream_sources_are_valid (sources))
+		gs_plugin_appstream_queue_rebuild (self);
+
+	return g_steal_pointer (&sources);
+}
+
 static gint
 get_priority_for_interactivity (gboolean interactive)
 {
@@ -910,11 +1176,13 @@ setup_thread_cb (GTask        *task,
                  GCancellable *cancellable)
 {
 	GsPluginAppstream *self = GS_PLUGIN_APPSTREAM (source_object);
+	g_autoptr(GPtrArray) sources = NULL;
 	g_autoptr(GError) local_error = NULL;
 
 	assert_in_worker (self);
 
-	if (!gs_plugin_appstream_check_silo (self, cancellable, &local_error))
+	sources = gs_plugin_appstream_ref_silos (self, cancellable, &local_error);
+	if (sources == NULL)
 		g_task_return_error (task, g_steal_pointer (&local_error));
 	else
 		g_task_return_boolean (task, TRUE);
@@ -984,15 +1252,20 @@ gs_plugin_url_to_app (GsPlugin *plugin,
 		      GError **error)
 {
 	GsPluginAppstream *self = GS_PLUGIN_APPSTREAM (plugin);
-	g_autoptr(GRWLockReaderLocker) locker = NULL;
+	g_autoptr(GPtrArray) sources = NULL;
 
 	/* check silo is valid */
-	if (!gs_plugin_appstream_check_silo (self, cancellable, error))
+	sources = gs_plugin_appstream_ref_silos (self, cancellable, error);
+	if (sources == NULL)
 		return FALSE;
 
-	locker = g_rw_lock_reader_locker_new (&self->silo_lock);
+	for (guint i = 0; i < sources->len; i++) {
+		if (!gs_appstream_url_to_app (plugin, gs_appstream_sources_get_silo (sources, i),
+					      list, url, cancellable, error))
+			return FALSE;
+	}
 
-	return gs_appstream_url_to_app (plugin, self->silo, list, url, cancellable, error);
+	return TRUE;
 }
 
 static void
@@ -1042,34 +1315,39 @@ gs_plugin_appstream_set_compulsory_quirk (GsApp *app, XbNode *component)
 
 static gboolean
 gs_plugin_appstream_refine_state (GsPluginAppstream  *self,
+                                  GPtrArray          *sources,
                                   GsApp              *app,
                                   GError            **error)
 {
 	g_autofree gchar *xpath = NULL;
 	g_autoptr(GError) error_local = NULL;
-	g_autoptr(GRWLockReaderLocker) locker = NULL;
-	g_autoptr(XbNode) component = NULL;
 
 	/* Ignore apps with no ID */
 	if (gs_app_get_id (app) == NULL)
 		return TRUE;
 
-	locker = g_rw_lock_reader_locker_new (&self->silo_lock);
-
 	xpath = g_strdup_printf ("component/id[text()='%s']", gs_app_get_id (app));
-	component = xb_silo_query_first (self->silo, xpath, &error_local);
-	if (component == NULL) {
-		if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-			return TRUE;
-		g_propagate_error (error, g_steal_pointer (&error_local));
-		return FALSE;
+	for (guint i = 0; i < sources->len; i++) {
+		g_autoptr(XbNode) component = NULL;
+
+		component = xb_silo_query_first (gs_appstream_sources_get_silo (sources, i), xpath, &error_local);
+		if (component == NULL) {
+			if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
+				g_clear_error (&error_local);
+				continue;
+			}
+			g_propagate_error (error, g_steal_pointer (&error_local));
+			return FALSE;
+		}
+		gs_app_set_state (app, GS_APP_STATE_INSTALLED);
+		return TRUE;
 	}
-	gs_app_set_state (app, GS_APP_STATE_INSTALLED);
 	return TRUE;
 }
 
 static gboolean
 gs_plugin_refine_from_id (GsPluginAppstream    *self,
+                          GPtrArray            *sources,
                           GsApp                *app,
                           GsPluginRefineFlags   flags,
                           gboolean             *found,
@@ -1077,17 +1355,14 @@ gs_plugin_refine_from_id (GsPluginAppstream    *self,
 {
 	const gchar *id, *origin;
 	g_autoptr(GError) error_local = NULL;
-	g_autoptr(GRWLockReaderLocker) locker = NULL;
 	g_autoptr(GString) xpath = g_string_new (NULL);
-	g_autoptr(GPtrArray) components = NULL;
+	guint n_found = 0;
 
 	/* not enough info to find */
 	id = gs_app_get_id (app);
 	if (id == NULL)
 		return TRUE;
 
-	locker = g_rw_lock_reader_locker_new (&self->silo_lock);
-
 	origin = gs_app_get_origin_appstream (app);
 
 	/* look in AppStream then fall back to AppData */
@@ -1099,24 +1374,34 @@ gs_plugin_refine_from_id (GsPluginAppstream    *self,
 		xb_string_append_union (xpath, "components/component[@type='web-application']/id[text()='%s']/..", id);
 	}
 	xb_string_append_union (xpath, "component/id[text()='%s']/..", id);
-	components = xb_silo_query (self->silo, xpath->str, 0, &error_local);
-	if (components == NULL) {
-		if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-			return TRUE;
-		g_propagate_error (error, g_steal_pointer (&error_local));
-		return FALSE;
-	}
-	for (guint i = 0; i < components->len; i++) {
-		XbNode *component = g_ptr_array_index (components, i);
-		if (!gs_appstream_refine_app (GS_PLUGIN (self), app, self->silo,
-					      component, flags, error))
+	for (guint j = 0; j < sources->len; j++) {
+		XbSilo *silo = gs_appstream_sources_get_silo (sources, j);
+		g_autoptr(GPtrArray) components = NULL;
+
+		components = xb_silo_query (silo, xpath->str, 0, &error_local);
+		if (components == NULL) {
+			if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
+				g_clear_error (&error_local);
+				continue;
+			}
+			g_propagate_error (error, g_steal_pointer (&error_local));
 			return FALSE;
-		gs_plugin_appstream_set_compulsory_quirk (app, component);
+		}
+		for (guint i = 0; i < components->len; i++) {
+			XbNode *component = g_ptr_array_index (components, i);
+			if (!gs_appstream_refine_app (GS_PLUGIN (self), app, silo,
+						      component, flags, error))
+				return FALSE;
+			gs_plugin_appstream_set_compulsory_quirk (app, component);
+		}
+		n_found++;
 	}
+	if (n_found == 0)
+		return TRUE;
 
 	/* if an installed desktop or appdata file exists set to installed */
 	if (gs_app_get_state (app) == GS_APP_STATE_UNKNOWN) {
-		if (!gs_plugin_appstream_refine_state (self, app, error))
+		if (!gs_plugin_appstream_refine_state (self, sources, app, error))
 			return FALSE;
 	}
 
@@ -1127,46 +1412,56 @@ gs_plugin_refine_from_id (GsPluginAppstream    *self,
 
 static gboolean
 gs_plugin_refine_from_pkgname (GsPluginAppstream    *self,
+                               GPtrArray            *sources,
                                GsApp                *app,
                                GsPluginRefineFlags   flags,
                                GError              **error)
 {
-	GPtrArray *sources = gs_app_get_sources (app);
+	GPtrArray *app_sources = gs_app_get_sources (app);
 	g_autoptr(GError) error_local = NULL;
 
 	/* not enough info to find */
-	if (sources->len == 0)
+	if (app_sources->len == 0)
 		return TRUE;
 
 	/* find all apps when matching any prefixes */
-	for (guint j = 0; j < sources->len; j++) {
-		const gchar *pkgname = g_ptr_array_index (sources, j);
-		g_autoptr(GRWLockReaderLocker) locker = NULL;
-		g_autoptr(GString) xpath = g_string_new (NULL);
+	for (guint j = 0; j < app_sources->len; j++) {
+		const gchar *pkgname = g_ptr_array_index (app_sources, j);
 		g_autoptr(XbNode) component = NULL;
-
-		locker = g_rw_lock_reader_locker_new (&self->silo_lock);
+		XbSilo *silo = NULL;
+		g_autoptr(GPtrArray) xpaths = g_ptr_array_new_with_free_func (g_free);
 
 		/* prefer actual apps and then fallback to anything else */
-		xb_string_append_union (xpath, "components/component[@type='desktop-application']/pkgname[text()='%s']/..", pkgname);
-		xb_string_append_union (xpath, "components/component[@type='console-application']/pkgname[text()='%s']/..", pkgname);
-		xb_string_append_union (xpath, "components/component[@type='web-application']/pkgname[text()='%s']/..", pkgname);
-		xb_string_append_union (xpath, "components/component/pkgname[text()='%s']/..", pkgname);
-		component = xb_silo_query_first (self->silo, xpath->str, &error_local);
-		if (component == NULL) {
-			if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-				continue;
-			g_propagate_error (error, g_steal_pointer (&error_local));
-			return FALSE;
+		g_ptr_array_add (xpaths, g_strdup_printf ("components/component[@type='desktop-application']/pkgname[text()='%s']/..", pkgname));
+		g_ptr_array_add (xpaths, g_strdup_printf ("components/component[@type='console-application']/pkgname[text()='%s']/..", pkgname));
+		g_ptr_array_add (xpaths, g_strdup_printf ("components/component[@type='web-application']/pkgname[text()='%s']/..", pkgname));
+		g_ptr_array_add (xpaths, g_strdup_printf ("components/component/pkgname[text()='%s']/..", pkgname));
+
+		/* try each kind of component in all the silos before falling
+		 * back to the next one */
+		for (guint k = 0; component == NULL && k < xpaths->len; k++) {
+			for (guint i = 0; component == NULL && i < sources->len; i++) {
+				silo = gs_appstream_sources_get_silo (sources, i);
+				component = xb_silo_query_first (silo, g_ptr_array_index (xpaths, k), &error_local);
+				if (component == NULL) {
+					if (!g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
+						g_propagate_error (error, g_steal_pointer (&error_local));
+						return FALSE;
+					}
+					g_clear_error (&error_local);
+				}
+			}
 		}
-		if (!gs_appstream_refine_app (GS_PLUGIN (self), app, self->silo, component, flags, error))
+		if (component == NULL)
+			continue;
+		if (!gs_appstream_refine_app (GS_PLUGIN (self), app, silo, component, flags, error))
 			return FALSE;
 		gs_plugin_appstream_set_compulsory_quirk (app, component);
 	}
 
 	/* if an installed desktop or appdata file exists set to installed */
 	if (gs_app_get_state (app) == GS_APP_STATE_UNKNOWN) {
-		if (!gs_plugin_appstream_refine_state (self, app, error))
+		if (!gs_plugin_appstream_refine_state (self, sources, app, error))
 			return FALSE;
 	}
 
@@ -1200,6 +1495,7 @@ gs_plugin_appstream_refine_async (GsPlugin            *plugin,
 }
 
 static gboolean refine_wildcard (GsPluginAppstream    *self,
+                                 GPtrArray            *sources,
                                  GsApp                *app,
                                  GsAppList            *list,
                                  GsPluginRefineFlags   refine_flags,
@@ -1219,31 +1515,38 @@ refine_thread_cb (GTask        *task,
 	GsPluginRefineFlags flags = data->flags;
 	gboolean found = FALSE;
 	g_autoptr(GsAppList) app_list = NULL;
+	g_autoptr(GPtrArray) sources = NULL;
 	g_autoptr(GError) local_error = NULL;
 
 	assert_in_worker (self);
 
 	/* check silo is valid */
-	if (!gs_plugin_appstream_check_silo (self, cancellable, &local_error)) {
+	sources = gs_plugin_appstream_ref_silos (self, cancellable, &local_error);
+	if (sources == NULL) {
 		g_task_return_error (task, g_steal_pointer (&local_error));
 		return;
 	}
 
 	for (guint i = 0; i < gs_app_list_length (list); i++) {
 		GsApp *app = gs_app_list_index (list, i);
+		g_autoptr(GsTraceSpan) trace_span = NULL;
 
 		/* not us */
 		if (gs_app_get_bundle_kind (app) != AS_BUNDLE_KIND_PACKAGE &&
 		    gs_app_get_bundle_kind (app) != AS_BUNDLE_KIND_UNKNOWN)
 			continue;
 
+		trace_span = gs_trace_span_begin ("refine-app:appstream");
+		gs_trace_span_set_app_id (trace_span, gs_app_get_id (app));
+		gs_trace_span_set_refine_flags (trace_span, flags);
+
 		/* find by ID then fall back to package name */
-		if (!gs_plugin_refine_from_id (self, app, flags, &found, &local_error)) {
+		if (!gs_plugin_refine_from_id (self, sources, app, flags, &found, &local_error)) {
 			g_task_return_error (task, g_steal_pointer (&local_error));
 			return;
 		}
 		if (!found) {
-			if (!gs_plugin_refine_from_pkgname (self, app, flags, &local_error)) {
+			if (!gs_plugin_refine_from_pkgname (self, sources, app, flags, &local_error)) {
 				g_task_return_error (task, g_steal_pointer (&local_error));
 				return;
 			}
@@ -1262,7 +1565,7 @@ refine_thread_cb (GTask        *task,
 		GsApp *app = gs_app_list_index (app_list, j);
 
 		if (gs_app_has_quirk (app, GS_APP_QUIRK_IS_WILDCARD) &&
-		    !refine_wildcard (self, app, list, flags, cancellable, &local_error)) {
+		    !refine_wildcard (self, sources, app, list, flags, cancellable, &local_error)) {
 			g_task_return_error (task, g_steal_pointer (&local_error));
 			return;
 		}
@@ -1283,6 +1586,7 @@ gs_plugin_appstream_refine_finish (GsPlugin      *plugin,
 /* Run in @worker. Silo must be valid */
 static gboolean
 refine_wildcard (GsPluginAppstream    *self,
+                 GPtrArray            *sources,
                  GsApp                *app,
                  GsAppList            *list,
                  GsPluginRefineFlags   refine_flags,
@@ -1292,47 +1596,50 @@ refine_wildcard (GsPluginAppstream    *self,
 	const gchar *id;
 	g_autofree gchar *xpath = NULL;
 	g_autoptr(GError) error_local = NULL;
-	g_autoptr(GRWLockReaderLocker) locker = NULL;
-	g_autoptr(GPtrArray) components = NULL;
 
 	/* not enough info to find */
 	id = gs_app_get_id (app);
 	if (id == NULL)
 		return TRUE;
 
-	locker = g_rw_lock_reader_locker_new (&self->silo_lock);
-
 	/* find all app with package names when matching any prefixes */
 	xpath = g_strdup_printf ("components/component/id[text()='%s']/../pkgname/..", id);
-	components = xb_silo_query (self->silo, xpath, 0, &error_local);
-	if (components == NULL) {
-		if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-			return TRUE;
-		g_propagate_error (error, g_steal_pointer (&error_local));
-		return FALSE;
-	}
-	for (guint i = 0; i < components->len; i++) {
-		XbNode *component = g_ptr_array_index (components, i);
-		g_autoptr(GsApp) new = NULL;
+	for (guint j = 0; j < sources->len; j++) {
+		XbSilo *silo = gs_appstream_sources_get_silo (sources, j);
+		g_autoptr(GPtrArray) components = NULL;
 
-		/* new app */
-		new = gs_appstream_create_app (GS_PLUGIN (self), self->silo, component, error);
-		if (new == NULL)
-			return FALSE;
-		gs_app_set_scope (new, AS_COMPONENT_SCOPE_SYSTEM);
-		gs_app_subsume_metadata (new, app);
-		if (!gs_appstream_refine_app (GS_PLUGIN (self), new, self->silo, component,
-					      refine_flags, error))
+		components = xb_silo_query (silo, xpath, 0, &error_local);
+		if (components == NULL) {
+			if (g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
+				g_clear_error (&error_local);
+				continue;
+			}
+			g_propagate_error (error, g_steal_pointer (&error_local));
 			return FALSE;
-		gs_plugin_appstream_set_compulsory_quirk (new, component);
+		}
+		for (guint i = 0; i < components->len; i++) {
+			XbNode *component = g_ptr_array_index (components, i);
+			g_autoptr(GsApp) new = NULL;
 
-		/* if an installed desktop or appdata file exists set to installed */
-		if (gs_app_get_state (new) == GS_APP_STATE_UNKNOWN) {
-			if (!gs_plugin_appstream_refine_state (self, new, error))
+			/* new app */
+			new = gs_appstream_create_app (GS_PLUGIN (self), silo, component, error);
+			if (new == NULL)
 				return FALSE;
-		}
+			gs_app_set_scope (new, AS_COMPONENT_SCOPE_SYSTEM);
+			gs_app_subsume_metadata (new, app);
+			if (!gs_appstream_refine_app (GS_PLUGIN (self), new, silo, component,
+						      refine_flags, error))
+				return FALSE;
+			gs_plugin_appstream_set_compulsory_quirk (new, component);
+
+			/* if an installed desktop or appdata file exists set to installed */
+			if (gs_app_get_state (new) == GS_APP_STATE_UNKNOWN) {
+				if (!gs_plugin_appstream_refine_state (self, sources, new, error))
+					return FALSE;
+			}
 
-		gs_app_list_add (list, new);
+			gs_app_list_add (list, new);
+		}
 	}
 
 	/* success */
@@ -1380,23 +1687,25 @@ refine_categories_thread_cb (GTask        *task,
                              GCancellable *cancellable)
 {
 	GsPluginAppstream *self = GS_PLUGIN_APPSTREAM (source_object);
-	g_autoptr(GRWLockReaderLocker) locker = NULL;
+	g_autoptr(GPtrArray) sources = NULL;
 	GsPluginRefineCategoriesData *data = task_data;
 	g_autoptr(GError) local_error = NULL;
 
 	assert_in_worker (self);
 
 	/* check silo is valid */
-	if (!gs_plugin_appstream_check_silo (self, cancellable, &local_error)) {
+	sources = gs_plugin_appstream_ref_silos (self, cancellable, &local_error);
+	if (sources == NULL) {
 		g_task_return_error (task, g_steal_pointer (&local_error));
 		return;
 	}
 
-	locker = g_rw_lock_reader_locker_new (&self->silo_lock);
-
-	if (!gs_appstream_refine_category_sizes (self->silo, data->list, cancellable, &local_error)) {
-		g_task_return_error (task, g_steal_pointer (&local_error));
-		return;
+	for (guint i = 0; i < sources->len; i++) {
+		if (!gs_appstream_refine_category_sizes (gs_appstream_sources_get_silo (sources, i),
+							 data->list, cancellable, &local_error)) {
+			g_task_return_error (task, g_steal_pointer (&local_error));
+			return;
+		}
 	}
 
 	g_task_return_boolean (task, TRUE);
@@ -1444,7 +1753,7 @@ list_apps_thread_cb (GTask        *task,
                      GCancellable *cancellable)
 {
 	GsPluginAppstream *self = GS_PLUGIN_APPSTREAM (source_object);
-	g_autoptr(GRWLockReaderLocker) locker = NULL;
+	g_autoptr(GPtrArray) sources = NULL;
 	g_autoptr(GsAppList) list = gs_app_list_new ();
 	GsPluginListAppsData *data = task_data;
 	GDateTime *released_since = NULL;
@@ -1498,67 +1807,79 @@ list_apps_thread_cb (GTask        *task,
 	}
 
 	/* check silo is valid */
-	if (!gs_plugin_appstream_check_silo (self, cancellable, &local_error)) {
+	sources = gs_plugin_appstream_ref_silos (self, cancellable, &local_error);
+	if (sources == NULL) {
 		g_task_return_error (task, g_steal_pointer (&local_error));
 		return;
 	}
 
-	locker = g_rw_lock_reader_locker_new (&self->silo_lock);
+	/* each silo adds its results to @list in turn */
+	for (guint i = 0; i < sources->len; i++) {
+		XbSilo *silo = gs_appstream_sources_get_silo (sources, i);
 
-	if (released_since != NULL &&
-	    !gs_appstream_add_recent (GS_PLUGIN (self), self->silo, list, age_secs,
-				      cancellable, &local_error)) {
-		g_task_return_error (task, g_steal_pointer (&local_error));
-		return;
-	}
+		if (released_since != NULL &&
+		    !gs_appstream_add_recent (GS_PLUGIN (self), silo, list, age_secs,
+					      cancellable, &local_error)) {
+			g_task_return_error (task, g_steal_pointer (&local_error));
+			return;
+		}
 
-	if (is_curated != GS_APP_QUERY_TRISTATE_UNSET &&
-	    !gs_appstream_add_popular (self->silo, list, cancellable, &local_error)) {
-		g_task_return_error (task, g_steal_pointer (&local_error));
-		return;
-	}
+		if (is_curated != GS_APP_QUERY_TRISTATE_UNSET &&
+		    !gs_appstream_add_popular (silo, list, cancellable, &local_error)) {
+			g_task_return_error (task, g_steal_pointer (&local_error));
+			return;
+		}
 
-	if (is_featured != GS_APP_QUERY_TRISTATE_UNSET &&
-	    !gs_appstream_add_featured (self->silo, list, cancellable, &local_error)) {
-		g_task_return_error (task, g_steal_pointer (&local_error));
-		return;
-	}
+		if (is_featured != GS_APP_QUERY_TRISTATE_UNSET &&
+		    !gs_appstream_add_featured (silo, list, cancellable, &local_error)) {
+			g_task_return_error (task, g_steal_pointer (&local_error));
+			return;
+		}
 
-	if (category != NULL &&
-	    !gs_appstream_add_category_apps (GS_PLUGIN (self), self->silo, category, list, cancellable, &local_error)) {
-		g_task_return_error (task, g_steal_pointer (&local_error));
-		return;
-	}
+		if (category != NULL &&
+		    !gs_appstream_add_category_apps (GS_PLUGIN (self), silo, category, list, cancellable, &local_error)) {
+			g_task_return_error (task, g_steal_pointer (&local_error));
+			return;
+		}
 
-	if (is_installed == GS_APP_QUERY_TRISTATE_TRUE &&
-	    !gs_appstream_add_installed (GS_PLUGIN (self), self->silo, list, cancellable, &local_error)) {
-		g_task_return_error (task, g_steal_pointer (&local_error));
-		return;
-	}
+		if (is_installed == GS_APP_QUERY_TRISTATE_TRUE &&
+		    !gs_appstream_add_installed (GS_PLUGIN (self), silo, list, cancellable, &local_error)) {
+			g_task_return_error (task, g_steal_pointer (&local_error));
+			return;
+		}
 
-	if (deployment_featured != NULL &&
-	    !gs_appstream_add_deployment_featured (self->silo, deployment_featured, list,
-						   cancellable, &local_error)) {
-		g_task_return_error (task, g_steal_pointer (&local_error));
-		return;
-	}
+		if (deployment_featured != NULL &&
+		    !gs_appstream_add_deployment_featured (silo, deployment_featured, list,
+							   cancellable, &local_error)) {
+			g_task_return_error (task, g_steal_pointer (&local_error));
+			return;
+		}
 
-	if (developers != NULL &&
-	    !gs_appstream_search_developer_apps (GS_PLUGIN (self), self->silo, developers, list, cancellable, &local_error)) {
-		g_task_return_error (task, g_steal_pointer (&local_error));
-		return;
-	}
+		if (developers != NULL &&
+		    !gs_appstream_search_developer_apps (GS_PLUGIN (self), silo, developers, list, cancellable, &local_error)) {
+			g_task_return_error (task, g_steal_pointer (&local_error));
+			return;
+		}
 
-	if (keywords != NULL &&
-	    !gs_appstream_search (GS_PLUGIN (self), self->silo, keywords, list, cancellable, &local_error)) {
-		g_task_return_error (task, g_steal_pointer (&local_error));
-		return;
-	}
+		if (keywords != NULL &&
+		    (data->flags & GS_PLUGIN_LIST_APPS_FLAGS_TYPE_AHEAD) &&
+		    !gs_appstream_search_type_ahead (GS_PLUGIN (self), silo, keywords, list, cancellable, &local_error)) {
+			g_task_return_error (task, g_steal_pointer (&local_error));
+			return;
+		}
 
-	if (alternate_of != NULL &&
-	    !gs_appstream_add_alternates (self->silo, alternate_of, list, cancellable, &local_error)) {
-		g_task_return_error (task, g_steal_pointer (&local_error));
-		return;
+		if (keywords != NULL &&
+		    !(data->flags & GS_PLUGIN_LIST_APPS_FLAGS_TYPE_AHEAD) &&
+		    !gs_appstream_search (GS_PLUGIN (self), silo, keywords, list, cancellable, &local_error)) {
+			g_task_return_error (task, g_steal_pointer (&local_error));
+			return;
+		}
+
+		if (alternate_of != NULL &&
+		    !gs_appstream_add_alternates (silo, alternate_of, list, cancellable, &local_error)) {
+			g_task_return_error (task, g_steal_pointer (&local_error));
+			return;
+		}
 	}
 
 	g_task_return_pointer (task, g_steal_pointer (&list), g_object_unref);
@@ -1572,11 +1893,6 @@ gs_plugin_appstream_list_apps_finish (GsPlugin      *plugin,
 	return g_task_propagate_pointer (G_TASK (result), error);
 }
 
-static void refresh_metadata_thread_cb (GTask        *task,
-                                        gpointer      source_object,
-                                        gpointer      task_data,
-                                        GCancellable *cancellable);
-
 static void
 gs_plugin_appstream_refresh_metadata_async (GsPlugin                     *plugin,
                                             guint64                       cache_age_secs,
@@ -1585,35 +1901,16 @@ gs_plugin_appstream_refresh_metadata_async (GsPlugin                     *plugin
                                             GAsyncReadyCallback           callback,
                                             gpointer                      user_data)
 {
-	GsPluginAppstream *self = GS_PLUGIN_APPSTREAM (plugin);
 	g_autoptr(GTask) task = NULL;
-	gboolean interactive = (flags & GS_PLUGIN_REFRESH_METADATA_FLAGS_INTERACTIVE);
 
 	task = g_task_new (plugin, cancellable, callback, user_data);
 	g_task_set_source_tag (task, gs_plugin_appstream_refresh_metadata_async);
 
-	/* Queue a job to check the silo, which will cause it to be refreshed if needed. */
-	gs_worker_thread_queue (self->worker, get_priority_for_interactivity (interactive),
-				refresh_metadata_thread_cb, g_steal_pointer (&task));
-}
-
-/* Run in @worker. */
-static void
-refresh_metadata_thread_cb (GTask        *task,
-                            gpointer      source_object,
-                            gpointer      task_data,
-                            GCancellable *cancellable)
-{
-	GsPluginAppstream *self = GS_PLUGIN_APPSTREAM (source_object);
-	g_autoptr(GError) local_error = NULL;
-
-	assert_in_worker (self);
-
-	/* Checking the silo will refresh it if needed. */
-	if (!gs_plugin_appstream_check_silo (self, cancellable, &local_error))
-		g_task_return_error (task, g_steal_pointer (&local_error));
-	else
-		g_task_return_boolean (task, TRUE);
+	/* Rebuild the out of date silos, or all of them if asked to refresh
+	 * unconditionally. This is done outside @worker, so that queries can
+	 * carry on using the current silos meanwhile. */
+	g_task_set_task_data (task, GINT_TO_POINTER (cache_age_secs == 0), NULL);
+	g_task_run_in_thread (task, rebuild_thread_cb);
 }
 
 static gboolean
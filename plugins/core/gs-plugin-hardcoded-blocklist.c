@@ -32,6 +32,9 @@ gs_plugin_hardcoded_blocklist_init (GsPluginHardcodedBlocklist *self)
 {
 	/* need ID */
 	gs_plugin_add_rule (GS_PLUGIN (self), GS_PLUGIN_RULE_RUN_AFTER, "appstream");
+	gs_plugin_set_refine_flags (GS_PLUGIN (self),
+				    GS_PLUGIN_REFINE_FLAGS_NONE,
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_ID);
 }
 
 static gboolean
@@ -23,17 +23,29 @@
  * It is provided so that each plugin handling icons does not
  * have to handle the download and caching functionality.
  *
+ * The icons for all the apps being refined are fetched together: several
+ * downloads are in flight at once, bounded per server, each distinct URI is
+ * downloaded only once, and the downloaded icons are decoded and scaled in a
+ * separate thread pool so that decoding one doesn’t hold up the next download.
+ *
  * FIXME: This plugin will eventually go away. Currently it only exists as the
  * plugin threading code is a convenient way of ensuring that loading the remote
  * icons happens in a worker thread.
  */
 
+/* Maximum number of icons to download at once, in total and from any one
+ * server. */
+#define MAX_DOWNLOADS 16
+#define MAX_DOWNLOADS_PER_HOST 4
+
 struct _GsPluginIcons
 {
 	GsPlugin	parent;
 
 	SoupSession	*soup_session;  /* (owned) */
 	GsWorkerThread	*worker;  /* (owned) */
+	GThreadPool	*download_pool;  /* (owned) (element-type IconFetch) */
+	GThreadPool	*decode_pool;  /* (owned) (element-type IconFetch) */
 };
 
 G_DEFINE_TYPE (GsPluginIcons, gs_plugin_icons, GS_TYPE_PLUGIN)
@@ -47,6 +59,17 @@ gs_plugin_icons_init (GsPluginIcons *self)
 	/* needs remote icons downloaded */
 	gs_plugin_add_rule (GS_PLUGIN (self), GS_PLUGIN_RULE_RUN_AFTER, "appstream");
 	gs_plugin_add_rule (GS_PLUGIN (self), GS_PLUGIN_RULE_RUN_AFTER, "epiphany");
+	gs_plugin_set_refine_flags (GS_PLUGIN (self),
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON,
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON);
+}
+
+/* The pools are idle by the time this is called, as refining waits for all the
+ * icons it fetches. */
+static void
+gs_plugin_icons_thread_pool_free (GThreadPool *pool)
+{
+	g_thread_pool_free (pool, FALSE, TRUE);
 }
 
 static void
@@ -54,12 +77,19 @@ gs_plugin_icons_dispose (GObject *object)
 {
 	GsPluginIcons *self = GS_PLUGIN_ICONS (object);
 
+	g_clear_pointer (&self->download_pool, gs_plugin_icons_thread_pool_free);
+	g_clear_pointer (&self->decode_pool, gs_plugin_icons_thread_pool_free);
 	g_clear_object (&self->soup_session);
 	g_clear_object (&self->worker);
 
 	G_OBJECT_CLASS (gs_plugin_icons_parent_class)->dispose (object);
 }
 
+static void download_thread_cb (gpointer data,
+                                gpointer user_data);
+static void decode_thread_cb (gpointer data,
+                              gpointer user_data);
+
 static void
 gs_plugin_icons_setup_async (GsPlugin            *plugin,
                              GCancellable        *cancellable,
@@ -72,11 +102,25 @@ gs_plugin_icons_setup_async (GsPlugin            *plugin,
 	task = g_task_new (plugin, cancellable, callback, user_data);
 	g_task_set_source_tag (task, gs_plugin_icons_setup_async);
 
-	self->soup_session = gs_build_soup_session ();
+	/* Like gs_build_soup_session(), but allowing as many connections as
+	 * there can be downloads, overall and from each server. The download
+	 * threads all share it, which libsoup 3 supports since 3.2. */
+	self->soup_session = soup_session_new_with_options ("user-agent", gs_user_agent (),
+							    "timeout", 10,
+							    "max-conns", MAX_DOWNLOADS,
+							    "max-conns-per-host", MAX_DOWNLOADS_PER_HOST,
+							    NULL);
 
 	/* Start up a worker thread to process all the plugin’s function calls. */
 	self->worker = gs_worker_thread_new ("gs-plugin-icons");
 
+	/* Downloads block on the network, and decoding on the CPU, so they
+	 * are sized independently. */
+	self->download_pool = g_thread_pool_new (download_thread_cb, self,
+						 MAX_DOWNLOADS, FALSE, NULL);
+	self->decode_pool = g_thread_pool_new (decode_thread_cb, self,
+					       (gint) g_get_num_processors (), FALSE, NULL);
+
 	g_task_return_boolean (task, TRUE);
 }
 
@@ -118,6 +162,8 @@ shutdown_cb (GObject      *source_object,
 	g_autoptr(GsWorkerThread) worker = NULL;
 	g_autoptr(GError) local_error = NULL;
 
+	g_clear_pointer (&self->download_pool, gs_plugin_icons_thread_pool_free);
+	g_clear_pointer (&self->decode_pool, gs_plugin_icons_thread_pool_free);
 	g_clear_object (&self->soup_session);
 	worker = g_steal_pointer (&self->worker);
 
@@ -137,27 +183,188 @@ gs_plugin_icons_shutdown_finish (GsPlugin      *plugin,
 	return g_task_propagate_boolean (G_TASK (result), error);
 }
 
+/* The icons being fetched by one refine call. */
+typedef struct {
+	GMutex		 mutex;
+	GCond		 cond;
+	guint		 n_pending;  /* (mutex mutex) */
+	GHashTable	*hosts;  /* (mutex mutex) (owned) (element-type utf8 IconHost) */
+	guint		 maximum_icon_size;
+	GCancellable	*cancellable;  /* (nullable) (unowned) */
+} IconBatch;
+
+/* The downloads from one server which haven’t finished yet. */
+typedef struct {
+	GQueue		 queued;  /* (element-type IconFetch) (owned) */
+	guint		 n_active;
+} IconHost;
+
+/* One icon to download and cache. */
+typedef struct {
+	IconBatch	*batch;  /* (unowned) */
+	GsRemoteIcon	*icon;  /* (owned) */
+	gchar		*host;  /* (owned) */
+	GBytes		*data;  /* (owned) (nullable) */
+} IconFetch;
+
+static void
+icon_fetch_free (IconFetch *fetch)
+{
+	g_object_unref (fetch->icon);
+	g_free (fetch->host);
+	g_clear_pointer (&fetch->data, g_bytes_unref);
+	g_free (fetch);
+}
+
+static void
+icon_host_free (IconHost *host)
+{
+	g_queue_clear_full (&host->queued, (GDestroyNotify) icon_fetch_free);
+	g_free (host);
+}
+
+/* Must be called with the batch’s mutex held. */
+static void
+icon_host_start_downloads (GsPluginIcons *self,
+                           IconHost      *host)
+{
+	while (host->n_active < MAX_DOWNLOADS_PER_HOST && !g_queue_is_empty (&host->queued)) {
+		host->n_active++;
+		g_thread_pool_push (self->download_pool, g_queue_pop_head (&host->queued), NULL);
+	}
+}
+
+static void
+icon_fetch_done (IconFetch *fetch)
+{
+	IconBatch *batch = fetch->batch;
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	icon_fetch_free (fetch);
+
+	/* @batch may be freed as soon as this is unlocked */
+	locker = g_mutex_locker_new (&batch->mutex);
+	if (--batch->n_pending == 0)
+		g_cond_signal (&batch->cond);
+}
+
+/* Run in @download_pool. */
+static void
+download_thread_cb (gpointer data,
+                    gpointer user_data)
+{
+	GsPluginIcons *self = GS_PLUGIN_ICONS (user_data);
+	IconFetch *fetch = data;
+	IconBatch *batch = fetch->batch;
+	IconHost *host;
+	g_autoptr(GError) local_error = NULL;
+
+	fetch->data = gs_remote_icon_download (fetch->icon, self->soup_session,
+					       batch->cancellable, &local_error);
+	if (fetch->data == NULL)
+		g_debug ("failed to download icon %s: %s",
+			 gs_remote_icon_get_uri (fetch->icon), local_error->message);
+
+	/* let the next download from this server start */
+	g_mutex_lock (&batch->mutex);
+	host = g_hash_table_lookup (batch->hosts, fetch->host);
+	host->n_active--;
+	icon_host_start_downloads (self, host);
+	g_mutex_unlock (&batch->mutex);
+
+	if (fetch->data != NULL)
+		g_thread_pool_push (self->decode_pool, fetch, NULL);
+	else
+		icon_fetch_done (fetch);
+}
+
+/* Run in @decode_pool. */
+static void
+decode_thread_cb (gpointer data,
+                  gpointer user_data)
+{
+	IconFetch *fetch = data;
+	IconBatch *batch = fetch->batch;
+	g_autoptr(GError) local_error = NULL;
+
+	if (!gs_remote_icon_save_cached (fetch->icon, fetch->data, batch->maximum_icon_size,
+					 batch->cancellable, &local_error))
+		g_debug ("failed to cache icon %s: %s",
+			 gs_remote_icon_get_uri (fetch->icon), local_error->message);
+
+	icon_fetch_done (fetch);
+}
+
 static gboolean
-refine_app (GsPluginIcons        *self,
-            GsApp                *app,
-            GsPluginRefineFlags   flags,
-            GCancellable         *cancellable,
-            GError              **error)
+icon_is_cached (GIcon *icon)
 {
-	guint maximum_icon_size;
+	return g_file_query_exists (g_file_icon_get_file (G_FILE_ICON (icon)), NULL);
+}
+
+/* Downloads the icons in @icons_by_uri which aren’t cached yet, and waits for
+ * them all to be cached. */
+static void
+fetch_icons (GsPluginIcons *self,
+             GHashTable    *icons_by_uri,
+             guint          maximum_icon_size,
+             GCancellable  *cancellable)
+{
+	IconBatch batch = { 0, };
+	GHashTableIter iter;
+	gpointer value;
 
 	assert_in_worker (self);
 
-	/* not required */
-	if ((flags & GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON) == 0)
-		return TRUE;
+	g_mutex_init (&batch.mutex);
+	g_cond_init (&batch.cond);
+	batch.hosts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) icon_host_free);
+	batch.maximum_icon_size = maximum_icon_size;
+	batch.cancellable = cancellable;
+
+	g_mutex_lock (&batch.mutex);
+
+	/* queue up one download for each URI, grouped by server */
+	g_hash_table_iter_init (&iter, icons_by_uri);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		GPtrArray *icons = value;
+		GsRemoteIcon *icon = g_ptr_array_index (icons, 0);
+		g_autoptr(GUri) uri = NULL;
+		IconFetch *fetch;
+		IconHost *host;
+
+		if (icon_is_cached (G_ICON (icon)))
+			continue;
+
+		fetch = g_new0 (IconFetch, 1);
+		fetch->batch = &batch;
+		fetch->icon = g_object_ref (icon);
+		uri = g_uri_parse (gs_remote_icon_get_uri (icon), G_URI_FLAGS_NONE, NULL);
+		fetch->host = g_strdup ((uri != NULL && g_uri_get_host (uri) != NULL) ? g_uri_get_host (uri) : "");
+
+		host = g_hash_table_lookup (batch.hosts, fetch->host);
+		if (host == NULL) {
+			host = g_new0 (IconHost, 1);
+			g_queue_init (&host->queued);
+			g_hash_table_insert (batch.hosts, g_strdup (fetch->host), host);
+		}
+		g_queue_push_tail (&host->queued, fetch);
+		batch.n_pending++;
+	}
 
-	/* Currently a 160px icon is needed for #GsFeatureTile, at most. */
-	maximum_icon_size = 160 * gs_plugin_get_scale (GS_PLUGIN (self));
+	/* start as many downloads as each server allows, and then wait for
+	 * the rest to be started as those finish */
+	g_hash_table_iter_init (&iter, batch.hosts);
+	while (g_hash_table_iter_next (&iter, NULL, &value))
+		icon_host_start_downloads (self, value);
+
+	while (batch.n_pending > 0)
+		g_cond_wait (&batch.cond, &batch.mutex);
 
-	gs_app_ensure_icons_downloaded (app, self->soup_session, maximum_icon_size, cancellable);
+	g_mutex_unlock (&batch.mutex);
 
-	return TRUE;
+	g_hash_table_unref (batch.hosts);
+	g_cond_clear (&batch.cond);
+	g_mutex_clear (&batch.mutex);
 }
 
 static void refine_thread_cb (GTask        *task,
@@ -201,17 +408,60 @@ refine_thread_cb (GTask        *task,
 	GsPluginIcons *self = GS_PLUGIN_ICONS (source_object);
 	GsPluginRefineData *data = task_data;
 	GsAppList *list = data->list;
-	GsPluginRefineFlags flags = data->flags;
-	g_autoptr(GError) local_error = NULL;
+	guint maximum_icon_size;
+	g_autoptr(GHashTable) icons_by_uri = NULL;
+	GHashTableIter iter;
+	gpointer value;
 
 	assert_in_worker (self);
 
+	/* Currently a 160px icon is needed for #GsFeatureTile, at most. */
+	maximum_icon_size = 160 * gs_plugin_get_scale (GS_PLUGIN (self));
+
+	/* group the remote icons by URI, as several apps often share one */
+	icons_by_uri = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) g_ptr_array_unref);
 	for (guint i = 0; i < gs_app_list_length (list); i++) {
 		GsApp *app = gs_app_list_index (list, i);
+		g_autoptr(GPtrArray) icons = gs_app_dup_icons (app);
+
+		for (guint j = 0; icons != NULL && j < icons->len; j++) {
+			GIcon *icon = g_ptr_array_index (icons, j);
+			const gchar *uri;
+			GPtrArray *icons_for_uri;
+
+			/* Only remote icons need to be cached. */
+			if (!GS_IS_REMOTE_ICON (icon))
+				continue;
+
+			uri = gs_remote_icon_get_uri (GS_REMOTE_ICON (icon));
+			icons_for_uri = g_hash_table_lookup (icons_by_uri, uri);
+			if (icons_for_uri == NULL) {
+				icons_for_uri = g_ptr_array_new_with_free_func (g_object_unref);
+				g_hash_table_insert (icons_by_uri, (gpointer) uri, icons_for_uri);
+			}
+			g_ptr_array_add (icons_for_uri, g_object_ref (icon));
+		}
+	}
 
-		if (!refine_app (self, app, flags, cancellable, &local_error)) {
-			g_task_return_error (task, g_steal_pointer (&local_error));
-			return;
+	fetch_icons (self, icons_by_uri, maximum_icon_size, cancellable);
+
+	/* Ensure the dimensions are set on every icon, including the ones
+	 * which shared a download. This only reads the cached files. Icons
+	 * which failed to download are skipped rather than retried. */
+	g_hash_table_iter_init (&iter, icons_by_uri);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		GPtrArray *icons = value;
+
+		for (guint i = 0; i < icons->len; i++) {
+			GsRemoteIcon *icon = g_ptr_array_index (icons, i);
+			g_autoptr(GError) local_error = NULL;
+
+			if (!icon_is_cached (G_ICON (icon)))
+				continue;
+			if (!gs_remote_icon_ensure_cached (icon, self->soup_session, maximum_icon_size,
+							   cancellable, &local_error))
+				g_debug ("failed to cache icon %s: %s",
+					 gs_remote_icon_get_uri (icon), local_error->message);
 		}
 	}
 
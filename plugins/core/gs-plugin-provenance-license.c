@@ -91,6 +91,10 @@ gs_plugin_provenance_license_init (GsPluginProvenanceLicense *self)
 
 	/* need this set */
 	gs_plugin_add_rule (GS_PLUGIN (self), GS_PLUGIN_RULE_RUN_AFTER, "provenance");
+	gs_plugin_set_refine_flags (GS_PLUGIN (self),
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_LICENSE,
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_PROVENANCE |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_ORIGIN);
 }
 
 static void
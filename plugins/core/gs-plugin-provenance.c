@@ -135,6 +135,10 @@ gs_plugin_provenance_init (GsPluginProvenance *self)
 	gs_plugin_add_rule (GS_PLUGIN (self), GS_PLUGIN_RULE_RUN_AFTER, "dummy");
 	gs_plugin_add_rule (GS_PLUGIN (self), GS_PLUGIN_RULE_RUN_AFTER, "packagekit");
 	gs_plugin_add_rule (GS_PLUGIN (self), GS_PLUGIN_RULE_RUN_AFTER, "rpm-ostree");
+	gs_plugin_set_refine_flags (GS_PLUGIN (self),
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_PROVENANCE,
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_ID |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_ORIGIN);
 }
 
 static void
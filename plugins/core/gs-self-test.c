@@ -65,6 +65,301 @@ gs_plugins_core_search_repo_name_func (GsPluginLoader *plugin_loader)
 	g_assert_cmpint (gs_app_get_kind (app), ==, AS_COMPONENT_KIND_DESKTOP_APP);
 }
 
+static void
+gs_plugins_core_search_prefix_func (GsPluginLoader *plugin_loader)
+{
+	const struct {
+		const gchar *keyword;
+		const gchar *expected_id;  /* (nullable) */
+	} vectors[] = {
+		{ "arach", "arachne.desktop" },
+		{ "ARACHNE", "arachne.desktop" },
+		/* stems which differ from the word early on: “flies” and
+		 * the keyword “fly” both stem to “fli” */
+		{ "flies", "arachne.desktop" },
+		{ "fli", "arachne.desktop" },
+		{ "workstation", "org.fedoraproject.fedora-25" },
+		{ "nonexistent", NULL },
+	};
+
+	/* drop all caches */
+	gs_utils_rmtree (g_getenv ("GS_SELF_TEST_CACHEDIR"), NULL);
+	gs_test_reinitialise_plugin_loader (plugin_loader, allowlist, NULL);
+
+	for (gsize i = 0; i < G_N_ELEMENTS (vectors); i++) {
+		g_autoptr(GError) error = NULL;
+		g_autoptr(GsAppList) list = NULL;
+		g_autoptr(GsPluginJob) plugin_job = NULL;
+		g_autoptr(GsAppQuery) query = NULL;
+		const gchar *keywords[2] = { vectors[i].keyword, NULL };
+		gboolean found = FALSE;
+
+		query = gs_app_query_new ("keywords", keywords,
+					  "dedupe-flags", GS_PLUGIN_JOB_DEDUPE_FLAGS_DEFAULT,
+					  NULL);
+		plugin_job = gs_plugin_job_list_apps_new (query, GS_PLUGIN_LIST_APPS_FLAGS_NONE);
+		list = gs_plugin_loader_job_process (plugin_loader, plugin_job, NULL, &error);
+		gs_test_flush_main_context ();
+
+		if (vectors[i].expected_id == NULL) {
+			g_assert_true (list == NULL || gs_app_list_length (list) == 0);
+			continue;
+		}
+
+		g_assert_no_error (error);
+		g_assert_nonnull (list);
+		for (guint j = 0; j < gs_app_list_length (list); j++) {
+			GsApp *app = gs_app_list_index (list, j);
+			if (g_strcmp0 (gs_app_get_id (app), vectors[i].expected_id) == 0)
+				found = TRUE;
+		}
+		g_assert_true (found);
+	}
+}
+
+static void
+gs_plugins_core_search_type_ahead_func (GsPluginLoader *plugin_loader)
+{
+	const struct {
+		const gchar *keyword;
+		const gchar *expected_id;  /* (nullable) */
+	} vectors[] = {
+		{ "ara", "arachne.desktop" },
+		{ "test", "arachne.desktop" },
+		{ "arahne", "arachne.desktop" },
+		{ "fedira", "org.fedoraproject.fedora-25" },
+		/* summaries are only matched by the full search */
+		{ "workstation", NULL },
+		{ "nonexistent", NULL },
+	};
+
+	/* drop all caches */
+	gs_utils_rmtree (g_getenv ("GS_SELF_TEST_CACHEDIR"), NULL);
+	gs_test_reinitialise_plugin_loader (plugin_loader, allowlist, NULL);
+
+	for (gsize i = 0; i < G_N_ELEMENTS (vectors); i++) {
+		g_autoptr(GError) error = NULL;
+		g_autoptr(GsAppList) list = NULL;
+		g_autoptr(GsPluginJob) plugin_job = NULL;
+		g_autoptr(GsAppQuery) query = NULL;
+		const gchar *keywords[2] = { vectors[i].keyword, NULL };
+		gboolean found = FALSE;
+
+		query = gs_app_query_new ("keywords", keywords,
+					  "dedupe-flags", GS_PLUGIN_JOB_DEDUPE_FLAGS_DEFAULT,
+					  NULL);
+		plugin_job = gs_plugin_job_list_apps_new (query, GS_PLUGIN_LIST_APPS_FLAGS_TYPE_AHEAD);
+		list = gs_plugin_loader_job_process (plugin_loader, plugin_job, NULL, &error);
+		gs_test_flush_main_context ();
+
+		if (vectors[i].expected_id == NULL) {
+			g_assert_true (list == NULL || gs_app_list_length (list) == 0);
+			continue;
+		}
+
+		g_assert_no_error (error);
+		g_assert_nonnull (list);
+		for (guint j = 0; j < gs_app_list_length (list); j++) {
+			GsApp *app = gs_app_list_index (list, j);
+			if (g_strcmp0 (gs_app_get_id (app), vectors[i].expected_id) == 0)
+				found = TRUE;
+		}
+		g_assert_true (found);
+	}
+}
+
+typedef struct {
+	GsPlugin *plugin;  /* (unowned) */
+	guint n_rebuilds;
+	gint done;  /* (atomic) */
+	GError *error;  /* (owned) (nullable) */
+} SiloSwapStressData;
+
+static void
+silo_swap_refresh_cb (GObject      *source_object,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+	GAsyncResult **result_out = user_data;
+	*result_out = g_object_ref (result);
+}
+
+static gpointer
+silo_swap_rebuild_thread_cb (gpointer user_data)
+{
+	SiloSwapStressData *data = user_data;
+	GsPluginClass *plugin_class = GS_PLUGIN_GET_CLASS (data->plugin);
+	g_autoptr(GMainContext) context = g_main_context_new ();
+	g_autofree gchar *blobfn = NULL;
+
+	g_main_context_push_thread_default (context);
+	blobfn = gs_utils_get_cache_filename ("appstream", "components.xmlb",
+					      GS_UTILS_CACHE_FLAG_NONE, NULL);
+
+	for (guint i = 0; i < data->n_rebuilds && data->error == NULL; i++) {
+		g_autoptr(GAsyncResult) result = NULL;
+
+		/* make the silo be compiled from scratch each time */
+		if (blobfn != NULL)
+			g_unlink (blobfn);
+
+		plugin_class->refresh_metadata_async (data->plugin, 0,
+						      GS_PLUGIN_REFRESH_METADATA_FLAGS_NONE,
+						      NULL, silo_swap_refresh_cb, &result);
+		while (result == NULL)
+			g_main_context_iteration (context, TRUE);
+		plugin_class->refresh_metadata_finish (data->plugin, result, &data->error);
+	}
+
+	g_main_context_pop_thread_default (context);
+	g_atomic_int_set (&data->done, TRUE);
+
+	return NULL;
+}
+
+static void
+silo_swap_count_waits_cb (const gchar *name,
+                          gint64       begin_usec,
+                          gint64       duration_usec,
+                          gpointer     user_data)
+{
+	gint *n_waits = user_data;
+
+	if (g_strcmp0 (name, "rebuild-wait:appstream") == 0)
+		g_atomic_int_inc (n_waits);
+}
+
+static void
+gs_plugins_core_silo_swap_stress_func (GsPluginLoader *plugin_loader)
+{
+	SiloSwapStressData data = { NULL, };
+	GThread *thread;
+	const gchar *keywords[2] = { "arachne", NULL };
+	guint n_queries = 0;
+	gint n_waits = 0;
+
+	/* drop all caches */
+	gs_utils_rmtree (g_getenv ("GS_SELF_TEST_CACHEDIR"), NULL);
+	gs_test_reinitialise_plugin_loader (plugin_loader, allowlist, NULL);
+
+	/* setup has built the silo, so from now on nothing should wait for
+	 * it to be built */
+	gs_trace_set_span_func (silo_swap_count_waits_cb, &n_waits);
+
+	/* keep rebuilding the silo in the background… */
+	data.plugin = gs_plugin_loader_find_plugin (plugin_loader, "appstream");
+	g_assert_nonnull (data.plugin);
+	data.n_rebuilds = 20;
+	thread = g_thread_new ("silo-swap-stress", silo_swap_rebuild_thread_cb, &data);
+
+	/* …while searching and refining, which should neither fail, nor see a
+	 * half-built silo, nor wait for the rebuilds */
+	do {
+		g_autoptr(GError) error = NULL;
+		g_autoptr(GsApp) app = gs_app_new ("arachne.desktop");
+		g_autoptr(GsAppList) list = NULL;
+		g_autoptr(GsAppList) refined = NULL;
+		g_autoptr(GsAppQuery) query = NULL;
+		g_autoptr(GsPluginJob) search_job = NULL;
+		g_autoptr(GsPluginJob) refine_job = NULL;
+		gboolean found = FALSE;
+
+		query = gs_app_query_new ("keywords", keywords, NULL);
+		search_job = gs_plugin_job_list_apps_new (query, GS_PLUGIN_LIST_APPS_FLAGS_NONE);
+		list = gs_plugin_loader_job_process (plugin_loader, search_job, NULL, &error);
+		gs_test_flush_main_context ();
+		g_assert_no_error (error);
+		g_assert_nonnull (list);
+		for (guint i = 0; i < gs_app_list_length (list); i++) {
+			if (g_strcmp0 (gs_app_get_id (gs_app_list_index (list, i)), "arachne.desktop") == 0)
+				found = TRUE;
+		}
+		g_assert_true (found);
+
+		refine_job = gs_plugin_job_refine_new_for_app (app, GS_PLUGIN_REFINE_FLAGS_NONE);
+		refined = gs_plugin_loader_job_process (plugin_loader, refine_job, NULL, &error);
+		gs_test_flush_main_context ();
+		g_assert_no_error (error);
+		g_assert_nonnull (refined);
+		g_assert_cmpstr (gs_app_get_name (app), ==, "test");
+
+		n_queries += 2;
+	} while (!g_atomic_int_get (&data.done));
+
+	g_thread_join (thread);
+	gs_trace_set_span_func (NULL, NULL);
+	g_assert_no_error (data.error);
+
+	/* the old silos are queried while the new ones are built, so no
+	 * query should have waited on the rebuild lock */
+	g_test_message ("%u queries during %u rebuilds", n_queries, data.n_rebuilds);
+	g_assert_cmpint (g_atomic_int_get (&n_waits), ==, 0);
+}
+
+typedef struct {
+	GMutex mutex;
+	gint64 appstream_end;  /* (mutex mutex) */
+	gint64 icons_begin, icons_end;  /* (mutex mutex) */
+	gint64 blocklist_begin, blocklist_end;  /* (mutex mutex) */
+} RefineSpans;
+
+static void
+refine_spans_cb (const gchar *name,
+                 gint64       begin_usec,
+                 gint64       duration_usec,
+                 gpointer     user_data)
+{
+	RefineSpans *spans = user_data;
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&spans->mutex);
+
+	if (g_strcmp0 (name, "refine:appstream") == 0) {
+		spans->appstream_end = begin_usec + duration_usec;
+	} else if (g_strcmp0 (name, "refine:icons") == 0) {
+		spans->icons_begin = begin_usec;
+		spans->icons_end = begin_usec + duration_usec;
+	} else if (g_strcmp0 (name, "refine:hardcoded-blocklist") == 0) {
+		spans->blocklist_begin = begin_usec;
+		spans->blocklist_end = begin_usec + duration_usec;
+	}
+}
+
+static void
+gs_plugins_core_refine_parallel_func (GsPluginLoader *plugin_loader)
+{
+	const gchar * const refine_allowlist[] = { "appstream", "hardcoded-blocklist", "icons", NULL };
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GsApp) app = gs_app_new ("arachne.desktop");
+	g_autoptr(GsAppList) list = NULL;
+	g_autoptr(GsPluginJob) plugin_job = NULL;
+	RefineSpans spans = { 0, };
+
+	/* both of these run after appstream, and their refine flags don’t
+	 * overlap, so they should be refined at the same time once it has
+	 * finished */
+	gs_test_reinitialise_plugin_loader (plugin_loader, refine_allowlist, NULL);
+	g_mutex_init (&spans.mutex);
+	gs_trace_set_span_func (refine_spans_cb, &spans);
+
+	plugin_job = gs_plugin_job_refine_new_for_app (app, GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON);
+	list = gs_plugin_loader_job_process (plugin_loader, plugin_job, NULL, &error);
+	gs_test_flush_main_context ();
+	gs_trace_set_span_func (NULL, NULL);
+	g_assert_no_error (error);
+	g_assert_nonnull (list);
+
+	g_assert_cmpint (spans.icons_end, >, 0);
+	g_assert_cmpint (spans.blocklist_end, >, 0);
+	g_assert_cmpint (spans.appstream_end, <=, spans.icons_begin);
+	g_assert_cmpint (spans.appstream_end, <=, spans.blocklist_begin);
+
+	/* each started before the other finished */
+	g_assert_cmpint (spans.icons_begin, <=, spans.blocklist_end);
+	g_assert_cmpint (spans.blocklist_begin, <=, spans.icons_end);
+
+	g_mutex_clear (&spans.mutex);
+	gs_test_reinitialise_plugin_loader (plugin_loader, allowlist, NULL);
+}
+
 static void
 gs_plugins_core_os_release_func (GsPluginLoader *plugin_loader)
 {
@@ -234,6 +529,9 @@ main (int argc, char **argv)
 		"    <summary>Test</summary>\n"
 		"    <icon type=\"stock\">system-file-manager</icon>\n"
 		"    <pkgname>arachne</pkgname>\n"
+		"    <keywords>\n"
+		"      <keyword>fly</keyword>\n"
+		"    </keywords>\n"
 		"  </component>\n"
 		"  <component type=\"os-upgrade\">\n"
 		"    <id>org.fedoraproject.fedora-25</id>\n"
@@ -262,6 +560,18 @@ main (int argc, char **argv)
 	g_test_add_data_func ("/gnome-software/plugins/core/search-repo-name",
 			      plugin_loader,
 			      (GTestDataFunc) gs_plugins_core_search_repo_name_func);
+	g_test_add_data_func ("/gnome-software/plugins/core/search-prefix",
+			      plugin_loader,
+			      (GTestDataFunc) gs_plugins_core_search_prefix_func);
+	g_test_add_data_func ("/gnome-software/plugins/core/search-type-ahead",
+			      plugin_loader,
+			      (GTestDataFunc) gs_plugins_core_search_type_ahead_func);
+	g_test_add_data_func ("/gnome-software/plugins/core/silo-swap-stress",
+			      plugin_loader,
+			      (GTestDataFunc) gs_plugins_core_silo_swap_stress_func);
+	g_test_add_data_func ("/gnome-software/plugins/core/refine-parallel",
+			      plugin_loader,
+			      (GTestDataFunc) gs_plugins_core_refine_parallel_func);
 	g_test_add_data_func ("/gnome-software/plugins/core/os-release",
 			      plugin_loader,
 			      (GTestDataFunc) gs_plugins_core_os_release_func);
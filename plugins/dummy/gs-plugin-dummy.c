@@ -27,10 +27,17 @@ struct _GsPluginDummy {
 	GsApp			*cached_origin;
 	GHashTable		*installed_apps;	/* id:1 */
 	GHashTable		*available_apps;	/* id:1 */
+	guint			 n_list_apps_calls;	/* (atomic) */
 };
 
 G_DEFINE_TYPE (GsPluginDummy, gs_plugin_dummy, GS_TYPE_PLUGIN)
 
+typedef enum {
+	PROP_N_LIST_APPS_CALLS = 1,
+} GsPluginDummyProperty;
+
+static GParamSpec *props[PROP_N_LIST_APPS_CALLS + 1] = { NULL, };
+
 /* just flip-flop this every few seconds */
 static gboolean
 gs_plugin_dummy_allow_updates_cb (gpointer user_data)
@@ -59,6 +66,24 @@ gs_plugin_dummy_init (GsPluginDummy *self)
 	gs_plugin_add_rule (plugin, GS_PLUGIN_RULE_RUN_AFTER, "os-release");
 }
 
+static void
+gs_plugin_dummy_get_property (GObject    *object,
+                              guint       prop_id,
+                              GValue     *value,
+                              GParamSpec *pspec)
+{
+	GsPluginDummy *self = GS_PLUGIN_DUMMY (object);
+
+	switch ((GsPluginDummyProperty) prop_id) {
+	case PROP_N_LIST_APPS_CALLS:
+		g_value_set_uint (value, g_atomic_int_get (&self->n_list_apps_calls));
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+		break;
+	}
+}
+
 static void
 gs_plugin_dummy_dispose (GObject *object)
 {
@@ -731,6 +756,9 @@ gs_plugin_dummy_list_apps_async (GsPlugin              *plugin,
 	task = g_task_new (plugin, cancellable, callback, user_data);
 	g_task_set_source_tag (task, gs_plugin_dummy_list_apps_async);
 
+	/* so the self tests can check which queries reach the plugin */
+	g_atomic_int_inc (&self->n_list_apps_calls);
+
 	if (query != NULL) {
 		released_since = gs_app_query_get_released_since (query);
 		is_curated = gs_app_query_get_is_curated (query);
@@ -1083,6 +1111,7 @@ gs_plugin_dummy_class_init (GsPluginDummyClass *klass)
 	GObjectClass *object_class = G_OBJECT_CLASS (klass);
 	GsPluginClass *plugin_class = GS_PLUGIN_CLASS (klass);
 
+	object_class->get_property = gs_plugin_dummy_get_property;
 	object_class->dispose = gs_plugin_dummy_dispose;
 
 	plugin_class->setup_async = gs_plugin_dummy_setup_async;
@@ -1095,6 +1124,19 @@ gs_plugin_dummy_class_init (GsPluginDummyClass *klass)
 	plugin_class->refresh_metadata_finish = gs_plugin_dummy_refresh_metadata_finish;
 	plugin_class->list_distro_upgrades_async = gs_plugin_dummy_list_distro_upgrades_async;
 	plugin_class->list_distro_upgrades_finish = gs_plugin_dummy_list_distro_upgrades_finish;
+
+	/**
+	 * GsPluginDummy:n-list-apps-calls:
+	 *
+	 * Number of times #GsPluginClass.list_apps_async has been called on
+	 * the plugin. This is only for use by the self tests.
+	 */
+	props[PROP_N_LIST_APPS_CALLS] =
+		g_param_spec_uint ("n-list-apps-calls", NULL, NULL,
+				   0, G_MAXUINT, 0,
+				   G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+	g_object_class_install_properties (object_class, G_N_ELEMENTS (props), props);
 }
 
 GType
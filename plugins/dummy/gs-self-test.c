@@ -495,6 +495,91 @@ gs_plugins_dummy_search_alternate_func (GsPluginLoader *plugin_loader)
 	g_assert_cmpint (gs_app_get_kind (app_tmp), ==, AS_COMPONENT_KIND_DESKTOP_APP);
 }
 
+static void
+async_result_cb (GObject      *source_object,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+	GAsyncResult **result_out = user_data;
+
+	*result_out = g_object_ref (result);
+}
+
+static void
+gs_plugins_dummy_list_apps_cache_func (GsPluginLoader *plugin_loader)
+{
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GsAppList) list1 = NULL;
+	g_autoptr(GsAppList) list2 = NULL;
+	g_autoptr(GsAppList) list3 = NULL;
+	g_autoptr(GsAppQuery) query1 = NULL;
+	g_autoptr(GsAppQuery) query2 = NULL;
+	g_autoptr(GsPluginJob) plugin_job1 = NULL;
+	g_autoptr(GsPluginJob) plugin_job2 = NULL;
+	g_autoptr(GsPluginJob) plugin_job3 = NULL;
+	g_autoptr(GAsyncResult) result1 = NULL;
+	g_autoptr(GAsyncResult) result2 = NULL;
+	const gchar *keywords[2] = { "zeus", NULL };
+	GsPlugin *plugin = gs_plugin_loader_find_plugin (plugin_loader, "dummy");
+	guint n_calls_start, n_calls;
+
+	/* the search test has already run the same query */
+	gs_plugin_loader_clear_caches (plugin_loader);
+	g_object_get (plugin, "n-list-apps-calls", &n_calls_start, NULL);
+
+	/* run two equivalent queries at the same time, which differ only in
+	 * how the results are sorted and truncated */
+	query1 = gs_app_query_new ("keywords", keywords,
+				   "refine-flags", GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON,
+				   "dedupe-flags", GS_PLUGIN_JOB_DEDUPE_FLAGS_DEFAULT,
+				   "sort-func", gs_utils_app_sort_match_value,
+				   NULL);
+	query2 = gs_app_query_new ("keywords", keywords,
+				   "refine-flags", GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON,
+				   "dedupe-flags", GS_PLUGIN_JOB_DEDUPE_FLAGS_DEFAULT,
+				   "sort-func", gs_utils_app_sort_match_value,
+				   "max-results", 1,
+				   NULL);
+	plugin_job1 = gs_plugin_job_list_apps_new (query1, GS_PLUGIN_LIST_APPS_FLAGS_NONE);
+	plugin_job2 = gs_plugin_job_list_apps_new (query2, GS_PLUGIN_LIST_APPS_FLAGS_INTERACTIVE);
+	gs_plugin_loader_job_process_async (plugin_loader, plugin_job1, NULL, async_result_cb, &result1);
+	gs_plugin_loader_job_process_async (plugin_loader, plugin_job2, NULL, async_result_cb, &result2);
+
+	while (result1 == NULL || result2 == NULL)
+		g_main_context_iteration (NULL, TRUE);
+
+	list1 = gs_plugin_loader_job_process_finish (plugin_loader, result1, &error);
+	g_assert_no_error (error);
+	g_assert_nonnull (list1);
+	list2 = gs_plugin_loader_job_process_finish (plugin_loader, result2, &error);
+	g_assert_no_error (error);
+	g_assert_nonnull (list2);
+
+	g_assert_cmpint (gs_app_list_length (list1), >=, 1);
+	g_assert_cmpint (gs_app_list_length (list2), ==, 1);
+	g_assert_true (gs_app_list_index (list1, 0) == gs_app_list_index (list2, 0));
+	g_assert_cmpstr (gs_app_get_id (gs_app_list_index (list1, 0)), ==, "zeus.desktop");
+
+	/* both jobs were served by a single call into the plugin */
+	g_object_get (plugin, "n-list-apps-calls", &n_calls, NULL);
+	g_assert_cmpuint (n_calls - n_calls_start, ==, 1);
+
+	/* the results are still there after the cache is dropped, and are
+	 * fetched from the plugin again */
+	gs_plugin_loader_clear_caches (plugin_loader);
+
+	plugin_job3 = gs_plugin_job_list_apps_new (query1, GS_PLUGIN_LIST_APPS_FLAGS_NONE);
+	list3 = gs_plugin_loader_job_process (plugin_loader, plugin_job3, NULL, &error);
+	gs_test_flush_main_context ();
+	g_assert_no_error (error);
+	g_assert_nonnull (list3);
+	g_assert_cmpint (gs_app_list_length (list3), ==, gs_app_list_length (list1));
+	g_assert_cmpstr (gs_app_get_id (gs_app_list_index (list3, 0)), ==, "zeus.desktop");
+
+	g_object_get (plugin, "n-list-apps-calls", &n_calls, NULL);
+	g_assert_cmpuint (n_calls - n_calls_start, ==, 2);
+}
+
 static void
 gs_plugins_dummy_url_to_app_func (GsPluginLoader *plugin_loader)
 {
@@ -927,6 +1012,9 @@ main (int argc, char **argv)
 	g_test_add_data_func ("/gnome-software/plugins/dummy/search-alternate",
 			      plugin_loader,
 			      (GTestDataFunc) gs_plugins_dummy_search_alternate_func);
+	g_test_add_data_func ("/gnome-software/plugins/dummy/list-apps-cache",
+			      plugin_loader,
+			      (GTestDataFunc) gs_plugins_dummy_list_apps_cache_func);
 	g_test_add_data_func ("/gnome-software/plugins/dummy/url-to-app",
 			      plugin_loader,
 			      (GTestDataFunc) gs_plugins_dummy_url_to_app_func);
@@ -0,0 +1,341 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2018 Richard Hughes <richard@hughsie.com>
+ * Copyright (C) 2018 Kalev Lember <klember@redhat.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+/*
+ * The progress bookkeeping for a #GsFlatpakTransaction, kept apart from
+ * libflatpak so that it can be tested on its own.
+ *
+ * Ops are identified by their index: the ops which are run come first, in the
+ * order they’re run, followed by the skipped ops which are only reachable as
+ * related-to ops. The transitive closure of the related-to relation is
+ * computed once, as a bitset per op, along with the total download size of
+ * the ops related to each op. The part of that total for the ops which have
+ * already been run is then kept up to date as the transaction advances, so
+ * each progress tick only costs O(1) per app to update.
+ */
+
+#include "config.h"
+
+#include "gs-flatpak-progress.h"
+
+#define BITS_PER_WORD (sizeof (gulong) * 8)
+
+struct _GsFlatpakProgress {
+	guint		 n_ops;
+	guint		 n_listed_ops;
+	guint		 n_started_ops;
+	gsize		 n_bitset_words;
+	guint64		*download_sizes;	/* (owned) per op */
+	gboolean	*skipped;		/* (owned) per op */
+	GArray		**related_to_ops;	/* (owned) per op, (element-type guint) (nullable) */
+	gulong		*related_to_bitsets;	/* (owned) per op, the ops it is transitively related to, including itself */
+	guint64		*related_bytes;		/* (owned) per op, the download size of all the ops related to it */
+	guint64		*related_prior_bytes;	/* (owned) per op, the part of related_bytes for ops run before the current one */
+
+	/* for rate limiting in gs_flatpak_progress_tick() */
+	gint		 last_tick_op;
+	gint64		 last_tick_usec;
+};
+
+static guint64
+saturated_uint64_add (guint64 a, guint64 b)
+{
+	return (a <= G_MAXUINT64 - b) ? a + b : G_MAXUINT64;
+}
+
+/* Returns the index of the next bit set in @bits after @prev, or -1 */
+static gint
+bitset_next (const gulong *bits,
+             gsize         n_words,
+             gint          prev)
+{
+	gsize start = prev + 1;
+
+	for (gsize w = start / BITS_PER_WORD; w < n_words; w++) {
+		gint nth_bit = (w == start / BITS_PER_WORD) ? (gint) (start % BITS_PER_WORD) - 1 : -1;
+		gint bit = g_bit_nth_lsf (bits[w], nth_bit);
+
+		if (bit >= 0)
+			return w * BITS_PER_WORD + bit;
+	}
+
+	return -1;
+}
+
+/**
+ * gs_flatpak_progress_new:
+ * @n_ops: number of ops in the transaction, including skipped ones
+ * @n_listed_ops: number of ops which will be run, which come first
+ *
+ * Returns: (transfer full): a new #GsFlatpakProgress; set up the ops with
+ *    gs_flatpak_progress_set_op() and gs_flatpak_progress_add_related_to(),
+ *    then call gs_flatpak_progress_compute()
+ */
+GsFlatpakProgress *
+gs_flatpak_progress_new (guint n_ops,
+                         guint n_listed_ops)
+{
+	GsFlatpakProgress *self;
+
+	g_return_val_if_fail (n_listed_ops <= n_ops, NULL);
+
+	self = g_new0 (GsFlatpakProgress, 1);
+	self->n_ops = n_ops;
+	self->n_listed_ops = n_listed_ops;
+	self->n_bitset_words = MAX (1, (n_ops + BITS_PER_WORD - 1) / BITS_PER_WORD);
+	self->download_sizes = g_new0 (guint64, n_ops);
+	self->skipped = g_new0 (gboolean, n_ops);
+	self->related_to_ops = g_new0 (GArray *, n_ops);
+	self->related_to_bitsets = g_new0 (gulong, n_ops * self->n_bitset_words);
+	self->related_bytes = g_new0 (guint64, n_ops);
+	self->related_prior_bytes = g_new0 (guint64, n_ops);
+	self->last_tick_op = -1;
+
+	return self;
+}
+
+void
+gs_flatpak_progress_free (GsFlatpakProgress *self)
+{
+	for (guint i = 0; i < self->n_ops; i++)
+		g_clear_pointer (&self->related_to_ops[i], g_array_unref);
+	g_free (self->related_to_ops);
+	g_free (self->download_sizes);
+	g_free (self->skipped);
+	g_free (self->related_to_bitsets);
+	g_free (self->related_bytes);
+	g_free (self->related_prior_bytes);
+	g_free (self);
+}
+
+void
+gs_flatpak_progress_set_op (GsFlatpakProgress *self,
+                            guint              op,
+                            guint64            download_size,
+                            gboolean           is_skipped)
+{
+	g_return_if_fail (op < self->n_ops);
+
+	self->download_sizes[op] = download_size;
+	self->skipped[op] = is_skipped;
+}
+
+void
+gs_flatpak_progress_add_related_to (GsFlatpakProgress *self,
+                                    guint              op,
+                                    guint              related_to_op)
+{
+	g_return_if_fail (op < self->n_ops);
+	g_return_if_fail (related_to_op < self->n_ops);
+
+	if (self->related_to_ops[op] == NULL)
+		self->related_to_ops[op] = g_array_new (FALSE, FALSE, sizeof (guint));
+	g_array_append_val (self->related_to_ops[op], related_to_op);
+}
+
+/* Fills in the related-to bitset for op @i from those of its related-to ops,
+ * computing each at most once. @state is 0 for ops not visited yet, 1 while
+ * visiting (which stops cycles) and 2 once done. */
+static const gulong *
+compute_related_to_bitset (GsFlatpakProgress *self,
+                           guint              i,
+                           guint8            *state)
+{
+	gulong *bits = self->related_to_bitsets + i * self->n_bitset_words;
+	GArray *related_to_ops = self->related_to_ops[i];
+
+	if (state[i] != 0)
+		return bits;
+	state[i] = 1;
+
+	bits[i / BITS_PER_WORD] |= 1UL << (i % BITS_PER_WORD);
+
+	for (guint j = 0; related_to_ops != NULL && j < related_to_ops->len; j++) {
+		const gulong *related_bits;
+
+		related_bits = compute_related_to_bitset (self, g_array_index (related_to_ops, guint, j), state);
+		for (gsize w = 0; w < self->n_bitset_words; w++)
+			bits[w] |= related_bits[w];
+	}
+
+	state[i] = 2;
+	return bits;
+}
+
+/* Adds the download size of the listed op @i to the byte totals of every op
+ * it’s related to. Each op’s own size doesn’t count towards its total if it’s
+ * skipped. */
+static void
+add_op_download_size (GsFlatpakProgress *self,
+                      guint              i,
+                      guint64           *totals)
+{
+	const gulong *bits = self->related_to_bitsets + i * self->n_bitset_words;
+
+	for (gint r = bitset_next (bits, self->n_bitset_words, -1); r >= 0;
+	     r = bitset_next (bits, self->n_bitset_words, r)) {
+		if ((guint) r == i && self->skipped[i])
+			continue;
+		totals[r] = saturated_uint64_add (totals[r], self->download_sizes[i]);
+	}
+}
+
+/**
+ * gs_flatpak_progress_compute:
+ * @self: a #GsFlatpakProgress
+ *
+ * Computes the related-to closures and the byte totals, once all the ops
+ * have been set up.
+ */
+void
+gs_flatpak_progress_compute (GsFlatpakProgress *self)
+{
+	g_autofree guint8 *state = g_new0 (guint8, self->n_ops);
+
+	for (guint i = 0; i < self->n_ops; i++)
+		compute_related_to_bitset (self, i, state);
+	for (guint i = 0; i < self->n_listed_ops; i++)
+		add_op_download_size (self, i, self->related_bytes);
+}
+
+/**
+ * gs_flatpak_progress_advance_to:
+ * @self: a #GsFlatpakProgress
+ * @op: the listed op which has just been started
+ *
+ * Adds the ops which were run before @op to the prior byte totals of the ops
+ * they’re related to. Each op is only added once, however many times this is
+ * called.
+ */
+void
+gs_flatpak_progress_advance_to (GsFlatpakProgress *self,
+                                guint              op)
+{
+	if (op >= self->n_listed_ops)
+		return;
+
+	for (; self->n_started_ops < op; self->n_started_ops++)
+		add_op_download_size (self, self->n_started_ops, self->related_prior_bytes);
+}
+
+/**
+ * gs_flatpak_progress_next_related_to:
+ * @self: a #GsFlatpakProgress
+ * @op: an op
+ * @prev: the previous result, or -1 to start
+ *
+ * Iterates over the ops which @op is transitively related to, including @op
+ * itself, in index order.
+ *
+ * Returns: the next op, or -1 once there are no more
+ */
+gint
+gs_flatpak_progress_next_related_to (GsFlatpakProgress *self,
+                                     guint              op,
+                                     gint               prev)
+{
+	g_return_val_if_fail (op < self->n_ops, -1);
+
+	return bitset_next (self->related_to_bitsets + op * self->n_bitset_words,
+			    self->n_bitset_words, prev);
+}
+
+guint64
+gs_flatpak_progress_get_related_bytes (GsFlatpakProgress *self,
+                                       guint              op)
+{
+	g_return_val_if_fail (op < self->n_ops, 0);
+	return self->related_bytes[op];
+}
+
+guint64
+gs_flatpak_progress_get_related_prior_bytes (GsFlatpakProgress *self,
+                                             guint              op)
+{
+	g_return_val_if_fail (op < self->n_ops, 0);
+	return self->related_prior_bytes[op];
+}
+
+/**
+ * gs_flatpak_progress_get_percent:
+ * @self: a #GsFlatpakProgress
+ * @root_op: the op to calculate the progress for
+ * @bytes_transferred: bytes transferred so far by the op being run
+ *
+ * Calculates the progress of @root_op from the sum of the progress of all
+ * the ops related to it, so the progress for an app factors in the progress
+ * for all its runtimes.
+ *
+ * Returns: the progress, as a percentage
+ */
+guint
+gs_flatpak_progress_get_percent (GsFlatpakProgress *self,
+                                 guint              root_op,
+                                 guint64            bytes_transferred)
+{
+	guint64 related_prior_bytes;
+	guint64 related_bytes;
+
+	g_return_val_if_fail (root_op < self->n_ops, 0);
+
+	related_prior_bytes = self->related_prior_bytes[root_op];
+	related_bytes = self->related_bytes[root_op];
+	g_assert (related_prior_bytes <= related_bytes);
+
+	/* Avoid overflows when converting to percent, at the cost of losing
+	 * some precision in the least significant digits. */
+	if (related_prior_bytes > G_MAXUINT64 / 100 ||
+	    bytes_transferred > G_MAXUINT64 / 100) {
+		related_prior_bytes /= 100;
+		bytes_transferred /= 100;
+		related_bytes /= 100;
+	}
+
+	if (related_bytes == 0)
+		return 0;
+	return (related_prior_bytes * 100 / related_bytes) +
+	       (bytes_transferred * 100 / related_bytes);
+}
+
+/**
+ * gs_flatpak_progress_tick:
+ * @self: a #GsFlatpakProgress
+ * @op: the op being run, or -1 if it isn’t part of the transaction
+ * @op_name: name of the op, for the warning if @op is -1
+ * @bytes_transferred: bytes transferred so far by @op
+ * @now_usec: the current monotonic time
+ *
+ * Decides whether a progress tick for @op should update the apps it’s related
+ * to. Ticks less than %GS_FLATPAK_PROGRESS_UPDATE_INTERVAL_USEC after the
+ * last one are dropped, unless they’re for a different op or @op has just
+ * finished downloading, so the progress never lags at the end of an op.
+ *
+ * Returns: %TRUE if the apps related to @op should be updated
+ */
+gboolean
+gs_flatpak_progress_tick (GsFlatpakProgress *self,
+                          gint               op,
+                          const gchar       *op_name,
+                          guint64            bytes_transferred,
+                          gint64             now_usec)
+{
+	if (op < 0 || (guint) op >= self->n_ops) {
+		g_warning ("Couldn't find transaction operation %s", op_name);
+		return FALSE;
+	}
+
+	if (op == self->last_tick_op &&
+	    now_usec - self->last_tick_usec < GS_FLATPAK_PROGRESS_UPDATE_INTERVAL_USEC &&
+	    bytes_transferred < self->download_sizes[op])
+		return FALSE;
+
+	self->last_tick_op = op;
+	self->last_tick_usec = now_usec;
+	return TRUE;
+}
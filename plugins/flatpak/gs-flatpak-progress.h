@@ -0,0 +1,54 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ * vi:set noexpandtab tabstop=8 shiftwidth=8:
+ *
+ * Copyright (C) 2018 Richard Hughes <richard@hughsie.com>
+ * Copyright (C) 2018 Kalev Lember <klember@redhat.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The shortest time between two progress updates for the same op, so that a
+ * long transaction doesn’t flood the apps involved with notifications */
+#define GS_FLATPAK_PROGRESS_UPDATE_INTERVAL_USEC	(250 * 1000)
+
+typedef struct _GsFlatpakProgress GsFlatpakProgress;
+
+GsFlatpakProgress	*gs_flatpak_progress_new		(guint			 n_ops,
+								 guint			 n_listed_ops);
+void			 gs_flatpak_progress_free		(GsFlatpakProgress	*self);
+void			 gs_flatpak_progress_set_op		(GsFlatpakProgress	*self,
+								 guint			 op,
+								 guint64		 download_size,
+								 gboolean		 is_skipped);
+void			 gs_flatpak_progress_add_related_to	(GsFlatpakProgress	*self,
+								 guint			 op,
+								 guint			 related_to_op);
+void			 gs_flatpak_progress_compute		(GsFlatpakProgress	*self);
+void			 gs_flatpak_progress_advance_to		(GsFlatpakProgress	*self,
+								 guint			 op);
+gint			 gs_flatpak_progress_next_related_to	(GsFlatpakProgress	*self,
+								 guint			 op,
+								 gint			 prev);
+guint64			 gs_flatpak_progress_get_related_bytes	(GsFlatpakProgress	*self,
+								 guint			 op);
+guint64			 gs_flatpak_progress_get_related_prior_bytes
+								(GsFlatpakProgress	*self,
+								 guint			 op);
+guint			 gs_flatpak_progress_get_percent	(GsFlatpakProgress	*self,
+								 guint			 root_op,
+								 guint64		 bytes_transferred);
+gboolean		 gs_flatpak_progress_tick		(GsFlatpakProgress	*self,
+								 gint			 op,
+								 const gchar		*op_name,
+								 guint64		 bytes_transferred,
+								 gint64			 now_usec);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GsFlatpakProgress, gs_flatpak_progress_free)
+
+G_END_DECLS
@@ -10,12 +10,20 @@
 #include <config.h>
 
 #include "gs-flatpak-app.h"
+#include "gs-flatpak-progress.h"
 #include "gs-flatpak-transaction.h"
 
 struct _GsFlatpakTransaction {
 	FlatpakTransaction	 parent_instance;
 	GHashTable		*refhash;	/* ref:GsApp */
 	GError			*first_operation_error;
+
+	/* Progress bookkeeping, set up in _transaction_ready(). Ops are
+	 * indexed in the order they are run, followed by the skipped ops
+	 * which are only reachable as related-to ops. */
+	GPtrArray		*progress_ops;		/* (element-type FlatpakTransactionOperation) (owned) (nullable) */
+	GHashTable		*progress_op_indices;	/* (element-type FlatpakTransactionOperation guint) (owned) (nullable) */
+	GsFlatpakProgress	*progress;		/* (owned) (nullable) */
 };
 
 enum {
@@ -27,6 +35,14 @@ static guint signals[LAST_SIGNAL] = { 0 };
 
 G_DEFINE_TYPE (GsFlatpakTransaction, gs_flatpak_transaction, FLATPAK_TYPE_TRANSACTION)
 
+static void
+clear_progress_ops (GsFlatpakTransaction *self)
+{
+	g_clear_pointer (&self->progress_ops, g_ptr_array_unref);
+	g_clear_pointer (&self->progress_op_indices, g_hash_table_unref);
+	g_clear_pointer (&self->progress, gs_flatpak_progress_free);
+}
+
 static void
 gs_flatpak_transaction_finalize (GObject *object)
 {
@@ -38,6 +54,7 @@ gs_flatpak_transaction_finalize (GObject *object)
 	g_hash_table_unref (self->refhash);
 	if (self->first_operation_error != NULL)
 		g_error_free (self->first_operation_error);
+	clear_progress_ops (self);
 
 	G_OBJECT_CLASS (gs_flatpak_transaction_parent_class)->finalize (object);
 }
@@ -128,6 +145,100 @@ gs_flatpak_transaction_run (FlatpakTransaction *transaction,
 	return TRUE;
 }
 
+/* Returns the index of @op in the progress bookkeeping, or -1 if it’s not
+ * part of the transaction. */
+static gint
+progress_op_index (GsFlatpakTransaction        *self,
+                   FlatpakTransactionOperation *op)
+{
+	gpointer value;
+
+	if (self->progress_op_indices == NULL ||
+	    !g_hash_table_lookup_extended (self->progress_op_indices, op, NULL, &value))
+		return -1;
+
+	return GPOINTER_TO_INT (value);
+}
+
+static void
+add_progress_op (GsFlatpakTransaction        *self,
+                 FlatpakTransactionOperation *op)
+{
+	g_hash_table_insert (self->progress_op_indices, op, GUINT_TO_POINTER (self->progress_ops->len));
+	g_ptr_array_add (self->progress_ops, g_object_ref (op));
+}
+
+/* Adds the related-to ops of @op which aren’t indexed yet, recursively. */
+static void
+add_related_progress_ops (GsFlatpakTransaction        *self,
+                          FlatpakTransactionOperation *op)
+{
+	GPtrArray *related_to_ops = flatpak_transaction_operation_get_related_to_ops (op);
+
+	for (gsize i = 0; related_to_ops != NULL && i < related_to_ops->len; i++) {
+		FlatpakTransactionOperation *related_to_op = g_ptr_array_index (related_to_ops, i);
+
+		if (progress_op_index (self, related_to_op) >= 0)
+			continue;
+		add_progress_op (self, related_to_op);
+		add_related_progress_ops (self, related_to_op);
+	}
+}
+
+/* Indexes the ops for the #GsFlatpakProgress, which precomputes what
+ * update_progress_for_op() needs so that progress updates don’t have to walk
+ * the related-to graph of the whole transaction. */
+static void
+setup_progress_ops (GsFlatpakTransaction *self,
+                    GList                *ops)
+{
+	guint n_listed_ops;
+
+	clear_progress_ops (self);
+
+	self->progress_ops = g_ptr_array_new_with_free_func (g_object_unref);
+	self->progress_op_indices = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+	/* This relies on ops in a #FlatpakTransaction being run in the order
+	 * they’re returned by flatpak_transaction_get_operations(), which is true. */
+	for (GList *l = ops; l != NULL; l = l->next)
+		add_progress_op (self, l->data);
+	n_listed_ops = self->progress_ops->len;
+
+	/* Skipped ops aren’t returned by flatpak_transaction_get_operations(),
+	 * but can be reached through flatpak_transaction_operation_get_related_to_ops(). */
+	for (guint i = 0; i < n_listed_ops; i++)
+		add_related_progress_ops (self, g_ptr_array_index (self->progress_ops, i));
+
+	self->progress = gs_flatpak_progress_new (self->progress_ops->len, n_listed_ops);
+	for (guint i = 0; i < self->progress_ops->len; i++) {
+		FlatpakTransactionOperation *op = g_ptr_array_index (self->progress_ops, i);
+		GPtrArray *related_to_ops = flatpak_transaction_operation_get_related_to_ops (op);
+
+		gs_flatpak_progress_set_op (self->progress, i,
+					    flatpak_transaction_operation_get_download_size (op),
+					    flatpak_transaction_operation_get_is_skipped (op));
+		for (gsize j = 0; related_to_ops != NULL && j < related_to_ops->len; j++)
+			gs_flatpak_progress_add_related_to (self->progress, i,
+							    progress_op_index (self, g_ptr_array_index (related_to_ops, j)));
+	}
+	gs_flatpak_progress_compute (self->progress);
+}
+
+/* Adds the ops which were run before @op to the prior byte totals of the ops
+ * they’re related to. */
+static void
+advance_progress_to_op (GsFlatpakTransaction        *self,
+                        FlatpakTransactionOperation *op)
+{
+	gint index = progress_op_index (self, op);
+
+	if (self->progress == NULL || index < 0)
+		return;
+
+	gs_flatpak_progress_advance_to (self->progress, index);
+}
+
 static gboolean
 _transaction_ready (FlatpakTransaction *transaction)
 {
@@ -175,6 +286,9 @@ _transaction_ready (FlatpakTransaction *transaction)
 			g_debug ("%s", debug_message->str);
 		}
 	}
+
+	setup_progress_ops (self, ops);
+
 	return TRUE;
 }
 
@@ -196,63 +310,26 @@ progress_data_free (ProgressData *data)
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (ProgressData, progress_data_free)
 
-static gboolean
-op_is_related_to_op (FlatpakTransactionOperation *op,
-                     FlatpakTransactionOperation *root_op)
-{
-	GPtrArray *related_to_ops;  /* (element-type FlatpakTransactionOperation) */
-
-	if (op == root_op)
-		return TRUE;
-
-	related_to_ops = flatpak_transaction_operation_get_related_to_ops (op);
-	for (gsize i = 0; related_to_ops != NULL && i < related_to_ops->len; i++) {
-		FlatpakTransactionOperation *related_to_op = g_ptr_array_index (related_to_ops, i);
-		if (related_to_op == root_op || op_is_related_to_op (related_to_op, root_op))
-			return TRUE;
-	}
-
-	return FALSE;
-}
-
-static guint64
-saturated_uint64_add (guint64 a, guint64 b)
-{
-	return (a <= G_MAXUINT64 - b) ? a + b : G_MAXUINT64;
-}
-
 /*
  * update_progress_for_op:
  * @self: a #GsFlatpakTransaction
- * @current_progress: progress reporting object
- * @ops: results of calling flatpak_transaction_get_operations() on @self, for performance
- * @current_op: the #FlatpakTransactionOperation which the @current_progress is
- *    for; this is the operation currently being run by libflatpak
- * @root_op: the #FlatpakTransactionOperation at the root of the operation subtree
- *    to calculate progress for
+ * @current_progress: progress reporting object for the operation currently
+ *    being run by libflatpak
+ * @root_index: index of the #FlatpakTransactionOperation at the root of the
+ *    operation subtree to calculate progress for
  *
- * Calculate and update the #GsApp:progress for each app associated with
- * @root_op in a flatpak transaction. This will include the #GsApp for the app
- * being installed (for example), but also the #GsApps for all of its runtimes
- * and locales, and any other dependencies of them.
+ * Calculate and update the #GsApp:progress for the app associated with the
+ * op at @root_index in a flatpak transaction.
  *
- * Each #GsApp:progress is calculated based on the sum of the progress of all
- * the apps related to that one — so the progress for an app will factor in the
- * progress for all its runtimes.
+ * The #GsApp:progress is calculated by gs_flatpak_progress_get_percent().
  */
 static void
 update_progress_for_op (GsFlatpakTransaction        *self,
                         FlatpakTransactionProgress  *current_progress,
-                        GList                       *ops,
-                        FlatpakTransactionOperation *current_op,
-                        FlatpakTransactionOperation *root_op)
+                        guint                        root_index)
 {
+	FlatpakTransactionOperation *root_op = g_ptr_array_index (self->progress_ops, root_index);
 	g_autoptr(GsApp) root_app = NULL;
-	guint64 related_prior_download_bytes = 0;
-	guint64 related_download_bytes = 0;
-	guint64 current_bytes_transferred = flatpak_transaction_progress_get_bytes_transferred (current_progress);
-	gboolean seen_current_op = FALSE, seen_root_op = FALSE;
-	gboolean root_op_skipped = flatpak_transaction_operation_get_is_skipped (root_op);
 	guint percent;
 
 	/* If @root_op is being skipped and its GsApp isn't being
@@ -260,7 +337,7 @@ update_progress_for_op (GsFlatpakTransaction        *self,
 	 * @root_op is the runtime of an app and the app is the thing the
 	 * transaction was created for.
 	 */
-	if (root_op_skipped) {
+	if (flatpak_transaction_operation_get_is_skipped (root_op)) {
 		/* _transaction_operation_set_app() is only called on non-skipped ops */
 		const gchar *ref = flatpak_transaction_operation_get_ref (root_op);
 		root_app = _ref_to_app (self, ref);
@@ -282,49 +359,9 @@ update_progress_for_op (GsFlatpakTransaction        *self,
 		root_app = g_object_ref (unskipped_root_app);
 	}
 
-	/* This relies on ops in a #FlatpakTransaction being run in the order
-	 * they’re returned by flatpak_transaction_get_operations(), which is true. */
-	for (GList *l = ops; l != NULL; l = l->next) {
-		FlatpakTransactionOperation *op = FLATPAK_TRANSACTION_OPERATION (l->data);
-		guint64 op_download_size = flatpak_transaction_operation_get_download_size (op);
-
-		if (op == current_op)
-			seen_current_op = TRUE;
-		if (op == root_op)
-			seen_root_op = TRUE;
-
-		/* Currently libflatpak doesn't return skipped ops in
-		 * flatpak_transaction_get_operations(), but check just in case.
-		 */
-		if (op == root_op && root_op_skipped)
-			continue;
-
-		if (op_is_related_to_op (op, root_op)) {
-			/* Saturate instead of overflowing */
-			related_download_bytes = saturated_uint64_add (related_download_bytes, op_download_size);
-			if (!seen_current_op)
-				related_prior_download_bytes = saturated_uint64_add (related_prior_download_bytes, op_download_size);
-		}
-	}
-
-	g_assert (related_prior_download_bytes <= related_download_bytes);
-	g_assert (seen_root_op || root_op_skipped);
-
-	/* Avoid overflows when converting to percent, at the cost of losing
-	 * some precision in the least significant digits. */
-	if (related_prior_download_bytes > G_MAXUINT64 / 100 ||
-	    current_bytes_transferred > G_MAXUINT64 / 100) {
-		related_prior_download_bytes /= 100;
-		    current_bytes_transferred /= 100;
-		    related_download_bytes /= 100;
-	}
-
 	/* Update the progress of @root_app. */
-	if (related_download_bytes > 0)
-		percent = ((related_prior_download_bytes * 100 / related_download_bytes) +
-		           (current_bytes_transferred * 100 / related_download_bytes));
-	else
-		percent = 0;
+	percent = gs_flatpak_progress_get_percent (self->progress, root_index,
+						   flatpak_transaction_progress_get_bytes_transferred (current_progress));
 
 	if (gs_app_get_progress (root_app) == 100 ||
 	    gs_app_get_progress (root_app) == GS_APP_PROGRESS_UNKNOWN ||
@@ -337,25 +374,6 @@ update_progress_for_op (GsFlatpakTransaction        *self,
 	}
 }
 
-static void
-update_progress_for_op_recurse_up (GsFlatpakTransaction        *self,
-				   FlatpakTransactionProgress  *progress,
-				   GList                       *ops,
-				   FlatpakTransactionOperation *current_op,
-				   FlatpakTransactionOperation *root_op)
-{
-	GPtrArray *related_to_ops = flatpak_transaction_operation_get_related_to_ops (root_op);
-
-	/* Update progress for @root_op */
-	update_progress_for_op (self, progress, ops, current_op, root_op);
-
-	/* Update progress for ops related to @root_op, e.g. apps whose runtime is @root_op */
-	for (gsize i = 0; related_to_ops != NULL && i < related_to_ops->len; i++) {
-		FlatpakTransactionOperation *related_to_op = g_ptr_array_index (related_to_ops, i);
-		update_progress_for_op_recurse_up (self, progress, ops, current_op, related_to_op);
-	}
-}
-
 static void
 _transaction_progress_changed_cb (FlatpakTransactionProgress *progress,
 				  gpointer user_data)
@@ -363,7 +381,7 @@ _transaction_progress_changed_cb (FlatpakTransactionProgress *progress,
 	ProgressData *data = user_data;
 	GsApp *app = data->app;
 	GsFlatpakTransaction *self = data->transaction;
-	g_autolist(FlatpakTransactionOperation) ops = NULL;
+	gint current_index;
 
 	if (flatpak_transaction_progress_get_is_estimating (progress)) {
 		/* "Estimating" happens while fetching the metadata, which
@@ -396,9 +414,25 @@ _transaction_progress_changed_cb (FlatpakTransactionProgress *progress,
 	 * but they can be accessed via
 	 * flatpak_transaction_operation_get_related_to_ops(), so have to be
 	 * ignored manually.
+	 *
+	 * The transitive closure of the related-to ops was computed in
+	 * _transaction_ready(), so each app up the hierarchy is updated once
+	 * per tick, even if it can be reached by more than one path. Ticks
+	 * closer together than %GS_FLATPAK_PROGRESS_UPDATE_INTERVAL_USEC are
+	 * dropped.
 	 */
-	ops = flatpak_transaction_get_operations (FLATPAK_TRANSACTION (self));
-	update_progress_for_op_recurse_up (self, progress, ops, data->operation, data->operation);
+	if (self->progress == NULL)
+		return;
+	current_index = progress_op_index (self, data->operation);
+	if (!gs_flatpak_progress_tick (self->progress, current_index,
+				       flatpak_transaction_operation_get_ref (data->operation),
+				       flatpak_transaction_progress_get_bytes_transferred (progress),
+				       g_get_monotonic_time ()))
+		return;
+
+	for (gint r = gs_flatpak_progress_next_related_to (self->progress, current_index, -1); r >= 0;
+	     r = gs_flatpak_progress_next_related_to (self->progress, current_index, r))
+		update_progress_for_op (self, progress, (guint) r);
 }
 
 static const gchar *
@@ -430,6 +464,9 @@ _transaction_new_operation (FlatpakTransaction *transaction,
 	GsApp *app;
 	g_autoptr(ProgressData) progress_data = NULL;
 
+	/* the ops before this one have finished, one way or another */
+	advance_progress_to_op (GS_FLATPAK_TRANSACTION (transaction), operation);
+
 	/* find app */
 	app = _transaction_operation_get_app (operation);
 	if (app == NULL) {
@@ -1153,6 +1153,8 @@ gs_flatpak_rescan_appstream_store (GsFlatpak *self,
 {
 	const gchar *const *locales = g_get_language_names ();
 	g_autofree gchar *blobfn = NULL;
+	g_autofree gchar *indexfn = NULL;
+	g_autoptr(GError) error_index = NULL;
 	g_autoptr(GFile) file = NULL;
 	g_autoptr(GPtrArray) xremotes = NULL;
 	g_autoptr(GRWLockReaderLocker) reader_locker = NULL;
@@ -1249,6 +1251,15 @@ gs_flatpak_rescan_appstream_store (GsFlatpak *self,
 	if (self->silo == NULL)
 		return FALSE;
 
+	/* index the searchable fields; search still works without it */
+	indexfn = gs_utils_get_cache_filename (gs_flatpak_get_id (self),
+					       "components.idx",
+					       GS_UTILS_CACHE_FLAG_WRITEABLE |
+					       GS_UTILS_CACHE_FLAG_CREATE_DIRECTORY,
+					       NULL);
+	if (!gs_appstream_silo_ensure_search_index (self->silo, indexfn, cancellable, &error_index))
+		g_debug ("failed to build search index: %s", error_index->message);
+
 	/* success */
 	return TRUE;
 }
@@ -4173,6 +4184,7 @@ gboolean
 gs_flatpak_search (GsFlatpak *self,
 		   const gchar * const *values,
 		   GsAppList *list,
+		   gboolean type_ahead,
 		   gboolean interactive,
 		   GCancellable *cancellable,
 		   GError **error)
@@ -4187,9 +4199,14 @@ gs_flatpak_search (GsFlatpak *self,
 	if (!ensure_flatpak_silo_with_locker (self, &locker, interactive, cancellable, error))
 		return FALSE;
 
-	if (!gs_appstream_search (self->plugin, self->silo, values, list_tmp,
-				  cancellable, error))
+	if (type_ahead) {
+		if (!gs_appstream_search_type_ahead (self->plugin, self->silo, values, list_tmp,
+						     cancellable, error))
+			return FALSE;
+	} else if (!gs_appstream_search (self->plugin, self->silo, values, list_tmp,
+					 cancellable, error)) {
 		return FALSE;
+	}
 
 	gs_flatpak_ensure_remote_title (self, interactive, cancellable);
 
@@ -4226,9 +4243,16 @@ gs_flatpak_search (GsFlatpak *self,
 			continue;
 		}
 
-		if (!gs_appstream_search (self->plugin, app_silo, values, app_list_tmp,
-					  cancellable, error))
+		/* these silos have no index, so type-ahead searches fall
+		 * back to a full search, but they are small */
+		if (type_ahead) {
+			if (!gs_appstream_search_type_ahead (self->plugin, app_silo, values, app_list_tmp,
+							     cancellable, error))
+				return FALSE;
+		} else if (!gs_appstream_search (self->plugin, app_silo, values, app_list_tmp,
+						 cancellable, error)) {
 			return FALSE;
+		}
 
 		gs_flatpak_claim_app_list (self, app_list_tmp, interactive);
 		gs_app_list_add_list (list, app_list_tmp);
@@ -122,6 +122,7 @@ GsApp		*gs_flatpak_find_source_by_url	(GsFlatpak		*self,
 gboolean	gs_flatpak_search		(GsFlatpak		*self,
 						 const gchar * const	*values,
 						 GsAppList		*list,
+						 gboolean		 type_ahead,
 						 gboolean		 interactive,
 						 GCancellable		*cancellable,
 						 GError			**error);
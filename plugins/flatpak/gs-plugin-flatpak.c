@@ -20,8 +20,12 @@
  * libflatpak API is entirely synchronous (and thread-safe). * Message passing
  * to the worker thread is by gs_worker_thread_queue().
  *
- * FIXME: It may speed things up in future to have one worker thread *per*
- * `FlatpakInstallation`, all operating in parallel.
+ * Each `FlatpakInstallation` additionally has its own worker thread. Jobs on
+ * the plugin’s worker which have to look at every installation (refining
+ * wildcards, listing apps and refreshing metadata) fan out to those, so that
+ * independent installations are processed in parallel, and merge the results
+ * in installation order. The installation workers are only used from the
+ * plugin’s worker, so jobs are still serialised with respect to each other.
  */
 
 #include <config.h>
@@ -46,6 +50,9 @@ struct _GsPluginFlatpak
 
 	GsWorkerThread		*worker;  /* (owned) */
 
+	GMutex			 installation_workers_mutex;
+	GHashTable		*installation_workers;  /* (element-type GsFlatpak GsWorkerThread) (owned); keys are unowned */
+
 	GPtrArray		*installations;  /* (element-type GsFlatpak) (owned); may be NULL before setup or after shutdown */
 	gboolean		 has_system_helper;
 	const gchar		*destdir_for_tests;
@@ -75,12 +82,23 @@ gs_plugin_flatpak_dispose (GObject *object)
 {
 	GsPluginFlatpak *self = GS_PLUGIN_FLATPAK (object);
 
+	g_clear_pointer (&self->installation_workers, g_hash_table_unref);
 	g_clear_pointer (&self->installations, g_ptr_array_unref);
 	g_clear_object (&self->worker);
 
 	G_OBJECT_CLASS (gs_plugin_flatpak_parent_class)->dispose (object);
 }
 
+static void
+gs_plugin_flatpak_finalize (GObject *object)
+{
+	GsPluginFlatpak *self = GS_PLUGIN_FLATPAK (object);
+
+	g_mutex_clear (&self->installation_workers_mutex);
+
+	G_OBJECT_CLASS (gs_plugin_flatpak_parent_class)->finalize (object);
+}
+
 static void
 gs_plugin_flatpak_init (GsPluginFlatpak *self)
 {
@@ -88,15 +106,34 @@ gs_plugin_flatpak_init (GsPluginFlatpak *self)
 
 	self->installations = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
 
+	g_mutex_init (&self->installation_workers_mutex);
+	self->installation_workers = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+							    NULL, g_object_unref);
+
 	/* getting app properties from appstream is quicker */
 	gs_plugin_add_rule (plugin, GS_PLUGIN_RULE_RUN_AFTER, "appstream");
 
 	/* like appstream, we need the icon plugin to load cached icons into pixbufs */
 	gs_plugin_add_rule (plugin, GS_PLUGIN_RULE_RUN_BEFORE, "icons");
 
+	/* resolves wildcards, so this is refined in series with everything */
+	gs_plugin_set_refine_flags (plugin,
+				    GS_APPSTREAM_REFINE_FLAGS_PROVIDED |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_SIZE |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_SIZE_DATA |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_VERSION |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_SETUP_ACTION |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_ORIGIN_HOSTNAME |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_ORIGIN_UI |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_RUNTIME,
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_ID);
+
 	/* prioritize over packages */
 	gs_plugin_add_rule (plugin, GS_PLUGIN_RULE_BETTER_THAN, "packagekit");
 
+	/* see gs_plugin_adopt_app() */
+	gs_plugin_add_adopt_bundle_kind (plugin, AS_BUNDLE_KIND_FLATPAK);
+
 	/* set name of MetaInfo file */
 	gs_plugin_set_appstream_id (plugin, "org.gnome.Software.Plugin.Flatpak");
 
@@ -162,6 +199,167 @@ get_priority_for_interactivity (gboolean interactive)
 	return interactive ? G_PRIORITY_DEFAULT : G_PRIORITY_LOW;
 }
 
+/* Returns the worker for @flatpak, starting it if needed. It stays valid
+ * until the plugin is shut down. */
+static GsWorkerThread *
+get_installation_worker (GsPluginFlatpak *self,
+                         GsFlatpak       *flatpak)
+{
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&self->installation_workers_mutex);
+	GsWorkerThread *worker;
+
+	worker = g_hash_table_lookup (self->installation_workers, flatpak);
+	if (worker == NULL) {
+		g_autofree gchar *name = g_strdup_printf ("gs-plugin-flatpak-%s", gs_flatpak_get_id (flatpak));
+
+		worker = gs_worker_thread_new (name);
+		g_hash_table_insert (self->installation_workers, flatpak, worker);
+	}
+
+	return worker;
+}
+
+/* Does the part of a job for a single installation, adding any apps it finds
+ * to @list. Run in the worker for @flatpak. */
+typedef gboolean (*InstallationFunc) (GsPluginFlatpak  *self,
+                                      GsFlatpak        *flatpak,
+                                      GsAppList        *list,
+                                      gpointer          user_data,
+                                      GCancellable     *cancellable,
+                                      GError          **error);
+
+typedef struct {
+	GsFlatpak *flatpak;  /* (owned) */
+	GsAppList *list;  /* (owned) */
+	InstallationFunc func;
+	gpointer user_data;  /* (unowned) */
+} InstallationData;
+
+static void
+installation_data_free (InstallationData *data)
+{
+	g_object_unref (data->flatpak);
+	g_object_unref (data->list);
+	g_free (data);
+}
+
+/* Run in the worker for @data->flatpak. */
+static void
+installation_thread_cb (GTask        *task,
+                        gpointer      source_object,
+                        gpointer      task_data,
+                        GCancellable *cancellable)
+{
+	GsPluginFlatpak *self = GS_PLUGIN_FLATPAK (source_object);
+	InstallationData *data = task_data;
+	g_autoptr(GError) local_error = NULL;
+
+	/* used for self tests, to check how a failure in one installation is
+	 * handled */
+	if (self->destdir_for_tests != NULL) {
+		g_autoptr(GFile) path = flatpak_installation_get_path (gs_flatpak_get_installation (data->flatpak, FALSE));
+		g_autoptr(GFile) fail_file = g_file_get_child (path, "fail-for-tests");
+
+		if (g_file_query_exists (fail_file, cancellable)) {
+			g_task_return_new_error (task, GS_PLUGIN_ERROR, GS_PLUGIN_ERROR_FAILED,
+						 "Failed for tests in %s", gs_flatpak_get_id (data->flatpak));
+			return;
+		}
+	}
+
+	if (!data->func (self, data->flatpak, data->list, data->user_data, cancellable, &local_error))
+		g_task_return_error (task, g_steal_pointer (&local_error));
+	else
+		g_task_return_boolean (task, TRUE);
+}
+
+static void
+installation_done_cb (GObject      *source_object,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+	guint *n_pending = user_data;
+
+	(*n_pending)--;
+}
+
+/* Run in @worker. Runs @func for each installation on its own worker, waits
+ * for all of them, and then adds the apps they found to @list in installation
+ * order, so the results don’t depend on which finished first. If any of them
+ * failed, the error from the first installation to fail is returned. */
+static gboolean
+run_for_each_installation (GsPluginFlatpak   *self,
+                           gint               priority,
+                           InstallationFunc   func,
+                           gpointer           user_data,
+                           GsAppList         *list,
+                           GCancellable      *cancellable,
+                           GError           **error)
+{
+	g_autoptr(GMainContext) context = NULL;
+	g_autoptr(GMainContextPusher) pusher = NULL;
+	g_autoptr(GPtrArray) tasks = NULL;
+	g_autoptr(GError) local_error = NULL;
+	guint n_pending = 0;
+
+	assert_in_worker (self);
+
+	/* nothing to run in parallel with, so save the round trip */
+	if (self->installations->len == 1)
+		return func (self, g_ptr_array_index (self->installations, 0), list,
+			     user_data, cancellable, error);
+
+	/* the tasks complete in this context, which is only iterated below */
+	context = g_main_context_new ();
+	pusher = g_main_context_pusher_new (context);
+	tasks = g_ptr_array_new_with_free_func (g_object_unref);
+
+	for (guint i = 0; i < self->installations->len; i++) {
+		GsFlatpak *flatpak = g_ptr_array_index (self->installations, i);
+		g_autoptr(GTask) task = NULL;
+		InstallationData *data;
+
+		data = g_new0 (InstallationData, 1);
+		data->flatpak = g_object_ref (flatpak);
+		data->list = gs_app_list_new ();
+		data->func = func;
+		data->user_data = user_data;
+
+		task = g_task_new (self, cancellable, installation_done_cb, &n_pending);
+		g_task_set_source_tag (task, run_for_each_installation);
+		g_task_set_task_data (task, data, (GDestroyNotify) installation_data_free);
+		g_ptr_array_add (tasks, g_object_ref (task));
+
+		n_pending++;
+		gs_worker_thread_queue (get_installation_worker (self, flatpak), priority,
+					installation_thread_cb, g_steal_pointer (&task));
+	}
+
+	while (n_pending > 0)
+		g_main_context_iteration (context, TRUE);
+
+	for (guint i = 0; i < tasks->len; i++) {
+		GTask *task = g_ptr_array_index (tasks, i);
+		InstallationData *data = g_task_get_task_data (task);
+		g_autoptr(GError) error_local = NULL;
+
+		if (!g_task_propagate_boolean (task, &error_local)) {
+			g_debug ("Failed for '%s': %s", gs_flatpak_get_id (data->flatpak), error_local->message);
+			if (local_error == NULL)
+				local_error = g_steal_pointer (&error_local);
+			continue;
+		}
+		gs_app_list_add_list (list, data->list);
+	}
+
+	if (local_error != NULL) {
+		g_propagate_error (error, g_steal_pointer (&local_error));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 static void setup_thread_cb (GTask        *task,
                              gpointer      source_object,
                              gpointer      task_data,
@@ -260,8 +458,33 @@ setup_thread_cb (GTask        *task,
 		g_autofree gchar *full_path = g_build_filename (self->destdir_for_tests,
 								"flatpak",
 								NULL);
+		g_autofree gchar *system_path = g_build_filename (self->destdir_for_tests,
+								  "flatpak-system",
+								  NULL);
 		g_autoptr(GFile) file = g_file_new_for_path (full_path);
 		g_autoptr(FlatpakInstallation) installation = NULL;
+
+		installations = g_ptr_array_new_with_free_func (g_object_unref);
+
+		/* and a system one before it, like the real installations,
+		 * if the test has created one */
+		if (g_file_test (system_path, G_FILE_TEST_IS_DIR)) {
+			g_autoptr(GFile) system_file = g_file_new_for_path (system_path);
+			g_autoptr(FlatpakInstallation) system_installation = NULL;
+
+			g_debug ("using custom flatpak system path %s", system_path);
+			system_installation = flatpak_installation_new_for_path (system_file, FALSE,
+										 cancellable,
+										 &error_local);
+			if (system_installation == NULL) {
+				gs_flatpak_error_convert (&error_local);
+				g_task_return_error (task, g_steal_pointer (&error_local));
+				return;
+			}
+
+			g_ptr_array_add (installations, g_steal_pointer (&system_installation));
+		}
+
 		g_debug ("using custom flatpak path %s", full_path);
 		installation = flatpak_installation_new_for_path (file, TRUE,
 								  cancellable,
@@ -272,7 +495,6 @@ setup_thread_cb (GTask        *task,
 			return;
 		}
 
-		installations = g_ptr_array_new_with_free_func (g_object_unref);
 		g_ptr_array_add (installations, g_steal_pointer (&installation));
 	}
 
@@ -314,6 +536,11 @@ gs_plugin_flatpak_setup_finish (GsPlugin      *plugin,
 static void shutdown_cb (GObject      *source_object,
                          GAsyncResult *result,
                          gpointer      user_data);
+static void installation_worker_shutdown_ref (GTask *task);
+static void installation_worker_shutdown_unref (GTask *task);
+static void installation_worker_shutdown_cb (GObject      *source_object,
+                                             GAsyncResult *result,
+                                             gpointer      user_data);
 
 static void
 gs_plugin_flatpak_shutdown_async (GsPlugin            *plugin,
@@ -341,6 +568,9 @@ shutdown_cb (GObject      *source_object,
 	g_autoptr(GsWorkerThread) worker = NULL;
 	g_autoptr(GError) local_error = NULL;
 
+	GHashTableIter iter;
+	gpointer installation_worker;
+
 	worker = g_steal_pointer (&self->worker);
 
 	if (!gs_worker_thread_shutdown_finish (worker, result, &local_error)) {
@@ -348,12 +578,61 @@ shutdown_cb (GObject      *source_object,
 		return;
 	}
 
-	/* Clear the flatpak installations */
+	/* Nothing can queue work on the installation workers any more, so they
+	 * are idle and can be stopped without a cancellable (a cancelled
+	 * shutdown would leave their threads unjoined). The task holds one
+	 * pending count of its own until they have all been told to stop. */
+	g_task_set_task_data (task, g_new0 (guint, 1), g_free);
+	installation_worker_shutdown_ref (task);
+
+	g_hash_table_iter_init (&iter, self->installation_workers);
+	while (g_hash_table_iter_next (&iter, NULL, &installation_worker)) {
+		installation_worker_shutdown_ref (task);
+		gs_worker_thread_shutdown_async (installation_worker, NULL,
+						 installation_worker_shutdown_cb, g_object_ref (task));
+	}
+
+	installation_worker_shutdown_unref (task);
+}
+
+static void
+installation_worker_shutdown_ref (GTask *task)
+{
+	guint *n_pending = g_task_get_task_data (task);
+
+	(*n_pending)++;
+}
+
+static void
+installation_worker_shutdown_unref (GTask *task)
+{
+	GsPluginFlatpak *self = g_task_get_source_object (task);
+	guint *n_pending = g_task_get_task_data (task);
+
+	if (--(*n_pending) > 0)
+		return;
+
+	/* Clear the installation workers and the flatpak installations */
+	g_hash_table_remove_all (self->installation_workers);
 	g_ptr_array_set_size (self->installations, 0);
 
 	g_task_return_boolean (task, TRUE);
 }
 
+static void
+installation_worker_shutdown_cb (GObject      *source_object,
+                                 GAsyncResult *result,
+                                 gpointer      user_data)
+{
+	g_autoptr(GTask) task = G_TASK (user_data);
+	g_autoptr(GError) local_error = NULL;
+
+	if (!gs_worker_thread_shutdown_finish (GS_WORKER_THREAD (source_object), result, &local_error))
+		g_debug ("Failed to stop installation worker: %s", local_error->message);
+
+	installation_worker_shutdown_unref (task);
+}
+
 static gboolean
 gs_plugin_flatpak_shutdown_finish (GsPlugin      *plugin,
                                    GAsyncResult  *result,
@@ -424,6 +703,25 @@ gs_plugin_flatpak_refresh_metadata_async (GsPlugin                     *plugin,
 				refresh_metadata_thread_cb, g_steal_pointer (&task));
 }
 
+/* Run in the worker for @flatpak. */
+static gboolean
+refresh_metadata_installation (GsPluginFlatpak  *self,
+                               GsFlatpak        *flatpak,
+                               GsAppList        *list,
+                               gpointer          user_data,
+                               GCancellable     *cancellable,
+                               GError          **error)
+{
+	GsPluginRefreshMetadataData *data = user_data;
+	gboolean interactive = (data->flags & GS_PLUGIN_REFRESH_METADATA_FLAGS_INTERACTIVE);
+	g_autoptr(GError) local_error = NULL;
+
+	if (!gs_flatpak_refresh (flatpak, data->cache_age_secs, interactive, cancellable, &local_error))
+		g_debug ("Failed to refresh metadata for '%s': %s", gs_flatpak_get_id (flatpak), local_error->message);
+
+	return TRUE;
+}
+
 /* Run in @worker. */
 static void
 refresh_metadata_thread_cb (GTask        *task,
@@ -434,16 +732,13 @@ refresh_metadata_thread_cb (GTask        *task,
 	GsPluginFlatpak *self = GS_PLUGIN_FLATPAK (source_object);
 	GsPluginRefreshMetadataData *data = task_data;
 	gboolean interactive = (data->flags & GS_PLUGIN_REFRESH_METADATA_FLAGS_INTERACTIVE);
+	g_autoptr(GsAppList) list = gs_app_list_new ();
 
 	assert_in_worker (self);
 
-	for (guint i = 0; i < self->installations->len; i++) {
-		g_autoptr(GError) local_error = NULL;
-		GsFlatpak *flatpak = g_ptr_array_index (self->installations, i);
-
-		if (!gs_flatpak_refresh (flatpak, data->cache_age_secs, interactive, cancellable, &local_error))
-			g_debug ("Failed to refresh metadata for '%s': %s", gs_flatpak_get_id (flatpak), local_error->message);
-	}
+	/* failures are only logged, so this can’t fail */
+	run_for_each_installation (self, get_priority_for_interactivity (interactive), refresh_metadata_installation,
+				   data, list, cancellable, NULL);
 
 	g_task_return_boolean (task, TRUE);
 }
@@ -581,6 +876,34 @@ gs_plugin_flatpak_refine_async (GsPlugin            *plugin,
 				refine_thread_cb, g_steal_pointer (&task));
 }
 
+typedef struct {
+	GsAppList *wildcards;  /* (unowned) */
+	GsPluginRefineFlags flags;
+} RefineWildcardsData;
+
+/* Run in the worker for @flatpak. */
+static gboolean
+refine_wildcards_installation (GsPluginFlatpak  *self,
+                               GsFlatpak        *flatpak,
+                               GsAppList        *list,
+                               gpointer          user_data,
+                               GCancellable     *cancellable,
+                               GError          **error)
+{
+	RefineWildcardsData *data = user_data;
+	gboolean interactive = gs_plugin_has_flags (GS_PLUGIN (self), GS_PLUGIN_FLAGS_INTERACTIVE);
+
+	for (guint i = 0; i < gs_app_list_length (data->wildcards); i++) {
+		GsApp *app = gs_app_list_index (data->wildcards, i);
+
+		if (!gs_flatpak_refine_wildcard (flatpak, app, list, data->flags, interactive,
+						 cancellable, error))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
 /* Run in @worker. */
 static void
 refine_thread_cb (GTask        *task,
@@ -593,7 +916,7 @@ refine_thread_cb (GTask        *task,
 	GsAppList *list = data->list;
 	GsPluginRefineFlags flags = data->flags;
 	gboolean interactive = gs_plugin_has_flags (GS_PLUGIN (self), GS_PLUGIN_FLAGS_INTERACTIVE);
-	g_autoptr(GsAppList) app_list = NULL;
+	g_autoptr(GsAppList) wildcards = NULL;
 	g_autoptr(GError) local_error = NULL;
 
 	assert_in_worker (self);
@@ -608,26 +931,27 @@ refine_thread_cb (GTask        *task,
 
 	/* Refine wildcards.
 	 *
-	 * Use a copy of the list for the loop because a function called
+	 * Collect them in a separate list for the loop because a function called
 	 * on the plugin may affect the list which can lead to problems
 	 * (e.g. inserting an app in the list on every call results in
 	 * an infinite loop) */
-	app_list = gs_app_list_copy (list);
-
-	for (guint j = 0; j < gs_app_list_length (app_list); j++) {
-		GsApp *app = gs_app_list_index (app_list, j);
+	wildcards = gs_app_list_new ();
+	for (guint i = 0; i < gs_app_list_length (list); i++) {
+		GsApp *app = gs_app_list_index (list, i);
 
-		if (!gs_app_has_quirk (app, GS_APP_QUIRK_IS_WILDCARD))
-			continue;
+		if (gs_app_has_quirk (app, GS_APP_QUIRK_IS_WILDCARD))
+			gs_app_list_add (wildcards, app);
+	}
 
-		for (guint i = 0; i < self->installations->len; i++) {
-			GsFlatpak *flatpak = g_ptr_array_index (self->installations, i);
+	if (gs_app_list_length (wildcards) > 0) {
+		RefineWildcardsData wildcards_data = { wildcards, flags };
 
-			if (!gs_flatpak_refine_wildcard (flatpak, app, list, flags, interactive,
-							 cancellable, &local_error)) {
-				g_task_return_error (task, g_steal_pointer (&local_error));
-				return;
-			}
+		/* each installation adds its matches to its own list, which are
+		 * then added to @list in installation order */
+		if (!run_for_each_installation (self, get_priority_for_interactivity (interactive), refine_wildcards_installation,
+						&wildcards_data, list, cancellable, &local_error)) {
+			g_task_return_error (task, g_steal_pointer (&local_error));
+			return;
 		}
 	}
 
@@ -1842,6 +2166,95 @@ gs_plugin_flatpak_list_apps_async (GsPlugin              *plugin,
 				list_apps_thread_cb, g_steal_pointer (&task));
 }
 
+/* Run in the worker for @flatpak. The query has already been checked by
+ * list_apps_thread_cb(). */
+static gboolean
+list_apps_installation (GsPluginFlatpak  *self,
+                        GsFlatpak        *flatpak,
+                        GsAppList        *list,
+                        gpointer          user_data,
+                        GCancellable     *cancellable,
+                        GError          **error)
+{
+	GsPluginListAppsData *data = user_data;
+	gboolean interactive = (data->flags & GS_PLUGIN_LIST_APPS_FLAGS_INTERACTIVE);
+	gboolean type_ahead = (data->flags & GS_PLUGIN_LIST_APPS_FLAGS_TYPE_AHEAD);
+	GDateTime *released_since = gs_app_query_get_released_since (data->query);
+	GsAppQueryTristate is_curated = gs_app_query_get_is_curated (data->query);
+	GsAppQueryTristate is_featured = gs_app_query_get_is_featured (data->query);
+	GsCategory *category = gs_app_query_get_category (data->query);
+	GsAppQueryTristate is_installed = gs_app_query_get_is_installed (data->query);
+	guint64 age_secs = 0;
+	const gchar * const *deployment_featured = gs_app_query_get_deployment_featured (data->query);
+	const gchar *const *developers = gs_app_query_get_developers (data->query);
+	const gchar * const *keywords = gs_app_query_get_keywords (data->query);
+	GsApp *alternate_of = gs_app_query_get_alternate_of (data->query);
+	const gchar *provides_tag = NULL;
+	GsAppQueryProvidesType provides_type = gs_app_query_get_provides (data->query, &provides_tag);
+	const gchar * const provides_tag_strv[2] = { provides_tag, NULL };
+
+	if (released_since != NULL) {
+		g_autoptr(GDateTime) now = g_date_time_new_now_local ();
+		age_secs = g_date_time_difference (now, released_since) / G_TIME_SPAN_SECOND;
+	}
+
+	if (released_since != NULL &&
+	    !gs_flatpak_add_recent (flatpak, list, age_secs, interactive, cancellable, error)) {
+		return FALSE;
+	}
+
+	if (is_curated != GS_APP_QUERY_TRISTATE_UNSET &&
+	    !gs_flatpak_add_popular (flatpak, list, interactive, cancellable, error)) {
+		return FALSE;
+	}
+
+	if (is_featured != GS_APP_QUERY_TRISTATE_UNSET &&
+	    !gs_flatpak_add_featured (flatpak, list, interactive, cancellable, error)) {
+		return FALSE;
+	}
+
+	if (category != NULL &&
+	    !gs_flatpak_add_category_apps (flatpak, category, list, interactive, cancellable, error)) {
+		return FALSE;
+	}
+
+	if (is_installed != GS_APP_QUERY_TRISTATE_UNSET &&
+	    !gs_flatpak_add_installed (flatpak, list, interactive, cancellable, error)) {
+		return FALSE;
+	}
+
+	if (deployment_featured != NULL &&
+	    !gs_flatpak_add_deployment_featured (flatpak, list, interactive, deployment_featured, cancellable, error)) {
+		return FALSE;
+	}
+
+	if (developers != NULL &&
+	    !gs_flatpak_search_developer_apps (flatpak, developers, list, interactive, cancellable, error)) {
+		return FALSE;
+	}
+
+	if (keywords != NULL &&
+	    !gs_flatpak_search (flatpak, keywords, list, type_ahead, interactive, cancellable, error)) {
+		return FALSE;
+	}
+
+	if (alternate_of != NULL &&
+	    !gs_flatpak_add_alternates (flatpak, alternate_of, list, interactive, cancellable, error)) {
+		return FALSE;
+	}
+
+	/* The @provides_type is deliberately ignored here, as flatpak
+	 * wants to try and match anything. This could be changed in
+	 * future. */
+	if (provides_tag != NULL &&
+	    provides_type != GS_APP_QUERY_PROVIDES_UNKNOWN &&
+	    !gs_flatpak_search (flatpak, provides_tag_strv, list, FALSE, interactive, cancellable, error)) {
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 /* Run in @worker. */
 static void
 list_apps_thread_cb (GTask        *task,
@@ -1852,19 +2265,17 @@ list_apps_thread_cb (GTask        *task,
 	GsPluginFlatpak *self = GS_PLUGIN_FLATPAK (source_object);
 	g_autoptr(GsAppList) list = gs_app_list_new ();
 	GsPluginListAppsData *data = task_data;
-	gboolean interactive = (data->flags & GS_PLUGIN_LIST_APPS_FLAGS_INTERACTIVE);
 	GDateTime *released_since = NULL;
 	GsAppQueryTristate is_curated = GS_APP_QUERY_TRISTATE_UNSET;
 	GsAppQueryTristate is_featured = GS_APP_QUERY_TRISTATE_UNSET;
 	GsCategory *category = NULL;
 	GsAppQueryTristate is_installed = GS_APP_QUERY_TRISTATE_UNSET;
-	guint64 age_secs = 0;
 	const gchar * const *deployment_featured = NULL;
 	const gchar *const *developers = NULL;
 	const gchar * const *keywords = NULL;
 	GsApp *alternate_of = NULL;
 	const gchar *provides_tag = NULL;
-	GsAppQueryProvidesType provides_type = GS_APP_QUERY_PROVIDES_UNKNOWN;
+	gboolean interactive = (data->flags & GS_PLUGIN_LIST_APPS_FLAGS_INTERACTIVE);
 	g_autoptr(GError) local_error = NULL;
 
 	assert_in_worker (self);
@@ -1879,12 +2290,7 @@ list_apps_thread_cb (GTask        *task,
 		developers = gs_app_query_get_developers (data->query);
 		keywords = gs_app_query_get_keywords (data->query);
 		alternate_of = gs_app_query_get_alternate_of (data->query);
-		provides_type = gs_app_query_get_provides (data->query, &provides_tag);
-	}
-
-	if (released_since != NULL) {
-		g_autoptr(GDateTime) now = g_date_time_new_now_local ();
-		age_secs = g_date_time_difference (now, released_since) / G_TIME_SPAN_SECOND;
+		gs_app_query_get_provides (data->query, &provides_tag);
 	}
 
 	/* Currently only support a subset of query properties, and only one set at once.
@@ -1908,73 +2314,10 @@ list_apps_thread_cb (GTask        *task,
 		return;
 	}
 
-	for (guint i = 0; i < self->installations->len; i++) {
-		GsFlatpak *flatpak = g_ptr_array_index (self->installations, i);
-		const gchar * const provides_tag_strv[2] = { provides_tag, NULL };
-
-		if (released_since != NULL &&
-		    !gs_flatpak_add_recent (flatpak, list, age_secs, interactive, cancellable, &local_error)) {
-			g_task_return_error (task, g_steal_pointer (&local_error));
-			return;
-		}
-
-		if (is_curated != GS_APP_QUERY_TRISTATE_UNSET &&
-		    !gs_flatpak_add_popular (flatpak, list, interactive, cancellable, &local_error)) {
-			g_task_return_error (task, g_steal_pointer (&local_error));
-			return;
-		}
-
-		if (is_featured != GS_APP_QUERY_TRISTATE_UNSET &&
-		    !gs_flatpak_add_featured (flatpak, list, interactive, cancellable, &local_error)) {
-			g_task_return_error (task, g_steal_pointer (&local_error));
-			return;
-		}
-
-		if (category != NULL &&
-		    !gs_flatpak_add_category_apps (flatpak, category, list, interactive, cancellable, &local_error)) {
-			g_task_return_error (task, g_steal_pointer (&local_error));
-			return;
-		}
-
-		if (is_installed != GS_APP_QUERY_TRISTATE_UNSET &&
-		    !gs_flatpak_add_installed (flatpak, list, interactive, cancellable, &local_error)) {
-			g_task_return_error (task, g_steal_pointer (&local_error));
-			return;
-		}
-
-		if (deployment_featured != NULL &&
-		    !gs_flatpak_add_deployment_featured (flatpak, list, interactive, deployment_featured, cancellable, &local_error)) {
-			g_task_return_error (task, g_steal_pointer (&local_error));
-			return;
-		}
-
-		if (developers != NULL &&
-		    !gs_flatpak_search_developer_apps (flatpak, developers, list, interactive, cancellable, &local_error)) {
-			g_task_return_error (task, g_steal_pointer (&local_error));
-			return;
-		}
-
-		if (keywords != NULL &&
-		    !gs_flatpak_search (flatpak, keywords, list, interactive, cancellable, &local_error)) {
-			g_task_return_error (task, g_steal_pointer (&local_error));
-			return;
-		}
-
-		if (alternate_of != NULL &&
-		    !gs_flatpak_add_alternates (flatpak, alternate_of, list, interactive, cancellable, &local_error)) {
-			g_task_return_error (task, g_steal_pointer (&local_error));
-			return;
-		}
-
-		/* The @provides_type is deliberately ignored here, as flatpak
-		 * wants to try and match anything. This could be changed in
-		 * future. */
-		if (provides_tag != NULL &&
-		    provides_type != GS_APP_QUERY_PROVIDES_UNKNOWN &&
-		    !gs_flatpak_search (flatpak, provides_tag_strv, list, interactive, cancellable, &local_error)) {
-			g_task_return_error (task, g_steal_pointer (&local_error));
-			return;
-		}
+	if (!run_for_each_installation (self, get_priority_for_interactivity (interactive), list_apps_installation,
+					data, list, cancellable, &local_error)) {
+		g_task_return_error (task, g_steal_pointer (&local_error));
+		return;
 	}
 
 	g_task_return_pointer (task, g_steal_pointer (&list), g_object_unref);
@@ -2295,6 +2638,7 @@ gs_plugin_flatpak_class_init (GsPluginFlatpakClass *klass)
 	GsPluginClass *plugin_class = GS_PLUGIN_CLASS (klass);
 
 	object_class->dispose = gs_plugin_flatpak_dispose;
+	object_class->finalize = gs_plugin_flatpak_finalize;
 
 	plugin_class->setup_async = gs_plugin_flatpak_setup_async;
 	plugin_class->setup_finish = gs_plugin_flatpak_setup_finish;
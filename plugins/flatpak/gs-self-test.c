@@ -14,6 +14,7 @@
 #include "gnome-software-private.h"
 
 #include "gs-flatpak-app.h"
+#include "gs-flatpak-progress.h"
 
 #include "gs-test.h"
 
@@ -75,6 +76,88 @@ gs_flatpak_test_write_ref_file (const gchar *filename, const gchar *url, const g
 	return g_file_set_contents (path, str->str, -1, error);
 }
 
+static void
+gs_plugins_flatpak_progress_func (void)
+{
+	g_autoptr(GsFlatpakProgress) progress = NULL;
+	const guint64 sizes[] = { 100, 1000, 300, 600, 50 };
+	const guint expected_related_to[][6] = {
+		{ 0, 1, 2, 3, 4, G_MAXUINT },
+		{ 1, 2, 3, 4, G_MAXUINT },
+		{ 2, G_MAXUINT },
+		{ 3, 4, G_MAXUINT },
+		{ 4, G_MAXUINT },
+	};
+	const guint64 expected_related_bytes[] = { 100, 1100, 1400, 1700, 1700 };
+
+	/* A transaction which runs, in order, a locale for a runtime, the
+	 * runtime, the two apps which need it, and an extension for an app
+	 * whose own op is skipped and so comes last:
+	 *    0 locale → 1 runtime → 2 app A
+	 *                         ↘ 3 extension → 4 app B (skipped) */
+	progress = gs_flatpak_progress_new (5, 4);
+	for (guint i = 0; i < G_N_ELEMENTS (sizes); i++)
+		gs_flatpak_progress_set_op (progress, i, sizes[i], i == 4);
+	gs_flatpak_progress_add_related_to (progress, 0, 1);
+	gs_flatpak_progress_add_related_to (progress, 1, 2);
+	gs_flatpak_progress_add_related_to (progress, 1, 3);
+	gs_flatpak_progress_add_related_to (progress, 3, 4);
+	gs_flatpak_progress_compute (progress);
+
+	/* the related-to closure, and the download sizes of the listed ops
+	 * each op is related to, without the skipped op’s own size */
+	for (guint i = 0; i < G_N_ELEMENTS (expected_related_to); i++) {
+		gint r = -1;
+
+		for (guint j = 0; expected_related_to[i][j] != G_MAXUINT; j++) {
+			r = gs_flatpak_progress_next_related_to (progress, i, r);
+			g_assert_cmpint (r, ==, expected_related_to[i][j]);
+		}
+		g_assert_cmpint (gs_flatpak_progress_next_related_to (progress, i, r), ==, -1);
+		g_assert_cmpuint (gs_flatpak_progress_get_related_bytes (progress, i), ==, expected_related_bytes[i]);
+		g_assert_cmpuint (gs_flatpak_progress_get_related_prior_bytes (progress, i), ==, 0);
+	}
+
+	/* nothing has been run before the first op */
+	gs_flatpak_progress_advance_to (progress, 0);
+	g_assert_cmpuint (gs_flatpak_progress_get_percent (progress, 2, 50), ==, 3);
+
+	/* once app A is started, the locale and runtime are counted as done
+	 * for every op they relate to, and only once however often the
+	 * transaction advances to the same op */
+	gs_flatpak_progress_advance_to (progress, 2);
+	gs_flatpak_progress_advance_to (progress, 2);
+	g_assert_cmpuint (gs_flatpak_progress_get_related_prior_bytes (progress, 0), ==, 100);
+	g_assert_cmpuint (gs_flatpak_progress_get_related_prior_bytes (progress, 1), ==, 1100);
+	g_assert_cmpuint (gs_flatpak_progress_get_related_prior_bytes (progress, 2), ==, 1100);
+	g_assert_cmpuint (gs_flatpak_progress_get_related_prior_bytes (progress, 4), ==, 1100);
+	g_assert_cmpuint (gs_flatpak_progress_get_percent (progress, 2, 150), ==, 88);
+	g_assert_cmpuint (gs_flatpak_progress_get_percent (progress, 2, 300), ==, 99);
+
+	/* skipped ops aren’t run, so don’t advance anything */
+	gs_flatpak_progress_advance_to (progress, 4);
+	g_assert_cmpuint (gs_flatpak_progress_get_related_prior_bytes (progress, 4), ==, 1100);
+	gs_flatpak_progress_advance_to (progress, 3);
+	g_assert_cmpuint (gs_flatpak_progress_get_related_prior_bytes (progress, 4), ==, 1100);
+	g_assert_cmpuint (gs_flatpak_progress_get_percent (progress, 4, 0), ==, 64);
+
+	/* ticks for ops which aren’t in the transaction are ignored */
+	g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
+			       "Couldn't find transaction operation runtime/org.test.Missing*");
+	g_assert_false (gs_flatpak_progress_tick (progress, -1, "runtime/org.test.Missing/x86_64/master", 0, 0));
+	g_test_assert_expected_messages ();
+
+	/* ticks for the same op are rate limited, unless it’s just finished */
+	g_assert_true (gs_flatpak_progress_tick (progress, 3, "op3", 0, 0));
+	g_assert_false (gs_flatpak_progress_tick (progress, 3, "op3", 10, 1));
+	g_assert_false (gs_flatpak_progress_tick (progress, 3, "op3", 20, GS_FLATPAK_PROGRESS_UPDATE_INTERVAL_USEC - 1));
+	g_assert_true (gs_flatpak_progress_tick (progress, 3, "op3", 30, GS_FLATPAK_PROGRESS_UPDATE_INTERVAL_USEC));
+	g_assert_true (gs_flatpak_progress_tick (progress, 3, "op3", 600, GS_FLATPAK_PROGRESS_UPDATE_INTERVAL_USEC + 1));
+
+	/* and the first tick of the next op is never dropped */
+	g_assert_true (gs_flatpak_progress_tick (progress, 2, "op2", 0, GS_FLATPAK_PROGRESS_UPDATE_INTERVAL_USEC + 2));
+}
+
 /* create duplicate file as if downloaded in firefox */
 static void
 gs_plugins_flatpak_repo_non_ascii_func (GsPluginLoader *plugin_loader)
@@ -1904,6 +1987,155 @@ gs_plugins_flatpak_runtime_extension_func (GsPluginLoader *plugin_loader)
 	g_assert_false (gs_app_is_installed (extension));
 }
 
+/* Adds a remote called @remote_name to the installation at @path, with
+ * AppStream data for a single app, as if it had just been refreshed */
+static void
+gs_flatpak_test_add_remote_with_app (const gchar *path,
+                                     const gchar *remote_name,
+                                     const gchar *app_id)
+{
+	g_autofree gchar *xml = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GFile) file = g_file_new_for_path (path);
+	g_autoptr(GFile) appstream_dir = NULL;
+	g_autoptr(GFile) appstream_file = NULL;
+	g_autoptr(FlatpakInstallation) installation = NULL;
+	g_autoptr(FlatpakRemote) remote = NULL;
+	g_autoptr(GConverter) compressor = NULL;
+	g_autoptr(GFileOutputStream) file_stream = NULL;
+	g_autoptr(GOutputStream) stream = NULL;
+	gboolean ret;
+
+	/* opened as a user installation even for the system one, so that the
+	 * remote can be added without the system helper */
+	installation = flatpak_installation_new_for_path (file, TRUE, NULL, &error);
+	g_assert_no_error (error);
+
+	remote = flatpak_remote_new (remote_name);
+	flatpak_remote_set_url (remote, "file:///nonexistent");
+	flatpak_remote_set_gpg_verify (remote, FALSE);
+	ret = flatpak_installation_add_remote (installation, remote, FALSE, NULL, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	g_clear_object (&remote);
+
+	remote = flatpak_installation_get_remote_by_name (installation, remote_name, NULL, &error);
+	g_assert_no_error (error);
+	appstream_dir = flatpak_remote_get_appstream_dir (remote, NULL);
+	g_assert_nonnull (appstream_dir);
+	ret = g_file_make_directory_with_parents (appstream_dir, NULL, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+
+	xml = g_strdup_printf ("<?xml version=\"1.0\"?>\n"
+			       "<components version=\"0.14\" origin=\"%s\">\n"
+			       "  <component type=\"desktop-application\">\n"
+			       "    <id>%s</id>\n"
+			       "    <name>%s</name>\n"
+			       "    <summary>Checks the mergeorder of installations</summary>\n"
+			       "    <bundle type=\"flatpak\">app/%s/%s/master</bundle>\n"
+			       "  </component>\n"
+			       "</components>\n",
+			       remote_name, app_id, app_id, app_id, flatpak_get_default_arch ());
+
+	appstream_file = g_file_get_child (appstream_dir, "appstream.xml.gz");
+	file_stream = g_file_replace (appstream_file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, &error);
+	g_assert_no_error (error);
+	compressor = G_CONVERTER (g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1));
+	stream = g_converter_output_stream_new (G_OUTPUT_STREAM (file_stream), compressor);
+	ret = g_output_stream_write_all (stream, xml, strlen (xml), NULL, NULL, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	ret = g_output_stream_close (stream, NULL, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+}
+
+/* keeps the apps in the order the plugin returned them */
+static gint
+gs_flatpak_test_keep_order_cb (GsApp *app1, GsApp *app2, gpointer user_data)
+{
+	return 0;
+}
+
+static GsAppList *
+gs_flatpak_test_search (GsPluginLoader *plugin_loader, const gchar *keyword, GError **error)
+{
+	const gchar *keywords[2] = { keyword, NULL };
+	g_autoptr(GsAppQuery) query = NULL;
+	g_autoptr(GsPluginJob) plugin_job = NULL;
+	GsAppList *list;
+
+	query = gs_app_query_new ("keywords", keywords,
+				  "sort-func", gs_flatpak_test_keep_order_cb,
+				  NULL);
+	plugin_job = gs_plugin_job_list_apps_new (query, GS_PLUGIN_LIST_APPS_FLAGS_NONE);
+	list = gs_plugin_loader_job_process (plugin_loader, plugin_job, NULL, error);
+	gs_test_flush_main_context ();
+
+	return list;
+}
+
+static void
+gs_plugins_flatpak_installations_func (GsPluginLoader *plugin_loader)
+{
+	const gchar *root = g_getenv ("GS_SELF_TEST_FLATPAK_DATADIR");
+	g_autofree gchar *system_path = g_build_filename (root, "flatpak-system", NULL);
+	g_autofree gchar *user_path = g_build_filename (root, "flatpak", NULL);
+	g_autofree gchar *fail_fn = g_build_filename (system_path, "fail-for-tests", NULL);
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GFile) user_file = g_file_new_for_path (user_path);
+	g_autoptr(FlatpakInstallation) user_installation = NULL;
+	g_autoptr(GsAppList) list = NULL;
+	GsApp *app;
+	gboolean ret;
+
+	/* no flatpak, abort */
+	if (!gs_plugin_loader_get_enabled (plugin_loader, "flatpak"))
+		return;
+
+	/* a system installation next to the user one, with an app in each,
+	 * so each job is run on both installations in parallel */
+	gs_flatpak_test_add_remote_with_app (system_path, "test-system", "org.test.Alpha");
+	gs_flatpak_test_add_remote_with_app (user_path, "test-user", "org.test.Beta");
+	gs_test_reinitialise_plugin_loader (plugin_loader, allowlist, NULL);
+
+	/* the results are merged in installation order, system first, however
+	 * the installations finished */
+	list = gs_flatpak_test_search (plugin_loader, "mergeorder", &error);
+	g_assert_no_error (error);
+	g_assert_nonnull (list);
+	g_assert_cmpuint (gs_app_list_length (list), ==, 2);
+	app = gs_app_list_index (list, 0);
+	g_assert_cmpstr (gs_app_get_id (app), ==, "org.test.Alpha");
+	g_assert_cmpint (gs_app_get_scope (app), ==, AS_COMPONENT_SCOPE_SYSTEM);
+	app = gs_app_list_index (list, 1);
+	g_assert_cmpstr (gs_app_get_id (app), ==, "org.test.Beta");
+	g_assert_cmpint (gs_app_get_scope (app), ==, AS_COMPONENT_SCOPE_USER);
+	g_clear_object (&list);
+
+	/* if one installation fails, its error is returned rather than the
+	 * results from the other one */
+	ret = g_file_set_contents (fail_fn, "", 0, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	gs_plugin_loader_clear_caches (plugin_loader);
+
+	list = gs_flatpak_test_search (plugin_loader, "mergeorder", &error);
+	g_assert_error (error, GS_PLUGIN_ERROR, GS_PLUGIN_ERROR_FAILED);
+	g_assert_null (list);
+	g_clear_error (&error);
+
+	/* go back to just the user installation */
+	user_installation = flatpak_installation_new_for_path (user_file, TRUE, NULL, &error);
+	g_assert_no_error (error);
+	ret = flatpak_installation_remove_remote (user_installation, "test-user", NULL, &error);
+	g_assert_no_error (error);
+	g_assert_true (ret);
+	gs_utils_rmtree (system_path, NULL);
+	gs_test_reinitialise_plugin_loader (plugin_loader, allowlist, NULL);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -1961,6 +2193,8 @@ main (int argc, char **argv)
 	g_assert_true (ret);
 
 	/* plugin tests go here */
+	g_test_add_func ("/gnome-software/plugins/flatpak/progress",
+			 gs_plugins_flatpak_progress_func);
 	g_test_add_data_func ("/gnome-software/plugins/flatpak/app-with-runtime",
 			      plugin_loader,
 			      (GTestDataFunc) gs_plugins_flatpak_app_with_runtime_func);
@@ -1994,6 +2228,9 @@ main (int argc, char **argv)
 	g_test_add_data_func ("/gnome-software/plugins/flatpak/repo{non-ascii}",
 			      plugin_loader,
 			      (GTestDataFunc) gs_plugins_flatpak_repo_non_ascii_func);
+	g_test_add_data_func ("/gnome-software/plugins/flatpak/installations",
+			      plugin_loader,
+			      (GTestDataFunc) gs_plugins_flatpak_installations_func);
 	retval = g_test_run ();
 
 	/* Clean up. */
@@ -107,6 +107,9 @@ gs_plugin_fwupd_init (GsPluginFwupd *self)
 
 	/* set name of MetaInfo file */
 	gs_plugin_set_appstream_id (GS_PLUGIN (self), "org.gnome.Software.Plugin.Fwupd");
+
+	/* see gs_plugin_adopt_app() */
+	gs_plugin_add_adopt_component_kind (GS_PLUGIN (self), AS_COMPONENT_KIND_FIRMWARE);
 }
 
 static void
@@ -138,11 +138,33 @@ gs_plugin_packagekit_init (GsPluginPackagekit *self)
 	/* we can return better results than dpkg directly */
 	gs_plugin_add_rule (plugin, GS_PLUGIN_RULE_CONFLICTS, "dpkg");
 
+	/* see gs_plugin_adopt_app() */
+	gs_plugin_add_adopt_bundle_kind (plugin, AS_BUNDLE_KIND_PACKAGE);
+	gs_plugin_add_adopt_component_kind (plugin, AS_COMPONENT_KIND_OPERATING_SYSTEM);
+
 	/* need repos::repo-filename */
 	gs_plugin_add_rule (plugin, GS_PLUGIN_RULE_RUN_AFTER, "repos");
 
 	/* generic updates happen after PackageKit offline updates */
 	gs_plugin_add_rule (plugin, GS_PLUGIN_RULE_RUN_BEFORE, "generic-updates");
+
+	/* only ever fills in the package data for the apps it manages, from
+	 * their package names */
+	gs_plugin_set_refine_flags (plugin,
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_LICENSE |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_URL |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_DESCRIPTION |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_SIZE |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_VERSION |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_HISTORY |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_SETUP_ACTION |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_UPDATE_DETAILS |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_ORIGIN |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_RELATED |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_UPDATE_SEVERITY |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_UPGRADE_REMOVED |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_PROVENANCE,
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_ID);
 }
 
 static void
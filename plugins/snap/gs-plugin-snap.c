@@ -149,6 +149,26 @@ gs_plugin_snap_init (GsPluginSnap *self)
 	gs_plugin_add_rule (GS_PLUGIN (self), GS_PLUGIN_RULE_BETTER_THAN, "packagekit");
 	gs_plugin_add_rule (GS_PLUGIN (self), GS_PLUGIN_RULE_RUN_BEFORE, "icons");
 
+	/* only ever fills in the data for the snaps it manages, from snapd */
+	gs_plugin_set_refine_flags (GS_PLUGIN (self),
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_LICENSE |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_URL |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_DESCRIPTION |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_SIZE |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_VERSION |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_SETUP_ACTION |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_ORIGIN |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_SIZE_DATA |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_ORIGIN_HOSTNAME |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_SCREENSHOTS |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_DEVELOPER_NAME |
+				    GS_PLUGIN_REFINE_FLAGS_REQUIRE_KUDOS,
+				    GS_PLUGIN_REFINE_FLAGS_NONE);
+
+	/* gs_plugin_adopt_app() also matches on the app ID, so don’t declare
+	 * what it adopts; it is asked about every app */
+
 	/* set name of MetaInfo file */
 	gs_plugin_set_appstream_id (GS_PLUGIN (self), "org.gnome.Software.Plugin.Snap");
 }
@@ -12,6 +12,8 @@
 
 #include "gs-appstream.h"
 #include "gs-plugin-vanilla-meta.h"
+#include "gs-vanilla-meta-containers.h"
+#include "gs-vanilla-meta-state.h"
 #include "gs-vanilla-meta-util.h"
 
 static gint get_priority_for_interactivity(gboolean interactive);
@@ -32,7 +34,8 @@ static void enable_repository_thread_cb(GTask *task,
                                         gpointer source_object,
                                         gpointer task_data,
                                         GCancellable *cancellable);
-gboolean check_app_is_installed(GsApp *app,
+gboolean check_app_is_installed(GsPluginVanillaMeta *self,
+                                GsApp *app,
                                 GCancellable *cancellable,
                                 GError *error,
                                 gboolean update_status);
@@ -53,6 +56,14 @@ struct _GsPluginVanillaMeta {
     GsWorkerThread *worker; /* (owned) */
     GMutex silo_mutex;
     XbSilo *silo;
+    GsVanillaMetaState *state; /* (owned) */
+    GsVanillaMetaContainers *containers; /* (owned) */
+
+    // One worker per apx container, so that operations in different
+    // containers run concurrently while those in the same container are
+    // serialised, as its package manager would require
+    GMutex container_workers_mutex;
+    GHashTable *container_workers; /* (element-type utf8 GsWorkerThread) (owned) */
 };
 
 G_DEFINE_TYPE(GsPluginVanillaMeta, gs_plugin_vanilla_meta, GS_TYPE_PLUGIN)
@@ -65,6 +76,7 @@ gs_plugin_vanilla_meta_dispose(GObject *object)
     GsPluginVanillaMeta *self = GS_PLUGIN_VANILLA_META(object);
 
     g_clear_object(&self->worker);
+    g_clear_pointer(&self->container_workers, g_hash_table_unref);
     g_mutex_clear(&self->silo_mutex);
     G_OBJECT_CLASS(gs_plugin_vanilla_meta_parent_class)->dispose(object);
 }
@@ -72,6 +84,11 @@ gs_plugin_vanilla_meta_dispose(GObject *object)
 static void
 gs_plugin_vanilla_meta_finalize(GObject *object)
 {
+    GsPluginVanillaMeta *self = GS_PLUGIN_VANILLA_META(object);
+
+    g_clear_pointer(&self->state, gs_vanilla_meta_state_free);
+    g_clear_pointer(&self->containers, gs_vanilla_meta_containers_free);
+    g_mutex_clear(&self->container_workers_mutex);
     G_OBJECT_CLASS(gs_plugin_vanilla_meta_parent_class)->finalize(object);
 }
 
@@ -81,6 +98,64 @@ get_priority_for_interactivity(gboolean interactive)
     return interactive ? G_PRIORITY_DEFAULT : G_PRIORITY_LOW;
 }
 
+// Returns the worker for @container, starting it if needed. It stays valid
+// until the plugin is disposed.
+static GsWorkerThread *
+get_container_worker(GsPluginVanillaMeta *self, const gchar *container)
+{
+    g_autoptr(GMutexLocker) locker = g_mutex_locker_new(&self->container_workers_mutex);
+    GsWorkerThread *worker;
+
+    if (container == NULL)
+        container = "apx_managed";
+
+    worker = g_hash_table_lookup(self->container_workers, container);
+    if (worker == NULL) {
+        g_autofree gchar *name = g_strdup_printf("gs-plugin-vanilla-meta-%s", container);
+
+        worker = gs_worker_thread_new(name);
+        g_hash_table_insert(self->container_workers, g_strdup(container), worker);
+    }
+
+    return worker;
+}
+
+static void
+async_result_cb(GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+    GAsyncResult **result_out = user_data;
+
+    *result_out = g_object_ref(result);
+}
+
+// Runs @thread_func on the worker for @app's container and waits for it,
+// for the synchronous plugin vfuncs
+static gboolean
+run_in_container_worker(GsPluginVanillaMeta *self,
+                        GsApp *app,
+                        GTaskThreadFunc thread_func,
+                        GCancellable *cancellable,
+                        GError **error)
+{
+    g_autoptr(GMainContext) context      = g_main_context_new();
+    g_autoptr(GMainContextPusher) pusher = g_main_context_pusher_new(context);
+    g_autoptr(GAsyncResult) result       = NULL;
+    g_autoptr(GTask) task                = NULL;
+    const gchar *container               = gs_app_get_metadata_item(app, "Vanilla::container");
+
+    task = g_task_new(self, cancellable, async_result_cb, &result);
+    g_task_set_source_tag(task, run_in_container_worker);
+    g_task_set_task_data(task, g_object_ref(app), g_object_unref);
+
+    gs_worker_thread_queue(get_container_worker(self, container), G_PRIORITY_DEFAULT, thread_func,
+                           g_steal_pointer(&task));
+
+    while (result == NULL)
+        g_main_context_iteration(context, TRUE);
+
+    return g_task_propagate_boolean(G_TASK(result), error);
+}
+
 static void
 gs_plugin_vanilla_meta_setup_async(GsPlugin *plugin,
                                    GCancellable *cancellable,
@@ -193,6 +268,9 @@ refresh_plugin_cache(GsPluginVanillaMeta *self, GCancellable *cancellable, GErro
                 g_debug("Could not refine app %s", gs_app_get_id(app));
                 return FALSE;
             }
+
+            // Whether it's installed is checked when it's refined, on the
+            // worker for its container
         }
     }
 
@@ -205,6 +283,117 @@ gs_plugin_vanilla_meta_setup_finish(GsPlugin *plugin, GAsyncResult *result, GErr
     return g_task_propagate_boolean(G_TASK(result), error);
 }
 
+static void shutdown_cb(GObject *source_object, GAsyncResult *result, gpointer user_data);
+static void shutdown_container_workers(GTask *task);
+static void container_worker_shutdown_unref(GTask *task);
+static void
+container_worker_shutdown_cb(GObject *source_object, GAsyncResult *result, gpointer user_data);
+
+static void
+gs_plugin_vanilla_meta_shutdown_async(GsPlugin *plugin,
+                                      GCancellable *cancellable,
+                                      GAsyncReadyCallback callback,
+                                      gpointer user_data)
+{
+    GsPluginVanillaMeta *self = GS_PLUGIN_VANILLA_META(plugin);
+    g_autoptr(GTask) task     = NULL;
+
+    task = g_task_new(self, cancellable, callback, user_data);
+    g_task_set_source_tag(task, gs_plugin_vanilla_meta_shutdown_async);
+
+    // The worker is only started by setup
+    if (self->worker == NULL) {
+        shutdown_container_workers(g_steal_pointer(&task));
+        return;
+    }
+
+    // Stop the worker thread first, as it queues work on the container workers.
+    // Any refine still waiting on a container worker is completed by that
+    // worker, which runs everything queued before it stops.
+    gs_worker_thread_shutdown_async(self->worker, cancellable, shutdown_cb,
+                                    g_steal_pointer(&task));
+}
+
+static void
+shutdown_cb(GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+    g_autoptr(GTask) task            = G_TASK(user_data);
+    GsPluginVanillaMeta *self        = g_task_get_source_object(task);
+    g_autoptr(GsWorkerThread) worker = NULL;
+    g_autoptr(GError) local_error    = NULL;
+
+    worker = g_steal_pointer(&self->worker);
+
+    if (!gs_worker_thread_shutdown_finish(worker, result, &local_error)) {
+        g_task_return_error(task, g_steal_pointer(&local_error));
+        return;
+    }
+
+    shutdown_container_workers(g_steal_pointer(&task));
+}
+
+// Stops every container worker, then returns @task (transfer full). Nothing
+// queues work on them any more, so they are stopped without a cancellable,
+// as a cancelled shutdown would leave their threads unjoined. The task
+// holds one pending count of its own until they have all been told to stop.
+static void
+shutdown_container_workers(GTask *task)
+{
+    GsPluginVanillaMeta *self      = g_task_get_source_object(task);
+    g_autoptr(GMutexLocker) locker = g_mutex_locker_new(&self->container_workers_mutex);
+    guint *n_pending               = g_new0(guint, 1);
+    GHashTableIter iter;
+    gpointer container_worker;
+
+    g_task_set_task_data(task, n_pending, g_free);
+    *n_pending = 1;
+
+    g_hash_table_iter_init(&iter, self->container_workers);
+    while (g_hash_table_iter_next(&iter, NULL, &container_worker)) {
+        (*n_pending)++;
+        gs_worker_thread_shutdown_async(container_worker, NULL, container_worker_shutdown_cb,
+                                        g_object_ref(task));
+    }
+    g_clear_pointer(&locker, g_mutex_locker_free);
+
+    container_worker_shutdown_unref(task);
+    g_object_unref(task);
+}
+
+static void
+container_worker_shutdown_unref(GTask *task)
+{
+    GsPluginVanillaMeta *self = g_task_get_source_object(task);
+    guint *n_pending          = g_task_get_task_data(task);
+
+    if (--(*n_pending) > 0)
+        return;
+
+    g_mutex_lock(&self->container_workers_mutex);
+    g_hash_table_remove_all(self->container_workers);
+    g_mutex_unlock(&self->container_workers_mutex);
+
+    g_task_return_boolean(task, TRUE);
+}
+
+static void
+container_worker_shutdown_cb(GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+    g_autoptr(GTask) task         = G_TASK(user_data);
+    g_autoptr(GError) local_error = NULL;
+
+    if (!gs_worker_thread_shutdown_finish(GS_WORKER_THREAD(source_object), result, &local_error))
+        g_debug("Failed to stop container worker: %s", local_error->message);
+
+    container_worker_shutdown_unref(task);
+}
+
+static gboolean
+gs_plugin_vanilla_meta_shutdown_finish(GsPlugin *plugin, GAsyncResult *result, GError **error)
+{
+    return g_task_propagate_boolean(G_TASK(result), error);
+}
+
 static void
 gs_plugin_vanilla_meta_init(GsPluginVanillaMeta *self)
 {
@@ -212,8 +401,28 @@ gs_plugin_vanilla_meta_init(GsPluginVanillaMeta *self)
 
     gs_plugin_set_appstream_id(plugin, "org.gnome.Software.Plugin.VanillaMeta");
 
+    self->state      = gs_vanilla_meta_state_new();
+    self->containers = gs_vanilla_meta_containers_new();
+
+    g_mutex_init(&self->container_workers_mutex);
+    self->container_workers =
+        g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref);
+
     gs_plugin_add_rule(plugin, GS_PLUGIN_RULE_RUN_AFTER, "appstream");
     gs_plugin_add_rule(plugin, GS_PLUGIN_RULE_RUN_BEFORE, "icons");
+
+    // Refines its apps from its own AppStream data, which can set their IDs,
+    // so this is refined in series with everything
+    gs_plugin_set_refine_flags(plugin,
+                               GS_APPSTREAM_REFINE_FLAGS_PROVIDED |
+                                   GS_PLUGIN_REFINE_FLAGS_REQUIRE_SETUP_ACTION |
+                                   GS_PLUGIN_REFINE_FLAGS_REQUIRE_ORIGIN_UI |
+                                   GS_PLUGIN_REFINE_FLAGS_REQUIRE_ORIGIN_HOSTNAME |
+                                   GS_PLUGIN_REFINE_FLAGS_REQUIRE_PROVENANCE,
+                               GS_PLUGIN_REFINE_FLAGS_NONE);
+
+    // See gs_plugin_adopt_app()
+    gs_plugin_add_adopt_origin(plugin, "vanilla_meta");
 }
 
 gboolean
@@ -273,7 +482,7 @@ gs_plugin_add_sources(GsPlugin *plugin, GsAppList *list, GCancellable *cancellab
                 gs_appstream_create_app(plugin, self->silo, components->pdata[i], &local_error);
 
             g_debug("Created app %s", gs_app_get_name(related));
-            if (check_app_is_installed(related, cancellable, local_error, TRUE))
+            if (check_app_is_installed(self, related, cancellable, local_error, TRUE))
                 gs_app_add_related(app, related);
         }
     } else {
@@ -394,76 +603,49 @@ gs_plugin_launch(GsPlugin *plugin, GsApp *app, GCancellable *cancellable, GError
                                          NULL, error);
 }
 
-gboolean
-gs_plugin_app_install(GsPlugin *plugin, GsApp *app, GCancellable *cancellable, GError **error)
+static gboolean
+install_app(GsPluginVanillaMeta *self, GsApp *app, GCancellable *cancellable, GError **error)
 {
     const gchar *package_name       = NULL;
     const gchar *container_flag     = NULL;
     const gchar *app_container_name = gs_app_get_metadata_item(app, "Vanilla::container");
     SubprocessOutput *output        = NULL;
+    gboolean container_installed    = FALSE;
 
-    // Only process this app if was created by this plugin
-    if (!gs_app_has_management_plugin(app, plugin))
-        return TRUE;
-
-    // Check container exists, otherwise run init for it
-    output = gs_vanilla_meta_run_subprocess(
-        "podman container ls --noheading -a | rev | cut -d\' \' -f 1 | rev",
-        G_SUBPROCESS_FLAGS_STDOUT_PIPE, cancellable, error);
-
-    if (output->input_stream != NULL) {
-        g_autoptr(GByteArray) ls_out = g_byte_array_new();
-        gchar buffer[4096];
-        gsize nread = 0;
-        gboolean success;
-        g_auto(GStrv) splits = NULL;
-
-        gs_app_set_state(app, GS_APP_STATE_INSTALLING);
-
-        while (success = g_input_stream_read_all(output->input_stream, buffer, sizeof(buffer),
-                                                 &nread, cancellable, error),
-               success && nread > 0) {
-            g_byte_array_append(ls_out, (const guint8 *)buffer, nread);
-        }
-
-        // If we have a valid output
-        if (success && ls_out->len > 0) {
-            // NUL-terminate the array, to use it as a string
-            g_byte_array_append(ls_out, (const guint8 *)"", 1);
+    if (app_container_name == NULL) {
+        g_debug("Install: Container name not set for %s, cannot install", gs_app_get_name(app));
+        return FALSE;
+    }
 
-            splits = g_strsplit((gchar *)ls_out->data, "\n", -1);
+    gs_app_set_state(app, GS_APP_STATE_INSTALLING);
 
-            if (app_container_name == NULL) {
-                g_debug("Install: Container name not set for %s, cannot install",
-                        gs_app_get_name(app));
-                gs_app_set_state(app, GS_APP_STATE_AVAILABLE);
-                free(output);
-                return FALSE;
-            }
+    // Check container exists, otherwise run init for it
+    if (!gs_vanilla_meta_containers_contains(self->containers, app_container_name,
+                                             &container_installed, cancellable, error)) {
+        gs_app_set_state(app, GS_APP_STATE_AVAILABLE);
+        return FALSE;
+    }
 
-            gboolean container_installed = FALSE;
-            for (guint i = 0; i < g_strv_length(splits); i++) {
-                if (g_strcmp0(splits[i], app_container_name) == 0) {
-                    // Container is installed, nothing to do for now
-                    g_debug("Container %s already initialized", app_container_name);
-                    container_installed = TRUE;
-                    break;
-                }
-            }
+    if (container_installed) {
+        g_debug("Container %s already initialized", app_container_name);
+    } else {
+        g_autofree gchar *init_cmd = NULL;
 
-            // Initialize container
-            if (!container_installed) {
-                g_debug("Install: Running init for container %s", app_container_name);
+        g_debug("Install: Running init for container %s", app_container_name);
 
-                container_flag = apx_container_flag_from_name(app_container_name);
+        container_flag = apx_container_flag_from_name(app_container_name);
+        init_cmd       = g_strdup_printf("apx %s init", container_flag);
 
-                const gchar *init_cmd = g_strdup_printf("apx %s init", container_flag);
-                gs_vanilla_meta_run_subprocess(init_cmd, G_SUBPROCESS_FLAGS_STDOUT_SILENCE,
-                                               cancellable, error);
-            }
+        output = gs_vanilla_meta_run_subprocess(init_cmd, G_SUBPROCESS_FLAGS_STDOUT_SILENCE,
+                                                cancellable, error);
+        if (output == NULL) {
+            gs_app_set_state(app, GS_APP_STATE_AVAILABLE);
+            return FALSE;
         }
+        if (output->exit_code == 0)
+            gs_vanilla_meta_containers_add(self->containers, app_container_name);
+        free(output);
     }
-    free(output);
 
     // Install package and process output
     if (container_flag == NULL)
@@ -483,6 +665,7 @@ gs_plugin_app_install(GsPlugin *plugin, GsApp *app, GCancellable *cancellable, G
 
     output = gs_vanilla_meta_run_subprocess(install_cmd, G_SUBPROCESS_FLAGS_STDOUT_SILENCE,
                                             cancellable, error);
+    gs_vanilla_meta_state_invalidate(self->state, app_container_name);
     if (output->input_stream != NULL) {
         gs_app_set_state(app, GS_APP_STATE_INSTALLED);
         free(output);
@@ -494,17 +677,13 @@ gs_plugin_app_install(GsPlugin *plugin, GsApp *app, GCancellable *cancellable, G
     }
 }
 
-gboolean
-gs_plugin_app_remove(GsPlugin *plugin, GsApp *app, GCancellable *cancellable, GError **error)
+static gboolean
+remove_app(GsPluginVanillaMeta *self, GsApp *app, GCancellable *cancellable, GError **error)
 {
     const gchar *package_name       = NULL;
     const gchar *container_flag     = NULL;
     const gchar *app_container_name = gs_app_get_metadata_item(app, "Vanilla::container");
 
-    // Only process this app if was created by this plugin
-    if (!gs_app_has_management_plugin(app, plugin))
-        return TRUE;
-
     container_flag = apx_container_flag_from_name(app_container_name);
     package_name   = gs_app_get_source_default(app);
     if (package_name == NULL) {
@@ -517,6 +696,7 @@ gs_plugin_app_remove(GsPlugin *plugin, GsApp *app, GCancellable *cancellable, GE
 
     SubprocessOutput *output = gs_vanilla_meta_run_subprocess(
         remove_cmd, G_SUBPROCESS_FLAGS_STDOUT_SILENCE, cancellable, error);
+    gs_vanilla_meta_state_invalidate(self->state, app_container_name);
 
     if (output->input_stream != NULL) {
         gs_app_set_state(app, GS_APP_STATE_AVAILABLE);
@@ -529,6 +709,58 @@ gs_plugin_app_remove(GsPlugin *plugin, GsApp *app, GCancellable *cancellable, GE
     }
 }
 
+static void
+install_thread_cb(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+    GsPluginVanillaMeta *self     = GS_PLUGIN_VANILLA_META(source_object);
+    GsApp *app                    = task_data;
+    g_autoptr(GError) local_error = NULL;
+    gboolean success;
+
+    success = install_app(self, app, cancellable, &local_error);
+    if (local_error != NULL)
+        g_task_return_error(task, g_steal_pointer(&local_error));
+    else
+        g_task_return_boolean(task, success);
+}
+
+gboolean
+gs_plugin_app_install(GsPlugin *plugin, GsApp *app, GCancellable *cancellable, GError **error)
+{
+    // Only process this app if was created by this plugin
+    if (!gs_app_has_management_plugin(app, plugin))
+        return TRUE;
+
+    return run_in_container_worker(GS_PLUGIN_VANILLA_META(plugin), app, install_thread_cb,
+                                   cancellable, error);
+}
+
+static void
+remove_thread_cb(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+    GsPluginVanillaMeta *self     = GS_PLUGIN_VANILLA_META(source_object);
+    GsApp *app                    = task_data;
+    g_autoptr(GError) local_error = NULL;
+    gboolean success;
+
+    success = remove_app(self, app, cancellable, &local_error);
+    if (local_error != NULL)
+        g_task_return_error(task, g_steal_pointer(&local_error));
+    else
+        g_task_return_boolean(task, success);
+}
+
+gboolean
+gs_plugin_app_remove(GsPlugin *plugin, GsApp *app, GCancellable *cancellable, GError **error)
+{
+    // Only process this app if was created by this plugin
+    if (!gs_app_has_management_plugin(app, plugin))
+        return TRUE;
+
+    return run_in_container_worker(GS_PLUGIN_VANILLA_META(plugin), app, remove_thread_cb,
+                                   cancellable, error);
+}
+
 void
 gs_plugin_adopt_app(GsPlugin *plugin, GsApp *app)
 {
@@ -546,7 +778,11 @@ gs_plugin_adopt_app(GsPlugin *plugin, GsApp *app)
 }
 
 gboolean
-check_app_is_installed(GsApp *app, GCancellable *cancellable, GError *error, gboolean update_status)
+check_app_is_installed(GsPluginVanillaMeta *self,
+                       GsApp *app,
+                       GCancellable *cancellable,
+                       GError *error,
+                       gboolean update_status)
 {
     const gchar *package_name       = NULL;
     const gchar *container_flag     = NULL;
@@ -554,6 +790,7 @@ check_app_is_installed(GsApp *app, GCancellable *cancellable, GError *error, gbo
     const gchar *app_container_name = NULL;
     SubprocessOutput *output        = NULL;
     gboolean query_result           = FALSE;
+    g_autoptr(GError) state_error   = NULL;
 
     app_container_name = gs_app_get_metadata_item(app, "Vanilla::container");
     container_flag = apx_container_flag_from_name(app_container_name);
@@ -564,6 +801,19 @@ check_app_is_installed(GsApp *app, GCancellable *cancellable, GError *error, gbo
         return FALSE;
     }
 
+    // Ask the cached container state first, which only needs one
+    // subprocess per container rather than one per app
+    query_result = gs_vanilla_meta_state_is_installed(
+        self->state, app_container_name != NULL ? app_container_name : "apx_managed",
+        package_name, cancellable, &state_error);
+    if (state_error == NULL) {
+        g_debug("Package %s is %sinstalled", gs_app_get_name(app), query_result ? "" : "not ");
+        if (update_status)
+            gs_app_set_state(app, query_result ? GS_APP_STATE_INSTALLED : GS_APP_STATE_AVAILABLE);
+        return query_result;
+    }
+    g_debug("Falling back to apx for %s: %s", gs_app_get_name(app), state_error->message);
+
     check_cmd = g_strdup_printf("apx %s show -i %s", container_flag, package_name);
 
     output = gs_vanilla_meta_run_subprocess(
@@ -700,35 +950,125 @@ gs_plugin_vanilla_meta_refine_async(GsPlugin *plugin,
     task = gs_plugin_refine_data_new_task(plugin, list, flags, cancellable, callback, user_data);
 
     g_task_set_source_tag(task, gs_plugin_vanilla_meta_refine_async);
+    g_task_set_priority(task, get_priority_for_interactivity(interactive));
 
-    gs_worker_thread_queue(self->worker, get_priority_for_interactivity(interactive),
-                           refine_thread_cb, g_steal_pointer(&task));
+    gs_worker_thread_queue(self->worker, g_task_get_priority(task), refine_thread_cb,
+                           g_steal_pointer(&task));
+}
+
+typedef struct {
+    GTask *task; // (owned) the refine task
+    gint n_pending; // (atomic)
+} RefineFanout;
+
+// Called from the plugin's worker and from the container workers. The refine
+// task is returned from whichever finishes last; its callback runs in the
+// caller's context, so it does not depend on the plugin's worker still running.
+static void
+refine_fanout_complete_one(RefineFanout *fanout)
+{
+    if (!g_atomic_int_dec_and_test(&fanout->n_pending))
+        return;
+
+    g_task_return_boolean(fanout->task, TRUE);
+    g_object_unref(fanout->task);
+    g_free(fanout);
+}
+
+typedef struct {
+    GsAppList *list; // (owned)
+    RefineFanout *fanout; // (unowned)
+} CheckInstalledData;
+
+static void
+check_installed_data_free(CheckInstalledData *data)
+{
+    g_object_unref(data->list);
+    g_free(data);
+}
+
+static void
+check_installed_thread_cb(GTask *task,
+                          gpointer source_object,
+                          gpointer task_data,
+                          GCancellable *cancellable)
+{
+    GsPluginVanillaMeta *self = GS_PLUGIN_VANILLA_META(source_object);
+    CheckInstalledData *data  = task_data;
+
+    for (guint i = 0; i < gs_app_list_length(data->list); i++)
+        check_app_is_installed(self, gs_app_list_index(data->list, i), cancellable, NULL, TRUE);
+
+    refine_fanout_complete_one(data->fanout);
+    g_task_return_boolean(task, TRUE);
 }
 
 static void
 refine_thread_cb(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
 {
-    GsPluginVanillaMeta *self     = GS_PLUGIN_VANILLA_META(source_object);
-    GsPluginRefineData *data      = task_data;
-    g_autoptr(GError) local_error = NULL;
+    GsPluginVanillaMeta *self               = GS_PLUGIN_VANILLA_META(source_object);
+    GsPluginRefineData *data                = task_data;
+    g_autoptr(GHashTable) apps_by_container = NULL;
+    g_autoptr(GError) local_error           = NULL;
+    RefineFanout *fanout                    = NULL;
+    GHashTableIter iter;
+    gpointer container, list;
 
     assert_in_worker(self);
 
     refresh_plugin_cache(self, cancellable, &local_error);
 
+    apps_by_container = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref);
+
     for (guint i = 0; i < gs_app_list_length(data->list); i++) {
-        GsApp *app               = gs_app_list_index(data->list, i);
-        GsPluginRefineData *data = task_data;
+        GsApp *app = gs_app_list_index(data->list, i);
+        const gchar *app_container_name;
+        GsAppList *container_list;
+        g_autoptr(GError) refine_error = NULL;
 
         if (g_strcmp0(gs_app_get_origin(app), "vanilla_meta"))
             continue;
 
-        if (!refine_app(self, app, data->flags, cancellable, &local_error)) {
-            g_task_return_error(task, g_steal_pointer(&local_error));
+        if (!refine_app(self, app, data->flags, cancellable, &refine_error)) {
+            g_debug("Could not refine app %s", gs_app_get_id(app));
+            continue;
+        }
+
+        app_container_name = gs_app_get_metadata_item(app, "Vanilla::container");
+        if (app_container_name == NULL)
+            app_container_name = "apx_managed";
+
+        container_list = g_hash_table_lookup(apps_by_container, app_container_name);
+        if (container_list == NULL) {
+            container_list = gs_app_list_new();
+            g_hash_table_insert(apps_by_container, g_strdup(app_container_name), container_list);
         }
+        gs_app_list_add(container_list, app);
     }
 
-    g_task_return_boolean(task, TRUE);
+    // Checking which apps are installed needs a subprocess per container, so
+    // do it on each container's worker and finish when the last one has.
+    // The fanout holds one reference of its own until everything is queued.
+    fanout       = g_new0(RefineFanout, 1);
+    fanout->task = g_object_ref(task);
+    g_atomic_int_set(&fanout->n_pending, 1);
+
+    g_hash_table_iter_init(&iter, apps_by_container);
+    while (g_hash_table_iter_next(&iter, &container, &list)) {
+        g_autoptr(GTask) check_task    = g_task_new(self, cancellable, NULL, NULL);
+        CheckInstalledData *check_data = g_new0(CheckInstalledData, 1);
+
+        check_data->list   = g_object_ref(list);
+        check_data->fanout = fanout;
+        g_task_set_source_tag(check_task, check_installed_thread_cb);
+        g_task_set_task_data(check_task, check_data, (GDestroyNotify) check_installed_data_free);
+
+        g_atomic_int_inc(&fanout->n_pending);
+        gs_worker_thread_queue(get_container_worker(self, container), g_task_get_priority(task),
+                               check_installed_thread_cb, g_steal_pointer(&check_task));
+    }
+
+    refine_fanout_complete_one(fanout);
 }
 
 static gboolean
@@ -738,12 +1078,13 @@ refine_app(GsPluginVanillaMeta *self,
            GCancellable *cancellable,
            GError **error)
 {
-    g_autofree gchar *id_safe     = NULL;
-    g_autofree gchar *xpath       = NULL;
-    g_autoptr(XbNode) component   = NULL;
-    const gchar *container_name   = NULL;
-    g_autoptr(XbNode) child       = NULL;
-    g_autoptr(GError) local_error = NULL;
+    g_autofree gchar *id_safe      = NULL;
+    g_autofree gchar *xpath        = NULL;
+    g_autoptr(XbNode) component    = NULL;
+    const gchar *container_name    = NULL;
+    g_autoptr(XbNode) child        = NULL;
+    g_autoptr(GError) local_error  = NULL;
+    g_autoptr(GMutexLocker) locker = NULL;
     XbNodeChildIter iter;
 
     if (!gs_app_has_management_plugin(app, NULL))
@@ -760,7 +1101,7 @@ refine_app(GsPluginVanillaMeta *self,
                                 "id[text()='%s']/..",
                               id_safe);
 
-    g_mutex_lock(&self->silo_mutex);
+    locker    = g_mutex_locker_new(&self->silo_mutex);
     component = xb_silo_query_first(self->silo, xpath, &local_error);
     if (local_error != NULL) {
         g_debug("Failed to refine app %s in query stage", gs_app_get_name(app));
@@ -792,9 +1133,7 @@ refine_app(GsPluginVanillaMeta *self,
         g_debug("Failed to refine app %s", gs_app_get_name(app));
         return FALSE;
     }
-    g_mutex_unlock(&self->silo_mutex);
-
-    check_app_is_installed(app, cancellable, local_error, TRUE);
+    g_clear_pointer(&locker, g_mutex_locker_free);
 
     // Iterate node's children until we find container name
     xb_node_child_iter_init(&iter, component);
@@ -835,6 +1174,8 @@ gs_plugin_vanilla_meta_class_init(GsPluginVanillaMetaClass *klass)
 
     plugin_class->setup_async               = gs_plugin_vanilla_meta_setup_async;
     plugin_class->setup_finish              = gs_plugin_vanilla_meta_setup_finish;
+    plugin_class->shutdown_async            = gs_plugin_vanilla_meta_shutdown_async;
+    plugin_class->shutdown_finish           = gs_plugin_vanilla_meta_shutdown_finish;
     plugin_class->enable_repository_async   = gs_plugin_vanilla_meta_enable_repository_async;
     plugin_class->enable_repository_finish  = gs_plugin_vanilla_meta_enable_repository_finish;
     plugin_class->disable_repository_async  = gs_plugin_vanilla_meta_disable_repository_async;
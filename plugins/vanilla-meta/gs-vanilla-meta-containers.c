@@ -0,0 +1,299 @@
+/*
+ * Copyright (C) 2023 Mateus Melchiades
+ */
+
+/*
+ * Keeps the set of podman containers, so that installing an app doesn't need
+ * to ask podman whether its apx container has been initialised.
+ *
+ * The containers are listed once with podman's JSON output and saved to a
+ * snapshot in the cache directory, which is reused by the next session as
+ * long as podman's container database hasn't been modified since. The
+ * database is also monitored, so containers created or removed outside of
+ * GNOME Software are noticed.
+ */
+
+#include <config.h>
+
+#include <gnome-software.h>
+#include <json-glib/json-glib.h>
+#include <sys/stat.h>
+
+#include "gs-vanilla-meta-containers.h"
+
+struct _GsVanillaMetaContainers {
+    GMutex mutex;
+    GHashTable *names;       // (element-type utf8 utf8) (owned) (nullable) NULL until loaded
+    gint64 storage_mtime;    // of storage_filename when names was listed
+    gboolean stale;          // set when storage_filename changes
+    gchar *storage_filename; // (owned) podman's container database
+    GFileMonitor *monitor;   // (owned) (nullable)
+};
+
+static gint64
+get_mtime(const gchar *filename)
+{
+    struct stat st;
+
+    if (filename == NULL || stat(filename, &st) != 0)
+        return 0;
+    return (gint64)st.st_mtim.tv_sec * G_USEC_PER_SEC + st.st_mtim.tv_nsec / 1000;
+}
+
+static void
+storage_changed_cb(GFileMonitor *monitor,
+                   GFile *file,
+                   GFile *other_file,
+                   GFileMonitorEvent event_type,
+                   gpointer user_data)
+{
+    GsVanillaMetaContainers *containers = user_data;
+    g_autoptr(GMutexLocker) locker      = g_mutex_locker_new(&containers->mutex);
+
+    g_debug("Podman containers changed");
+    containers->stale = TRUE;
+}
+
+static gchar *
+get_snapshot_filename(GError **error)
+{
+    return gs_utils_get_cache_filename("vanilla-meta", "containers.json",
+                                       GS_UTILS_CACHE_FLAG_WRITEABLE |
+                                           GS_UTILS_CACHE_FLAG_CREATE_DIRECTORY,
+                                       error);
+}
+
+// Adds the strings in the @member array of @object to @names
+static void
+add_names_from_member(GHashTable *names, JsonObject *object, const gchar *member)
+{
+    JsonNode *node = json_object_get_member(object, member);
+    JsonArray *array;
+
+    if (node == NULL || !JSON_NODE_HOLDS_ARRAY(node))
+        return;
+
+    array = json_node_get_array(node);
+    for (guint i = 0; i < json_array_get_length(array); i++) {
+        const gchar *name = json_array_get_string_element(array, i);
+
+        if (name != NULL)
+            g_hash_table_add(names, g_strdup(name));
+    }
+}
+
+// Loads the snapshot saved by a previous session, if it's still up to date
+static gboolean
+load_snapshot(GsVanillaMetaContainers *containers)
+{
+    g_autofree gchar *filename   = NULL;
+    g_autoptr(JsonParser) parser = json_parser_new();
+    g_autoptr(GError) error      = NULL;
+    JsonNode *root;
+    JsonObject *object;
+    gint64 storage_mtime;
+
+    filename = get_snapshot_filename(&error);
+    if (filename == NULL || !g_file_test(filename, G_FILE_TEST_EXISTS))
+        return FALSE;
+    if (!json_parser_load_from_file(parser, filename, &error)) {
+        g_debug("Failed to load container snapshot: %s", error->message);
+        return FALSE;
+    }
+
+    root = json_parser_get_root(parser);
+    if (root == NULL || !JSON_NODE_HOLDS_OBJECT(root))
+        return FALSE;
+    object = json_node_get_object(root);
+    if (!json_object_has_member(object, "containers"))
+        return FALSE;
+
+    storage_mtime = json_object_get_int_member_with_default(object, "storage-mtime", 0);
+    if (storage_mtime == 0 || storage_mtime != get_mtime(containers->storage_filename))
+        return FALSE;
+
+    g_clear_pointer(&containers->names, g_hash_table_unref);
+    containers->names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    add_names_from_member(containers->names, object, "containers");
+    containers->storage_mtime = storage_mtime;
+
+    g_debug("Loaded %u containers from snapshot", g_hash_table_size(containers->names));
+    return TRUE;
+}
+
+static void
+save_snapshot(GsVanillaMetaContainers *containers)
+{
+    g_autofree gchar *filename         = NULL;
+    g_autofree gchar *data             = NULL;
+    g_autoptr(JsonBuilder) builder     = json_builder_new();
+    g_autoptr(JsonGenerator) generator = json_generator_new();
+    g_autoptr(JsonNode) root           = NULL;
+    g_autoptr(GError) error            = NULL;
+    GHashTableIter iter;
+    gpointer name;
+
+    filename = get_snapshot_filename(&error);
+    if (filename == NULL) {
+        g_debug("Failed to save container snapshot: %s", error->message);
+        return;
+    }
+
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "storage-mtime");
+    json_builder_add_int_value(builder, containers->storage_mtime);
+    json_builder_set_member_name(builder, "containers");
+    json_builder_begin_array(builder);
+    g_hash_table_iter_init(&iter, containers->names);
+    while (g_hash_table_iter_next(&iter, &name, NULL))
+        json_builder_add_string_value(builder, name);
+    json_builder_end_array(builder);
+    json_builder_end_object(builder);
+
+    root = json_builder_get_root(builder);
+    json_generator_set_root(generator, root);
+    data = json_generator_to_data(generator, NULL);
+
+    if (!g_file_set_contents(filename, data, -1, &error))
+        g_debug("Failed to save container snapshot: %s", error->message);
+}
+
+static GHashTable *
+list_containers(GCancellable *cancellable, GError **error)
+{
+    g_autoptr(GSubprocess) subprocess = NULL;
+    g_autoptr(JsonParser) parser      = json_parser_new();
+    g_autoptr(GsTraceSpan) trace_span = NULL;
+    g_autofree gchar *stdout_buf      = NULL;
+    GHashTable *names;
+    JsonNode *root;
+    JsonArray *array;
+
+    trace_span = gs_trace_span_begin("subprocess:podman");
+    gs_trace_span_set_detail(trace_span, "container ls");
+
+    subprocess = g_subprocess_new(G_SUBPROCESS_FLAGS_STDOUT_PIPE | G_SUBPROCESS_FLAGS_STDERR_SILENCE,
+                                  error, "podman", "container", "ls", "--all", "--format", "json",
+                                  NULL);
+    if (subprocess == NULL)
+        return NULL;
+    if (!g_subprocess_communicate_utf8(subprocess, NULL, cancellable, &stdout_buf, NULL, error))
+        return NULL;
+    if (!g_subprocess_get_if_exited(subprocess) || g_subprocess_get_exit_status(subprocess) != 0) {
+        g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to list podman containers");
+        return NULL;
+    }
+
+    if (!json_parser_load_from_data(parser, stdout_buf != NULL ? stdout_buf : "", -1, error))
+        return NULL;
+    root = json_parser_get_root(parser);
+
+    // Podman prints nothing at all rather than an empty array on some versions
+    names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    if (root == NULL)
+        return names;
+    if (!JSON_NODE_HOLDS_ARRAY(root)) {
+        g_hash_table_unref(names);
+        g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                            "Unexpected output listing podman containers");
+        return NULL;
+    }
+
+    array = json_node_get_array(root);
+    for (guint i = 0; i < json_array_get_length(array); i++) {
+        JsonNode *node = json_array_get_element(array, i);
+
+        if (JSON_NODE_HOLDS_OBJECT(node))
+            add_names_from_member(names, json_node_get_object(node), "Names");
+    }
+
+    g_debug("Listed %u podman containers", g_hash_table_size(names));
+    return names;
+}
+
+GsVanillaMetaContainers *
+gs_vanilla_meta_containers_new(void)
+{
+    GsVanillaMetaContainers *containers = g_new0(GsVanillaMetaContainers, 1);
+    g_autoptr(GFile) storage_file       = NULL;
+    g_autoptr(GError) error             = NULL;
+
+    g_mutex_init(&containers->mutex);
+    containers->storage_filename = g_build_filename(g_get_user_data_dir(), "containers", "storage",
+                                                    "overlay-containers", "containers.json", NULL);
+
+    // Emitted in the main context, so this has to be created from the main thread
+    storage_file        = g_file_new_for_path(containers->storage_filename);
+    containers->monitor = g_file_monitor_file(storage_file, G_FILE_MONITOR_NONE, NULL, &error);
+    if (containers->monitor != NULL)
+        g_signal_connect(containers->monitor, "changed", G_CALLBACK(storage_changed_cb), containers);
+    else
+        g_debug("Failed to monitor podman containers: %s", error->message);
+
+    return containers;
+}
+
+void
+gs_vanilla_meta_containers_free(GsVanillaMetaContainers *containers)
+{
+    if (containers->monitor != NULL) {
+        g_signal_handlers_disconnect_by_data(containers->monitor, containers);
+        g_file_monitor_cancel(containers->monitor);
+        g_object_unref(containers->monitor);
+    }
+    g_clear_pointer(&containers->names, g_hash_table_unref);
+    g_free(containers->storage_filename);
+    g_mutex_clear(&containers->mutex);
+    g_free(containers);
+}
+
+/*
+ * Sets @contains_out to whether podman has a container called @container,
+ * listing the containers first if they aren't known yet or have changed.
+ * Returns FALSE with @error set if they couldn't be listed.
+ */
+gboolean
+gs_vanilla_meta_containers_contains(GsVanillaMetaContainers *containers,
+                                    const gchar *container,
+                                    gboolean *contains_out,
+                                    GCancellable *cancellable,
+                                    GError **error)
+{
+    g_autoptr(GMutexLocker) locker = g_mutex_locker_new(&containers->mutex);
+
+    if (containers->names == NULL && !containers->stale)
+        load_snapshot(containers);
+
+    // The monitor only works while the main context is iterated, so check
+    // the database hasn't changed under a command line client too
+    if (containers->names == NULL || containers->stale ||
+        containers->storage_mtime != get_mtime(containers->storage_filename)) {
+        GHashTable *names;
+        gint64 storage_mtime = get_mtime(containers->storage_filename);
+
+        names = list_containers(cancellable, error);
+        if (names == NULL)
+            return FALSE;
+
+        g_clear_pointer(&containers->names, g_hash_table_unref);
+        containers->names         = names;
+        containers->storage_mtime = storage_mtime;
+        containers->stale         = FALSE;
+        save_snapshot(containers);
+    }
+
+    *contains_out = g_hash_table_contains(containers->names, container);
+    return TRUE;
+}
+
+/*
+ * Records that @container has just been created, e.g. by `apx init`.
+ */
+void
+gs_vanilla_meta_containers_add(GsVanillaMetaContainers *containers, const gchar *container)
+{
+    g_autoptr(GMutexLocker) locker = g_mutex_locker_new(&containers->mutex);
+
+    if (containers->names != NULL)
+        g_hash_table_add(containers->names, g_strdup(container));
+}
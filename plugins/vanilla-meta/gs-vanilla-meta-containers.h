@@ -0,0 +1,25 @@
+/*
+ * Copyright (C) 2023 Mateus Melchiades
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GsVanillaMetaContainers GsVanillaMetaContainers;
+
+GsVanillaMetaContainers *gs_vanilla_meta_containers_new(void);
+void gs_vanilla_meta_containers_free(GsVanillaMetaContainers *containers);
+gboolean gs_vanilla_meta_containers_contains(GsVanillaMetaContainers *containers,
+                                             const gchar *container,
+                                             gboolean *contains_out,
+                                             GCancellable *cancellable,
+                                             GError **error);
+void gs_vanilla_meta_containers_add(GsVanillaMetaContainers *containers, const gchar *container);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(GsVanillaMetaContainers, gs_vanilla_meta_containers_free)
+
+G_END_DECLS
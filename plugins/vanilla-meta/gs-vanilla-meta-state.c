@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2023 Mateus Melchiades
+ */
+
+/*
+ * Keeps the set of installed packages for each apx container, so that
+ * refining a list of apps is a hash lookup per app rather than one
+ * `apx show` subprocess per app.
+ *
+ * Each container is enumerated with a single subprocess, which also reports
+ * the container's overlay upper directory. The package database inside it is
+ * then stat()ed on every lookup, and the container is enumerated again once
+ * its modification time changes.
+ */
+
+#include <config.h>
+
+#include <gnome-software.h>
+#include <sys/stat.h>
+
+#include "gs-vanilla-meta-state.h"
+
+// Only used when the package database can't be found on the host
+#define GS_VANILLA_META_STATE_MAX_AGE (5 * 60 * G_USEC_PER_SEC)
+
+typedef struct {
+    const gchar *container;
+    const gchar *list_cmd;
+    const gchar *db_path; // relative to the container root
+} PackageDb;
+
+static const PackageDb package_dbs[] = {
+    // dpkg also lists packages which were removed but kept their config
+    // files ("rc"), so only keep those whose current status is installed
+    // ("ii", or "hi" if held)
+    { "apx_managed",
+      "dpkg-query -W -f='${db:Status-Abbrev} ${Package}\\n' | awk 'substr($1, 2, 1) == \"i\" { print $2 }'",
+      "var/lib/dpkg/status" },
+    { "apx_managed_aur", "pacman -Qq", "var/lib/pacman/local" },
+    { "apx_managed_dnf", "rpm -qa --qf '%{NAME}\\n'", "usr/lib/sysimage/rpm" },
+    { "apx_managed_apk", "apk info", "lib/apk/db/installed" },
+    { "apx_managed_zypper", "rpm -qa --qf '%{NAME}\\n'", "usr/lib/sysimage/rpm" },
+    { "apx_managed_xbps", "xbps-query -l | awk '{print $2}' | sed 's/-[^-]*$//'", "var/db/xbps" },
+};
+
+typedef struct {
+    GHashTable *packages; // (element-type utf8 utf8) (owned)
+    gchar *db_filename;   // (nullable) (owned) package database on the host
+    gint64 db_mtime;
+    gint64 enumerated_at;
+} ContainerState;
+
+struct _GsVanillaMetaState {
+    GMutex mutex;
+    GHashTable *containers; // (element-type utf8 ContainerState) (owned)
+};
+
+static void
+container_state_free(ContainerState *container_state)
+{
+    g_hash_table_unref(container_state->packages);
+    g_free(container_state->db_filename);
+    g_free(container_state);
+}
+
+static const PackageDb *
+package_db_for_container(const gchar *container)
+{
+    for (gsize i = 0; i < G_N_ELEMENTS(package_dbs); i++) {
+        if (g_strcmp0(package_dbs[i].container, container) == 0)
+            return &package_dbs[i];
+    }
+    return NULL;
+}
+
+static gint64
+get_mtime(const gchar *filename)
+{
+    struct stat st;
+
+    if (filename == NULL || stat(filename, &st) != 0)
+        return 0;
+    return (gint64)st.st_mtim.tv_sec * G_USEC_PER_SEC + st.st_mtim.tv_nsec / 1000;
+}
+
+static ContainerState *
+enumerate_container(const gchar *container,
+                    const PackageDb *db,
+                    GCancellable *cancellable,
+                    GError **error)
+{
+    g_autoptr(GSubprocess) subprocess = NULL;
+    g_autofree gchar *container_quoted = g_shell_quote(container);
+    g_autofree gchar *list_cmd_quoted  = g_shell_quote(db->list_cmd);
+    g_autofree gchar *cmd              = NULL;
+    g_autofree gchar *stdout_buf       = NULL;
+    g_auto(GStrv) lines                = NULL;
+    g_autoptr(GsTraceSpan) trace_span  = NULL;
+    ContainerState *container_state;
+
+    // The first line is the overlay upper directory, the rest are package names
+    cmd = g_strdup_printf("podman inspect --format '{{.GraphDriver.Data.UpperDir}}' %s && "
+                          "podman start %s >/dev/null && "
+                          "podman exec %s sh -c %s",
+                          container_quoted, container_quoted, container_quoted, list_cmd_quoted);
+
+    trace_span = gs_trace_span_begin("subprocess:podman");
+    gs_trace_span_set_detail(trace_span, container);
+
+    subprocess = g_subprocess_new(G_SUBPROCESS_FLAGS_STDOUT_PIPE | G_SUBPROCESS_FLAGS_STDERR_SILENCE,
+                                  error, "sh", "-c", cmd, NULL);
+    if (subprocess == NULL)
+        return NULL;
+    if (!g_subprocess_communicate_utf8(subprocess, NULL, cancellable, &stdout_buf, NULL, error))
+        return NULL;
+    if (!g_subprocess_get_if_exited(subprocess) || g_subprocess_get_exit_status(subprocess) != 0) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                    "Failed to list installed packages in container %s", container);
+        return NULL;
+    }
+
+    container_state           = g_new0(ContainerState, 1);
+    container_state->packages = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    lines = g_strsplit(stdout_buf != NULL ? stdout_buf : "", "\n", -1);
+    for (guint i = 0; lines[i] != NULL; i++) {
+        g_strstrip(lines[i]);
+        if (lines[i][0] == '\0')
+            continue;
+        if (i == 0) {
+            if (g_path_is_absolute(lines[i]))
+                container_state->db_filename = g_build_filename(lines[i], db->db_path, NULL);
+            continue;
+        }
+        g_hash_table_add(container_state->packages, g_strdup(lines[i]));
+    }
+
+    container_state->db_mtime      = get_mtime(container_state->db_filename);
+    container_state->enumerated_at = g_get_monotonic_time();
+
+    g_debug("Container %s has %u installed packages", container,
+            g_hash_table_size(container_state->packages));
+    return container_state;
+}
+
+static gboolean
+container_state_is_valid(ContainerState *container_state)
+{
+    if (container_state->db_filename == NULL)
+        return g_get_monotonic_time() - container_state->enumerated_at <
+               GS_VANILLA_META_STATE_MAX_AGE;
+    return get_mtime(container_state->db_filename) == container_state->db_mtime;
+}
+
+GsVanillaMetaState *
+gs_vanilla_meta_state_new(void)
+{
+    GsVanillaMetaState *state = g_new0(GsVanillaMetaState, 1);
+
+    g_mutex_init(&state->mutex);
+    state->containers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                              (GDestroyNotify)container_state_free);
+    return state;
+}
+
+void
+gs_vanilla_meta_state_free(GsVanillaMetaState *state)
+{
+    g_hash_table_unref(state->containers);
+    g_mutex_clear(&state->mutex);
+    g_free(state);
+}
+
+/*
+ * Returns TRUE if @package_name is installed in @container. If the container
+ * can't be enumerated, FALSE is returned with @error set, and the caller
+ * should fall back to asking apx directly.
+ */
+gboolean
+gs_vanilla_meta_state_is_installed(GsVanillaMetaState *state,
+                                   const gchar *container,
+                                   const gchar *package_name,
+                                   GCancellable *cancellable,
+                                   GError **error)
+{
+    g_autoptr(GMutexLocker) locker = NULL;
+    const PackageDb *db            = package_db_for_container(container);
+    ContainerState *container_state;
+
+    if (db == NULL) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                    "Unknown package database for container %s", container);
+        return FALSE;
+    }
+
+    locker          = g_mutex_locker_new(&state->mutex);
+    container_state = g_hash_table_lookup(state->containers, container);
+    if (container_state != NULL && container_state_is_valid(container_state))
+        return g_hash_table_contains(container_state->packages, package_name);
+    g_clear_pointer(&locker, g_mutex_locker_free);
+
+    // Don't hold up lookups in other containers while this one is enumerated.
+    // Most lookups come from the container's worker, but add_sources runs on
+    // the loader's thread, so the same container can be enumerated twice at
+    // once. That only wastes work: each enumeration builds its own state, and
+    // the last one to finish replaces the other under the lock.
+    container_state = enumerate_container(container, db, cancellable, error);
+
+    locker = g_mutex_locker_new(&state->mutex);
+    if (container_state == NULL) {
+        g_hash_table_remove(state->containers, container);
+        return FALSE;
+    }
+    g_hash_table_replace(state->containers, g_strdup(container), container_state);
+
+    return g_hash_table_contains(container_state->packages, package_name);
+}
+
+/*
+ * Forgets what is installed in @container, e.g. after installing or removing
+ * something in it.
+ */
+void
+gs_vanilla_meta_state_invalidate(GsVanillaMetaState *state, const gchar *container)
+{
+    g_autoptr(GMutexLocker) locker = g_mutex_locker_new(&state->mutex);
+
+    if (container != NULL)
+        g_hash_table_remove(state->containers, container);
+}
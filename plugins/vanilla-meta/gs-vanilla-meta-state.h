@@ -0,0 +1,25 @@
+/*
+ * Copyright (C) 2023 Mateus Melchiades
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GsVanillaMetaState GsVanillaMetaState;
+
+GsVanillaMetaState *gs_vanilla_meta_state_new(void);
+void gs_vanilla_meta_state_free(GsVanillaMetaState *state);
+gboolean gs_vanilla_meta_state_is_installed(GsVanillaMetaState *state,
+                                            const gchar *container,
+                                            const gchar *package_name,
+                                            GCancellable *cancellable,
+                                            GError **error);
+void gs_vanilla_meta_state_invalidate(GsVanillaMetaState *state, const gchar *container);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(GsVanillaMetaState, gs_vanilla_meta_state_free)
+
+G_END_DECLS
@@ -7,7 +7,9 @@
 #include <glib.h>
 #include <glib/gi18n.h>
 #include <gnome-software.h>
+#include <glib/gstdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "gs-plugin-vso.h"
 
@@ -19,9 +21,23 @@ static void list_apps_thread_cb(GTask *task,
                                 gpointer task_data,
                                 GCancellable *cancellable);
 
+// How long to reuse the result of `vso update-check` for, as long as the
+// transaction lock doesn't change
+#define GS_PLUGIN_VSO_UPDATES_MAX_AGE (30 * 60 * G_USEC_PER_SEC)
+
+typedef struct {
+    gboolean locked;
+    gint64 mtime; // of the lock file, if locked
+} LockState;
+
 struct _GsPluginVso {
     GsPlugin parent;
     GsWorkerThread *worker; /* (owned) */
+
+    GMutex updates_mutex;
+    GsAppList *updates; // (owned) (nullable) (mutex updates_mutex) result of the last check
+    LockState updates_lock_state; // (mutex updates_mutex)
+    gint64 updates_checked_at;    // (mutex updates_mutex)
 };
 
 G_DEFINE_TYPE(GsPluginVso, gs_plugin_vso, GS_TYPE_PLUGIN)
@@ -42,6 +58,10 @@ gs_plugin_vso_dispose(GObject *object)
 static void
 gs_plugin_vso_finalize(GObject *object)
 {
+    GsPluginVso *self = GS_PLUGIN_VSO(object);
+
+    g_clear_object(&self->updates);
+    g_mutex_clear(&self->updates_mutex);
     G_OBJECT_CLASS(gs_plugin_vso_parent_class)->finalize(object);
 }
 
@@ -87,7 +107,12 @@ gs_plugin_vso_init(GsPluginVso *self)
 {
     GsPlugin *plugin = GS_PLUGIN(self);
 
+    g_mutex_init(&self->updates_mutex);
+
     gs_plugin_add_rule(plugin, GS_PLUGIN_RULE_RUN_AFTER, "appstream");
+
+    // See gs_plugin_adopt_app()
+    gs_plugin_add_adopt_component_kind(plugin, AS_COMPONENT_KIND_DESKTOP_APP);
 }
 
 void
@@ -215,6 +240,27 @@ gs_plugin_add_updates_historical(GsPlugin *plugin,
     return TRUE;
 }
 
+static LockState
+get_lock_state(void)
+{
+    LockState lock_state = { FALSE, 0 };
+    GStatBuf st;
+
+    if (g_stat(lock_path, &st) == 0) {
+        lock_state.locked = TRUE;
+        lock_state.mtime  = st.st_mtime;
+    }
+    return lock_state;
+}
+
+static void
+forget_updates(GsPluginVso *self)
+{
+    g_autoptr(GMutexLocker) locker = g_mutex_locker_new(&self->updates_mutex);
+
+    g_clear_object(&self->updates);
+}
+
 gboolean
 gs_plugin_update(GsPlugin *plugin, GsAppList *list, GCancellable *cancellable, GError **error)
 {
@@ -263,83 +309,143 @@ gs_plugin_update(GsPlugin *plugin, GsAppList *list, GCancellable *cancellable, G
         return FALSE;
     }
 
+    // The pending updates have changed
+    forget_updates(GS_PLUGIN_VSO(plugin));
+
     return TRUE;
 }
 
+// Parses a line of `vso update-check` output, in the format
+// "  - <name>\t<old version> -> <new version>". Returns FALSE for any other line.
+static gboolean
+parse_update_line(const gchar *line,
+                  gchar **name_out,
+                  gchar **old_version_out,
+                  gchar **new_version_out)
+{
+    const gchar *tab;
+    const gchar *arrow;
+
+    if (!g_str_has_prefix(line, "  - "))
+        return FALSE;
+    line += strlen("  - ");
+
+    tab = strchr(line, '\t');
+    if (tab == NULL)
+        return FALSE;
+    arrow = strstr(tab + 1, " -> ");
+    if (arrow == NULL)
+        return FALSE;
+
+    *name_out        = g_strndup(line, tab - line);
+    *old_version_out = g_strndup(tab + 1, arrow - (tab + 1));
+    *new_version_out = g_strstrip(g_strdup(arrow + strlen(" -> ")));
+    return TRUE;
+}
+
+// Reuses the app from the previous check if there is one, so the updates
+// page keeps the same objects across refreshes
+static GsApp *
+ensure_update_app(GsPlugin *plugin,
+                  const gchar *name,
+                  const gchar *old_version,
+                  const gchar *new_version)
+{
+    g_autoptr(GsApp) app = gs_plugin_cache_lookup(plugin, name);
+
+    if (app == NULL) {
+        app = gs_app_new(NULL);
+        gs_app_set_management_plugin(app, plugin);
+        gs_app_set_name(app, GS_APP_QUALITY_LOWEST, name);
+        gs_app_add_quirk(app, GS_APP_QUIRK_NEEDS_REBOOT);
+        gs_app_set_scope(app, AS_COMPONENT_SCOPE_SYSTEM);
+        gs_app_set_bundle_kind(app, AS_BUNDLE_KIND_PACKAGE);
+        gs_app_set_kind(app, AS_COMPONENT_KIND_GENERIC);
+        gs_app_set_size_download(app, GS_SIZE_TYPE_VALID, 0);
+        gs_app_add_source(app, name);
+        gs_plugin_cache_add(plugin, name, app);
+    }
+
+    gs_app_set_version(app, old_version);
+    gs_app_set_update_version(app, new_version);
+    gs_app_set_state(app, GS_APP_STATE_UPDATABLE);
+
+    return g_steal_pointer(&app);
+}
+
 gboolean
 gs_plugin_add_updates(GsPlugin *plugin, GsAppList *list, GCancellable *cancellable, GError **error)
 {
-    const gchar *cmd = "pkexec vso update-check";
-    g_autoptr(GError) local_error = NULL;
-
+    GsPluginVso *self                 = GS_PLUGIN_VSO(plugin);
+    g_autoptr(GMutexLocker) locker    = NULL;
     g_autoptr(GSubprocess) subprocess = NULL;
-    GInputStream *input_stream;
+    g_autoptr(GDataInputStream) data_stream = NULL;
+    g_autoptr(GsAppList) updates      = NULL;
+    g_autoptr(GError) local_error     = NULL;
+    LockState lock_state;
+
+    // Held while checking, so that concurrent refreshes share one check
+    locker     = g_mutex_locker_new(&self->updates_mutex);
+    lock_state = get_lock_state();
+
+    if (self->updates != NULL && self->updates_lock_state.locked == lock_state.locked &&
+        self->updates_lock_state.mtime == lock_state.mtime &&
+        g_get_monotonic_time() - self->updates_checked_at < GS_PLUGIN_VSO_UPDATES_MAX_AGE) {
+        g_debug("Reusing the result of the last update check");
+        gs_app_list_add_list(list, self->updates);
+        return TRUE;
+    }
 
-    subprocess = g_subprocess_new(G_SUBPROCESS_FLAGS_STDOUT_PIPE, error, "sh", "-c", cmd, NULL);
-    if (!g_subprocess_wait(subprocess, cancellable, error))
+    subprocess = g_subprocess_new(G_SUBPROCESS_FLAGS_STDOUT_PIPE, error, "pkexec", "vso",
+                                  "update-check", NULL);
+    if (subprocess == NULL)
         return FALSE;
 
-    input_stream = g_subprocess_get_stdout_pipe(subprocess);
-
-    if (input_stream != NULL) {
-        g_autoptr(GByteArray) ls_out = g_byte_array_new();
-        gchar buffer[4096];
-        gsize nread = 0;
-        gboolean success;
-        g_auto(GStrv) splits       = NULL;
-        g_auto(GStrv) pkg_splits   = NULL;
-        g_auto(GStrv) pkg_versions = NULL;
-
-        while (success = g_input_stream_read_all(input_stream, buffer, sizeof(buffer), &nread,
-                                                 cancellable, error),
-               success && nread > 0) {
-            g_byte_array_append(ls_out, (const guint8 *)buffer, nread);
-        }
+    // Create the apps as the lines arrive, rather than buffering all the
+    // output; reading before waiting also stops vso blocking on a full pipe
+    updates     = gs_app_list_new();
+    data_stream = g_data_input_stream_new(g_subprocess_get_stdout_pipe(subprocess));
 
-        if (local_error != NULL) {
-            g_debug("Error checking for updates: %s", local_error->message);
-            return FALSE;
-        }
+    while (TRUE) {
+        g_autofree gchar *line        = NULL;
+        g_autofree gchar *name        = NULL;
+        g_autofree gchar *old_version = NULL;
+        g_autofree gchar *new_version = NULL;
+        g_autoptr(GsApp) app          = NULL;
 
-        // If we have a valid output
-        if (success && ls_out->len > 0) {
-            // NUL-terminate the array, to use it as a string
-            g_byte_array_append(ls_out, (const guint8 *)"", 1);
-
-            splits = g_strsplit((gchar *)ls_out->data, "\n", -1);
-
-            // Format: "  - %s\t%s -> %s", pkg_name, pkg_oldver, pkg_newver
-            for (guint i = 0; i < g_strv_length(splits); i++) {
-                if (g_str_has_prefix(splits[i], "  - ")) {
-                    gchar *split_no_prefix = &splits[i][4];
-
-                    pkg_splits   = g_strsplit(split_no_prefix, "\t", 2);
-                    pkg_versions = g_strsplit(pkg_splits[1], " -> ", 2);
-
-                    g_debug("Package: %s", pkg_splits[0]);
-                    g_debug("Old ver: %s", pkg_versions[0]);
-                    g_debug("New ver: %s", pkg_versions[1]);
-
-                    g_autoptr(GsApp) app = gs_app_new(NULL);
-                    gs_app_set_management_plugin(app, plugin);
-                    gs_app_set_name(app, GS_APP_QUALITY_LOWEST, g_strdup(pkg_splits[0]));
-                    gs_app_add_quirk(app, GS_APP_QUIRK_NEEDS_REBOOT);
-                    gs_app_set_scope(app, AS_COMPONENT_SCOPE_SYSTEM);
-                    gs_app_set_bundle_kind(app, AS_BUNDLE_KIND_PACKAGE);
-                    gs_app_set_kind(app, AS_COMPONENT_KIND_GENERIC);
-                    gs_app_set_size_download(app, GS_SIZE_TYPE_VALID, 0);
-                    gs_app_add_source(app, g_strdup(pkg_splits[0]));
-                    gs_app_set_version(app, g_strdup(pkg_versions[0]));
-                    gs_app_set_update_version(app, g_strdup(pkg_versions[1]));
-                    gs_app_set_state(app, GS_APP_STATE_UPDATABLE);
-
-                    gs_plugin_cache_add(plugin, pkg_splits[0], app);
-                    gs_app_list_add(list, app);
-                }
-            }
-        }
+        line = g_data_input_stream_read_line_utf8(data_stream, NULL, cancellable, &local_error);
+        if (line == NULL)
+            break;
+        if (!parse_update_line(line, &name, &old_version, &new_version))
+            continue;
+
+        g_debug("Package %s: %s -> %s", name, old_version, new_version);
+        app = ensure_update_app(plugin, name, old_version, new_version);
+        gs_app_list_add(updates, app);
+    }
+
+    if (local_error != NULL) {
+        g_debug("Error checking for updates: %s", local_error->message);
+        g_propagate_error(error, g_steal_pointer(&local_error));
+        return FALSE;
+    }
+
+    if (!g_subprocess_wait(subprocess, cancellable, error))
+        return FALSE;
+
+    gs_app_list_add_list(list, updates);
+
+    // Don't remember a failed check, e.g. if authentication was dismissed
+    if (!g_subprocess_get_if_exited(subprocess) ||
+        g_subprocess_get_exit_status(subprocess) != EXIT_SUCCESS) {
+        g_debug("vso update-check failed");
+        return TRUE;
     }
 
+    g_set_object(&self->updates, updates);
+    self->updates_lock_state = lock_state;
+    self->updates_checked_at = g_get_monotonic_time();
+
     return TRUE;
 }
 
@@ -151,6 +151,8 @@ gs_application_init (GsApplication *application)
 		  _("Prefer local file sources to AppStream"), NULL },
 		{ "version", 0, 0, G_OPTION_ARG_NONE, NULL,
 		  _("Show version number"), NULL },
+		{ "dump-trace", '\0', 0, G_OPTION_ARG_NONE, NULL,
+		  _("Save a trace of recent operations in the running instance"), NULL },
 		{ NULL }
 	};
 
@@ -896,6 +898,22 @@ verbose_activated (GSimpleAction *action,
 	gs_debug_set_verbose (app->debug, TRUE);
 }
 
+static void
+dump_trace_activated (GSimpleAction *action,
+		      GVariant      *parameter,
+		      gpointer       data)
+{
+	GsApplication *app = GS_APPLICATION (data);
+	g_autofree gchar *filename = NULL;
+	g_autoptr(GError) error = NULL;
+
+	filename = gs_plugin_loader_dump_trace (app->plugin_loader, &error);
+	if (filename == NULL)
+		g_warning ("Failed to save trace: %s", error->message);
+	else
+		g_message ("Saved trace to %s", filename);
+}
+
 static GActionEntry actions[] = {
 	{ "about", about_activated, NULL, NULL, NULL },
 	{ "quit", quit_activated, NULL, NULL, NULL },
@@ -906,6 +924,7 @@ static GActionEntry actions[] = {
 	{ "show-offline-update-error", show_offline_updates_error, NULL, NULL, NULL },
 	{ "autoupdate", autoupdate_activated, NULL, NULL, NULL },
 	{ "verbose", verbose_activated, NULL, NULL, NULL },
+	{ "dump-trace", dump_trace_activated, NULL, NULL, NULL },
 	{ "nop", NULL, NULL, NULL }
 };
 
@@ -1256,6 +1275,15 @@ gs_application_handle_local_options (GApplication *app, GVariantDict *options)
 						NULL);
 	}
 
+	if (g_variant_dict_contains (options, "dump-trace")) {
+		/* The trace is written by the running instance, to its
+		 * cache directory */
+		g_action_group_activate_action (G_ACTION_GROUP (app),
+						"dump-trace",
+						NULL);
+		return 0;
+	}
+
 	if (g_variant_dict_lookup (options, "mode", "&s", &mode)) {
 		g_action_group_activate_action (G_ACTION_GROUP (app),
 						"set-mode",
@@ -17,6 +17,9 @@
 
 #define SPINNER_TIMEOUT_SECS 2
 
+/* how many decoded screenshots to keep around for showing again */
+#define TEXTURE_CACHE_SIZE 8
+
 struct _GsScreenshotImage
 {
 	GtkWidget	 parent_instance;
@@ -33,6 +36,8 @@ struct _GsScreenshotImage
 	SoupSession	*session;
 	SoupMessage	*message;
 	GCancellable	*cancellable;
+	GCancellable	*decode_cancellable;
+	guint		 decode_serial;
 	gchar		*filename;
 	const gchar	*current_image;
 	guint		 width;
@@ -100,46 +105,6 @@ gs_screenshot_image_set_error (GsScreenshotImage *ssimg, const gchar *message)
 	gs_screenshot_image_stop_spinner (ssimg);
 }
 
-static void
-as_screenshot_show_image (GsScreenshotImage *ssimg)
-{
-	if (as_screenshot_get_media_kind (ssimg->screenshot) == AS_SCREENSHOT_MEDIA_KIND_VIDEO) {
-		gtk_video_set_filename (GTK_VIDEO (ssimg->video), ssimg->filename);
-		ssimg->current_image = "video";
-	} else {
-		g_autoptr(GdkPixbuf) pixbuf = NULL;
-
-		/* no need to composite */
-		if (ssimg->width == G_MAXUINT || ssimg->height == G_MAXUINT) {
-			pixbuf = gdk_pixbuf_new_from_file (ssimg->filename, NULL);
-		} else {
-			/* this is always going to have alpha */
-			pixbuf = gdk_pixbuf_new_from_file_at_scale (ssimg->filename,
-								    (gint) (ssimg->width * ssimg->scale),
-								    (gint) (ssimg->height * ssimg->scale),
-								    FALSE, NULL);
-		}
-
-		/* show icon */
-		if (g_strcmp0 (ssimg->current_image, "image1") == 0) {
-			if (pixbuf != NULL)
-				gtk_picture_set_pixbuf (GTK_PICTURE (ssimg->image2), pixbuf);
-			ssimg->current_image = "image2";
-		} else {
-			if (pixbuf != NULL)
-				gtk_picture_set_pixbuf (GTK_PICTURE (ssimg->image1), pixbuf);
-			ssimg->current_image = "image1";
-		}
-	}
-
-	gtk_stack_set_visible_child_name (GTK_STACK (ssimg->stack), ssimg->current_image);
-
-	gtk_widget_show (GTK_WIDGET (ssimg));
-	ssimg->showing_image = TRUE;
-
-	gs_screenshot_image_stop_spinner (ssimg);
-}
-
 static GdkPixbuf *
 gs_pixbuf_resample (GdkPixbuf *original,
 		    guint width,
@@ -218,119 +183,475 @@ gs_pixbuf_save_filename (GdkPixbuf *pixbuf,
 			 GError **error)
 {
 	g_autoptr(GdkPixbuf) pb = NULL;
+	g_autofree gchar *buf = NULL;
+	gsize buf_size;
 
-	/* resample & save pixbuf */
+	/* resample & save pixbuf; the file is replaced atomically, as it may
+	 * be loaded by another thread at the same time */
 	pb = gs_pixbuf_resample (pixbuf, width, height, FALSE);
-	return gdk_pixbuf_save (pb,
-				filename,
-				"png",
-				error,
-				NULL);
+	if (!gdk_pixbuf_save_to_buffer (pb, &buf, &buf_size, "png", error, NULL))
+		return FALSE;
+	return g_file_set_contents (filename, buf, (gssize) buf_size, error);
 }
 
+/* Decoded screenshots, so that showing one again doesn't mean decoding it
+ * again. They are keyed by the cache filename, which is made up of a hash of
+ * the URL and the device pixel size, and by the size they were decoded at.
+ * The most recently used is last. Only used from the main thread. */
+typedef struct {
+	gchar		*key;
+	GdkTexture	*texture;
+} CachedTexture;
+
+static GQueue texture_cache = G_QUEUE_INIT;
+
 static void
-gs_screenshot_image_show_blurred (GsScreenshotImage *ssimg,
-				  const gchar *filename_thumb)
+cached_texture_free (CachedTexture *cached)
 {
-	g_autoptr(GdkPixbuf) pb_src = NULL;
-	g_autoptr(GdkPixbuf) pb = NULL;
+	g_free (cached->key);
+	g_object_unref (cached->texture);
+	g_free (cached);
+}
 
-	pb_src = gdk_pixbuf_new_from_file (filename_thumb, NULL);
-	if (pb_src == NULL)
-		return;
-	pb = gs_pixbuf_resample (pb_src,
-				 ssimg->width * ssimg->scale,
-				 ssimg->height * ssimg->scale,
-				 TRUE /* blurred */);
-	if (pb == NULL)
-		return;
+static gchar *
+gs_screenshot_image_get_texture_key (const gchar *filename,
+				     guint width,
+				     guint height)
+{
+	return g_strdup_printf ("%s@%ux%u", filename, width, height);
+}
 
-	if (g_strcmp0 (ssimg->current_image, "video") == 0) {
-		ssimg->current_image = "image1";
-		gtk_stack_set_visible_child_name (GTK_STACK (ssimg->stack), ssimg->current_image);
+static GdkTexture *
+gs_screenshot_image_texture_cache_lookup (const gchar *key)
+{
+	for (GList *l = texture_cache.head; l != NULL; l = l->next) {
+		CachedTexture *cached = l->data;
+		if (g_strcmp0 (cached->key, key) == 0) {
+			g_queue_unlink (&texture_cache, l);
+			g_queue_push_tail_link (&texture_cache, l);
+			return g_object_ref (cached->texture);
+		}
 	}
+	return NULL;
+}
 
-	if (g_strcmp0 (ssimg->current_image, "image1") == 0) {
-		gtk_picture_set_pixbuf (GTK_PICTURE (ssimg->image1), pb);
-	} else {
-		gtk_picture_set_pixbuf (GTK_PICTURE (ssimg->image2), pb);
+static void
+gs_screenshot_image_texture_cache_insert (const gchar *key,
+					  GdkTexture *texture)
+{
+	CachedTexture *cached;
+
+	for (GList *l = texture_cache.head; l != NULL; l = l->next) {
+		cached = l->data;
+		if (g_strcmp0 (cached->key, key) == 0) {
+			g_queue_delete_link (&texture_cache, l);
+			cached_texture_free (cached);
+			break;
+		}
 	}
+
+	cached = g_new0 (CachedTexture, 1);
+	cached->key = g_strdup (key);
+	cached->texture = g_object_ref (texture);
+	g_queue_push_tail (&texture_cache, cached);
+	while (texture_cache.length > TEXTURE_CACHE_SIZE)
+		cached_texture_free (g_queue_pop_head (&texture_cache));
 }
 
-static gboolean
-gs_screenshot_image_save_downloaded_img (GsScreenshotImage *ssimg,
-					 GdkPixbuf *pixbuf,
-					 GError **error)
+typedef struct {
+	GdkPixbuf	*pixbuf;
+	gchar		*filename;
+	guint		 width;  /* device pixels, or G_MAXUINT to keep the image size */
+	guint		 height;
+	/* the other size the screenshot is shown at, if any */
+	gchar		*counterpart_kind;  /* (nullable) */
+	gchar		*counterpart_basename;  /* (nullable) */
+	guint		 counterpart_width;
+	guint		 counterpart_height;
+} SaveData;
+
+static void
+save_data_free (SaveData *data)
+{
+	g_clear_object (&data->pixbuf);
+	g_free (data->filename);
+	g_free (data->counterpart_kind);
+	g_free (data->counterpart_basename);
+	g_free (data);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (SaveData, save_data_free)
+
+static void
+gs_screenshot_image_save_thread_cb (GTask *task,
+				    gpointer source_object,
+				    gpointer task_data,
+				    GCancellable *cancellable)
 {
-	gboolean ret;
-	const GPtrArray *images;
+	SaveData *data = task_data;
+	guint pixbuf_width = (guint) gdk_pixbuf_get_width (data->pixbuf);
+	guint pixbuf_height = (guint) gdk_pixbuf_get_height (data->pixbuf);
+	g_autofree gchar *filename = NULL;
 	g_autoptr(GError) error_local = NULL;
-	g_autofree char *filename = NULL;
-	g_autofree char *size_dir = NULL;
-	g_autofree char *cache_kind = NULL;
-	g_autofree char *basename = NULL;
-	guint width = ssimg->width;
-	guint height = ssimg->height;
-
-	ret = gs_pixbuf_save_filename (pixbuf, ssimg->filename,
-				      ssimg->width * ssimg->scale,
-				      ssimg->height * ssimg->scale,
-				      error);
-
-	if (!ret)
-		return FALSE;
 
-	if (ssimg->screenshot == NULL)
-		return TRUE;
+	/* is image size destination size unknown or exactly the correct size */
+	if (data->width == G_MAXUINT || data->height == G_MAXUINT ||
+	    (data->width == pixbuf_width && data->height == pixbuf_height)) {
+		if (!gs_pixbuf_save_filename (data->pixbuf, data->filename,
+					      pixbuf_width, pixbuf_height,
+					      &error_local))
+			g_warning ("Failed to save screenshot '%s': %s",
+				   data->filename, error_local->message);
+		g_task_return_boolean (task, TRUE);
+		return;
+	}
 
-	images = as_screenshot_get_images (ssimg->screenshot);
-	if (images->len > 1)
-		return TRUE;
+	if (!gs_pixbuf_save_filename (data->pixbuf, data->filename,
+				      data->width, data->height,
+				      &error_local)) {
+		g_warning ("Failed to save screenshot '%s': %s",
+			   data->filename, error_local->message);
+		g_task_return_boolean (task, TRUE);
+		return;
+	}
 
-	if (width == AS_IMAGE_THUMBNAIL_WIDTH &&
-	    height == AS_IMAGE_THUMBNAIL_HEIGHT) {
-		width = AS_IMAGE_NORMAL_WIDTH;
-		height = AS_IMAGE_NORMAL_HEIGHT;
-	} else {
-		width = AS_IMAGE_THUMBNAIL_WIDTH;
-		height = AS_IMAGE_THUMBNAIL_HEIGHT;
+	if (data->counterpart_kind == NULL) {
+		g_task_return_boolean (task, TRUE);
+		return;
 	}
 
-	width *= ssimg->scale;
-	height *= ssimg->scale;
-	basename = g_path_get_basename (ssimg->filename);
-	size_dir = g_strdup_printf ("%ux%u", width, height);
-	cache_kind = g_build_filename ("screenshots", size_dir, NULL);
-	filename = gs_utils_get_cache_filename (cache_kind, basename,
+	filename = gs_utils_get_cache_filename (data->counterpart_kind,
+						data->counterpart_basename,
 						GS_UTILS_CACHE_FLAG_WRITEABLE |
 						GS_UTILS_CACHE_FLAG_CREATE_DIRECTORY,
 						&error_local);
-
-        if (filename == NULL) {
+	if (filename == NULL) {
 		/* if we cannot get a cache filename, warn about that but do not
 		 * set a user's visible error because this is a complementary
 		 * operation */
-                g_warning ("Failed to get cache filename for counterpart "
-                           "screenshot '%s' in folder '%s': %s", basename,
-                           cache_kind, error_local->message);
-                return TRUE;
-        }
-
-	ret = gs_pixbuf_save_filename (pixbuf, filename,
-					width, height,
-					&error_local);
-
-	if (!ret) {
-		/* if we cannot save this screenshot, warn about that but do not
-		 * set a user's visible error because this is a complementary
-		 * operation */
-                g_warning ("Failed to save screenshot '%s': %s", filename,
-                           error_local->message);
-        }
+		g_warning ("Failed to get cache filename for counterpart "
+			   "screenshot '%s' in folder '%s': %s",
+			   data->counterpart_basename, data->counterpart_kind,
+			   error_local->message);
+	} else if (!gs_pixbuf_save_filename (data->pixbuf, filename,
+					     data->counterpart_width,
+					     data->counterpart_height,
+					     &error_local)) {
+		g_warning ("Failed to save screenshot '%s': %s", filename,
+			   error_local->message);
+	}
+
+	g_task_return_boolean (task, TRUE);
+}
+
+typedef struct {
+	gchar		*filename;
+	GBytes		*bytes;  /* (nullable) a download to decode instead of @filename */
+	guint		 width;  /* device pixels, or G_MAXUINT to keep the image size */
+	guint		 height;
+	gboolean	 blurred;
+	guint		 serial;
+	gchar		*key;  /* (nullable) for the texture cache */
+	SaveData	*save_data;  /* (nullable) how to save the decoded download */
+	GdkPixbuf	*pixbuf;  /* (nullable) the decoded download */
+} DecodeData;
+
+static void
+decode_data_free (DecodeData *data)
+{
+	g_free (data->filename);
+	g_clear_pointer (&data->bytes, g_bytes_unref);
+	g_free (data->key);
+	g_clear_pointer (&data->save_data, save_data_free);
+	g_clear_object (&data->pixbuf);
+	g_free (data);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (DecodeData, decode_data_free)
+
+static void
+gs_screenshot_image_decode_thread_cb (GTask *task,
+				      gpointer source_object,
+				      gpointer task_data,
+				      GCancellable *cancellable)
+{
+	DecodeData *data = task_data;
+	gboolean keep_size = (data->width == G_MAXUINT || data->height == G_MAXUINT);
+	g_autoptr(GdkPixbuf) pixbuf = NULL;
+	g_autoptr(GError) error = NULL;
+
+	if (data->bytes != NULL) {
+		g_autoptr(GInputStream) stream = g_memory_input_stream_new_from_bytes (data->bytes);
+
+		data->pixbuf = gdk_pixbuf_new_from_stream (stream, cancellable, &error);
+		if (data->pixbuf != NULL && keep_size)
+			pixbuf = g_object_ref (data->pixbuf);
+		else if (data->pixbuf != NULL)
+			pixbuf = gs_pixbuf_resample (data->pixbuf, data->width, data->height, FALSE);
+	} else if (data->blurred) {
+		g_autoptr(GdkPixbuf) pixbuf_src = gdk_pixbuf_new_from_file (data->filename, &error);
+
+		if (pixbuf_src != NULL)
+			pixbuf = gs_pixbuf_resample (pixbuf_src,
+						     keep_size ? 0 : data->width,
+						     keep_size ? 0 : data->height,
+						     TRUE /* blurred */);
+	} else if (keep_size) {
+		/* no need to composite */
+		pixbuf = gdk_pixbuf_new_from_file (data->filename, &error);
+	} else {
+		/* this is always going to have alpha */
+		pixbuf = gdk_pixbuf_new_from_file_at_scale (data->filename,
+							    (gint) data->width,
+							    (gint) data->height,
+							    FALSE, &error);
+	}
+
+	if (pixbuf == NULL) {
+		g_task_return_error (task, g_steal_pointer (&error));
+		return;
+	}
+
+	g_task_return_pointer (task, gdk_texture_new_for_pixbuf (pixbuf), g_object_unref);
+}
+
+static void
+gs_screenshot_image_set_texture (GsScreenshotImage *ssimg,
+				 GdkTexture *texture,
+				 gboolean blurred)
+{
+	/* a placeholder until the real image is loaded */
+	if (blurred) {
+		if (g_strcmp0 (ssimg->current_image, "video") == 0) {
+			ssimg->current_image = "image1";
+			gtk_stack_set_visible_child_name (GTK_STACK (ssimg->stack), ssimg->current_image);
+		}
+
+		if (g_strcmp0 (ssimg->current_image, "image1") == 0)
+			gtk_picture_set_paintable (GTK_PICTURE (ssimg->image1), GDK_PAINTABLE (texture));
+		else
+			gtk_picture_set_paintable (GTK_PICTURE (ssimg->image2), GDK_PAINTABLE (texture));
+		return;
+	}
+
+	/* show icon */
+	if (g_strcmp0 (ssimg->current_image, "image1") == 0) {
+		gtk_picture_set_paintable (GTK_PICTURE (ssimg->image2), GDK_PAINTABLE (texture));
+		ssimg->current_image = "image2";
+	} else {
+		gtk_picture_set_paintable (GTK_PICTURE (ssimg->image1), GDK_PAINTABLE (texture));
+		ssimg->current_image = "image1";
+	}
+
+	gtk_stack_set_visible_child_name (GTK_STACK (ssimg->stack), ssimg->current_image);
+}
 
-	return TRUE;
+static void
+gs_screenshot_image_decode_cb (GObject *source_object,
+			       GAsyncResult *result,
+			       gpointer user_data)
+{
+	GsScreenshotImage *ssimg = GS_SCREENSHOT_IMAGE (source_object);
+	DecodeData *data = g_task_get_task_data (G_TASK (result));
+	g_autoptr(GdkTexture) texture = NULL;
+	g_autoptr(GError) error = NULL;
+
+	texture = g_task_propagate_pointer (G_TASK (result), &error);
+	if (texture == NULL) {
+		if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED) ||
+		    data->serial != ssimg->decode_serial)
+			return;
+		if (data->bytes != NULL) {
+			/* TRANSLATORS: possibly image file corrupt or not an image */
+			gs_screenshot_image_set_error (ssimg, _("Failed to load image"));
+		} else {
+			g_debug ("Failed to load screenshot %s: %s",
+				 data->filename, error->message);
+		}
+		return;
+	}
+
+	if (data->key != NULL)
+		gs_screenshot_image_texture_cache_insert (data->key, texture);
+
+	/* keep the download for next time, without holding up showing it */
+	if (data->save_data != NULL && data->pixbuf != NULL) {
+		g_autoptr(GTask) task = g_task_new (NULL, NULL, NULL, NULL);
+
+		data->save_data->pixbuf = g_steal_pointer (&data->pixbuf);
+		g_task_set_source_tag (task, gs_screenshot_image_save_thread_cb);
+		g_task_set_task_data (task, g_steal_pointer (&data->save_data),
+				      (GDestroyNotify) save_data_free);
+		g_task_run_in_thread (task, gs_screenshot_image_save_thread_cb);
+	}
+
+	/* superseded by another image */
+	if (data->serial != ssimg->decode_serial)
+		return;
+
+	gs_screenshot_image_set_texture (ssimg, texture, data->blurred);
+	if (data->bytes != NULL) {
+		gtk_widget_show (GTK_WIDGET (ssimg));
+		ssimg->showing_image = TRUE;
+		gs_screenshot_image_stop_spinner (ssimg);
+	}
+}
+
+/* makes sure any image still being decoded isn't shown */
+static void
+gs_screenshot_image_cancel_decode (GsScreenshotImage *ssimg)
+{
+	g_cancellable_cancel (ssimg->decode_cancellable);
+	g_clear_object (&ssimg->decode_cancellable);
+	ssimg->decode_cancellable = g_cancellable_new ();
+	ssimg->decode_serial++;
+}
+
+static void
+gs_screenshot_image_start_decode (GsScreenshotImage *ssimg,
+				  DecodeData *data)
+{
+	g_autoptr(GTask) task = NULL;
+
+	gs_screenshot_image_cancel_decode (ssimg);
+	data->serial = ssimg->decode_serial;
+
+	task = g_task_new (ssimg, ssimg->decode_cancellable, gs_screenshot_image_decode_cb, NULL);
+	g_task_set_source_tag (task, gs_screenshot_image_start_decode);
+	g_task_set_task_data (task, data, (GDestroyNotify) decode_data_free);
+	g_task_run_in_thread (task, gs_screenshot_image_decode_thread_cb);
+}
+
+static void
+gs_screenshot_image_get_device_size (GsScreenshotImage *ssimg,
+				     guint *width,
+				     guint *height)
+{
+	if (ssimg->width == G_MAXUINT || ssimg->height == G_MAXUINT) {
+		*width = G_MAXUINT;
+		*height = G_MAXUINT;
+	} else {
+		*width = ssimg->width * ssimg->scale;
+		*height = ssimg->height * ssimg->scale;
+	}
+}
+
+/* Shows @filename once it's been decoded in a thread, or straight away if it
+ * was decoded recently. */
+static void
+gs_screenshot_image_decode_file (GsScreenshotImage *ssimg,
+				 const gchar *filename,
+				 gboolean blurred)
+{
+	g_autoptr(DecodeData) data = g_new0 (DecodeData, 1);
+
+	data->filename = g_strdup (filename);
+	data->blurred = blurred;
+	gs_screenshot_image_get_device_size (ssimg, &data->width, &data->height);
+
+	if (!blurred) {
+		g_autoptr(GdkTexture) texture = NULL;
+
+		data->key = gs_screenshot_image_get_texture_key (filename, data->width, data->height);
+		texture = gs_screenshot_image_texture_cache_lookup (data->key);
+		if (texture != NULL) {
+			gs_screenshot_image_cancel_decode (ssimg);
+			gs_screenshot_image_set_texture (ssimg, texture, FALSE);
+			return;
+		}
+	}
+
+	gs_screenshot_image_start_decode (ssimg, g_steal_pointer (&data));
+}
+
+/* Shows the downloaded @bytes once they've been decoded in a thread, then
+ * saves them to ssimg->filename, and to the cache for the other size the
+ * screenshot is shown at if it only comes in one size. */
+static void
+gs_screenshot_image_decode_download (GsScreenshotImage *ssimg,
+				     GBytes *bytes)
+{
+	g_autoptr(DecodeData) data = g_new0 (DecodeData, 1);
+	g_autoptr(SaveData) save_data = g_new0 (SaveData, 1);
+
+	data->filename = g_strdup (ssimg->filename);
+	data->bytes = g_bytes_ref (bytes);
+	gs_screenshot_image_get_device_size (ssimg, &data->width, &data->height);
+	data->key = gs_screenshot_image_get_texture_key (data->filename, data->width, data->height);
+
+	save_data->filename = g_strdup (ssimg->filename);
+	save_data->width = data->width;
+	save_data->height = data->height;
+
+	if (ssimg->screenshot != NULL &&
+	    as_screenshot_get_images (ssimg->screenshot)->len <= 1 &&
+	    data->width != G_MAXUINT && data->height != G_MAXUINT) {
+		g_autofree gchar *size_dir = NULL;
+		guint width;
+		guint height;
+
+		if (ssimg->width == AS_IMAGE_THUMBNAIL_WIDTH &&
+		    ssimg->height == AS_IMAGE_THUMBNAIL_HEIGHT) {
+			width = AS_IMAGE_NORMAL_WIDTH;
+			height = AS_IMAGE_NORMAL_HEIGHT;
+		} else {
+			width = AS_IMAGE_THUMBNAIL_WIDTH;
+			height = AS_IMAGE_THUMBNAIL_HEIGHT;
+		}
+
+		save_data->counterpart_width = width * ssimg->scale;
+		save_data->counterpart_height = height * ssimg->scale;
+		save_data->counterpart_basename = g_path_get_basename (ssimg->filename);
+		size_dir = g_strdup_printf ("%ux%u", save_data->counterpart_width, save_data->counterpart_height);
+		save_data->counterpart_kind = g_build_filename ("screenshots", size_dir, NULL);
+	}
+	data->save_data = g_steal_pointer (&save_data);
+
+	gs_screenshot_image_start_decode (ssimg, g_steal_pointer (&data));
 }
 
+static void
+as_screenshot_show_image (GsScreenshotImage *ssimg)
+{
+	if (as_screenshot_get_media_kind (ssimg->screenshot) == AS_SCREENSHOT_MEDIA_KIND_VIDEO) {
+		gs_screenshot_image_cancel_decode (ssimg);
+		gtk_video_set_filename (GTK_VIDEO (ssimg->video), ssimg->filename);
+		ssimg->current_image = "video";
+		gtk_stack_set_visible_child_name (GTK_STACK (ssimg->stack), ssimg->current_image);
+	} else {
+		gs_screenshot_image_decode_file (ssimg, ssimg->filename, FALSE);
+	}
+
+	gtk_widget_show (GTK_WIDGET (ssimg));
+	ssimg->showing_image = TRUE;
+
+	gs_screenshot_image_stop_spinner (ssimg);
+}
+
+#if SOUP_CHECK_VERSION(3, 0, 0)
+static void
+gs_screenshot_image_read_cb (GObject *source_object,
+			     GAsyncResult *result,
+			     gpointer user_data)
+{
+	GOutputStream *output_stream = G_OUTPUT_STREAM (source_object);
+	g_autoptr(GsScreenshotImage) ssimg = GS_SCREENSHOT_IMAGE (user_data);
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GError) error = NULL;
+
+	if (g_output_stream_splice_finish (output_stream, result, &error) < 0) {
+		if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			return;
+		g_warning ("Failed to download screenshot: %s", error->message);
+		gs_screenshot_image_set_error (ssimg, _("Screenshot not found"));
+		return;
+	}
+
+	bytes = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (output_stream));
+	gs_screenshot_image_decode_download (ssimg, bytes);
+}
+#endif
+
 static void
 #if SOUP_CHECK_VERSION(3, 0, 0)
 gs_screenshot_image_complete_cb (GObject *source_object,
@@ -343,11 +664,14 @@ gs_screenshot_image_complete_cb (SoupSession *session,
 #endif
 {
 	g_autoptr(GsScreenshotImage) ssimg = GS_SCREENSHOT_IMAGE (user_data);
-	gboolean ret;
 	g_autoptr(GError) error = NULL;
-	g_autoptr(GdkPixbuf) pixbuf = NULL;
-	g_autoptr(GInputStream) stream = NULL;
 	guint status_code;
+#if SOUP_CHECK_VERSION(3, 0, 0)
+	g_autoptr(GInputStream) stream = NULL;
+	g_autoptr(GOutputStream) output_stream = NULL;
+#else
+	g_autoptr(GBytes) bytes = NULL;
+#endif
 
 #if SOUP_CHECK_VERSION(3, 0, 0)
 	SoupMessage *msg;
@@ -420,45 +744,18 @@ gs_screenshot_image_complete_cb (SoupSession *session,
 		return;
 	}
 
-#if !SOUP_CHECK_VERSION(3, 0, 0)
-	/* create a buffer with the data */
-	stream = g_memory_input_stream_new_from_data (msg->response_body->data,
-						      msg->response_body->length,
-						      NULL);
-	if (stream == NULL) {
-		gs_screenshot_image_stop_spinner (ssimg);
-		return;
-	}
+	/* read the image, then decode it in a thread */
+#if SOUP_CHECK_VERSION(3, 0, 0)
+	output_stream = g_memory_output_stream_new_resizable ();
+	g_output_stream_splice_async (output_stream, stream,
+				      G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+				      G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+				      G_PRIORITY_DEFAULT, ssimg->cancellable,
+				      gs_screenshot_image_read_cb, g_object_ref (ssimg));
+#else
+	bytes = g_bytes_new (msg->response_body->data, msg->response_body->length);
+	gs_screenshot_image_decode_download (ssimg, bytes);
 #endif
-
-	/* load the image */
-	pixbuf = gdk_pixbuf_new_from_stream (stream, NULL, NULL);
-	if (pixbuf == NULL) {
-		/* TRANSLATORS: possibly image file corrupt or not an image */
-		gs_screenshot_image_set_error (ssimg, _("Failed to load image"));
-		return;
-	}
-
-	/* is image size destination size unknown or exactly the correct size */
-	if (ssimg->width == G_MAXUINT || ssimg->height == G_MAXUINT ||
-	    (ssimg->width * ssimg->scale == (guint) gdk_pixbuf_get_width (pixbuf) &&
-	     ssimg->height * ssimg->scale == (guint) gdk_pixbuf_get_height (pixbuf))) {
-		ret = gs_pixbuf_save_filename (pixbuf, ssimg->filename,
-					       gdk_pixbuf_get_width (pixbuf),
-					       gdk_pixbuf_get_height (pixbuf),
-					       &error);
-		if (!ret) {
-			gs_screenshot_image_set_error (ssimg, error->message);
-			return;
-		}
-	} else if (!gs_screenshot_image_save_downloaded_img (ssimg, pixbuf,
-							     &error)) {
-		gs_screenshot_image_set_error (ssimg, error->message);
-		return;
-	}
-
-	/* got image, so show */
-	as_screenshot_show_image (ssimg);
 }
 
 void
@@ -715,7 +1012,7 @@ gs_screenshot_image_load_async (GsScreenshotImage *ssimg,
 							     NULL);
 		g_assert (cachefn_thumb != NULL);
 		if (g_file_test (cachefn_thumb, G_FILE_TEST_EXISTS))
-			gs_screenshot_image_show_blurred (ssimg, cachefn_thumb);
+			gs_screenshot_image_decode_file (ssimg, cachefn_thumb, TRUE);
 	}
 
 	/* re-request the cache filename, which might be different as it needs
@@ -853,6 +1150,9 @@ gs_screenshot_image_dispose (GObject *object)
 		g_clear_object (&ssimg->cancellable);
 	}
 
+	g_cancellable_cancel (ssimg->decode_cancellable);
+	g_clear_object (&ssimg->decode_cancellable);
+
 	if (ssimg->message != NULL) {
 #if !SOUP_CHECK_VERSION(3, 0, 0)
 		soup_session_cancel_message (ssimg->session,
@@ -878,6 +1178,7 @@ gs_screenshot_image_init (GsScreenshotImage *ssimg)
 
 	ssimg->settings = g_settings_new ("org.gnome.software");
 	ssimg->showing_image = FALSE;
+	ssimg->decode_cancellable = g_cancellable_new ();
 
 	gtk_widget_init_template (GTK_WIDGET (ssimg));
 
@@ -19,6 +19,10 @@
 
 #define GS_SEARCH_PAGE_MAX_RESULTS	50
 
+/* how long to wait after the last keystroke before following the type-ahead
+ * results up with a full search, which also matches summaries and the like */
+#define GS_SEARCH_PAGE_FULL_SEARCH_DELAY	500 /* ms */
+
 struct _GsSearchPage
 {
 	GsPage			 parent_instance;
@@ -33,6 +37,7 @@ struct _GsSearchPage
 	gchar			*appid_to_show;
 	gchar			*value;
 	guint			 waiting_id;
+	guint			 full_search_id;
 	guint			 max_results;
 	guint			 stamp;
 	gboolean		 changed;
@@ -270,8 +275,12 @@ gs_search_page_sort_cb (GsApp *app1, GsApp *app2, gpointer user_data)
 	return g_strcmp0 (key2, key1);
 }
 
+/* @show_waiting is %FALSE when the current results are for the same text,
+ * and should stay on screen until the new ones arrive */
 static void
-gs_search_page_load (GsSearchPage *self)
+gs_search_page_load_with_flags (GsSearchPage *self,
+				GsPluginListAppsFlags flags,
+				gboolean show_waiting)
 {
 	g_autoptr(GsPluginJob) plugin_job = NULL;
 	g_autoptr(GsAppQuery) query = NULL;
@@ -288,7 +297,8 @@ gs_search_page_load (GsSearchPage *self)
 
 	/* search for apps */
 	gs_search_page_waiting_cancel (self);
-	self->waiting_id = g_timeout_add (250, gs_search_page_waiting_show_cb, self);
+	if (show_waiting)
+		self->waiting_id = g_timeout_add (250, gs_search_page_waiting_show_cb, self);
 
 	search_data = g_new0 (GetSearchData, 1);
 	search_data->self = self;
@@ -311,13 +321,43 @@ gs_search_page_load (GsSearchPage *self)
 				  "sort-func", gs_search_page_sort_cb,
 				  "sort-user-data", self,
 				  NULL);
-	plugin_job = gs_plugin_job_list_apps_new (query, GS_PLUGIN_LIST_APPS_FLAGS_NONE);
+	plugin_job = gs_plugin_job_list_apps_new (query, flags);
 	gs_plugin_loader_job_process_async (self->plugin_loader, plugin_job,
 					    self->search_cancellable,
 					    gs_search_page_get_search_cb,
 					    g_steal_pointer (&search_data));
 }
 
+static void
+gs_search_page_load (GsSearchPage *self)
+{
+	g_clear_handle_id (&self->full_search_id, g_source_remove);
+	gs_search_page_load_with_flags (self, GS_PLUGIN_LIST_APPS_FLAGS_NONE, TRUE);
+}
+
+static gboolean
+gs_search_page_full_search_cb (gpointer user_data)
+{
+	GsSearchPage *self = GS_SEARCH_PAGE (user_data);
+
+	self->full_search_id = 0;
+	gs_search_page_load_with_flags (self, GS_PLUGIN_LIST_APPS_FLAGS_NONE, FALSE);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Only matches the start of words in app names, IDs and keywords, which is
+ * quick enough to do on every keystroke; a full search follows once the
+ * user stops typing. */
+static void
+gs_search_page_load_type_ahead (GsSearchPage *self)
+{
+	g_clear_handle_id (&self->full_search_id, g_source_remove);
+	gs_search_page_load_with_flags (self, GS_PLUGIN_LIST_APPS_FLAGS_TYPE_AHEAD, TRUE);
+	self->full_search_id = g_timeout_add (GS_SEARCH_PAGE_FULL_SEARCH_DELAY,
+					      gs_search_page_full_search_cb, self);
+}
+
 static void
 gs_search_page_app_row_activated_cb (GtkListBox *list_box,
                                      GtkListBoxRow *row,
@@ -380,7 +420,7 @@ gs_search_page_set_text (GsSearchPage *self, const gchar *value)
 
 	/* Load immediately, when the page is active */
 	if (self->value && gs_page_is_active (GS_PAGE (self)))
-		gs_search_page_load (self);
+		gs_search_page_load_type_ahead (self);
 	else
 		self->changed = TRUE;
 }
@@ -407,6 +447,7 @@ gs_search_page_switch_from (GsPage *page)
 
 	g_cancellable_cancel (self->search_cancellable);
 	g_clear_object (&self->search_cancellable);
+	g_clear_handle_id (&self->full_search_id, g_source_remove);
 }
 
 static void
@@ -501,6 +542,7 @@ gs_search_page_dispose (GObject *object)
 	g_clear_object (&self->plugin_loader);
 	g_clear_object (&self->cancellable);
 	g_clear_object (&self->search_cancellable);
+	g_clear_handle_id (&self->full_search_id, g_source_remove);
 
 	G_OBJECT_CLASS (gs_search_page_parent_class)->dispose (object);
 }
@@ -24,6 +24,9 @@
 typedef struct {
 	GsShellSearchProvider *provider;
 	GDBusMethodInvocation *invocation;
+	GCancellable *cancellable;
+	gchar **terms;
+	GsAppList *type_ahead_list;  /* (nullable) until the type-ahead search has finished */
 } PendingSearch;
 
 struct _GsShellSearchProvider {
@@ -43,6 +46,9 @@ static void
 pending_search_free (PendingSearch *search)
 {
 	g_object_unref (search->invocation);
+	g_object_unref (search->cancellable);
+	g_strfreev (search->terms);
+	g_clear_object (&search->type_ahead_list);
 	g_slice_free (PendingSearch, search);
 }
 
@@ -59,6 +65,9 @@ search_sort_by_kudo_cb (GsApp *app1, GsApp *app2, gpointer user_data)
 	return 0;
 }
 
+static void pending_search_run (PendingSearch         *search,
+				GsPluginListAppsFlags  flags);
+
 static void
 search_done_cb (GObject *source,
 		GAsyncResult *res,
@@ -68,18 +77,33 @@ search_done_cb (GObject *source,
 	GsShellSearchProvider *self = search->provider;
 	guint i;
 	GVariantBuilder builder;
+	g_autoptr(GsAppList) full_list = NULL;
 	g_autoptr(GsAppList) list = NULL;
 
+	full_list = gs_plugin_loader_job_process_finish (self->plugin_loader, res, NULL);
+
+	/* follow the type-ahead results up with a full search, which also
+	 * matches summaries and the like, as the search page does; the shell
+	 * only takes one reply, so it gets both at once */
+	if (search->type_ahead_list == NULL) {
+		search->type_ahead_list = (full_list != NULL) ? g_steal_pointer (&full_list) : gs_app_list_new ();
+		if (!g_cancellable_is_cancelled (search->cancellable)) {
+			pending_search_run (search, GS_PLUGIN_LIST_APPS_FLAGS_NONE);
+			return;
+		}
+	}
+
 	/* cache no longer valid */
 	gs_app_list_remove_all (self->search_results);
 
-	list = gs_plugin_loader_job_process_finish (self->plugin_loader, res, NULL);
-	if (list == NULL) {
-		g_dbus_method_invocation_return_value (search->invocation, g_variant_new ("(as)", NULL));
-		pending_search_free (search);
-		g_application_release (g_application_get_default ());
-		return;	
-	}
+	/* the full results come first, then any type-ahead ones they missed,
+	 * which is all of them if the full search failed */
+	list = gs_app_list_new ();
+	if (full_list != NULL)
+		gs_app_list_add_list (list, full_list);
+	gs_app_list_add_list (list, search->type_ahead_list);
+	if (gs_app_list_length (list) > GS_SHELL_SEARCH_PROVIDER_MAX_RESULTS)
+		gs_app_list_truncate (list, GS_SHELL_SEARCH_PROVIDER_MAX_RESULTS);
 
 	/* sort by kudos, as there is no ratings data by default */
 	gs_app_list_sort (list, search_sort_by_kudo_cb, NULL);
@@ -142,14 +166,37 @@ gs_shell_search_provider_sort_cb (GsApp *app1, GsApp *app2, gpointer user_data)
 	return g_strcmp0 (key2, key1);
 }
 
+static void
+pending_search_run (PendingSearch         *search,
+		    GsPluginListAppsFlags  flags)
+{
+	GsShellSearchProvider *self = search->provider;
+	g_autoptr(GsPluginJob) plugin_job = NULL;
+	g_autoptr(GsAppQuery) query = NULL;
+
+	query = gs_app_query_new ("keywords", search->terms,
+				  "refine-flags", GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON |
+						  GS_PLUGIN_REFINE_FLAGS_REQUIRE_ORIGIN_HOSTNAME,
+				  "dedupe-flags", GS_APP_LIST_FILTER_FLAG_PREFER_INSTALLED |
+						  GS_APP_LIST_FILTER_FLAG_KEY_ID_PROVIDES,
+				  "max-results", GS_SHELL_SEARCH_PROVIDER_MAX_RESULTS,
+				  "sort-func", gs_shell_search_provider_sort_cb,
+				  "sort-user-data", self,
+				  NULL);
+	plugin_job = gs_plugin_job_list_apps_new (query, flags);
+
+	gs_plugin_loader_job_process_async (self->plugin_loader, plugin_job,
+					    search->cancellable,
+					    search_done_cb,
+					    search);
+}
+
 static void
 execute_search (GsShellSearchProvider  *self,
 		GDBusMethodInvocation  *invocation,
 		gchar		 **terms)
 {
 	PendingSearch *pending_search;
-	g_autoptr(GsPluginJob) plugin_job = NULL;
-	g_autoptr(GsAppQuery) query = NULL;
 
 	g_cancellable_cancel (self->cancellable);
 	g_clear_object (&self->cancellable);
@@ -161,28 +208,16 @@ execute_search (GsShellSearchProvider  *self,
 		return;
 	}
 
-	pending_search = g_slice_new (PendingSearch);
-	pending_search->provider = self;
-	pending_search->invocation = g_object_ref (invocation);
-
 	g_application_hold (g_application_get_default ());
 	self->cancellable = g_cancellable_new ();
 
-	query = gs_app_query_new ("keywords", terms,
-				  "refine-flags", GS_PLUGIN_REFINE_FLAGS_REQUIRE_ICON |
-						  GS_PLUGIN_REFINE_FLAGS_REQUIRE_ORIGIN_HOSTNAME,
-				  "dedupe-flags", GS_APP_LIST_FILTER_FLAG_PREFER_INSTALLED |
-						  GS_APP_LIST_FILTER_FLAG_KEY_ID_PROVIDES,
-				  "max-results", GS_SHELL_SEARCH_PROVIDER_MAX_RESULTS,
-				  "sort-func", gs_shell_search_provider_sort_cb,
-				  "sort-user-data", self,
-				  NULL);
-	plugin_job = gs_plugin_job_list_apps_new (query, GS_PLUGIN_LIST_APPS_FLAGS_NONE);
+	pending_search = g_slice_new0 (PendingSearch);
+	pending_search->provider = self;
+	pending_search->invocation = g_object_ref (invocation);
+	pending_search->cancellable = g_object_ref (self->cancellable);
+	pending_search->terms = g_strdupv (terms);
 
-	gs_plugin_loader_job_process_async (self->plugin_loader, plugin_job,
-					    self->cancellable,
-					    search_done_cb,
-					    pending_search);
+	pending_search_run (pending_search, GS_PLUGIN_LIST_APPS_FLAGS_TYPE_AHEAD);
 }
 
 static gboolean